@@ -0,0 +1,273 @@
+// Benchmark suite for the Elk engine, with machine-readable results.
+//
+// Runs a fixed corpus of WebScreen-style scripts on the bytecode VM and on
+// the tree-walker, with the engine set up like the device does it: same
+// heap and VM memory size, adaptive GC trigger, pinned script, incremental
+// GC stepped between calls like the JS task loop does. Each benchmark defines
+// a "run" function once, then calls it with js_call() like a timer would.
+// Prints JSON: CPU time in ns per call (best of NUM_ROUNDS rounds, without
+// GC steps), peak JS memory use, GC runs and GC time over all rounds.
+//
+// Build and run on the host, from the repository root:
+//
+//   cc -O2 -o elk_bench bench/elk_bench.c webscreen/elk.c -lm
+//   ./elk_bench > before.json
+//   ./elk_bench -b before.json  # After a change: fail on regressions
+//
+// Or use bench/Makefile: "make -C bench baseline", then "make -C bench check".
+// With -b, a benchmark more than 10% slower than in the baseline (-t sets
+// the percentage) is reported on stderr, and the exit code is 1. With -s,
+// the heap gets a fast tier of that many bytes in front, see js_setslowmem().
+// On the host both tiers are the same RAM, so this measures the engine side
+// of it only, not PSRAM latency
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../webscreen/elk.h"
+
+#define NUM_ROUNDS 10
+#define HEAP_BYTES (256 * 1024)  // Same as ELK_HEAP_BYTES on the device
+#define VM_BYTES (64 * 1024)     // Same as ELK_VM_BYTES on the device
+#define GC_SLICE_US 2000         // Same as ELK_GC_SLICE_US on the device
+
+struct bench {
+  const char *name;
+  int calls;         // Calls of run() per round
+  const char *code;  // Defines run()
+};
+
+static const struct bench benches[] = {
+    {"loop", 100,
+     "let run = function() {"
+     "  let s = 0;"
+     "  for (let i = 0; i < 1000; i++) { s = s + i * 2; }"
+     "  return s;"
+     "};"},
+    {"string_concat", 100,
+     "let run = function() {"
+     "  let s = '';"
+     "  for (let i = 0; i < 100; i++) { s = s + 'item ' + numberToString(i) + ', '; }"
+     "  return s.length;"
+     "};"},
+    {"object_props", 250,
+     "let cfg = {x: 10, y: 20, w: 100, h: 40, bg: 0, fg: 65535, radius: 4,"
+     "  border: 1, pad: 2, font: 14, opa: 255, angle: 0, zoom: 256,"
+     "  hidden: false, text: 'label', count: 0};"
+     "let run = function() {"
+     "  for (let i = 0; i < 50; i++) {"
+     "    cfg.count = cfg.count + 1;"
+     "    cfg.angle = (cfg.angle + cfg.pad * 3) % 3600;"
+     "    cfg.x = cfg.x + cfg.w / cfg.zoom - cfg.border;"
+     "  }"
+     "  return cfg.count;"
+     "};"},
+    {"gc_churn", 100,
+     "let run = function() {"
+     "  let keep = 0;"
+     "  for (let i = 0; i < 100; i++) {"
+     "    let o = {id: i, name: 'tmp', pos: {x: i, y: i + 1}};"
+     "    keep = keep + o.pos.y;"
+     "  }"
+     "  return keep;"
+     "};"},
+    {"deep_calls", 100,
+     "let fib = function(n) { if (n < 2) { return n; } return fib(n - 1) + fib(n - 2); };"
+     "let down = function(n) { if (n === 0) { return 0; } return 1 + down(n - 1); };"
+     "let run = function() { return fib(10) + down(40); };"},
+    {"coord_math", 100,
+     "let run = function() {"
+     "  let cols = 4, w = 110, h = 48, pad = 6, sum = 0;"
+     "  for (let i = 0; i < 64; i++) {"
+     "    let x = (i % cols) * (w + pad) + 10, y = ((i / cols) | 0) * (h + pad) + 30;"
+     "    let cx = x + (w >> 1), cy = y + (h >> 1);"
+     "    if (cx > 320) { cx = 320; }"
+     "    if (cy < 0) { cy = 0; }"
+     "    sum = sum + cx * 3 + cy - (x & 7);"
+     "  }"
+     "  return sum;"
+     "};"},
+    {"animation", 100,
+     "let anim = {from: 20, to: 300, frames: 60, color: 63488};"
+     "let run = function() {"
+     "  let acc = 0;"
+     "  for (let f = 0; f <= anim.frames; f++) {"
+     "    let t = (f * 256 / anim.frames) | 0;"
+     "    let e = (t * t) >> 8;"
+     "    let pos = anim.from + (((anim.to - anim.from) * e) >> 8);"
+     "    let r = (anim.color >> 11) & 31, g = (anim.color >> 5) & 63, b = anim.color & 31;"
+     "    let c = ((r * t >> 8) << 11) | ((g * t >> 8) << 5) | (b * t >> 8);"
+     "    acc = (acc + pos + c) % 65536;"
+     "  }"
+     "  return acc;"
+     "};"},
+    {"retained_state", 100,
+     "let list = null;"
+     "let add = function(n) {"
+     "  for (let i = 0; i < n; i++) { list = {next: list, id: i, name: 'item', w: 100, h: 40}; }"
+     "};"
+     "add(600);"
+     "let run = function() {"
+     "  let s = 0;"
+     "  for (let i = 0; i < 100; i++) { let o = {a: i, b: 'tmp', c: {d: i}}; s = s + o.c.d; }"
+     "  return s + list.id;"
+     "};"},
+    {"scope_lookup", 100,
+     "let width = 320, height = 170, margin = 8, theme = {fg: 65535, bg: 0, accent: 2016};"
+     "let layout = function(i) {"
+     "  let col = i % 4, row = (i / 4) | 0;"
+     "  let cell = function() { return margin + col * ((width - margin) >> 2) + (theme.accent & 15); };"
+     "  return cell() + row * (height >> 3) + theme.fg % 7;"
+     "};"
+     "let run = function() {"
+     "  let s = 0;"
+     "  for (let i = 0; i < 100; i++) { s = (s + layout(i)) % 65536; }"
+     "  return s;"
+     "};"},
+    {"timer_callback", 10000,
+     "let label = 1;"
+     "let state = {ticks: 0, value: 0, text: ''};"
+     "let run = function() {"
+     "  state.ticks++;"
+     "  state.value = (state.value * 7 + 3) % 1000;"
+     "  state.text = 'Value: ' + numberToString(state.value);"
+     "  label_set_text(label, state.text);"
+     "};"},
+};
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);  // Not wall time: ignore preemption
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Stand-ins for the device bindings the scripts call
+static jsval_t numberToString(struct js *js, jsval_t *args, int nargs) {
+  char buf[32];
+  if (nargs < 1 || js_type(args[0]) != JS_NUM) return js_mkstr(js, "", 0);
+  return js_mkstr(js, buf, js_fmtnum(js_getnum(args[0]), buf, sizeof(buf)));
+}
+
+static jsval_t label_set_text(struct js *js, jsval_t *args, int nargs) {
+  (void) js, (void) args, (void) nargs;
+  return js_mktrue();
+}
+
+struct result {
+  double ns;  // Best time per call
+  size_t peak, gcruns, gcus;
+  const char *err;
+};
+
+static struct result run(const struct bench *b, void *heap, void *vm, void *fast,
+                         size_t fastlen) {
+  struct result r = {0, 0, 0, 0, NULL};
+  struct js *js = fast == NULL ? js_create(heap, HEAP_BYTES) : js_create(fast, fastlen);
+  size_t total, minfree;
+  if (fast != NULL) js_setslowmem(js, heap, HEAP_BYTES);
+  js_setgcadapt(js, HEAP_BYTES / 4, HEAP_BYTES / 2);
+  js_setvm(js, vm, vm == NULL ? 0 : VM_BYTES);
+  js_setgcslice(js, GC_SLICE_US);
+  js_set(js, js_glob(js), "numberToString", js_mkfun(numberToString));
+  js_set(js, js_glob(js), "label_set_text", js_mkfun(label_set_text));
+  js_pin(js, b->code, strlen(b->code));  // Like elk_run_script() does
+  jsval_t res = js_eval(js, b->code, strlen(b->code));
+  int fn = js_root(js, js_get(js, js_glob(js), "run"));
+  if (js_type(res) == JS_ERR) r.err = js_str(js, res);
+  for (int i = 0; i < NUM_ROUNDS && r.err == NULL; i++) {
+    double t = now_ns(), gc = 0;
+    for (int n = 0; n < b->calls && r.err == NULL; n++) {
+      res = js_call(js, js_rootval(js, fn), NULL, 0);
+      if (js_type(res) == JS_ERR) r.err = js_str(js, res);
+      double t2 = now_ns();  // GC steps run between callbacks on the device
+      js_gcstep(js);         // too, they count as GC time, not call time
+      gc += now_ns() - t2;
+    }
+    t = (now_ns() - t - gc) / b->calls;
+    if (i == 0 || t < r.ns) r.ns = t;
+  }
+  js_stats(js, &total, &minfree, NULL, &r.gcruns, NULL, NULL, &r.gcus, NULL);
+  r.peak = total - minfree;
+  return r;
+}
+
+// Find the ns per call of a benchmark in a JSON file made by this program
+static double baseline(const char *json, const char *name, const char *engine) {
+  char key[100];
+  const char *p;
+  snprintf(key, sizeof(key), "\"name\": \"%s\", \"engine\": \"%s\",", name, engine);
+  if (json == NULL || (p = strstr(json, key)) == NULL) return 0;
+  if ((p = strstr(p, "\"ns_per_call\": ")) == NULL) return 0;
+  return atof(p + 15);
+}
+
+static char *readfile(const char *path) {
+  FILE *fp = fopen(path, "rb");
+  char *buf = NULL;
+  long len;
+  if (fp != NULL && fseek(fp, 0, SEEK_END) == 0 && (len = ftell(fp)) >= 0 &&
+      fseek(fp, 0, SEEK_SET) == 0 && (buf = calloc(1, (size_t) len + 1)) != NULL &&
+      fread(buf, 1, (size_t) len, fp) != (size_t) len) {
+    free(buf);
+    buf = NULL;
+  }
+  if (fp != NULL) fclose(fp);
+  return buf;
+}
+
+int main(int argc, char **argv) {
+  void *heap = malloc(HEAP_BYTES), *vm = malloc(VM_BYTES);
+  const char *engines[] = {"vm", "tree"}, *sep = "";
+  char *base = NULL;
+  double threshold = 10;
+  size_t fastlen = 0;
+  void *fast = NULL;
+  int status = 0;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (strcmp(argv[i], "-b") == 0 && (base = readfile(argv[i + 1])) == NULL) {
+      fprintf(stderr, "Cannot read %s\n", argv[i + 1]);
+      return 1;
+    }
+    if (strcmp(argv[i], "-t") == 0) threshold = atof(argv[i + 1]);
+    if (strcmp(argv[i], "-s") == 0) fastlen = (size_t) atol(argv[i + 1]);
+  }
+  if (fastlen > 0 && (fast = malloc(fastlen)) == NULL) return 1;
+  printf("{\"elk\": \"%s\", \"rounds\": %d, \"fast_bytes\": %lu, \"benchmarks\": [",
+         JS_VERSION, NUM_ROUNDS, (unsigned long) fastlen);
+  for (int e = 0; e < 2; e++) {
+    for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+      const struct bench *b = &benches[i];
+      struct result r = run(b, heap, e == 0 ? vm : NULL, fast, fastlen);
+      double was = baseline(base, b->name, engines[e]);
+      printf("%s\n  {\"name\": \"%s\", \"engine\": \"%s\", \"calls\": %d, "
+             "\"ns_per_call\": %.1f, \"peak_bytes\": %lu, \"gc_runs\": %lu, "
+             "\"gc_us\": %lu",
+             sep, b->name, engines[e], b->calls * NUM_ROUNDS, r.ns, (unsigned long) r.peak,
+             (unsigned long) r.gcruns, (unsigned long) r.gcus);
+      if (r.err != NULL) {
+        printf(", \"error\": \"");
+        for (const char *p = r.err; *p != '\0'; p++) putchar(*p == '"' ? '\'' : *p);
+        printf("\"");
+      }
+      if (was > 0) printf(", \"baseline_ns_per_call\": %.1f", was);
+      printf("}");
+      sep = ",";
+      if (r.err != NULL) {
+        fprintf(stderr, "%s/%s: %s\n", b->name, engines[e], r.err);
+        status = 1;
+      } else if (was > 0 && r.ns > was * (1 + threshold / 100)) {
+        fprintf(stderr, "%s/%s: %.1f ns/call, was %.1f (%+.0f%%)\n", b->name, engines[e],
+                r.ns, was, (r.ns / was - 1) * 100);
+        status = 1;
+      }
+    }
+  }
+  printf("\n]}\n");
+  free(base);
+  free(heap);
+  free(vm);
+  free(fast);
+  return status;
+}
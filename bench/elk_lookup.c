@@ -0,0 +1,87 @@
+// Global lookup benchmark for the Elk engine.
+//
+// Registers a few hundred native functions in the global scope, like
+// register_js_functions() does on the device, and times script calls that
+// have to find them. Functions registered first sit at the tail of the
+// global property list, so calling them is the worst case for lookup.
+// Calls run in batches with GC in between, so GC stays out of the timing.
+//
+// Build and run on the host, from the repository root:
+//
+//   cc -O2 -o elk_lookup bench/elk_lookup.c webscreen/elk.c -lm
+//   ./elk_lookup
+//
+// To compare with an older engine, build the same file against the elk.c
+// of that revision.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../webscreen/elk.h"
+
+#define NUM_BINDINGS 240
+#define NUM_CALLS 2000  // Calls per batch
+#define NUM_BATCHES 10
+#define HEAP_BYTES (256 * 1024)  // Same as ELK_HEAP_BYTES on the device
+#define VM_BYTES (64 * 1024)     // Same as ELK_VM_BYTES on the device
+
+static jsval_t nop(struct js *js, jsval_t *args, int nargs) {
+  (void) js, (void) args, (void) nargs;
+  return js_mkundef();
+}
+
+static double now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static char names[NUM_BINDINGS][32];
+
+static struct js *setup(void *heap, void *vm) {
+  static const char *prefixes[] = {"lv_obj_set_", "style_set_", "lv_label_",
+                                   "wifi_", "mqtt_", "sd_"};
+  struct js *js = js_create(heap, HEAP_BYTES);
+  for (int i = 0; i < NUM_BINDINGS; i++) {
+    snprintf(names[i], sizeof(names[i]), "%sfn%03d", prefixes[i % 6], i);
+    js_set(js, js_glob(js), names[i], js_mkfun(nop));
+  }
+  js_setgct(js, HEAP_BYTES);  // Never trigger GC automatically
+  js_setvm(js, vm, vm == NULL ? 0 : VM_BYTES);
+  return js;
+}
+
+// Call the given function in a loop, return microseconds per call
+static double run(struct js *js, const char *fn) {
+  char code[200];
+  double total = 0;
+  snprintf(code, sizeof(code),
+           "for (let i = 0; i < %d; i++) { %s(i); }", NUM_CALLS, fn);
+  for (int i = 0; i < NUM_BATCHES; i++) {
+    js_gc(js);
+    double t = now_us();
+    jsval_t res = js_eval(js, code, strlen(code));
+    total += now_us() - t;
+    if (js_type(res) == JS_ERR) printf("error: %s\n", js_str(js, res));
+  }
+  return total / (NUM_CALLS * NUM_BATCHES);
+}
+
+int main(void) {
+  void *heap = malloc(HEAP_BYTES), *vm = malloc(VM_BYTES);
+  const char *engines[] = {"tree-walker", "vm"};
+  for (int e = 0; e < 2; e++) {
+    struct js *js = setup(heap, e == 0 ? NULL : vm);
+    run(js, names[0]);  // Warm up
+    double first = run(js, names[0]);
+    double last = run(js, names[NUM_BINDINGS - 1]);
+    printf("%-12s %d globals: first registered %.3f us/call, "
+           "last registered %.3f us/call\n",
+           engines[e], NUM_BINDINGS, first, last);
+  }
+  free(heap);
+  free(vm);
+  return 0;
+}
@@ -0,0 +1,127 @@
+// Number formatting and parsing benchmark for the Elk engine.
+//
+// Checks js_fmtnum() and js_parsenum() against the C library on random
+// doubles: every formatted number must parse back to the same bits, and
+// parsing must match strtod(). Numbers where js_fmtnum() prints more digits
+// than the shortest "%.<N>g" that round-trips count as errors. Then times both
+// against snprintf() and strtod(), parsing the shortest form of numbers.
+//
+// Build and run on the host, from the repository root:
+//
+//   cc -O2 -o elk_numfmt bench/elk_numfmt.c webscreen/elk.c -lm
+//   ./elk_numfmt
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../webscreen/elk.h"
+
+#define NUM_CHECKS 1000000
+#define NUM_TIMED 200000
+
+static double now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static uint64_t rnd(void) {  // xorshift64
+  static uint64_t x = 88172645463325252ULL;
+  x ^= x << 13, x ^= x >> 7, x ^= x << 17;
+  return x;
+}
+
+// Random finite double: half any bit pattern, a quarter "human" decimals
+// like 12.5 or 0.003, a quarter integers
+static double rnd_double(void) {
+  uint64_t r = rnd();
+  double d;
+  switch (r & 3) {
+    case 0:
+    case 1:
+      do {
+        uint64_t u = rnd();
+        memcpy(&d, &u, sizeof(d));
+      } while (!isfinite(d));
+      return d;
+    case 2: return (double) (int64_t) (rnd() % 2000000 - 1000000) / pow(10, (double) (rnd() % 8));
+    default: return (double) (int64_t) (rnd() >> (rnd() % 64));
+  }
+}
+
+static int shortest_len(double d) {
+  char buf[40];
+  for (int prec = 1; prec < 17; prec++) {
+    snprintf(buf, sizeof(buf), "%.*g", prec, d);
+    if (strtod(buf, NULL) == d) return prec;
+  }
+  return 17;
+}
+
+// Significant digits, without leading and trailing zeros
+static int num_digits(const char *s) {
+  int n = 0, zeros = 0, lead = 1;
+  for (; *s != '\0' && *s != 'e'; s++) {
+    if (*s == '0' && lead) continue;
+    if (*s >= '1' && *s <= '9') lead = 0, n += zeros + 1, zeros = 0;
+    if (*s == '0') zeros++;
+  }
+  return n;
+}
+
+static int check(void) {
+  static const double special[] = {0.1, 0.2, 0.3, 1e21, 1e-7, 123e-20, 5e-324,
+                                    1.7976931348623157e308, 2.2250738585072014e-308,
+                                    9007199254740993.0, 1.0 / 3, 100, 1e6, -1.5};
+  char buf[40];
+  size_t n;
+  int errors = 0, longer = 0;
+  for (int i = 0; i < NUM_CHECKS; i++) {
+    double d = i < (int) (sizeof(special) / sizeof(special[0])) ? special[i] : rnd_double();
+    size_t len = js_fmtnum(d, buf, sizeof(buf));
+    double back = js_parsenum(buf, len, &n);
+    if (back != d || n != len || back != strtod(buf, NULL)) {
+      if (errors++ < 10) printf("round-trip error: %.17g -> %s -> %.17g\n", d, buf, back);
+    }
+    if (num_digits(buf) > shortest_len(d)) {
+      if (longer++ < 10) printf("not shortest: %.17g -> %s\n", d, buf);
+    }
+    snprintf(buf, sizeof(buf), "%.*g", (int) (rnd() % 17) + 1, d);
+    if (js_parsenum(buf, strlen(buf), &n) != strtod(buf, NULL)) {
+      if (errors++ < 10) printf("parse error: %s\n", buf);
+    }
+  }
+  printf("%d numbers checked, %d errors, %d not shortest\n", NUM_CHECKS, errors, longer);
+  return errors + longer;
+}
+
+int main(void) {
+  static double nums[NUM_TIMED];
+  static char strs[NUM_TIMED][32];
+  char buf[40];
+  size_t n, sum = 0;
+  double t, acc = 0;
+  int errors = check();
+  for (int i = 0; i < NUM_TIMED; i++) {
+    nums[i] = rnd_double();
+    js_fmtnum(nums[i], strs[i], sizeof(strs[i]));
+  }
+  t = now_us();
+  for (int i = 0; i < NUM_TIMED; i++) sum += js_fmtnum(nums[i], buf, sizeof(buf));
+  printf("js_fmtnum        %.3f us/number\n", (now_us() - t) / NUM_TIMED);
+  t = now_us();
+  for (int i = 0; i < NUM_TIMED; i++) sum += (size_t) snprintf(buf, sizeof(buf), "%.17g", nums[i]);
+  printf("snprintf %%.17g   %.3f us/number\n", (now_us() - t) / NUM_TIMED);
+  t = now_us();
+  for (int i = 0; i < NUM_TIMED; i++) acc += js_parsenum(strs[i], strlen(strs[i]), &n);
+  printf("js_parsenum      %.3f us/number\n", (now_us() - t) / NUM_TIMED);
+  t = now_us();
+  for (int i = 0; i < NUM_TIMED; i++) acc += strtod(strs[i], NULL);
+  printf("strtod           %.3f us/number\n", (now_us() - t) / NUM_TIMED);
+  if (sum == 0 || acc == 1) printf("\n");  // Keep the loops
+  return errors ? 1 : 0;
+}
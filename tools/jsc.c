@@ -0,0 +1,51 @@
+// Compile a WebScreen script into a .jsc file, the same way the device does
+// when a script is uploaded. Copy the result next to the .js on the SD card.
+// The device checks it against the .js by content once, on the first start.
+//
+// Build and run on the host, from the repository root:
+//
+//   cc -O2 -o jsc tools/jsc.c webscreen/elk.c -lm
+//   ./jsc app.js app.jsc
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../webscreen/elk.h"
+
+int main(int argc, char **argv) {
+  FILE *fp;
+  char *code, *buf;
+  long len;
+  size_t size;
+  if (argc != 3) {
+    fprintf(stderr, "Usage: %s app.js app.jsc\n", argv[0]);
+    return 1;
+  }
+  if ((fp = fopen(argv[1], "rb")) == NULL || fseek(fp, 0, SEEK_END) != 0 ||
+      (len = ftell(fp)) < 0 || fseek(fp, 0, SEEK_SET) != 0) {
+    fprintf(stderr, "Cannot read %s\n", argv[1]);
+    return 1;
+  }
+  code = malloc((size_t) len + 1);
+  if (code == NULL || fread(code, 1, (size_t) len, fp) != (size_t) len) {
+    fprintf(stderr, "Cannot read %s\n", argv[1]);
+    return 1;
+  }
+  fclose(fp);
+  if ((size = js_compile(code, (size_t) len, NULL, 0)) == 0) {
+    fprintf(stderr, "%s: bad token, e.g. an unterminated string\n", argv[1]);
+    return 1;
+  }
+  buf = malloc(size);
+  if (buf == NULL || js_compile(code, (size_t) len, buf, size) != size) {
+    fprintf(stderr, "%s: compile error\n", argv[1]);
+    return 1;
+  }
+  if ((fp = fopen(argv[2], "wb")) == NULL || fwrite(buf, 1, size, fp) != size ||
+      fclose(fp) != 0) {
+    fprintf(stderr, "Cannot write %s\n", argv[2]);
+    return 1;
+  }
+  printf("%s: %ld -> %lu bytes\n", argv[2], len, (unsigned long) size);
+  return 0;
+}
@@ -0,0 +1,74 @@
+// Profile a script on the host with the same sampling profiler the device
+// uses, and print the collapsed stacks, e.g. for flamegraph.pl. The script
+// runs with the bytecode VM unless -t is given, then the innermost tree-walker
+// functions show source offsets as "name@offset".
+//
+// Build and run on the host, from the repository root:
+//
+//   cc -O2 -o jsprof tools/jsprof.c webscreen/elk.c -lm
+//   ./jsprof app.js > app.folded
+//   flamegraph.pl app.folded > app.svg
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "../webscreen/elk.h"
+
+static struct js *s_js;
+
+static void on_sigprof(int sig) {
+  (void) sig;
+  js_profsample(s_js);
+}
+
+static void out(void *ctx, const char *buf, size_t len) {
+  fwrite(buf, 1, len, (FILE *) ctx);
+}
+
+static jsval_t print(struct js *js, jsval_t *args, int nargs) {
+  for (int i = 0; i < nargs; i++) {
+    const char *s = js_str(js, args[i]);
+    fprintf(stderr, "%s%s", i > 0 ? " " : "", s);
+  }
+  fputc('\n', stderr);
+  return js_mkundef();
+}
+
+int main(int argc, char **argv) {
+  static char mem[512 * 1024], vm[64 * 1024], prof[64 * 1024];
+  struct itimerval it = {{0, 1000}, {0, 1000}};  // Sample every millisecond
+  bool tree = argc == 3 && strcmp(argv[1], "-t") == 0;
+  const char *path = argv[argc - 1];
+  FILE *fp;
+  char *code;
+  long len;
+  if (argc != 2 && !tree) {
+    fprintf(stderr, "Usage: %s [-t] app.js\n", argv[0]);
+    return 1;
+  }
+  if ((fp = fopen(path, "rb")) == NULL || fseek(fp, 0, SEEK_END) != 0 ||
+      (len = ftell(fp)) < 0 || fseek(fp, 0, SEEK_SET) != 0 ||
+      (code = malloc((size_t) len + 1)) == NULL ||
+      fread(code, 1, (size_t) len, fp) != (size_t) len) {
+    fprintf(stderr, "Cannot read %s\n", path);
+    return 1;
+  }
+  fclose(fp);
+  s_js = js_create(mem, sizeof(mem));
+  if (!tree) js_setvm(s_js, vm, sizeof(vm));
+  js_set(s_js, js_glob(s_js), "print", js_mkfun(print));
+  js_profstart(s_js, prof, sizeof(prof));
+  signal(SIGPROF, on_sigprof);
+  setitimer(ITIMER_PROF, &it, NULL);
+  jsval_t res = js_eval(s_js, code, (size_t) len);
+  memset(&it, 0, sizeof(it));
+  setitimer(ITIMER_PROF, &it, NULL);
+  js_profstop(s_js);
+  if (js_type(res) == JS_ERR) fprintf(stderr, "%s\n", js_str(s_js, res));
+  size_t n = js_profdump(s_js, tree, out, stdout);
+  fprintf(stderr, "%s: %lu samples\n", path, (unsigned long) n);
+  return 0;
+}
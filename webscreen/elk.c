@@ -35,8 +35,111 @@
 #define JS_GC_THRESHOLD 0.75
 #endif
 
+#ifndef JS_VM_STACK
+#define JS_VM_STACK 256  // Bytecode VM value stack size, in jsval_t slots
+#endif
+
+#ifndef JS_INDEX_MIN
+#define JS_INDEX_MIN 16  // Hash-index objects that have more props than that
+#endif
+
+#ifndef JS_INDEX_OBJS
+#define JS_INDEX_OBJS 4  // Max number of hash-indexed objects
+#endif
+
+#ifndef JS_GC_STACK
+#define JS_GC_STACK 256  // GC mark stack size, in entities
+#endif
+
+#ifndef JS_FREE_MAX
+#define JS_FREE_MAX 64  // Largest entity size, in bytes, kept on free lists
+#endif
+
+#ifndef JS_ROPE_MIN
+#define JS_ROPE_MIN 256  // Concatenations at least that long make ropes
+#endif
+
+#ifndef JS_GC_PERIOD_MS
+#define JS_GC_PERIOD_MS 250  // Adaptive GC threshold: room for that much growth
+#endif
+
+#ifndef JS_ROOTS
+#define JS_ROOTS 16  // Max number of values held by C code, see js_root()
+#endif
+
+#ifndef JS_PROF_DEPTH
+#define JS_PROF_DEPTH 16  // Calls deep the profiler tracks, see js_profstart()
+#endif
+
+#ifndef JS_PROF_NAME
+#define JS_PROF_NAME 24  // Max function name length in profiles, with 0
+#endif
+
+#ifndef JS_PROF_STACK
+#define JS_PROF_STACK 120  // Max call stack length in profiles, with 0
+#endif
+
+#ifndef JS_BUDGET_STEPS
+#define JS_BUDGET_STEPS 32  // Statements between execution budget checks
+#endif
+
+#ifndef JS_NOW_US  // Microsecond clock, for GC pauses and execution budget
+#ifdef ESP_PLATFORM
+#include <esp_timer.h>
+#define JS_NOW_US() ((uint64_t)esp_timer_get_time())
+#else
+#include <time.h>
+#define JS_NOW_US() ((uint64_t)clock() * 1000000U / CLOCKS_PER_SEC)
+#endif
+#endif
+
 typedef uint32_t jsoff_t;
 
+// Pre-lexed token, produced once per js_eval() by tkbuild()
+struct jstok {
+  jsval_t tval;  // Numeric literal value, valid for TOK_NUMBER only
+  jsoff_t off;   // Token offset in the tokenized code
+  jsoff_t info;  // Token length << 8 | token type
+};
+
+// Profiler: a call tracked for sampling, see js_profstart()
+struct jsframe {
+  char name[JS_PROF_NAME];  // Name the function was called by, or empty
+  const char *code;         // Function text run by the tree-walker, or NULL
+  jsoff_t len;              // Function text length
+};
+
+// Profiler: samples of one call stack, "outer;inner" names. For the leaf
+// JS function, "@N" gives the source offset that was running, unless the
+// table had no room for another offset
+struct jssample {
+  uint32_t count;  // Number of samples, 0 for a free slot
+  uint32_t hash;   // Stack hash
+  char stack[JS_PROF_STACK];
+};
+
+// Profiler state, at the beginning of the buffer given to js_profstart(),
+// followed by the sample table. js_profsample() writes ticks only, from any
+// task or interrupt. The rest belongs to the task that runs the JS code
+struct jsprof {
+  struct jsframe frames[JS_PROF_DEPTH];  // Tracked calls, outermost first
+  uint32_t depth;    // Number of calls, may exceed JS_PROF_DEPTH
+  uint32_t nslots;   // Sample table size
+  uint32_t nused;    // Sample table slots in use
+  uint32_t dropped;  // Samples not recorded, the table was full
+  volatile uint32_t ticks;  // Samples requested by js_profsample()
+  uint32_t taken;    // Ticks taken as samples or skipped, see proftake()
+  volatile bool on;  // Calls are tracked and samples are taken
+};
+
+// Property hash index of a large object, see lkp()
+struct jsidx {
+  jsoff_t obj;  // Object offset
+  jsoff_t off;  // Offset in the index memory: cap (key, prop offset) pairs
+  jsoff_t cap;  // Index capacity, power of 2
+  jsoff_t n;    // Number of indexed keys
+};
+
 struct js {
   jsoff_t css;        // Max observed C stack size
   jsoff_t lwm;        // JS RAM low watermark: min free RAM observed
@@ -50,6 +153,8 @@ struct js {
 #define F_CALL 4U     // We're inside a function call
 #define F_BREAK 8U    // Exit the loop
 #define F_RETURN 16U  // Return has been executed
+  uint8_t lazy;       // Innermost block or call has no scope yet, see js_let()
+  uint8_t tkown;      // Whether the innermost eval built js->tk, see tkdrop()
   jsoff_t clen;       // Code snippet length
   jsoff_t pos;        // Current parsing position
   jsoff_t toff;       // Offset of the last parsed token
@@ -58,11 +163,70 @@ struct js {
   jsval_t tval;       // Holds last parsed numeric or string literal value
   jsval_t scope;      // Current scope
   uint8_t *mem;       // Available JS memory
+  uint8_t *slow;      // Slow tier of JS memory, see js_setslowmem(), or NULL
+  jsoff_t split;      // Offsets from here on are in the slow tier, ~0 if none
   jsoff_t size;       // Memory size
   jsoff_t brk;        // Current mem usage boundary
   jsoff_t gct;        // GC threshold. If brk > gct, trigger GC
   jsoff_t maxcss;     // Maximum allowed C stack size usage
+  jsoff_t tkbytes;    // Memory above js->size taken by token caches
   void *cstk;         // C stack pointer at the beginning of js_eval()
+  struct jstok *tk;   // Token cache for the code being evaluated, or NULL
+  const char *tkcode; // Code the token cache was built for
+  const char *pin;    // Read-only source of function bodies, see js_pin()
+  jsoff_t pinlen;     // Length of the pinned source
+  jsoff_t tklen;      // Length of the tokenized code
+  jsoff_t ntk;        // Number of cached tokens
+  jsoff_t tki;        // Token cache cursor: index of the next expected token
+  jsoff_t *atoms;     // Interned property keys, see mkkey()
+  jsoff_t natoms;     // Atom table size, power of 2
+  jsoff_t nkeys;      // Number of atoms in the table
+  jsoff_t badkeys;    // Number of props whose key is not an atom
+  uint8_t *idx;       // Memory for the property hash indexes
+  jsoff_t idxsize;    // Size of the index memory
+  jsoff_t idxbrk;     // Index memory usage boundary
+  jsoff_t nidx;       // Number of hash-indexed objects
+  struct jsidx idxs[JS_INDEX_OBJS];  // Hash-indexed objects
+  uint8_t *vm;        // Bytecode VM memory, see js_setvm(), or NULL
+  jsval_t *vstk;      // VM value stack, lives at the beginning of VM memory
+  jsoff_t vsp;        // VM value stack pointer
+  jsoff_t vmax;       // VM value stack size
+  jsoff_t vmcache;    // Start of the compiled functions cache
+  jsoff_t vmbrk;      // End of the compiled functions cache
+  jsoff_t vmtop;      // Start of the compiled top-level code
+  jsoff_t vmdepth;    // Number of running VM frames
+  uint8_t vmfull;     // Function cache overflowed, flush it when possible
+  uint32_t gcruns;    // Number of GC runs
+  uint32_t gclast;    // Last GC pause, microseconds
+  uint32_t gcmax;     // Longest GC pause, microseconds
+  uint64_t gctime;    // Total GC time, microseconds
+  uint32_t gcslice;   // Incremental GC slice budget, microseconds, 0: off
+  uint32_t *gcmap;    // Incremental GC mark bitmap, 1 bit per 4 bytes
+  jsoff_t *gcstk;     // Incremental GC mark stack
+  jsoff_t gcsp;       // Mark stack pointer
+  jsoff_t gcend;      // Memory boundary at the start of the GC cycle
+  jsoff_t gcscan;     // Mark stack overflowed: rescan memory from here
+  uint8_t gcphase;    // Incremental GC cycle is in progress
+  jsoff_t gctmin;     // Adaptive GC threshold bounds, see js_setgcadapt().
+  jsoff_t gctmax;     // If gctmax is 0, the threshold is fixed
+  jsoff_t gclive;     // Memory in use after the last GC
+  uint32_t gcrate;    // Live memory growth rate, bytes per second, smoothed
+  uint64_t gcstamp;   // JS_NOW_US() at the end of the last GC
+  jsoff_t gcfn;       // Bytes of function bodies marked in this GC cycle
+  jsoff_t heap[5];    // Live bytes after the last GC, see js_heapstats()
+  jsoff_t freel[JS_FREE_MAX / 4 - 1];  // Free lists of dead entities, by size
+  jsoff_t free;       // Bytes on the free lists
+  jsoff_t holes;      // Bytes in dead entities too big for the free lists
+  jsval_t (*resolve)(struct js *, const char *, size_t);  // Lookup fallback
+  jsval_t roots[JS_ROOTS];  // Values held by C code, ROOT_FREE if unused
+  uint64_t deadline;  // Execution budget runs out at this JS_NOW_US() time
+  uint32_t budget;    // Execution budget, microseconds, 0: off
+  uint32_t bsteps;    // Statements left until the next deadline check
+  uint32_t nrun;      // Nesting depth of js_eval() and js_call()
+  bool (*overrun)(struct js *);  // Execution budget overrun handler
+  struct jsprof *prof;  // Profiler, see js_profstart(), or NULL
+  const char *pname;    // Name of the function being called, for profiling
+  jsoff_t pnlen;        // Length of pname
 };
 
 // A JS memory stores diffenent entities: objects, properties, strings
@@ -77,16 +241,38 @@ struct js {
 //  Object:   8 bytes: offset of the first property, offset of the upper obj
 //  Property: 8 bytes + val: 4 byte next prop, 4 byte key offs, N byte value
 //  String:   4xN bytes: 4 byte len << 2, 4byte-aligned 0-terminated data
+//  Rope:     16 bytes: string header with S_ROPE set, left, right, length
+//  Pinned:   12 bytes: string header with S_EXT set, offset, length
+//  Array:    8 bytes: offset of the data string, 4 byte len << 2 | kind
+//
+// Array elements are packed into a string entity, which is replaced by a
+// bigger one when an Array grows. Typed arrays have a fixed length.
+//
+// Long concatenations make ropes instead of copying both sides: a rope is a
+// string entity that points to its left side, a string or another rope, and
+// to its right side, always a flat string. Ropes are flattened when their
+// bytes are needed, see vstr(). A flattened rope points to the flat copy on
+// the left, and to 0 on the right.
+//
+// Function values point to a string with the function source. If the source
+// is in the buffer given to js_pin(), the string is a pinned reference: the
+// offset and length of the source in that buffer, see fnsrc().
 //
 // If C functions are imported, they use the upper part of memory as stack for
 // passing params. Each argument is pushed to the top of the memory as jsval_t,
 // and js.size is decreased by sizeof(jsval_t), i.e. 8 bytes. When function
 // returns, js.size is restored back. So js.size is used as a stack pointer.
+// js_eval() uses the same stack for the token cache of the code it runs.
+//
+// Property keys are interned: all props with the same key name point to the
+// same string, an atom, so keys are compared by offset. The atom table and
+// the memory for property hash indexes are carved from the end of the JS
+// memory, above js.size. Indexes are dropped by GC and rebuilt on demand.
 
 // clang-format off
 enum { 
   TOK_ERR, TOK_EOF, TOK_IDENTIFIER, TOK_NUMBER, TOK_STRING, TOK_SEMICOLON,
-  TOK_LPAREN, TOK_RPAREN, TOK_LBRACE, TOK_RBRACE,
+  TOK_LPAREN, TOK_RPAREN, TOK_LBRACE, TOK_RBRACE, TOK_LBRACKET, TOK_RBRACKET,
   // Keyword tokens
   TOK_BREAK = 50, TOK_CASE, TOK_CATCH, TOK_CLASS, TOK_CONST, TOK_CONTINUE,
   TOK_DEFAULT, TOK_DELETE, TOK_DO, TOK_ELSE, TOK_FINALLY, TOK_FOR, TOK_FUNC,
@@ -107,15 +293,21 @@ enum {
 enum {
   // IMPORTANT: T_OBJ, T_PROP, T_STR must go first.  That is required by the
   // memory layout functions: memory entity types are encoded in the 2 bits,
-  // thus type values must be 0,1,2,3
+  // thus type values must be 0,1,2,3. Arrays use the remaining memory type 3,
+  // which is T_ARR & 3. T_ELEM refers to an array element, like T_PROP does
+  // to a property, but it is not a memory entity
   T_OBJ, T_PROP, T_STR, T_UNDEF, T_NULL, T_NUM, T_BOOL, T_FUNC, T_CODEREF,
-  T_CFUNC, T_ERR
+  T_CFUNC, T_ERR, T_ARR, T_ELEM
 };
+#define M_ARR (T_ARR & 3U)  // Memory entity type of arrays
+#define S_ROPE 0x40000000U  // String header flag of ropes
+#define S_EXT 0x20000000U   // String header flag of pinned function sources
+#define ROOT_FREE mkval(T_CODEREF, 0)  // Free js->roots slot: C never sees coderefs
 
 static const char *typestr(uint8_t t) {
   const char *names[] = { "object", "prop", "string", "undefined", "null",
                           "number", "boolean", "function", "coderef",
-                          "cfunc", "err", "nan" };
+                          "cfunc", "err", "object", "elem" };
   return (t < sizeof(names) / sizeof(names[0])) ? names[t] : "??";
 }
 
@@ -131,8 +323,16 @@ static const char *typestr(uint8_t t) {
 //
 // On 64-bit platforms, pointers are really 48 bit only, so they can fit,
 // provided they are sign extended
+//
+// Small integers, numbers that fit int32_t, are stored with type T_NUM in
+// the low 32 bits: arithmetic on them skips doubles, which the ESP32 does
+// in software. Other numbers, and -0, are doubles
+static bool is_smi(jsval_t v) { return (v >> 48U) == (0x7ff0U | T_NUM); }
+static int32_t smi(jsval_t v) { return (int32_t) (uint32_t) v; }
 static jsval_t tov(double d) { union { double d; jsval_t v; } u = {d}; return u.v; }
-static double tod(jsval_t v) { union { jsval_t v; double d; } u = {v}; return u.d; }
+static double tod(jsval_t v) { union { jsval_t v; double d; } u = {v}; return is_smi(v) ? (double) smi(v) : u.d; }
+static jsval_t mksmi(int64_t n) { return n >= INT32_MIN && n <= INT32_MAX ? ((jsval_t) (0x7ff0U | T_NUM) << 48U) | (uint32_t) n : tov((double) n); }
+static jsval_t tonum(double d) { return d >= INT32_MIN && d <= INT32_MAX && d == (int32_t) d && (d != 0 || !signbit(d)) ? mksmi((int32_t) d) : tov(d); }
 static jsval_t mkval(uint8_t type, uint64_t data) { return ((jsval_t) 0x7ff0U << 48U) | ((jsval_t) (type) << 48) | (data & 0xffffffffffffUL); }
 static bool is_nan(jsval_t v) { return (v >> 52U) == 0x7ffU; }
 static uint8_t vtype(jsval_t v) { return is_nan(v) ? ((v >> 48U) & 15U) : (uint8_t) T_NUM; }
@@ -140,6 +340,9 @@ static size_t vdata(jsval_t v) { return (size_t) (v & ~((jsval_t) 0x7fffUL << 48
 static jsval_t mkcoderef(jsval_t off, jsoff_t len) { return mkval(T_CODEREF, (off & 0xffffffU) | ((jsval_t)(len & 0xffffffU) << 24U)); }
 static jsoff_t coderefoff(jsval_t v) { return v & 0xffffffU; }
 static jsoff_t codereflen(jsval_t v) { return (v >> 24U) & 0xffffffU; }
+static jsval_t mkelem(jsoff_t arr, jsoff_t i) { return mkval(T_ELEM, (arr >> 2) | ((jsval_t) i << 24U)); }
+static jsoff_t elemarr(jsval_t v) { return (jsoff_t) (v & 0xffffffU) << 2; }
+static jsoff_t elemidx(jsval_t v) { return (v >> 24U) & 0xffffffU; }
 
 static uint8_t unhex(uint8_t c) { return (c >= '0' && c <= '9') ? (uint8_t) (c - '0') : (c >= 'a' && c <= 'f') ? (uint8_t) (c - 'W') : (c >= 'A' && c <= 'F') ? (uint8_t) (c - '7') : 0; }
 static bool is_space(int c) { return c == ' ' || c == '\r' || c == '\n' || c == '\t' || c == '\f' || c == '\v'; }
@@ -151,12 +354,24 @@ static bool is_ident_continue(int c) { return c == '_' || c == '$' || is_alpha(c
 static bool is_err(jsval_t v) { return vtype(v) == T_ERR; }
 static bool is_unary(uint8_t tok) { return tok >= TOK_POSTINC && tok <= TOK_UMINUS; }
 static bool is_assign(uint8_t tok) { return (tok >= TOK_ASSIGN && tok <= TOK_OR_ASSIGN); }
-static void saveoff(struct js *js, jsoff_t off, jsoff_t val) { memcpy(&js->mem[off], &val, sizeof(val)); }
-static void saveval(struct js *js, jsoff_t off, jsval_t val) { memcpy(&js->mem[off], &val, sizeof(val)); }
-static jsoff_t loadoff(struct js *js, jsoff_t off) { jsoff_t v = 0; assert(js->brk <= js->size); memcpy(&v, &js->mem[off], sizeof(v)); return v; }
+// Address of a JS memory offset: in the buffer given to js_create() below
+// js->split, in the slow tier from there on. Entities never straddle it.
+// Hot, long-lived entities are in the fast buffer, so tell the compiler
+#if defined(__GNUC__)
+#define FASTMEM(js, off) __builtin_expect((off) < (js)->split, 1)
+#else
+#define FASTMEM(js, off) ((off) < (js)->split)
+#endif
+static inline uint8_t *memp(struct js *js, jsoff_t off) { return FASTMEM(js, off) ? &js->mem[off] : &js->slow[off - js->split]; }
+// Lowest offset of free memory that is contiguous up to js->size: what the
+// token caches, C call args and scratch buffers can take from the top
+static jsoff_t toplim(struct js *js) { return js->brk < js->split && js->split < js->size ? js->split : js->brk; }
+static void saveoff(struct js *js, jsoff_t off, jsoff_t val) { memcpy(memp(js, off), &val, sizeof(val)); }
+static void saveval(struct js *js, jsoff_t off, jsval_t val) { memcpy(memp(js, off), &val, sizeof(val)); }
+static jsoff_t loadoff(struct js *js, jsoff_t off) { jsoff_t v = 0; assert(js->brk <= js->size); memcpy(&v, memp(js, off), sizeof(v)); return v; }
 static jsoff_t offtolen(jsoff_t off) { return (off >> 2) - 1; }
-static jsoff_t vstrlen(struct js *js, jsval_t v) { return offtolen(loadoff(js, (jsoff_t) vdata(v))); }
-static jsval_t loadval(struct js *js, jsoff_t off) { jsval_t v = 0; memcpy(&v, &js->mem[off], sizeof(v)); return v; }
+static jsoff_t vstrlen(struct js *js, jsval_t v) { jsoff_t off = (jsoff_t) vdata(v), h = loadoff(js, off); return h & S_ROPE ? loadoff(js, off + 12) : offtolen(h); }
+static jsval_t loadval(struct js *js, jsoff_t off) { jsval_t v = 0; memcpy(&v, memp(js, off), sizeof(v)); return v; }
 static jsval_t upper(struct js *js, jsval_t scope) { return mkval(T_OBJ, loadoff(js, (jsoff_t) (vdata(scope) + sizeof(jsoff_t)))); }
 static jsoff_t align32(jsoff_t v) { return ((v + 3) >> 2) << 2; }
 
@@ -169,14 +384,23 @@ static size_t tostr(struct js *js, jsval_t value, char *buf, size_t len);
 static jsval_t js_expr(struct js *js);
 static jsval_t js_stmt(struct js *js);
 static jsval_t do_op(struct js *, uint8_t op, jsval_t l, jsval_t r);
+static const uint8_t *vm_entry(struct js *js, jsval_t func);
+static jsval_t vm_invoke(struct js *js, const uint8_t *e, jsval_t *args, int nargs);
+static bool vm_eval(struct js *js, jsval_t *res);
+static bool gcshade(struct js *js, jsoff_t off);
+static inline jsoff_t esize(jsoff_t w);
+static jsoff_t js_alloc(struct js *js, size_t size);
 
-static void setlwm(struct js *js) {
+// Update the memory low-water and C stack high-water marks. Return the C
+// stack in use now, for checks against maxcss: the high-water mark stays up
+static jsoff_t setlwm(struct js *js) {
   jsoff_t n = 0, css = 0;
   if (js->brk < js->size) n = js->size - js->brk;
   if (js->lwm > n) js->lwm = n;
   if ((char *)js->cstk > (char *)&n)
     css = (jsoff_t)((char *)js->cstk - (char *)&n);
   if (css > js->css) js->css = css;
+  return css;
 }
 
 // Copy src to dst, make no overflows, 0-terminate. Return bytes copied
@@ -187,6 +411,39 @@ static size_t cpy(char *dst, size_t dstlen, const char *src, size_t srclen) {
   return i;
 }
 
+// Array element sizes by kind, see JS_ARRAY and friends in elk.h
+static const uint8_t arresize[] = {sizeof(jsval_t), 1, 2, 4};
+
+static jsoff_t arrlen(struct js *js, jsoff_t arr) { return loadoff(js, (jsoff_t)(arr + sizeof(arr))) >> 2; }
+static uint8_t arrkind(struct js *js, jsoff_t arr) { return loadoff(js, (jsoff_t)(arr + sizeof(arr))) & 3U; }
+static jsoff_t arrdata(struct js *js, jsoff_t arr) { return (loadoff(js, arr) & ~3U) + (jsoff_t)sizeof(arr); }
+
+// Load array element, which must be within the array length
+static jsval_t arrload(struct js *js, jsoff_t arr, jsoff_t i) {
+  uint8_t kind = arrkind(js, arr);
+  jsoff_t off = arrdata(js, arr) + i * arresize[kind];
+  int16_t i16;
+  float f32;
+  switch (kind) {
+    case JS_UINT8: return mksmi(*memp(js, off));
+    case JS_INT16: memcpy(&i16, memp(js, off), sizeof(i16)); return mksmi(i16);
+    case JS_FLOAT32: memcpy(&f32, memp(js, off), sizeof(f32)); return tov(f32);
+    default: return loadval(js, off);
+  }
+}
+
+// Stringify JS array
+static size_t strarr(struct js *js, jsval_t arr, char *buf, size_t len) {
+  jsoff_t off = (jsoff_t)vdata(arr), n = arrlen(js, off);
+  size_t k = cpy(buf, len, "[", 1);
+  for (jsoff_t i = 0; i < n && k < len; i++) {
+    k += cpy(buf + k, len - k, ",", i == 0 ? 0 : 1);
+    k += tostr(js, arrload(js, off, i), buf + k, len - k);
+    if (k > len) k = len;  // Number got truncated
+  }
+  return k + cpy(buf + k, len - k, "]", 1);
+}
+
 // Stringify JS object
 static size_t strobj(struct js *js, jsval_t obj, char *buf, size_t len) {
   size_t n = cpy(buf, len, "{", 1);
@@ -204,35 +461,365 @@ static size_t strobj(struct js *js, jsval_t obj, char *buf, size_t len) {
   return n + cpy(buf + n, len - n, "}", 1);
 }
 
+// Number to string conversion, Grisu3: find the shortest digits that parse
+// back to the same double, with 64-bit integer arithmetic and a table of
+// cached powers of ten, 10^-348 .. 10^340 in steps of 8. For about 0.5% of
+// values it cannot tell that its digits are the shortest and closest, and
+// fmtexact() takes over. See F. Loitsch, "Printing Floating-Point Numbers
+// Quickly and Accurately with Integers", PLDI 2010
+struct diyfp {
+  uint64_t f;  // Significand
+  int e;       // Binary exponent
+};
+
+static const uint64_t pow10f[] = {
+    0xfa8fd5a0081c0288ULL, 0xbaaee17fa23ebf76ULL, 0x8b16fb203055ac76ULL,
+    0xcf42894a5dce35eaULL, 0x9a6bb0aa55653b2dULL, 0xe61acf033d1a45dfULL,
+    0xab70fe17c79ac6caULL, 0xff77b1fcbebcdc4fULL, 0xbe5691ef416bd60cULL,
+    0x8dd01fad907ffc3cULL, 0xd3515c2831559a83ULL, 0x9d71ac8fada6c9b5ULL,
+    0xea9c227723ee8bcbULL, 0xaecc49914078536dULL, 0x823c12795db6ce57ULL,
+    0xc21094364dfb5637ULL, 0x9096ea6f3848984fULL, 0xd77485cb25823ac7ULL,
+    0xa086cfcd97bf97f4ULL, 0xef340a98172aace5ULL, 0xb23867fb2a35b28eULL,
+    0x84c8d4dfd2c63f3bULL, 0xc5dd44271ad3cdbaULL, 0x936b9fcebb25c996ULL,
+    0xdbac6c247d62a584ULL, 0xa3ab66580d5fdaf6ULL, 0xf3e2f893dec3f126ULL,
+    0xb5b5ada8aaff80b8ULL, 0x87625f056c7c4a8bULL, 0xc9bcff6034c13053ULL,
+    0x964e858c91ba2655ULL, 0xdff9772470297ebdULL, 0xa6dfbd9fb8e5b88fULL,
+    0xf8a95fcf88747d94ULL, 0xb94470938fa89bcfULL, 0x8a08f0f8bf0f156bULL,
+    0xcdb02555653131b6ULL, 0x993fe2c6d07b7facULL, 0xe45c10c42a2b3b06ULL,
+    0xaa242499697392d3ULL, 0xfd87b5f28300ca0eULL, 0xbce5086492111aebULL,
+    0x8cbccc096f5088ccULL, 0xd1b71758e219652cULL, 0x9c40000000000000ULL,
+    0xe8d4a51000000000ULL, 0xad78ebc5ac620000ULL, 0x813f3978f8940984ULL,
+    0xc097ce7bc90715b3ULL, 0x8f7e32ce7bea5c70ULL, 0xd5d238a4abe98068ULL,
+    0x9f4f2726179a2245ULL, 0xed63a231d4c4fb27ULL, 0xb0de65388cc8ada8ULL,
+    0x83c7088e1aab65dbULL, 0xc45d1df942711d9aULL, 0x924d692ca61be758ULL,
+    0xda01ee641a708deaULL, 0xa26da3999aef774aULL, 0xf209787bb47d6b85ULL,
+    0xb454e4a179dd1877ULL, 0x865b86925b9bc5c2ULL, 0xc83553c5c8965d3dULL,
+    0x952ab45cfa97a0b3ULL, 0xde469fbd99a05fe3ULL, 0xa59bc234db398c25ULL,
+    0xf6c69a72a3989f5cULL, 0xb7dcbf5354e9beceULL, 0x88fcf317f22241e2ULL,
+    0xcc20ce9bd35c78a5ULL, 0x98165af37b2153dfULL, 0xe2a0b5dc971f303aULL,
+    0xa8d9d1535ce3b396ULL, 0xfb9b7cd9a4a7443cULL, 0xbb764c4ca7a44410ULL,
+    0x8bab8eefb6409c1aULL, 0xd01fef10a657842cULL, 0x9b10a4e5e9913129ULL,
+    0xe7109bfba19c0c9dULL, 0xac2820d9623bf429ULL, 0x80444b5e7aa7cf85ULL,
+    0xbf21e44003acdd2dULL, 0x8e679c2f5e44ff8fULL, 0xd433179d9c8cb841ULL,
+    0x9e19db92b4e31ba9ULL, 0xeb96bf6ebadf77d9ULL, 0xaf87023b9bf0ee6bULL
+};
+static const int16_t pow10e[] = {
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980, -954,
+    -927, -901, -874, -847, -821, -794, -768, -741, -715, -688, -661, -635,
+    -608, -582, -555, -529, -502, -475, -449, -422, -396, -369, -343, -316,
+    -289, -263, -236, -210, -183, -157, -130, -103, -77, -50, -24, 3, 30, 56,
+    83, 109, 136, 162, 189, 216, 242, 269, 295, 322, 348, 375, 402, 428, 455,
+    481, 508, 534, 561, 588, 614, 641, 667, 694, 720, 747, 774, 800, 827, 853,
+    880, 907, 933, 960, 986, 1013, 1039, 1066
+};
+
+static struct diyfp diymul(struct diyfp x, struct diyfp y) {
+  uint64_t a = x.f >> 32, b = x.f & 0xffffffffU, c = y.f >> 32, d = y.f & 0xffffffffU;
+  uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+  uint64_t tmp = (bd >> 32) + (ad & 0xffffffffU) + (bc & 0xffffffffU) + (1U << 31);
+  struct diyfp r = {ac + (ad >> 32) + (bc >> 32) + (tmp >> 32), x.e + y.e + 64};
+  return r;
+}
+
+// Nudge the last digit towards the exact value w, staying within the unsafe
+// interval. All values are scaled by the same 10^x, and known up to unit.
+// Return false if the digits may not be the closest or may not round-trip
+static bool grisuweed(char *buf, int n, uint64_t whigh, uint64_t unsafe, uint64_t rest,
+                      uint64_t ten, uint64_t unit) {
+  uint64_t lo = whigh - unit, hi = whigh + unit;  // Distance to w, either way
+  while (rest < lo && unsafe - rest >= ten &&
+         (rest + ten < lo || lo - rest >= rest + ten - lo)) {
+    buf[n - 1]--;
+    rest += ten;
+  }
+  if (rest < hi && unsafe - rest >= ten && (rest + ten < hi || hi - rest > rest + ten - hi)) {
+    return false;  // Another digit could be closer, given the error
+  }
+  return 2 * unit <= rest && rest <= unsafe - 4 * unit;
+}
+
+// Generate digits of the upper bound high, as long as they stay above low.
+// Return the number of digits, adjust decimal exponent k, 0 if not sure
+static int grisudigits(struct diyfp low, struct diyfp w, struct diyfp high,
+                       char *buf, int *k) {
+  static const uint32_t p10[] = {1,      10,      100,      1000,      10000,
+                                 100000, 1000000, 10000000, 100000000, 1000000000};
+  uint64_t unit = 1, one = (uint64_t) 1 << -w.e, toohigh = high.f + unit;
+  uint64_t unsafe = toohigh - (low.f - unit), whigh = toohigh - w.f, p2 = toohigh & (one - 1);
+  uint32_t p1 = (uint32_t) (toohigh >> -w.e);
+  int n = 0, kappa = 1;
+  while (kappa < 10 && p1 >= p10[kappa]) kappa++;
+  while (kappa > 0) {
+    uint32_t d = p1 / p10[kappa - 1];
+    p1 %= p10[kappa - 1];
+    buf[n++] = (char) ('0' + d);
+    kappa--;
+    uint64_t rest = ((uint64_t) p1 << -w.e) + p2;
+    if (rest < unsafe) {
+      *k += kappa;
+      return grisuweed(buf, n, whigh, unsafe, rest, (uint64_t) p10[kappa] << -w.e, unit) ? n : 0;
+    }
+  }
+  for (;;) {
+    p2 *= 10, unit *= 10, unsafe *= 10, kappa--;
+    buf[n++] = (char) ('0' + (p2 >> -w.e));
+    p2 &= one - 1;
+    if (p2 < unsafe) {
+      *k += kappa;
+      return grisuweed(buf, n, whigh * unit, unsafe, p2, one, unit) ? n : 0;
+    }
+  }
+}
+
+// Shortest digits of a positive finite double: value = digits * 10^k.
+// Return their number, 0 if Grisu3 is not sure of them
+static int grisu3(double dv, char *buf, int *k) {
+  uint64_t u, m;
+  memcpy(&u, &dv, sizeof(u));
+  int be = (int) (u >> 52 & 0x7ff);
+  m = u & (((uint64_t) 1 << 52) - 1);
+  struct diyfp v = {be ? m | (uint64_t) 1 << 52 : m, be ? be - 1075 : -1074};
+  struct diyfp w = v, wp = {(v.f << 1) + 1, v.e - 1}, wm;
+  while (!(w.f & ((uint64_t) 1 << 63))) w.f <<= 1, w.e--;
+  while (!(wp.f & ((uint64_t) 1 << 53))) wp.f <<= 1, wp.e--;
+  wp.f <<= 10, wp.e -= 10;  // Normalized upper boundary, same exponent as w
+  if (v.f == (uint64_t) 1 << 52) {  // Lower boundary is closer
+    wm.f = (v.f << 2) - 1, wm.e = v.e - 2;
+  } else {
+    wm.f = (v.f << 1) - 1, wm.e = v.e - 1;
+  }
+  wm.f <<= wm.e - wp.e, wm.e = wp.e;
+  // Pick a cached power that brings the binary exponent into [-60, -32]
+  double dk = (-61 - wp.e) * 0.30102999566398114 + 347;
+  int i = (int) dk;
+  if (dk - i > 0.0) i++;
+  i = (i >> 3) + 1;
+  struct diyfp c = {pow10f[i], pow10e[i]};
+  *k = 348 - i * 8;
+  return grisudigits(diymul(wm, c), diymul(w, c), diymul(wp, c), buf, k);
+}
+
+// Shortest digits the slow way, for values Grisu3 is not sure of: the
+// fewest significant digits printf rounds to that parse back to the value
+static int fmtexact(double dv, char *buf, int *k) {
+  char tmp[32];
+  int p, n = 0;
+  for (p = 1; p < 17; p++) {
+    snprintf(tmp, sizeof(tmp), "%.*e", p - 1, dv);
+    if (strtod(tmp, NULL) == dv) break;
+  }
+  snprintf(tmp, sizeof(tmp), "%.*e", p - 1, dv);
+  for (const char *s = tmp; *s != 'e'; s++) {
+    if (*s != '.') buf[n++] = *s;
+  }
+  while (n > 1 && buf[n - 1] == '0') n--;
+  *k = atoi(strchr(tmp, 'e') + 1) - n + 1;
+  return n;
+}
+
+// Format a number like JS does, into buf of at least 26 bytes: shortest
+// round-trip digits, exponent form below 1e-6 and from 1e21 on. Exact
+// integers below 2^53 take a fast path. Return string length
+static size_t fmtnum(double dv, char *buf) {
+  char d[24];
+  size_t n = 0;
+  int nd, k, i, x;
+  if (dv != dv) return cpy(buf, 26, "NaN", 3);
+  if (dv == 0) return cpy(buf, 26, "0", 1);  // Also -0
+  if (dv < 0) buf[n++] = '-', dv = -dv;
+  if (dv > 1.7976931348623157e308) return n + cpy(buf + n, 25, "Infinity", 8);
+  if (dv < 9007199254740992.0 && dv == (double) (uint64_t) dv) {
+    uint64_t v = (uint64_t) dv;
+    for (nd = 0; v > 0; v /= 10) d[nd++] = (char) ('0' + v % 10);
+    while (nd > 0) buf[n++] = d[--nd];
+    buf[n] = '\0';
+    return n;
+  }
+  if ((nd = grisu3(dv, d, &k)) == 0) nd = fmtexact(dv, d, &k);
+  x = nd + k;  // Value is 0.digits * 10^x
+  if (k >= 0 && x <= 21) {  // 1234e7 -> 12340000000
+    for (i = 0; i < x; i++) buf[n++] = i < nd ? d[i] : '0';
+  } else if (x > 0 && x <= 21) {  // 1234e-2 -> 12.34
+    for (i = 0; i < nd; i++) {
+      if (i == x) buf[n++] = '.';
+      buf[n++] = d[i];
+    }
+  } else if (x > -6 && x <= 0) {  // 1234e-7 -> 0.0001234
+    buf[n++] = '0', buf[n++] = '.';
+    for (i = x; i < 0; i++) buf[n++] = '0';
+    for (i = 0; i < nd; i++) buf[n++] = d[i];
+  } else {  // 1234e30 -> 1.234e+33
+    buf[n++] = d[0];
+    if (nd > 1) buf[n++] = '.';
+    for (i = 1; i < nd; i++) buf[n++] = d[i];
+    buf[n++] = 'e', buf[n++] = x > 0 ? '+' : '-';
+    x = x > 0 ? x - 1 : 1 - x;
+    if (x >= 100) buf[n++] = (char) ('0' + x / 100);
+    if (x >= 10) buf[n++] = (char) ('0' + x / 10 % 10);
+    buf[n++] = (char) ('0' + x % 10);
+  }
+  buf[n] = '\0';
+  return n;
+}
+
 // Stringify numeric JS value
 static size_t strnum(jsval_t value, char *buf, size_t len) {
-  double dv = tod(value), iv;
-  const char *fmt = modf(dv, &iv) == 0.0 ? "%.17g" : "%g";
-  return (size_t)snprintf(buf, len, fmt, dv);
+  char tmp[26];
+  return cpy(buf, len, tmp, fmtnum(tod(value), tmp));
+}
+
+// Parse a decimal or 0x hex number from at most len bytes of buf, with an
+// optional sign. Set *n to the number of bytes taken, 0 if there is no
+// number. Exact cases, mantissa up to 2^53 and scale up to 10^22, take the
+// fast path; everything else goes to strtod() with a normalized copy
+static double parsenum(const char *buf, size_t len, size_t *n) {
+  static const double p10[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+                               1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+                               1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+  char tmp[56];
+  uint64_t m = 0;
+  size_t i = 0, nd = 0, nt = 0;  // Digits taken, digits in tmp
+  int e = 0, ex = 0, esign = 1, dropped = 0;
+  bool neg = false;
+  double v;
+  *n = 0;
+  if (i < len && (buf[i] == '-' || buf[i] == '+')) neg = buf[i++] == '-';
+  if (i + 8 <= len && memcmp(&buf[i], "Infinity", 8) == 0) {
+    *n = i + 8;
+    return neg ? -INFINITY : INFINITY;
+  }
+  if (i + 2 < len && buf[i] == '0' && (buf[i + 1] | 0x20) == 'x' &&
+      is_xdigit(buf[i + 2])) {
+    for (v = 0, i += 2; i < len && is_xdigit(buf[i]); i++) v = v * 16 + unhex(buf[i]);
+    *n = i;
+    return neg ? -v : v;
+  }
+  for (bool frac = false;; i++) {
+    if (i < len && buf[i] == '.' && !frac) {
+      frac = true;
+      continue;
+    }
+    if (i >= len || !is_digit(buf[i])) break;
+    nd++;
+    if (m == 0 && buf[i] == '0') {  // Leading zero
+      if (frac) e--;
+      continue;
+    }
+    if (nt < 40) {
+      tmp[nt++] = buf[i];
+      if (nt <= 19) m = m * 10 + (uint64_t) (buf[i] - '0');
+      if (frac) e--;
+    } else {
+      dropped |= buf[i] != '0';
+      if (!frac) e++;
+    }
+  }
+  if (nd == 0) return 0;
+  *n = i;
+  if (i + 1 < len && (buf[i] | 0x20) == 'e') {
+    size_t j = i + 1;
+    if (j < len && (buf[j] == '-' || buf[j] == '+')) esign = buf[j++] == '-' ? -1 : 1;
+    if (j < len && is_digit(buf[j])) {
+      for (; j < len && is_digit(buf[j]); j++) ex = ex < 10000 ? ex * 10 + buf[j] - '0' : ex;
+      e += esign * ex;
+      *n = i = j;
+    }
+  }
+  if (nt <= 19 && m <= ((uint64_t) 1 << 53) && e >= -22 && e <= 22) {
+    v = e < 0 ? (double) m / p10[-e] : (double) m * p10[e];
+  } else if (nt == 0) {
+    v = 0;
+  } else {
+    if (dropped) tmp[nt++] = '1', e--;  // Keep rounding direction of the tail
+    tmp[nt++] = 'e';
+    if (e < 0) tmp[nt++] = '-', e = -e;
+    for (ex = 10000; ex > 1 && e < ex; ex /= 10) (void) 0;
+    for (; ex > 0; ex /= 10) tmp[nt++] = (char) ('0' + e / ex % 10);
+    tmp[nt] = '\0';
+    v = strtod(tmp, NULL);
+  }
+  return neg ? -v : v;
+}
+
+// Copy the first lim bytes of a rope or a flat string to dst. Right sides
+// are flat, so walk down the left sides, filling dst from the end
+static void ropecpy(struct js *js, jsoff_t off, uint8_t *dst, jsoff_t lim) {
+  jsoff_t v = loadoff(js, off), len = v & S_ROPE ? loadoff(js, off + 12) : offtolen(v);
+  while (len > 0) {
+    jsoff_t piece = off, n = len;  // Flat string: all of it
+    v = loadoff(js, off);
+    if (v & S_ROPE) {
+      piece = loadoff(js, off + 8), off = loadoff(js, off + 4);
+      if (piece == 0) continue;  // Flattened, the copy is on the left
+      n = offtolen(loadoff(js, piece));
+    }
+    len -= n;  // The piece goes to dst[len .. len + n)
+    if (len < lim) memcpy(dst + len, memp(js, piece + sizeof(off)), len + n > lim ? lim - len : n);
+  }
 }
 
-// Return mem offset and length of the JS string
+// Flatten a rope: copy it to a new flat string, which becomes its left side.
+// Return offset of the flat string, or ~0 if memory is out: the rope stays
+// as it is. No GC here, callers hold offsets in the middle of an expression
+static jsoff_t ropeflat(struct js *js, jsoff_t off) {
+  jsoff_t n = loadoff(js, off + 12), s, hdr = (n + 1) << 2 | T_STR;
+  if (loadoff(js, off + 8) == 0) return loadoff(js, off + 4);  // Flat already
+  if ((s = js_alloc(js, sizeof(hdr) + n + 1)) == ~(jsoff_t)0) return s;
+  saveoff(js, s, hdr);
+  ropecpy(js, off, memp(js, s + sizeof(hdr)), n);
+  *memp(js, s + sizeof(hdr) + n) = 0;  // 0-terminate
+  saveoff(js, off + 4, s), saveoff(js, off + 8, 0);
+  return s;
+}
+
+// Return mem offset and length of the JS string. Ropes get flattened: for
+// one, check for ~0 and length 0, when memory is out
 static jsoff_t vstr(struct js *js, jsval_t value, jsoff_t *len) {
   jsoff_t off = (jsoff_t)vdata(value);
+  if (loadoff(js, off) & S_ROPE) off = ropeflat(js, off);
+  if (off == ~(jsoff_t)0) {
+    if (len) *len = 0;
+    return off;
+  }
   if (len) *len = offtolen(loadoff(js, off));
   return (jsoff_t)(off + sizeof(off));
 }
 
+// Return source text and length of a JS function, in JS memory or in the
+// pinned buffer
+static const char *fnsrc(struct js *js, jsval_t func, jsoff_t *len) {
+  jsoff_t off = (jsoff_t) vdata(func);
+  if (loadoff(js, off) & S_EXT) {
+    *len = loadoff(js, off + 8);
+    return js->pin + loadoff(js, off + 4);
+  }
+  return (const char *) memp(js, vstr(js, func, len));
+}
+
 // Stringify string JS value
 static size_t strstring(struct js *js, jsval_t value, char *buf, size_t len) {
-  jsoff_t slen, off = vstr(js, value, &slen);
+  jsoff_t slen, off = (jsoff_t)vdata(value);
   size_t n = 0;
   n += cpy(buf + n, len - n, "\"", 1);
-  n += cpy(buf + n, len - n, (char *)&js->mem[off], slen);
+  if (loadoff(js, off) & S_ROPE) {  // Copy, don't flatten: js_str() output
+    slen = vstrlen(js, value);      // sits in free memory
+    if (slen > len - n) slen = (jsoff_t)(len - n);
+    ropecpy(js, off, (uint8_t *)buf + n, slen);
+    n += slen;
+  } else {
+    off = vstr(js, value, &slen);
+    n += cpy(buf + n, len - n, (char *)memp(js, off), slen);
+  }
   n += cpy(buf + n, len - n, "\"", 1);
   return n;
 }
 
 // Stringify JS function
 static size_t strfunc(struct js *js, jsval_t value, char *buf, size_t len) {
-  jsoff_t sn, off = vstr(js, value, &sn);
+  jsoff_t sn;
+  const char *fn = fnsrc(js, value, &sn);
   size_t n = cpy(buf, len, "function", 8);
-  return n + cpy(buf + n, len - n, (char *)&js->mem[off], sn);
+  return n + cpy(buf + n, len - n, fn, sn);
 }
 
 jsval_t js_mkerr(struct js *js, const char *xx, ...) {
@@ -253,6 +840,7 @@ static size_t tostr(struct js *js, jsval_t value, char *buf, size_t len) {
     case T_NULL:  return cpy(buf, len, "null", 4);
     case T_BOOL:  return cpy(buf, len, vdata(value) & 1 ? "true" : "false", vdata(value) & 1 ? 4 : 5);
     case T_OBJ:   return strobj(js, value, buf, len);
+    case T_ARR:   return strarr(js, value, buf, len);
     case T_STR:   return strstring(js, value, buf, len);
     case T_NUM:   return strnum(value, buf, len);
     case T_FUNC:  return strfunc(js, value, buf, len);
@@ -266,24 +854,51 @@ static size_t tostr(struct js *js, jsval_t value, char *buf, size_t len) {
 const char *js_str(struct js *js, jsval_t value) {
   // Leave jsoff_t placeholder between js->brk and a stringify buffer,
   // in case if next step is convert it into a JS variable
-  char *buf = (char *)&js->mem[js->brk + sizeof(jsoff_t)];
-  size_t len, available = js->size - js->brk - sizeof(jsoff_t);
+  jsoff_t lim = toplim(js);
+  char *buf = (char *)memp(js, lim + sizeof(jsoff_t));
+  size_t len, available = js->size - lim - sizeof(jsoff_t);
   if (is_err(value)) return js->errmsg;
-  if (js->brk + sizeof(jsoff_t) >= js->size) return "";
+  if (lim + sizeof(jsoff_t) >= js->size) return "";
   len = tostr(js, value, buf, available);
-  js_mkstr(js, NULL, len);
-  return buf;
+  jsval_t s = js_mkstr(js, buf, len);  // May land in a free slot, not at brk
+  return vtype(s) == T_STR ? (char *)memp(js, vdata(s) + sizeof(jsoff_t)) : buf;
 }
 
 bool js_truthy(struct js *js, jsval_t v) {
   uint8_t t = vtype(v);
-  return (t == T_BOOL && vdata(v) != 0) || (t == T_NUM && tod(v) != 0.0) || (t == T_OBJ || t == T_FUNC) || (t == T_STR && vstrlen(js, v) > 0);
+  return (t == T_BOOL && vdata(v) != 0) || (t == T_NUM && tod(v) != 0.0) || (t == T_OBJ || t == T_FUNC || t == T_ARR) || (t == T_STR && vstrlen(js, v) > 0);
 }
 
+// Out of memory: give up the token cache, if the innermost eval built it and
+// nothing was pushed below it since, and let the parser lex the text instead
+static bool tkdrop(struct js *js) {
+  jsoff_t n = js->ntk * (jsoff_t) sizeof(struct jstok);
+  if (js->tk == NULL || !js->tkown || (uint8_t *) js->tk != memp(js, js->size)) return false;
+  js->size += n, js->tkbytes -= n, js->tk = NULL, js->tkown = 0;
+  return true;
+}
+
+// Whether JS memory reaches up to end, after dropping the token cache if need be
+static bool fits(struct js *js, jsoff_t end) {
+  return end <= js->size || (tkdrop(js) && end <= js->size);
+}
+
+// Allocate from the free list of this size, if there is a free slot, or
+// at brk otherwise. See gcsweep()
 static jsoff_t js_alloc(struct js *js, size_t size) {
-  jsoff_t ofs = js->brk;
+  jsoff_t ofs = js->brk, *fl;
   size = align32((jsoff_t)size);  // 4-byte align, (n + k - 1) / k * k
-  if (js->brk + size > js->size) return ~(jsoff_t)0;
+  if (size <= JS_FREE_MAX && *(fl = &js->freel[size / 4 - 2]) != 0) {
+    ofs = *fl, *fl = loadoff(js, (jsoff_t)(ofs + sizeof(ofs))), js->free -= (jsoff_t)size;
+    if (js->gcphase) gcshade(js, ofs);  // Below gcend, but reachable
+    return ofs;
+  }
+  if (js->brk < js->split && js->brk + size > js->split) {  // Would straddle
+    if (!fits(js, js->split + (jsoff_t)size)) return ~(jsoff_t)0;  // the tiers: pad
+    saveoff(js, ofs, (js->split - ofs - (jsoff_t)sizeof(ofs)) << 2 | T_STR);  // with
+    ofs = js->brk = js->split;  // a dead slot, which the next GC reclaims
+  }
+  if (!fits(js, js->brk + (jsoff_t)size)) return ~(jsoff_t)0;
   js->brk += (jsoff_t)size;
   return ofs;
 }
@@ -291,10 +906,10 @@ static jsoff_t js_alloc(struct js *js, size_t size) {
 static jsval_t mkentity(struct js *js, jsoff_t b, const void *buf, size_t len) {
   jsoff_t ofs = js_alloc(js, len + sizeof(b));
   if (ofs == (jsoff_t)~0) return js_mkerr(js, "oom");
-  memcpy(&js->mem[ofs], &b, sizeof(b));
+  memcpy(memp(js, ofs), &b, sizeof(b));
   // Using memmove - in case we're stringifying data from the free JS mem
-  if (buf != NULL) memmove(&js->mem[ofs + sizeof(b)], buf, len);
-  if ((b & 3) == T_STR) js->mem[ofs + sizeof(b) + len - 1] = 0;  // 0-terminate
+  if (buf != NULL) memmove(memp(js, ofs + sizeof(b)), buf, len);
+  if ((b & 3) == T_STR && !(b & (S_ROPE | S_EXT))) *memp(js, ofs + sizeof(b) + len - 1) = 0;  // 0-terminate
   // printf("MKE: %u @ %u type %d\n", js->brk - ofs, ofs, b & 3);
   return mkval(b & 3, ofs);
 }
@@ -305,21 +920,217 @@ jsval_t js_mkstr(struct js *js, const void *ptr, size_t len) {
   return mkentity(js, (jsoff_t)((n << 2) | T_STR), ptr, n);
 }
 
+// Make a function value from its source text: a pinned reference if the
+// text is in the pinned buffer, a copy otherwise
+static jsval_t mkfunc(struct js *js, const char *code, jsoff_t len) {
+  jsval_t v;
+  if (js->pin != NULL && code >= js->pin && code + len <= js->pin + js->pinlen) {
+    jsoff_t ref[2] = {(jsoff_t) (code - js->pin), len};
+    v = mkentity(js, (jsoff_t) (sizeof(ref) << 2) | S_EXT | T_STR, ref, sizeof(ref));
+  } else {
+    v = js_mkstr(js, code, len);
+  }
+  return is_err(v) ? v : mkval(T_FUNC, vdata(v));
+}
+
+static bool is_mem_entity(uint8_t t) {
+  return t == T_OBJ || t == T_PROP || t == T_STR || t == T_FUNC || t == T_ARR;
+}
+
+// Incremental GC: mark entity as reachable, and queue it for scanning.
+// Entities allocated during the GC cycle are reachable, and the write
+// barrier makes sure that whatever they reference gets marked too.
+// Return true if the entity was not marked yet
+static bool gcshade(struct js *js, jsoff_t off) {
+  if (off >= js->gcend) return false;
+  uint32_t bit = 1U << (off / 4 % 32), *w = &js->gcmap[off / 128];
+  if (*w & bit) return false;
+  *w |= bit;
+  if (js->gcsp < JS_GC_STACK) {
+    js->gcstk[js->gcsp++] = off;
+  } else if (off < js->gcscan) {
+    js->gcscan = off;  // Mark stack is full, rescan memory later
+  }
+  return true;
+}
+
+// Write barrier: a reference to v is stored into memory
+static void gcbarrier(struct js *js, jsval_t v) {
+  if (!js->gcphase || !is_mem_entity(vtype(v))) return;
+  jsoff_t off = (jsoff_t)vdata(v);
+  if (gcshade(js, off) && vtype(v) == T_FUNC) js->gcfn += esize(loadoff(js, off));
+}
+
 static jsval_t mkobj(struct js *js, jsoff_t parent) {
+  if (js->gcphase) gcshade(js, parent);
   return mkentity(js, 0 | T_OBJ, &parent, sizeof(parent));
 }
 
+// Create array of the given kind and length, filled with undefined or 0
+static jsval_t mkarr(struct js *js, uint8_t kind, jsoff_t len) {
+  if (kind > JS_FLOAT32 || len > 0xffffffU) return js_mkerr(js, "bad array");
+  jsoff_t size = len * arresize[kind], hdr = len << 2 | kind;
+  jsval_t data = js_mkstr(js, NULL, size);
+  if (is_err(data)) return data;
+  jsval_t arr = mkentity(js, (jsoff_t)vdata(data) | M_ARR, &hdr, sizeof(hdr));
+  if (is_err(arr)) return arr;
+  memset(memp(js, vdata(data) + sizeof(jsoff_t)), 0, size);
+  for (jsoff_t i = 0; kind == JS_ARRAY && i < len; i++) {
+    saveval(js, (jsoff_t)(vdata(data) + sizeof(jsoff_t) + i * sizeof(jsval_t)), js_mkundef());
+  }
+  return mkval(T_ARR, vdata(arr));
+}
+
+// Make room for n elements in an Array: move data to a bigger string
+static jsval_t arrgrow(struct js *js, jsoff_t arr, jsoff_t n) {
+  jsoff_t old = loadoff(js, arr) & ~3U, cap = offtolen(loadoff(js, old)) / sizeof(jsval_t);
+  if (n <= cap) return js_mkundef();
+  cap = cap * 2 > n ? cap * 2 : n < 4 ? 4 : n;
+  jsval_t data = js_mkstr(js, NULL, cap * sizeof(jsval_t));
+  if (is_err(data)) return data;
+  memcpy(memp(js, vdata(data) + sizeof(jsoff_t)), memp(js, old + sizeof(jsoff_t)),
+         arrlen(js, arr) * sizeof(jsval_t));
+  saveoff(js, arr, (jsoff_t)vdata(data) | M_ARR);
+  return js_mkundef();
+}
+
+// Store array element. Storing past the end grows an Array, filling the gap
+// with undefined. Typed arrays have fixed length, and ignore such stores
+static jsval_t arrset(struct js *js, jsoff_t arr, jsoff_t i, jsval_t val) {
+  uint8_t kind = arrkind(js, arr);
+  jsoff_t len = arrlen(js, arr), off;
+  if (kind != JS_ARRAY) {
+    if (vtype(val) != T_NUM) return js_mkerr(js, "type mismatch");
+    if (i >= len) return val;
+    off = arrdata(js, arr) + i * arresize[kind];
+    if (kind == JS_UINT8) {
+      *memp(js, off) = (uint8_t)(long)tod(val);
+    } else if (kind == JS_INT16) {
+      int16_t v = (int16_t)(long)tod(val);
+      memcpy(memp(js, off), &v, sizeof(v));
+    } else {
+      float v = (float)tod(val);
+      memcpy(memp(js, off), &v, sizeof(v));
+    }
+    return val;
+  }
+  if (i >= len) {
+    if (i >= 0xffffffU) return js_mkerr(js, "bad index");
+    jsval_t res = arrgrow(js, arr, i + 1);
+    if (is_err(res)) return res;
+    for (off = arrdata(js, arr); len < i; len++) {
+      saveval(js, off + len * (jsoff_t)sizeof(jsval_t), js_mkundef());
+    }
+    saveoff(js, (jsoff_t)(arr + sizeof(arr)), (i + 1) << 2 | kind);
+  }
+  gcbarrier(js, val);
+  saveval(js, arrdata(js, arr) + i * (jsoff_t)sizeof(jsval_t), val);
+  return val;
+}
+
+static uint32_t strhash(const void *buf, size_t len) {
+  uint32_t h = 2166136261U;  // FNV-1a
+  for (size_t i = 0; i < len; i++) h = (h ^ ((const uint8_t *)buf)[i]) * 16777619U;
+  return h;
+}
+
+// Find the atom for the given key name. Return its offset, or 0 if the name
+// is not interned. If slot is not NULL, store the table slot for a new atom
+static jsoff_t atomfind(struct js *js, const void *buf, size_t len, jsoff_t *slot) {
+  jsoff_t a, mask = js->natoms - 1, i = strhash(buf, len) & mask;
+  while ((a = js->atoms[i]) != 0) {  // Offset 0 is the global scope, never a key
+    if (offtolen(loadoff(js, a)) == len && memcmp(memp(js, a + sizeof(a)), buf, len) == 0) break;
+    i = (i + 1) & mask;
+  }
+  if (slot != NULL) *slot = i;
+  return a;
+}
+
+// Intern string at offset off. Leave the table at most 3/4 full
+static bool atomadd(struct js *js, jsoff_t off, jsoff_t slot) {
+  if (js->nkeys + 1 > js->natoms / 4 * 3) return false;
+  js->atoms[slot] = off, js->nkeys++;
+  return true;
+}
+
+// Create a property key: reuse the atom if the name is interned already
+static jsval_t mkkey(struct js *js, const char *buf, size_t len) {
+  jsoff_t slot, a = atomfind(js, buf, len, &slot);
+  if (a != 0) return mkval(T_STR, a);
+  jsval_t k = js_mkstr(js, buf, len);
+  if (!is_err(k) && !atomadd(js, (jsoff_t)vdata(k), slot)) js->badkeys++;
+  return k;
+}
+
+// Same as mkkey(), for a key that is a JS string already
+static jsval_t mkkeyval(struct js *js, jsval_t k) {
+  jsoff_t n, slot, off, a;
+  if (is_err(k)) return k;
+  if ((off = vstr(js, k, &n)) == ~(jsoff_t)0) return js_mkerr(js, "oom");
+  k = mkval(T_STR, off - sizeof(off));  // Flat, if k is a rope
+  a = atomfind(js, memp(js, off), n, &slot);
+  if (a != 0) return mkval(T_STR, a);
+  if (!atomadd(js, (jsoff_t)vdata(k), slot)) js->badkeys++;
+  return k;
+}
+
+static struct jsidx *idxfind(struct js *js, jsoff_t obj) {
+  for (jsoff_t i = 0; i < js->nidx; i++) {
+    if (js->idxs[i].obj == obj) return &js->idxs[i];
+  }
+  return NULL;
+}
+
+// Find index slot of the given key atom: either the key, or an empty slot
+static jsoff_t *idxslot(struct js *js, struct jsidx *x, jsoff_t atom) {
+  jsoff_t *e = (jsoff_t *)&js->idx[x->off], mask = x->cap - 1;
+  jsoff_t i = ((atom >> 2) * 2654435761U) & mask;
+  while (e[i * 2] != 0 && e[i * 2] != atom) i = (i + 1) & mask;
+  return &e[i * 2];
+}
+
+// Index property. Newer props shadow older props with the same key
+static void idxput(struct js *js, struct jsidx *x, jsoff_t atom, jsoff_t prop) {
+  jsoff_t *e = idxslot(js, x, atom);
+  if (e[0] == 0) x->n++;
+  e[0] = atom, e[1] = prop;
+}
+
+// Build hash index for the object. Silently give up if there is no room
+static void idxbuild(struct js *js, jsoff_t obj) {
+  jsoff_t n = 0, cap = 32, off;
+  for (off = loadoff(js, obj) & ~3U; off != 0; off = loadoff(js, off) & ~3U) n++;
+  while (cap < n * 2) cap *= 2;
+  if (js->nidx >= JS_INDEX_OBJS || js->idxbrk + cap * 8 > js->idxsize) return;
+  struct jsidx *x = &js->idxs[js->nidx++];
+  x->obj = obj, x->off = js->idxbrk, x->cap = cap, x->n = 0;
+  memset(&js->idx[x->off], 0, cap * 8);
+  js->idxbrk += cap * 8;
+  for (off = loadoff(js, obj) & ~3U; off != 0; off = loadoff(js, off) & ~3U) {
+    jsoff_t koff = loadoff(js, (jsoff_t)(off + sizeof(off)));
+    if (idxslot(js, x, koff)[0] == 0) idxput(js, x, koff, off);
+  }
+}
+
 static jsval_t setprop(struct js *js, jsval_t obj, jsval_t k, jsval_t v) {
   jsoff_t koff = (jsoff_t)vdata(k);           // Key offset
   jsoff_t b, head = (jsoff_t)vdata(obj);      // Property list head
   char buf[sizeof(koff) + sizeof(v)];         // Property memory layout
-  memcpy(&b, &js->mem[head], sizeof(b));      // Load current 1st prop offset
+  memcpy(&b, memp(js, head), sizeof(b));      // Load current 1st prop offset
   memcpy(buf, &koff, sizeof(koff));           // Initialize prop data: copy key
   memcpy(buf + sizeof(koff), &v, sizeof(v));  // Copy value
-  jsoff_t brk = js->brk | T_OBJ;              // New prop offset
-  memcpy(&js->mem[head], &brk, sizeof(brk));  // Repoint head to the new prop
-  // printf("PROP: %u -> %u\n", b, brk);
-  return mkentity(js, (b & ~3U) | T_PROP, buf, sizeof(buf));  // Create new prop
+  if (js->gcphase) gcshade(js, b & ~3U), gcshade(js, koff), gcbarrier(js, v);
+  jsval_t res = mkentity(js, (b & ~3U) | T_PROP, buf, sizeof(buf));
+  if (!is_err(res)) saveoff(js, head, (jsoff_t)vdata(res) | T_OBJ);  // Repoint head
+  struct jsidx *x = idxfind(js, head);
+  if (x != NULL && !is_err(res)) {
+    if ((x->n + 1) * 4 > x->cap * 3) {
+      *x = js->idxs[--js->nidx];  // Index is too full, drop it. It gets
+    } else {                      // rebuilt bigger on the next lookup
+      idxput(js, x, koff, (jsoff_t)vdata(res));
+    }
+  }
+  return res;
 }
 
 // Return T_OBJ/T_PROP/T_STR entity size based on the first word in memory
@@ -327,62 +1138,154 @@ static inline jsoff_t esize(jsoff_t w) {
   switch (w & 3U) {  // clang-format off
     case T_OBJ:   return (jsoff_t) (sizeof(jsoff_t) + sizeof(jsoff_t));
     case T_PROP:  return (jsoff_t) (sizeof(jsoff_t) + sizeof(jsoff_t) + sizeof(jsval_t));
-    case T_STR:   return (jsoff_t) (sizeof(jsoff_t) + align32(w >> 2U));
+    case T_STR:   return (jsoff_t) (sizeof(jsoff_t) + align32((w & ~(S_ROPE | S_EXT)) >> 2U));
+    case M_ARR:   return (jsoff_t) (sizeof(jsoff_t) + sizeof(jsoff_t));
     default:      return (jsoff_t) ~0U;
   }  // clang-format on
 }
 
-static bool is_mem_entity(uint8_t t) {
-  return t == T_OBJ || t == T_PROP || t == T_STR || t == T_FUNC;
+#define GCMASK ~(((jsoff_t)~0) >> 1)  // Entity deletion marker
+// Compaction runs in three passes, Lisp2 style: find runs of dead entities
+// and compute forwarding, rewrite references, then slide live entities down.
+// Forwarding is kept in a break table in free memory: for each dead run, its
+// start offset and the number of dead bytes up to its end. If the table does
+// not fit into free memory, the passes repeat for the remaining dead runs.
+
+// Forwarding offset for an offset inside a live entity, or ~0 if it is dead
+static jsoff_t gcfwd(const jsoff_t *t, jsoff_t n, jsoff_t off) {
+  jsoff_t lo = 0, hi = n, mid;
+  while (lo < hi) {  // Find the first dead run that starts after off
+    mid = (lo + hi) / 2;
+    if (t[mid * 2] <= off) lo = mid + 1; else hi = mid;
+  }
+  if (lo == 0) return off;
+  jsoff_t prev = lo > 1 ? t[lo * 2 - 3] : 0;  // Dead bytes before this run
+  if (off < t[lo * 2 - 2] + t[lo * 2 - 1] - prev) return ~(jsoff_t)0;
+  return off - t[lo * 2 - 1];
 }
 
-#define GCMASK ~(((jsoff_t)~0) >> 1)  // Entity deletion marker
-static void js_fixup_offsets(struct js *js, jsoff_t start, jsoff_t size) {
-  for (jsoff_t n, v, off = 0; off < js->brk; off += n) {  // start from 0!
+static void gcfwdval(const jsoff_t *t, jsoff_t n, jsval_t *v) {
+  if (is_mem_entity(vtype(*v))) *v = mkval(vtype(*v), gcfwd(t, n, (jsoff_t)vdata(*v)));
+  if (vtype(*v) == T_ELEM) *v = mkelem(gcfwd(t, n, elemarr(*v)), elemidx(*v));
+}
+
+static void gcfwdptr(struct js *js, const jsoff_t *t, jsoff_t n, const char **p) {
+  jsoff_t lo = js->brk < js->split ? js->brk : js->split;  // Bytes in js->mem
+  if (*p >= (char *)js->mem && *p < (char *)&js->mem[lo]) {
+    *p = (char *)memp(js, gcfwd(t, n, (jsoff_t)(*p - (char *)js->mem)));
+  } else if (js->brk > js->split && *p >= (char *)js->slow && *p < (char *)&js->slow[js->brk - js->split]) {
+    *p = (char *)memp(js, gcfwd(t, n, js->split + (jsoff_t)(*p - (char *)js->slow)));
+  }
+}
+
+// Rewrite references in live entities and GC roots
+static void gcfixup(struct js *js, const jsoff_t *t, jsoff_t n) {
+  for (jsoff_t v, off = 0; off < js->brk; off += esize(v & ~GCMASK)) {
     v = loadoff(js, off);
-    n = esize(v & ~GCMASK);
     if (v & GCMASK) continue;  // To be deleted, don't bother
-    if ((v & 3) != T_OBJ && (v & 3) != T_PROP) continue;
-    if (v > start) saveoff(js, off, v - size);
-    if ((v & 3) == T_OBJ) {
-      jsoff_t u = loadoff(js, (jsoff_t)(off + sizeof(jsoff_t)));
-      if (u > start) saveoff(js, (jsoff_t)(off + sizeof(jsoff_t)), u - size);
+    if ((v & 3) == T_STR && (v & S_ROPE)) {  // Left and right sides
+      saveoff(js, (jsoff_t)(off + 4), gcfwd(t, n, loadoff(js, (jsoff_t)(off + 4))));
+      if (loadoff(js, (jsoff_t)(off + 8)) != 0) saveoff(js, (jsoff_t)(off + 8), gcfwd(t, n, loadoff(js, (jsoff_t)(off + 8))));
+    }
+    if ((v & 3) == T_STR) continue;
+    if ((v & 3) == M_ARR && arrkind(js, off) == JS_ARRAY) {  // Elements
+      for (jsoff_t i = 0, e = (v & ~3U) + (jsoff_t)sizeof(v); i < arrlen(js, off); i++, e += sizeof(jsval_t)) {
+        jsval_t val = loadval(js, e);
+        gcfwdval(t, n, &val);
+        saveval(js, e, val);
+      }
     }
+    saveoff(js, off, gcfwd(t, n, v & ~3U) | (v & 3));  // First or next prop
+    if ((v & 3) == M_ARR) continue;                      // or array data
+    jsoff_t u = loadoff(js, (jsoff_t)(off + sizeof(off)));  // Parent or key
+    saveoff(js, (jsoff_t)(off + sizeof(off)), gcfwd(t, n, u));
     if ((v & 3) == T_PROP) {
-      jsoff_t koff = loadoff(js, (jsoff_t)(off + sizeof(off)));
-      if (koff > start) saveoff(js, (jsoff_t)(off + sizeof(off)), koff - size);
       jsval_t val = loadval(js, (jsoff_t)(off + sizeof(off) + sizeof(off)));
-      if (is_mem_entity(vtype(val)) && vdata(val) > start) {
-        saveval(js, (jsoff_t)(off + sizeof(off) + sizeof(off)),
-                mkval(vtype(val), (unsigned long)(vdata(val) - size)));
-      }
+      gcfwdval(t, n, &val);
+      saveval(js, (jsoff_t)(off + sizeof(off) + sizeof(off)), val);
     }
   }
-  // Fixup js->scope
-  jsoff_t off = (jsoff_t)vdata(js->scope);
-  if (off > start) js->scope = mkval(T_OBJ, off - size);
-  if (js->nogc >= start) js->nogc -= size;
-  // Fixup code that we're executing now, if required
-  if (js->code > (char *)js->mem && js->code - (char *)js->mem < js->size && js->code - (char *)js->mem > start) {
-    js->code -= size;
-    // printf("GC-ing code under us!! %ld\n", js->code - (char *) js->mem);
+  gcfwdval(t, n, &js->scope);
+  js->nogc = gcfwd(t, n, js->nogc);
+  gcfwdptr(js, t, n, &js->code);    // Code that we're executing now,
+  gcfwdptr(js, t, n, &js->tkcode);  // if it is a function body
+  for (uint32_t i = 0; js->prof != NULL && i < js->prof->depth && i < JS_PROF_DEPTH; i++) {
+    gcfwdptr(js, t, n, &js->prof->frames[i].code);
+  }
+  for (jsoff_t i = 0; i < js->vsp; i++) gcfwdval(t, n, &js->vstk[i]);
+  for (int i = 0; i < JS_ROOTS; i++) gcfwdval(t, n, &js->roots[i]);
+  for (jsoff_t k, sz, eoff = js->vmcache; eoff < js->vmbrk; eoff += sz) {
+    memcpy(&k, &js->vm[eoff], sizeof(k));  // Compiled function key: when
+    memcpy(&sz, &js->vm[eoff + sizeof(k)], sizeof(sz));  // the function is
+    if (k != ~(jsoff_t)0 && (loadoff(js, k) & GCMASK)) k = ~(jsoff_t)0;  // deleted,
+    if (k != ~(jsoff_t)0) k = gcfwd(t, n, k);  // so is its code
+    memcpy(&js->vm[eoff], &k, sizeof(k));
+  }
+}
+
+// A live entity, which slides down to offset to, would straddle the tiers.
+// Move it to js->split instead: give the gap back from the dead runs before
+// it, last first, as dead slots at their ends. Entities in between slide
+// less, and still end below js->split. The slots stay flagged until they
+// have moved, so that nothing takes them for live entities
+static void gcpad(struct js *js, jsoff_t *t, jsoff_t n, jsoff_t to) {
+  for (jsoff_t i = n, gap = js->split - to; gap > 0 && i-- > 0;) {
+    jsoff_t len = t[i * 2 + 1] - (i > 0 ? t[i * 2 - 1] : 0), take = len < gap ? len : gap;
+    saveoff(js, t[i * 2] + len - take, (take - (jsoff_t)sizeof(to)) << 2 | T_STR | GCMASK);
+    for (jsoff_t k = i; k < n; k++) t[k * 2 + 1] -= take;
+    gap -= take;
+  }
+}
+
+// Move n bytes of JS memory down from offset from to offset to, in pieces
+// that do not cross js->split on either side
+static void memslide(struct js *js, jsoff_t to, jsoff_t from, jsoff_t n) {
+  while (n > 0) {
+    jsoff_t k = n;
+    if (from < js->split && from + k > js->split) k = js->split - from;
+    if (to < js->split && to + k > js->split) k = js->split - to;
+    memmove(memp(js, to), memp(js, from), k);
+    to += k, from += k, n -= k;
   }
-  // printf("FIXEDOFF %u %u\n", start, size);
 }
 
 static void js_delete_marked_entities(struct js *js) {
-  for (jsoff_t n, v, off = 0; off < js->brk; off += n) {
-    v = loadoff(js, off);
-    n = esize(v & ~GCMASK);
-    if (v & GCMASK) {  // This entity is marked for deletion, remove it
-      // printf("DEL: %4u %d %x\n", off, v & 3, n);
-      // assert(off + n <= js->brk);
-      js_fixup_offsets(js, off, n);
-      memmove(&js->mem[off], &js->mem[off + n], js->brk - off - n);
-      js->brk -= n;  // Shrink brk boundary by the size of deleted entity
-      n = 0;         // We shifted data, next iteration stay on this offset
+  jsoff_t local[32], *t, cap, n, v, sz, off, runend = 0;
+  do {
+    t = (jsoff_t *)memp(js, toplim(js));  // Break table lives in free memory
+    cap = (js->size - toplim(js)) / (jsoff_t)(sizeof(jsoff_t) * 2);
+    if (cap < sizeof(local) / sizeof(local[0]) / 2) {
+      t = local, cap = (jsoff_t)(sizeof(local) / sizeof(local[0]) / 2);
     }
-  }
+    for (n = 0, off = 0; off < js->brk; off += sz) {  // Pass 1: dead runs
+      v = loadoff(js, off);
+      sz = esize(v & ~GCMASK);
+      if (!(v & GCMASK)) {
+        jsoff_t to = n > 0 ? off - t[n * 2 - 1] : off;
+        if (to < js->split && to + sz > js->split) gcpad(js, t, n, to);
+        continue;
+      }
+      if (n > 0 && off == runend) {
+        t[n * 2 - 1] += sz;  // Extend current dead run
+      } else if (n < cap) {
+        t[n * 2] = off, t[n * 2 + 1] = (n > 0 ? t[n * 2 - 1] : 0) + sz, n++;
+      } else {
+        break;  // Break table is full, continue on the next round
+      }
+      runend = off + sz;
+    }
+    if (n == 0) break;
+    gcfixup(js, t, n);               // Pass 2: rewrite references
+    for (jsoff_t i = 0; i < n; i++) {  // Pass 3: slide live entities down
+      jsoff_t from = t[i * 2] + t[i * 2 + 1] - (i > 0 ? t[i * 2 - 1] : 0);
+      jsoff_t to = i + 1 < n ? t[i * 2 + 2] : js->brk;
+      memslide(js, from - t[i * 2 + 1], from, to - from);
+      if (from < to && (v = loadoff(js, from - t[i * 2 + 1])) & GCMASK) {
+        saveoff(js, from - t[i * 2 + 1], v & ~GCMASK);  // Slot from gcpad()
+      }
+    }
+    js->brk -= t[n * 2 - 1];
+  } while (off < js->brk + t[n * 2 - 1]);  // Stopped early, table was full
 }
 
 static void js_mark_all_entities_for_deletion(struct js *js) {
@@ -392,71 +1295,441 @@ static void js_mark_all_entities_for_deletion(struct js *js) {
   }
 }
 
-static jsoff_t js_unmark_entity(struct js *js, jsoff_t off) {
+// Mark stack of js_gc(). Marking is not recursive, so it takes constant
+// C stack. When the mark stack overflows, memory is rescanned instead
+struct jsmark {
+  jsoff_t stk[JS_GC_STACK];  // Unmarked entities to scan
+  jsoff_t sp;                // Stack pointer
+  jsoff_t scan;              // Rescan memory from here, ~0 if not needed
+};
+
+static void js_unmark_entity(struct js *js, struct jsmark *m, jsoff_t off) {
   jsoff_t v = loadoff(js, off);
-  if (v & GCMASK) {
-    saveoff(js, off, v & ~GCMASK);
-    // printf("UNMARK %5u %d\n", off, v & 3);
-    if ((v & 3) == T_OBJ) js_unmark_entity(js, v & ~(GCMASK | 3));
-    if ((v & 3) == T_PROP) {
-      js_unmark_entity(js, v & ~(GCMASK | 3));                          // Unmark next prop
-      js_unmark_entity(js, loadoff(js, (jsoff_t)(off + sizeof(off))));  // key
-      jsval_t val = loadval(js, (jsoff_t)(off + sizeof(off) + sizeof(off)));
-      if (is_mem_entity(vtype(val))) js_unmark_entity(js, (jsoff_t)vdata(val));
+  if (!(v & GCMASK)) return;
+  saveoff(js, off, v & ~GCMASK);
+  // printf("UNMARK %5u %d\n", off, v & 3);
+  if ((v & 3) == T_STR && !(v & S_ROPE)) return;  // Strings reference nothing
+  if (m->sp < JS_GC_STACK) {
+    m->stk[m->sp++] = off;
+  } else if (off < m->scan) {
+    m->scan = off;
+  }
+}
+
+// Unmark the entity a value references, if any. Count function bodies
+static void js_unmark_val(struct js *js, struct jsmark *m, jsval_t val) {
+  if (!is_mem_entity(vtype(val))) return;
+  jsoff_t off = (jsoff_t)vdata(val), v = loadoff(js, off);
+  if (vtype(val) == T_FUNC && (v & GCMASK)) js->gcfn += esize(v & ~GCMASK);
+  js_unmark_entity(js, m, off);
+}
+
+// Unmark entities referenced by an unmarked entity
+static void js_unmark_refs(struct js *js, struct jsmark *m, jsoff_t off) {
+  jsoff_t v = loadoff(js, off);
+  if ((v & 3) == T_STR) {  // Rope: left and right sides
+    js_unmark_entity(js, m, loadoff(js, (jsoff_t)(off + 4)));
+    if (loadoff(js, (jsoff_t)(off + 8)) != 0) js_unmark_entity(js, m, loadoff(js, (jsoff_t)(off + 8)));
+    return;
+  }
+  js_unmark_entity(js, m, v & ~3U);  // First or next prop, or array data
+  if ((v & 3) == M_ARR && arrkind(js, off) == JS_ARRAY) {
+    for (jsoff_t i = 0, e = arrdata(js, off); i < arrlen(js, off); i++, e += sizeof(jsval_t)) {
+      js_unmark_val(js, m, loadval(js, e));
     }
   }
-  return v & ~(GCMASK | 3U);
+  if ((v & 3) == T_PROP) {
+    js_unmark_entity(js, m, loadoff(js, (jsoff_t)(off + sizeof(off))));  // key
+    js_unmark_val(js, m, loadval(js, (jsoff_t)(off + sizeof(off) + sizeof(off))));
+  }
 }
 
 static void js_unmark_used_entities(struct js *js) {
+  struct jsmark m;
   jsval_t scope = js->scope;
+  m.sp = 0, m.scan = ~(jsoff_t)0;
   do {
-    js_unmark_entity(js, (jsoff_t)vdata(scope));
+    js_unmark_entity(js, &m, (jsoff_t)vdata(scope));
     scope = upper(js, scope);
   } while (vdata(scope) != 0);  // When global scope is GC-ed, stop
-  if (js->nogc) js_unmark_entity(js, js->nogc);
+  if (js->nogc) js_unmark_val(js, &m, mkval(T_FUNC, js->nogc));  // Called function
+  for (jsoff_t i = 0; i < js->vsp; i++) {  // Values on the VM stack
+    js_unmark_val(js, &m, js->vstk[i]);
+    if (vtype(js->vstk[i]) == T_ELEM) js_unmark_entity(js, &m, elemarr(js->vstk[i]));
+  }
+  for (int i = 0; i < JS_ROOTS; i++) {  // Values held by C code
+    js_unmark_val(js, &m, js->roots[i]);
+    if (vtype(js->roots[i]) == T_ELEM) js_unmark_entity(js, &m, elemarr(js->roots[i]));
+  }
+  for (;;) {
+    if (m.sp > 0) {
+      js_unmark_refs(js, &m, m.stk[--m.sp]);
+    } else if (m.scan < js->brk) {  // Mark stack overflowed: rescan
+      jsoff_t v, off = m.scan;
+      v = loadoff(js, off);
+      m.scan += esize(v & ~GCMASK);
+      if (!(v & GCMASK) && ((v & 3) != T_STR || (v & S_ROPE))) js_unmark_refs(js, &m, off);
+    } else {
+      break;
+    }
+  }
   // printf("UNMARK: nogc %u\n", js->nogc);
   // js_dump(js);
 }
 
-void js_gc(struct js *js) {
-  // printf("================== GC %u\n", js->nogc);
-  setlwm(js);
-  if (js->nogc == (jsoff_t)~0) return;  // ~0 is a special case: GC Is disabled
-  js_mark_all_entities_for_deletion(js);
-  js_unmark_used_entities(js);
+// Re-create atom table after GC has moved or deleted key strings
+static void atomsrebuild(struct js *js) {
+  memset(js->atoms, 0, js->natoms * sizeof(jsoff_t));
+  js->nkeys = js->badkeys = 0;
+  for (jsoff_t v, off = 0; off < js->brk; off += esize(v)) {
+    v = loadoff(js, off);
+    if ((v & 3) != T_PROP) continue;
+    jsoff_t slot, n, koff = loadoff(js, (jsoff_t)(off + sizeof(off)));
+    jsoff_t kstr = vstr(js, mkval(T_STR, koff), &n);
+    jsoff_t a = atomfind(js, memp(js, kstr), n, &slot);
+    if (a == koff) continue;
+    if (a != 0 || !atomadd(js, koff, slot)) js->badkeys++;
+  }
+}
+
+// Delete entities marked for deletion, rebuild what depends on offsets
+static void gccompact(struct js *js) {
   js_delete_marked_entities(js);
+  js->nidx = js->idxbrk = 0;  // Props have moved: drop hash indexes
+  atomsrebuild(js);
+  memset(js->freel, 0, sizeof(js->freel));
+  js->free = js->holes = 0;
 }
 
-// Skip whitespaces and comments
-static jsoff_t skiptonext(const char *code, jsoff_t len, jsoff_t n) {
-  // printf("SKIP: [%.*s]\n", len - n, &code[n]);
-  while (n < len) {
-    if (is_space(code[n])) {
-      n++;
-    } else if (n + 1 < len && code[n] == '/' && code[n + 1] == '/') {
-      for (n += 2; n < len && code[n] != '\n';) n++;
-    } else if (n + 3 < len && code[n] == '/' && code[n + 1] == '*') {
-      for (n += 4; n < len && (code[n - 2] != '*' || code[n - 1] != '/');) n++;
+// Sweep entities marked for deletion without moving anything: turn them into
+// free slots, which look like strings, so that memory walks can skip them.
+// Slots of up to JS_FREE_MAX bytes go on the free list of their size, lowest
+// offset first, and js_alloc() reuses them. Bigger ones stay as holes until
+// compaction. Dead entities at the top of memory are cut off. Interned keys
+// survive, so that names used again do not get re-interned. Return false,
+// without changing anything, if holes would take more than 1/4 of the room
+// that compaction makes below the GC threshold: then GC would run too often
+static bool gcsweep(struct js *js) {
+  jsoff_t v, sz, off, top = 0, dead = 0, holes = 0, d = 0, h = 0, tail[JS_FREE_MAX / 4 - 1], i;
+  for (i = 0; i < js->natoms; i++) {  // Revive dead keys, flag them in the
+    jsoff_t a = js->atoms[i];          // table in case compaction is due
+    if (a != 0 && (loadoff(js, a) & GCMASK)) {
+      saveoff(js, a, loadoff(js, a) & ~GCMASK), js->atoms[i] = a | 1U;
+    }
+  }
+  for (off = 0; off < js->brk; off += sz) {
+    v = loadoff(js, off), sz = esize(v & ~GCMASK);
+    if (!(v & GCMASK)) {
+      top = off + sz, dead = d, holes = h;  // Dead below top so far
     } else {
-      break;
+      d += sz, h += sz > JS_FREE_MAX ? sz : 0;
     }
   }
-  return n;
+  bool compact = top - dead > js->gct || holes > (js->gct - (top - dead)) / 4;
+  for (i = 0; i < js->natoms; i++) {
+    jsoff_t a = js->atoms[i] & ~1U;
+    if (compact && (js->atoms[i] & 1U)) saveoff(js, a, loadoff(js, a) | GCMASK);
+    js->atoms[i] = a;
+  }
+  if (compact) return false;
+  for (i = 0; i < js->nidx;) {  // Drop hash indexes of dead objects
+    if (loadoff(js, js->idxs[i].obj) & GCMASK) js->idxs[i] = js->idxs[--js->nidx]; else i++;
+  }
+  if (js->nidx == 0) js->idxbrk = 0;
+  for (jsoff_t k, eoff = js->vmcache; eoff < js->vmbrk; eoff += sz) {
+    memcpy(&k, &js->vm[eoff], sizeof(k));  // Forget compiled code of dead
+    memcpy(&sz, &js->vm[eoff + sizeof(k)], sizeof(sz));  // functions, their
+    if (k != ~(jsoff_t)0 && (loadoff(js, k) & GCMASK)) k = ~(jsoff_t)0;  // slots
+    memcpy(&js->vm[eoff], &k, sizeof(k));  // get reused by other functions
+  }
+  memset(js->freel, 0, sizeof(js->freel));
+  js->free = js->holes = 0;
+  for (off = 0; off < top; off += sz) {
+    v = loadoff(js, off), sz = esize(v & ~GCMASK);
+    if (!(v & GCMASK)) continue;
+    saveoff(js, off, (sz - (jsoff_t)sizeof(off)) << 2 | T_STR);
+    if (sz > JS_FREE_MAX || sz < 8) {  // 4 bytes: tier padding, see js_alloc()
+      js->holes += sz;
+      continue;
+    }
+    i = sz / 4 - 2;
+    saveoff(js, (jsoff_t)(off + sizeof(off)), 0);
+    if (js->freel[i] == 0) js->freel[i] = off; else saveoff(js, (jsoff_t)(tail[i] + sizeof(off)), off);
+    tail[i] = off, js->free += sz;
+  }
+  js->brk = top;
+  return true;
 }
 
-static bool streq(const char *buf, size_t len, const char *p, size_t n) {
-  return n == len && memcmp(buf, p, len) == 0;
+// Memory in use, for the GC threshold: free slots count as free, holes not
+static jsoff_t gcused(struct js *js) {
+  return js->brk - js->free;
 }
 
-static uint8_t parsekeyword(const char *buf, size_t len) {
-  switch (buf[0]) {  // clang-format off
-    case 'b': if (streq("break", 5, buf, len)) return TOK_BREAK; break;
-    case 'c': if (streq("class", 5, buf, len)) return TOK_CLASS; if (streq("case", 4, buf, len)) return TOK_CASE; if (streq("catch", 5, buf, len)) return TOK_CATCH; if (streq("const", 5, buf, len)) return TOK_CONST; if (streq("continue", 8, buf, len)) return TOK_CONTINUE; break;
-    case 'd': if (streq("do", 2, buf, len)) return TOK_DO;  if (streq("default", 7, buf, len)) return TOK_DEFAULT; break; // if (streq("delete", 6, buf, len)) return TOK_DELETE; break;
-    case 'e': if (streq("else", 4, buf, len)) return TOK_ELSE; break;
-    case 'f': if (streq("for", 3, buf, len)) return TOK_FOR; if (streq("function", 8, buf, len)) return TOK_FUNC; if (streq("finally", 7, buf, len)) return TOK_FINALLY; if (streq("false", 5, buf, len)) return TOK_FALSE; break;
-    case 'i': if (streq("if", 2, buf, len)) return TOK_IF; if (streq("in", 2, buf, len)) return TOK_IN; if (streq("instanceof", 10, buf, len)) return TOK_INSTANCEOF; break;
+// Tally live memory by entity type, after marking, for js_heapstats().
+// Function bodies, counted while marking, and array data are strings:
+// take them out of the strings
+static void gcaccount(struct js *js) {
+  jsoff_t n[4] = {0, 0, 0, 0}, data = 0;
+  for (jsoff_t v, off = 0; off < js->brk; off += esize(v & ~GCMASK)) {
+    v = loadoff(js, off);
+    if (v & GCMASK) continue;
+    n[v & 3] += esize(v);
+    if ((v & 3) == M_ARR) data += esize(loadoff(js, v & ~3U));
+  }
+  jsoff_t fn = js->gcfn < n[T_STR] - data ? js->gcfn : n[T_STR] - data;
+  js->heap[0] = n[T_OBJ], js->heap[1] = n[T_PROP], js->heap[2] = n[T_STR] - data - fn;
+  js->heap[3] = fn, js->heap[4] = n[M_ARR] + data;
+}
+
+// Adapt the GC threshold, see js_setgcadapt(). The more memory survives a
+// GC, the less the next one gains, so the room left above the live memory
+// is the live memory times the survival ratio. When little survives, GC is
+// cheap for what it frees: stay near the minimum. While the live memory
+// grows, e.g. when a script builds up its state, leave room for
+// JS_GC_PERIOD_MS of growth at the measured rate, if that is more. If the
+// live memory alone is over the maximum, go halfway to the memory size: a
+// threshold below it would run GC on every statement
+static void gcadapt(struct js *js, jsoff_t before) {
+  uint64_t now = JS_NOW_US(), us = now - js->gcstamp;
+  jsoff_t live = gcused(js), growth = live > js->gclive ? live - js->gclive : 0;
+  if (js->gcstamp != 0 && us > 0) {
+    uint64_t rate = (uint64_t)growth * 1000000U / us;
+    if (rate > 0xffffffffU) rate = 0xffffffffU;
+    js->gcrate = (uint32_t)(((uint64_t)js->gcrate * 3 + rate) / 4);
+  }
+  js->gcstamp = now, js->gclive = live;
+  if (js->gctmax == 0) return;
+  uint64_t room = before > 0 ? (uint64_t)live * live / before : 0;
+  uint64_t burst = (uint64_t)js->gcrate * JS_GC_PERIOD_MS / 1000U;
+  uint64_t gct = live + (room > burst ? room : burst);
+  js->gct = gct < js->gctmin ? js->gctmin : gct > js->gctmax ? js->gctmax : (jsoff_t)gct;
+  if (live >= js->gctmax) js->gct = live + (js->size - live) / 2;
+}
+
+// Delete entities marked for deletion. Sweep, unless compaction is forced
+// or a sweep does not free enough memory. Compaction takes longer: it
+// rewrites every reference, drops hash indexes and rebuilds the atoms
+static void gcreclaim(struct js *js, bool compact) {
+  jsoff_t before = gcused(js);
+  gcaccount(js);
+  if (compact || !gcsweep(js)) gccompact(js);
+  js->gcruns++;
+  gcadapt(js, before);
+}
+
+static void gcpause(struct js *js, uint64_t start) {
+  js->gclast = (uint32_t)(JS_NOW_US() - start);
+  if (js->gclast > js->gcmax) js->gcmax = js->gclast;
+  js->gctime += js->gclast;
+}
+
+static void gcfull(struct js *js, bool compact) {
+  // printf("================== GC %u\n", js->nogc);
+  setlwm(js);
+  if (js->nogc == (jsoff_t)~0) return;  // ~0 is a special case: GC Is disabled
+  uint64_t start = JS_NOW_US();
+  js->gcphase = 0, js->gcfn = 0;  // Abandon incremental GC cycle, if any
+  js_mark_all_entities_for_deletion(js);
+  js_unmark_used_entities(js);
+  gcreclaim(js, compact);
+  gcpause(js, start);
+}
+
+void js_gc(struct js *js) {
+  gcfull(js, true);
+}
+
+// Incremental GC. A cycle starts when brk > gct: all entities below brk are
+// white, roots get marked. Then js_gcstep() slices scan marked entities and
+// mark what they reference, until nothing is left to scan. Meanwhile, the
+// write barrier marks whatever gets stored into memory. Then roots are marked
+// again, and unmarked entities are deleted. Deletion moves entities, and
+// the code running between slices cannot cope with that, so it is done in
+// one go. It takes linear time, much like a marking slice over the heap.
+
+static void gcroots(struct js *js) {
+  gcshade(js, 0);  // Global scope
+  for (jsval_t scope = js->scope; vdata(scope) != 0; scope = upper(js, scope)) {
+    gcshade(js, (jsoff_t)vdata(scope));
+  }
+  if (js->nogc) gcbarrier(js, mkval(T_FUNC, js->nogc));  // Called function
+  for (jsoff_t i = 0; i < js->vsp; i++) {
+    gcbarrier(js, js->vstk[i]);
+    if (vtype(js->vstk[i]) == T_ELEM) gcshade(js, elemarr(js->vstk[i]));
+  }
+  for (int i = 0; i < JS_ROOTS; i++) {
+    gcbarrier(js, js->roots[i]);
+    if (vtype(js->roots[i]) == T_ELEM) gcshade(js, elemarr(js->roots[i]));
+  }
+}
+
+// Scan one entity: mark everything it references
+static void gcscanent(struct js *js, jsoff_t off) {
+  jsoff_t v = loadoff(js, off);
+  if ((v & 3) == T_STR && (v & S_ROPE)) {  // Left and right sides
+    gcshade(js, loadoff(js, (jsoff_t)(off + 4)));
+    if (loadoff(js, (jsoff_t)(off + 8)) != 0) gcshade(js, loadoff(js, (jsoff_t)(off + 8)));
+  }
+  if ((v & 3) == T_STR) return;
+  gcshade(js, v & ~3U);  // First or next prop, or array data
+  if ((v & 3) == M_ARR) {
+    for (jsoff_t i = 0; arrkind(js, off) == JS_ARRAY && i < arrlen(js, off); i++) {
+      gcbarrier(js, loadval(js, arrdata(js, off) + i * (jsoff_t)sizeof(jsval_t)));
+    }
+    return;
+  }
+  gcshade(js, loadoff(js, (jsoff_t)(off + sizeof(off))));  // Parent or key
+  if ((v & 3) == T_PROP) {
+    gcbarrier(js, loadval(js, (jsoff_t)(off + sizeof(off) + sizeof(off))));
+  }
+}
+
+// Do a unit of marking work. Return false if there is nothing left to mark
+static bool gcmarkstep(struct js *js) {
+  if (js->gcsp > 0) {
+    gcscanent(js, js->gcstk[--js->gcsp]);
+  } else if (js->gcscan < js->gcend) {  // Rescan after mark stack overflow
+    jsoff_t off = js->gcscan;
+    js->gcscan += esize(loadoff(js, off));
+    if (js->gcmap[off / 128] & (1U << (off / 4 % 32))) gcscanent(js, off);
+  } else {
+    return false;
+  }
+  return true;
+}
+
+static void gcfinish(struct js *js) {
+  gcroots(js);  // Roots are not covered by the write barrier
+  while (gcmarkstep(js)) (void)0;
+  for (jsoff_t v, off = 0; off < js->gcend; off += esize(v & ~GCMASK)) {
+    v = loadoff(js, off);
+    if (!(js->gcmap[off / 128] & (1U << (off / 4 % 32)))) saveoff(js, off, v | GCMASK);
+  }
+  js->gcphase = 0;
+  gcreclaim(js, false);
+}
+
+bool js_gcstep(struct js *js) {
+  if (js->gcslice == 0 || js->nogc == (jsoff_t)~0) return false;
+  if (!js->gcphase && gcused(js) <= js->gct) return false;
+  uint64_t start = JS_NOW_US();
+  setlwm(js);
+  if (!js->gcphase) {  // Start new cycle
+    memset(js->gcmap, 0, (js->brk / 128 + 1) * sizeof(*js->gcmap));
+    js->gcend = js->brk, js->gcsp = 0, js->gcscan = ~(jsoff_t)0;
+    js->gcphase = 1, js->gcfn = 0;
+    gcroots(js);
+  }
+  for (jsoff_t n = 1;; n++) {
+    if (!gcmarkstep(js)) {
+      gcfinish(js);
+      break;
+    }
+    if (n % 64 == 0 && JS_NOW_US() - start >= js->gcslice) break;
+  }
+  gcpause(js, start);
+  return js->gcphase != 0;
+}
+
+// Collect garbage at a statement boundary. With incremental GC, leave that
+// to js_gcstep(), unless memory is about to run out. Then, compact: free
+// slots of the wrong sizes may be what keeps brk up
+static void gccheck(struct js *js) {
+  if (js->brk > js->gct + (js->size - js->gct) / 2) {
+    js_gc(js);
+  } else if (js->gcslice == 0 && gcused(js) > js->gct) {
+    gcfull(js, false);
+  }
+}
+
+// Start the execution budget when the outermost js_eval() or js_call() runs
+static void budgetenter(struct js *js) {
+  if (js->nrun++ > 0 || js->budget == 0) return;
+  js->deadline = JS_NOW_US() + js->budget, js->bsteps = JS_BUDGET_STEPS;
+}
+
+static void proftake(struct js *js);
+
+// Check the execution budget on a statement boundary or a loop iteration.
+// The clock is read every JS_BUDGET_STEPS checks. Return error to abort.
+// Profiler samples requested since the last check are taken here too
+static jsval_t budgetcheck(struct js *js) {
+  if (js->prof != NULL && js->prof->ticks != js->prof->taken) proftake(js);
+  if (js->budget == 0 || --js->bsteps > 0) return js_mkundef();
+  js->bsteps = JS_BUDGET_STEPS;
+  if (JS_NOW_US() < js->deadline) return js_mkundef();
+  if (js->overrun == NULL || !js->overrun(js)) return js_mkerr(js, "execution budget exceeded");
+  js->deadline = JS_NOW_US() + js->budget;  // Go on with a new budget
+  return js_mkundef();
+}
+
+// Track a call for the profiler. Return true if it is tracked, then the
+// caller must profpop() it when the call returns. Calls are tracked while
+// the profiler is stopped too, so that the stack is right when it starts
+static bool profpush(struct js *js, const char *name, size_t len, const char *code,
+                     jsoff_t clen) {
+  struct jsprof *p = js->prof;
+  if (p == NULL) return false;
+  if (p->depth == 0) p->taken = p->ticks;  // Nothing ran since, skip those
+  if (p->depth < JS_PROF_DEPTH) {
+    struct jsframe *f = &p->frames[p->depth];
+    cpy(f->name, sizeof(f->name), name == NULL ? "" : name, name == NULL ? 0 : len);
+    f->code = code, f->len = clen;
+  }
+  p->depth++;
+  return true;
+}
+
+// Samples requested during a call, e.g. a native one, are of that call
+static void profpop(struct js *js, bool pushed) {
+  if (!pushed) return;
+  if (js->prof->ticks != js->prof->taken) proftake(js);
+  if (js->prof->depth > 0) js->prof->depth--;
+}
+
+// Name of a function called from C: the global variable that holds it
+static const char *profname(struct js *js, jsval_t func, jsoff_t *len) {
+  jsoff_t off = loadoff(js, 0) & ~3U;
+  for (; off < js->brk && off != 0; off = loadoff(js, off) & ~3U) {
+    if (loadval(js, (jsoff_t)(off + sizeof(off) * 2)) != func) continue;
+    jsoff_t koff = loadoff(js, (jsoff_t)(off + sizeof(off)));
+    *len = (loadoff(js, koff) >> 2) - 1;
+    return (const char *)memp(js, koff + sizeof(koff));
+  }
+  *len = 0;
+  return NULL;
+}
+
+// Skip whitespaces and comments
+static jsoff_t skiptonext(const char *code, jsoff_t len, jsoff_t n) {
+  // printf("SKIP: [%.*s]\n", len - n, &code[n]);
+  while (n < len) {
+    if (is_space(code[n])) {
+      n++;
+    } else if (n + 1 < len && code[n] == '/' && code[n + 1] == '/') {
+      for (n += 2; n < len && code[n] != '\n';) n++;
+    } else if (n + 3 < len && code[n] == '/' && code[n + 1] == '*') {
+      for (n += 4; n < len && (code[n - 2] != '*' || code[n - 1] != '/');) n++;
+    } else {
+      break;
+    }
+  }
+  return n;
+}
+
+static bool streq(const char *buf, size_t len, const char *p, size_t n) {
+  return n == len && memcmp(buf, p, len) == 0;
+}
+
+static uint8_t parsekeyword(const char *buf, size_t len) {
+  switch (buf[0]) {  // clang-format off
+    case 'b': if (streq("break", 5, buf, len)) return TOK_BREAK; break;
+    case 'c': if (streq("class", 5, buf, len)) return TOK_CLASS; if (streq("case", 4, buf, len)) return TOK_CASE; if (streq("catch", 5, buf, len)) return TOK_CATCH; if (streq("const", 5, buf, len)) return TOK_CONST; if (streq("continue", 8, buf, len)) return TOK_CONTINUE; break;
+    case 'd': if (streq("do", 2, buf, len)) return TOK_DO;  if (streq("default", 7, buf, len)) return TOK_DEFAULT; break; // if (streq("delete", 6, buf, len)) return TOK_DELETE; break;
+    case 'e': if (streq("else", 4, buf, len)) return TOK_ELSE; break;
+    case 'f': if (streq("for", 3, buf, len)) return TOK_FOR; if (streq("function", 8, buf, len)) return TOK_FUNC; if (streq("finally", 7, buf, len)) return TOK_FINALLY; if (streq("false", 5, buf, len)) return TOK_FALSE; break;
+    case 'i': if (streq("if", 2, buf, len)) return TOK_IF; if (streq("in", 2, buf, len)) return TOK_IN; if (streq("instanceof", 10, buf, len)) return TOK_INSTANCEOF; break;
     case 'l': if (streq("let", 3, buf, len)) return TOK_LET; break;
     case 'n': if (streq("new", 3, buf, len)) return TOK_NEW; if (streq("null", 4, buf, len)) return TOK_NULL; break;
     case 'r': if (streq("return", 6, buf, len)) return TOK_RETURN; break;
@@ -478,9 +1751,7 @@ static uint8_t parseident(const char *buf, jsoff_t len, jsoff_t *tlen) {
   return TOK_ERR;
 }
 
-static uint8_t next(struct js *js) {
-  if (js->consumed == 0) return js->tok;
-  js->consumed = 0;
+static uint8_t lex(struct js *js) {
   js->tok = TOK_ERR;
   js->toff = js->pos = skiptonext(js->code, js->clen, js->pos);
   js->tlen = 0;
@@ -496,6 +1767,8 @@ static uint8_t next(struct js *js) {
     case ')': TOK(TOK_RPAREN, 1);
     case '{': TOK(TOK_LBRACE, 1);
     case '}': TOK(TOK_RBRACE, 1);
+    case '[': TOK(TOK_LBRACKET, 1);
+    case ']': TOK(TOK_RBRACKET, 1);
     case ';': TOK(TOK_SEMICOLON, 1);
     case ',': TOK(TOK_COMMA, 1);
     case '!': if (LOOK(1, '=') && LOOK(2, '=')) TOK(TOK_NE, 3); TOK(TOK_NOT, 1);
@@ -529,9 +1802,9 @@ static uint8_t next(struct js *js) {
       if (buf[0] == buf[js->tlen]) js->tok = TOK_STRING, js->tlen++;
       break;
     case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9': {
-      char *end;
-      js->tval = tov(strtod(buf, &end)); // TODO(lsm): protect against OOB access
-      TOK(TOK_NUMBER, (jsoff_t) (end - buf));
+      size_t n;
+      js->tval = tonum(parsenum(buf, js->clen - js->toff, &n));
+      TOK(TOK_NUMBER, (jsoff_t) n);
     }
     default: js->tok = parseident(buf, js->clen - js->toff, &js->tlen); break;
   }  // clang-format on
@@ -540,12 +1813,84 @@ static uint8_t next(struct js *js) {
   return js->tok;
 }
 
+// Fetch the token at js->pos from the token cache. Return false on a miss,
+// in which case the caller falls back to lexing the code text
+static bool tkfetch(struct js *js) {
+  size_t delta = (size_t) (js->code - js->tkcode);
+  if (js->code < js->tkcode || delta + js->clen > js->tklen) return false;
+  jsoff_t p = (jsoff_t) delta + js->pos, end = (jsoff_t) delta + js->clen;
+  jsoff_t i = js->tki, lo = 0, hi = js->ntk;
+  if (i >= js->ntk || js->tk[i].off < p || (i > 0 && js->tk[i - 1].off >= p)) {
+    while (lo < hi) {  // Cursor miss, e.g. a loop jumped back: bsearch
+      jsoff_t mid = lo + (hi - lo) / 2;
+      if (js->tk[mid].off < p) lo = mid + 1; else hi = mid;
+    }
+    i = lo;
+  }
+  if (i >= js->ntk) return false;
+  if (i > 0 && js->tk[i - 1].off + (js->tk[i - 1].info >> 8) > p) return false;
+  const struct jstok *t = &js->tk[i];
+  if (t->off >= end) {  // Past the end of the current snippet
+    js->tok = TOK_EOF, js->toff = js->pos = js->clen, js->tlen = 0;
+  } else if (t->off + (t->info >> 8) > end) {
+    return false;  // Token straddles the snippet end, let the lexer clip it
+  } else {
+    js->tok = (uint8_t) (t->info & 255U);
+    js->toff = t->off - (jsoff_t) delta;
+    js->tlen = t->info >> 8;
+    js->pos = js->toff + js->tlen;
+    if (js->tok == TOK_NUMBER) js->tval = t->tval;
+  }
+  js->tki = i + 1;
+  return true;
+}
+
+static uint8_t next(struct js *js) {
+  if (js->consumed == 0) return js->tok;
+  js->consumed = 0;
+  if (js->tk != NULL && tkfetch(js)) return js->tok;
+  return lex(js);
+}
+
+// Memory a new token cache may take: half of free memory, and all caches
+// together about 1/16 of JS memory, twice the index memory
+static jsoff_t tkavail(struct js *js) {
+  jsoff_t avail = js->size > toplim(js) ? (js->size - toplim(js)) / 2 : 0;
+  jsoff_t cap = js->idxsize * 2 > js->tkbytes ? js->idxsize * 2 - js->tkbytes : 0;
+  return avail < cap ? avail : cap;
+}
+
+// Lex the code snippet once into a token array at the top of JS memory, so
+// that loops and function calls walk tokens instead of re-scanning the text.
+// If the cache does not fit in tkavail(), it is not built and the parser lexes
+// the text as before. The code that runs may take the cache back, see
+// tkdrop(). Return cache size in bytes.
+static jsoff_t tkbuild(struct js *js, const char *buf, jsoff_t len) {
+  jsoff_t max = tkavail(js) / (jsoff_t) sizeof(struct jstok), n = 0;
+  struct jstok *tk = (struct jstok *) memp(js, js->size - max * sizeof(*tk));
+  js->code = buf, js->clen = len, js->pos = 0, js->tk = NULL;
+  for (;;) {
+    if (n >= max) return 0;
+    uint8_t tok = lex(js);
+    if (js->tlen > 0xffffffU) return 0;
+    tk[n].off = js->toff, tk[n].info = js->tlen << 8 | tok;
+    tk[n].tval = tok == TOK_NUMBER ? js->tval : 0;
+    n++;
+    if (tok == TOK_EOF || tok == TOK_ERR) break;
+  }
+  js->size -= n * (jsoff_t) sizeof(*tk), js->tkbytes += n * (jsoff_t) sizeof(*tk);
+  memmove(memp(js, js->size), tk, n * sizeof(*tk));
+  js->tk = (struct jstok *) memp(js, js->size);
+  js->tkcode = buf, js->tklen = len, js->ntk = n, js->tki = 0;
+  return n * (jsoff_t) sizeof(*tk);
+}
+
 static inline uint8_t lookahead(struct js *js) {
   uint8_t old = js->tok, tok = 0;
-  jsoff_t pos = js->pos;
+  jsoff_t pos = js->pos, tki = js->tki;
   js->consumed = 1;
   tok = next(js);
-  js->pos = pos, js->tok = old;
+  js->pos = pos, js->tok = old, js->tki = tki;
   return tok;
 }
 
@@ -561,9 +1906,12 @@ static void delscope(struct js *js) {
   // printf("EXIT  SCOPE %u\n", (jsoff_t) vdata(js->scope));
 }
 
+// Blocks and calls create their scope lazily, on the first let that needs it:
+// most loop bodies and callbacks declare nothing and skip the allocation
 static jsval_t js_block(struct js *js, bool create_scope) {
   jsval_t res = js_mkundef();
-  if (create_scope) mkscope(js);  // Enter new scope
+  uint8_t lazy = js->lazy;
+  if (create_scope) js->lazy = 1;  // Enter new scope, when needed
   js->consumed = 1;
   // jsoff_t pos = js->pos;
   while (next(js) != TOK_EOF && next(js) != TOK_RBRACE && !is_err(res)) {
@@ -575,18 +1923,33 @@ static jsval_t js_block(struct js *js, bool create_scope) {
     }
   }
   // printf("BLOCKEND %s\n", js_str(js, res));
-  if (create_scope) delscope(js);  // Exit scope
+  if (create_scope && !js->lazy) delscope(js);  // Exit scope, if created
+  js->lazy = lazy;
   return res;
 }
 
-// Seach for property in a single object
-static jsoff_t lkp(struct js *js, jsval_t obj, const char *buf, size_t len) {
-  jsoff_t off = loadoff(js, (jsoff_t)vdata(obj)) & ~3U;  // Load first prop off
+// Search for property in a single object, given the key name and its atom.
+// While all keys are atoms, keys are compared by offset, and large objects
+// get a hash index. Otherwise, fall back to comparing key strings
+static jsoff_t lkpkey(struct js *js, jsval_t obj, const char *buf, size_t len, jsoff_t atom) {
+  jsoff_t head = (jsoff_t)vdata(obj), n = 0;
+  jsoff_t off = loadoff(js, head) & ~3U;  // Load first prop off
   // printf("LKP: %lu %u [%.*s]\n", vdata(obj), off, (int) len, buf);
+  if (js->badkeys == 0) {
+    if (atom == 0) return 0;  // Name is not interned, so no such prop
+    struct jsidx *x = idxfind(js, head);
+    if (x != NULL) return idxslot(js, x, atom)[1];
+    while (off < js->brk && off != 0) {  // Iterate over props
+      if (loadoff(js, (jsoff_t)(off + sizeof(off))) == atom) break;
+      off = loadoff(js, off) & ~3U, n++;
+    }
+    if (n > JS_INDEX_MIN) idxbuild(js, head);  // Long scan, index the object
+    return off < js->brk ? off : 0;
+  }
   while (off < js->brk && off != 0) {  // Iterate over props
     jsoff_t koff = loadoff(js, (jsoff_t)(off + sizeof(off)));
     jsoff_t klen = (loadoff(js, koff) >> 2) - 1;
-    const char *p = (char *)&js->mem[koff + sizeof(koff)];
+    const char *p = (char *)memp(js, koff + sizeof(koff));
     // printf("  %u %u[%.*s]\n", off, (int) klen, (int) klen, p);
     if (streq(buf, len, p, klen)) return off;  // Found !
     off = loadoff(js, off) & ~3U;              // Load next prop offset
@@ -594,26 +1957,42 @@ static jsoff_t lkp(struct js *js, jsval_t obj, const char *buf, size_t len) {
   return 0;  // Not found
 }
 
+// Seach for property in a single object
+static jsoff_t lkp(struct js *js, jsval_t obj, const char *buf, size_t len) {
+  return lkpkey(js, obj, buf, len, atomfind(js, buf, len, NULL));
+}
+
 // Lookup variable in the scope chain
 static jsval_t lookup(struct js *js, const char *buf, size_t len) {
   if (js->flags & F_NOEXEC) return 0;
+  jsoff_t atom = atomfind(js, buf, len, NULL);
   for (jsval_t scope = js->scope;;) {
-    jsoff_t off = lkp(js, scope, buf, len);
+    jsoff_t off = lkpkey(js, scope, buf, len, atom);
     if (off != 0) return mkval(T_PROP, off);
     if (vdata(scope) == 0) break;
     scope =
       mkval(T_OBJ, loadoff(js, (jsoff_t)(vdata(scope) + sizeof(jsoff_t))));
   }
+  if (js->resolve != NULL) {  // Not in any scope, ask the embedder
+    jsval_t v = js->resolve(js, buf, len);
+    if (vtype(v) != T_UNDEF) return v;
+  }
   return js_mkerr(js, "'%.*s' not found", (int)len, buf);
 }
 
 static jsval_t resolveprop(struct js *js, jsval_t v) {
+  if (vtype(v) == T_ELEM) {
+    jsoff_t arr = elemarr(v), i = elemidx(v);
+    return i < arrlen(js, arr) ? arrload(js, arr, i) : js_mkundef();
+  }
   if (vtype(v) != T_PROP) return v;
   return resolveprop(js,
                      loadval(js, (jsoff_t)(vdata(v) + sizeof(jsoff_t) * 2)));
 }
 
 static jsval_t assign(struct js *js, jsval_t lhs, jsval_t val) {
+  if (vtype(lhs) == T_ELEM) return arrset(js, elemarr(lhs), elemidx(lhs), val);
+  gcbarrier(js, val);
   saveval(js, (jsoff_t)((vdata(lhs) & ~3U) + sizeof(jsoff_t) * 2), val);
   return lhs;
 }
@@ -625,9 +2004,25 @@ static jsval_t do_assign_op(struct js *js, uint8_t op, jsval_t l, jsval_t r) {
   return assign(js, l, res);
 }
 
+// Concatenate without copying: make a rope that points to both sides.
+// The right side gets flattened, so a chain of appends, the common case,
+// is a list of pieces, which vstr() flattens in one go
+static jsval_t mkrope(struct js *js, jsval_t l, jsval_t r) {
+  jsoff_t n1 = vstrlen(js, l), n2, buf[3], off;
+  if (n1 == 0) return r;
+  if ((off = vstr(js, r, &n2)) == ~(jsoff_t)0) return js_mkerr(js, "oom");
+  buf[0] = (jsoff_t)vdata(l), buf[1] = off - (jsoff_t)sizeof(jsoff_t);
+  if (n2 == 0) return l;
+  buf[2] = n1 + n2;
+  if (js->gcphase) gcshade(js, buf[0]), gcshade(js, buf[1]);
+  return mkentity(js, (jsoff_t)(sizeof(buf) << 2) | S_ROPE | T_STR, buf, sizeof(buf));
+}
+
 static jsval_t do_string_op(struct js *js, uint8_t op, jsval_t l, jsval_t r) {
+  if (op == TOK_PLUS && vstrlen(js, l) + vstrlen(js, r) >= JS_ROPE_MIN) return mkrope(js, l, r);
   jsoff_t n1, off1 = vstr(js, l, &n1);
   jsoff_t n2, off2 = vstr(js, r, &n2);
+  if (off1 == ~(jsoff_t)0 || off2 == ~(jsoff_t)0) return js_mkerr(js, "oom");
   if (op == TOK_PLUS) {
     jsval_t res = js_mkstr(js, NULL, n1 + n2);
     // printf("STRPLUS %u %u %u %u [%.*s] [%.*s]\n", n1, off1, n2, off2, (int)
@@ -635,33 +2030,53 @@ static jsval_t do_string_op(struct js *js, uint8_t op, jsval_t l, jsval_t r) {
     //       &js->mem[off1], (int) n2, &js->mem[off2]);
     if (vtype(res) == T_STR) {
       jsoff_t n, off = vstr(js, res, &n);
-      memmove(&js->mem[off], &js->mem[off1], n1);
-      memmove(&js->mem[off + n1], &js->mem[off2], n2);
+      memmove(memp(js, off), memp(js, off1), n1);
+      memmove(memp(js, off + n1), memp(js, off2), n2);
     }
     return res;
   } else if (op == TOK_EQ) {
-    bool eq = n1 == n2 && memcmp(&js->mem[off1], &js->mem[off2], n1) == 0;
+    bool eq = n1 == n2 && memcmp(memp(js, off1), memp(js, off2), n1) == 0;
     return mkval(T_BOOL, eq ? 1 : 0);
   } else if (op == TOK_NE) {
-    bool eq = n1 == n2 && memcmp(&js->mem[off1], &js->mem[off2], n1) == 0;
+    bool eq = n1 == n2 && memcmp(memp(js, off1), memp(js, off2), n1) == 0;
     return mkval(T_BOOL, eq ? 0 : 1);
   } else {
     return js_mkerr(js, "bad str op");
   }
 }
 
-static jsval_t do_dot_op(struct js *js, jsval_t l, jsval_t r) {
-  const char *ptr = (char *)&js->code[coderefoff(r)];
-  if (vtype(r) != T_CODEREF) return js_mkerr(js, "ident expected");
+static jsval_t getprop(struct js *js, jsval_t l, const char *ptr, size_t len) {
   // Handle stringvalue.length
-  if (vtype(l) == T_STR && streq(ptr, codereflen(r), "length", 6)) {
-    return tov(offtolen(loadoff(js, (jsoff_t)vdata(l))));
+  if (vtype(l) == T_STR && streq(ptr, len, "length", 6)) {
+    return mksmi(vstrlen(js, l));
+  }
+  if (vtype(l) == T_ARR && streq(ptr, len, "length", 6)) {
+    return mksmi(arrlen(js, (jsoff_t)vdata(l)));
   }
   if (vtype(l) != T_OBJ) return js_mkerr(js, "lookup in non-obj");
-  jsoff_t off = lkp(js, l, ptr, codereflen(r));
+  jsoff_t off = lkp(js, l, ptr, len);
   return off == 0 ? js_mkundef() : mkval(T_PROP, off);
 }
 
+// Array indexing, arr[idx]: return a reference to the element
+static jsval_t do_index(struct js *js, jsval_t arr, jsval_t idx) {
+  if (js->flags & F_NOEXEC) return 0;
+  jsval_t a = resolveprop(js, arr), i = resolveprop(js, idx);
+  if (is_err(a)) return a;
+  if (is_err(i)) return i;
+  if (vtype(a) != T_ARR) return js_mkerr(js, "index of non-array");
+  if (vtype(i) != T_NUM || tod(i) < 0 || tod(i) >= 0xffffffU || tod(i) != (jsoff_t)tod(i)) {
+    return js_mkerr(js, "bad index");
+  }
+  if (vdata(a) >= (1U << 26)) return js_mkerr(js, "array too far");
+  return mkelem((jsoff_t)vdata(a), (jsoff_t)tod(i));
+}
+
+static jsval_t do_dot_op(struct js *js, jsval_t l, jsval_t r) {
+  if (vtype(r) != T_CODEREF) return js_mkerr(js, "ident expected");
+  return getprop(js, l, &js->code[coderefoff(r)], codereflen(r));
+}
+
 static jsval_t js_call_params(struct js *js) {
   jsoff_t pos = js->pos;
   uint8_t flags = js->flags;
@@ -685,34 +2100,42 @@ static void reverse(jsval_t *args, int nargs) {
   }
 }
 
-// Call native C function
-static jsval_t call_c(struct js *js,
-                      jsval_t (*fn)(struct js *, jsval_t *, int)) {
+// Call C or compiled function, parsing arguments from the current code.
+// 'name' is the name the function is called by, for the profiler
+static jsval_t call_c(struct js *js, jsval_t (*fn)(struct js *, jsval_t *, int),
+                      const uint8_t *e, const char *name, jsoff_t nlen) {
   int argc = 0;
   while (js->pos < js->clen) {
     if (next(js) == TOK_RPAREN) break;
     jsval_t arg = resolveprop(js, js_expr(js));
-    if (js->brk + sizeof(arg) > js->size) return js_mkerr(js, "call oom");
+    if (!fits(js, toplim(js) + (jsoff_t)sizeof(arg))) return js_mkerr(js, "call oom");
     js->size -= (jsoff_t)sizeof(arg);
-    memcpy(&js->mem[js->size], &arg, sizeof(arg));
+    memcpy(memp(js, js->size), &arg, sizeof(arg));
     argc++;
     // printf("  arg %d -> %s\n", argc, js_str(js, arg));
     if (next(js) == TOK_COMMA) js->consumed = 1;
   }
-  reverse((jsval_t *)&js->mem[js->size], argc);
-  jsval_t res = fn(js, (jsval_t *)&js->mem[js->size], argc);
+  reverse((jsval_t *)memp(js, js->size), argc);
+  jsval_t *args = (jsval_t *)memp(js, js->size);
+  bool pf = profpush(js, name, nlen, NULL, 0);
+  jsval_t res = e != NULL ? vm_invoke(js, e, args, argc) : fn(js, args, argc);
+  profpop(js, pf);
   setlwm(js);
   js->size += (jsoff_t)sizeof(jsval_t) * (jsoff_t)argc;  // Restore stack
   return res;
 }
 
 // Call JS function. 'fn' looks like this: "(a,b) { return a + b; }"
-static jsval_t call_js(struct js *js, const char *fn, jsoff_t fnlen) {
+// Arguments are parsed from the current code, or passed in 'args' by the VM.
+// 'name' is the name the function is called by, for the profiler
+static jsval_t call_js(struct js *js, const char *fn, jsoff_t fnlen,
+                       jsval_t *args, int nargs, const char *name, jsoff_t nlen) {
   jsoff_t fnpos = 1;
+  int argc = 0;
+  uint8_t lazy = js->lazy, made = 0;
   // printf("JSCALL [%.*s] -> %.*s\n", (int) js->clen, js->code, (int) fnlen,
   // fn);
   // printf("JSCALL, nogc %u [%.*s]\n", js->nogc, (int) fnlen, fn);
-  mkscope(js);  // Create function call scope
   // Loop over arguments list "(a, b)" and set scope variables
   while (fnpos < fnlen) {
     fnpos = skiptonext(fn, fnlen, fnpos);          // Skip to the identifier
@@ -723,13 +2146,22 @@ static jsval_t call_js(struct js *js, const char *fn, jsoff_t fnlen) {
     // Here we have argument name. Calculate arg value
     // printf("  [%.*s] -> %u [%.*s] -> ", (int) identlen, &fn[fnpos], js->pos,
     //       (int) js->clen, js->code);
-    js->pos = skiptonext(js->code, js->clen, js->pos);
-    js->consumed = 1;
-    jsval_t v = js->code[js->pos] == ')' ? js_mkundef() : js_expr(js);
-    // Set argument in the function scope
-    setprop(js, js->scope, js_mkstr(js, &fn[fnpos], identlen), v);
-    js->pos = skiptonext(js->code, js->clen, js->pos);
-    if (js->pos < js->clen && js->code[js->pos] == ',') js->pos++;
+    jsval_t v = js_mkundef();
+    if (args != NULL) {
+      if (argc < nargs) v = args[argc];
+      argc++;
+    } else {
+      js->pos = skiptonext(js->code, js->clen, js->pos);
+      js->consumed = 1;
+      v = js->code[js->pos] == ')' ? js_mkundef() : js_expr(js);
+    }
+    // Set argument in the function scope, create it for the first one
+    if (!made) mkscope(js), made = 1;
+    setprop(js, js->scope, mkkey(js, &fn[fnpos], identlen), v);
+    if (args == NULL) {
+      js->pos = skiptonext(js->code, js->clen, js->pos);
+      if (js->pos < js->clen && js->code[js->pos] == ',') js->pos++;
+    }
     fnpos = skiptonext(fn, fnlen, fnpos + identlen);  // Skip past identifier
     if (fnpos < fnlen && fn[fnpos] == ',') fnpos++;   // And skip comma
   }
@@ -739,9 +2171,13 @@ static jsval_t call_js(struct js *js, const char *fn, jsoff_t fnlen) {
   size_t n = fnlen - fnpos - 1U;                   // Function code with stripped braces
   // printf("flags: %d, body: %zu [%.*s]\n", js->flags, n, (int) n, &fn[fnpos]);
   js->flags = F_CALL;                                               // Mark we're in the function call
+  js->lazy = !made;                                                 // No params: scope on first let
+  bool pf = profpush(js, name, nlen, fn, fnlen);                    // After args are evaluated
   jsval_t res = js_eval(js, &fn[fnpos], n);                         // Call function, no GC
+  profpop(js, pf);
   if (!is_err(res) && !(js->flags & F_RETURN)) res = js_mkundef();  // No return
-  delscope(js);                                                     // Delete call scope
+  if (made || !js->lazy) delscope(js);                              // Delete call scope
+  js->lazy = lazy;
   // printf("  -> %d [%s], tok %d\n", js->flags, js_str(js, res), js->tok);
   return res;
 }
@@ -750,6 +2186,9 @@ static jsval_t do_call_op(struct js *js, jsval_t func, jsval_t args) {
   if (vtype(args) != T_CODEREF) return js_mkerr(js, "bad call");
   if (vtype(func) != T_FUNC && vtype(func) != T_CFUNC)
     return js_mkerr(js, "calling non-function");
+  const char *pname = js->pname;                // Name the function is called
+  jsoff_t pnlen = js->pnlen;                    // by, for the profiler
+  js->pname = NULL, js->pnlen = 0;
   const char *code = js->code;                  // Save current parser state
   jsoff_t clen = js->clen, pos = js->pos;       // code, position and code length
   js->code = &js->code[coderefoff(args)];       // Point parser to args
@@ -758,12 +2197,17 @@ static jsval_t do_call_op(struct js *js, jsval_t func, jsval_t args) {
   uint8_t tok = js->tok, flags = js->flags;     // Save flags
   jsoff_t nogc = js->nogc;
   jsval_t res = js_mkundef();
-  if (vtype(func) == T_FUNC) {
-    jsoff_t fnlen, fnoff = vstr(js, func, &fnlen);
-    js->nogc = (jsoff_t)(fnoff - sizeof(jsoff_t));
-    res = call_js(js, (const char *)(&js->mem[fnoff]), fnlen);
+  const uint8_t *e = NULL;
+  if (vtype(func) == T_FUNC && js->vm != NULL) e = vm_entry(js, func);
+  if (e != NULL) {
+    res = call_c(js, NULL, e, pname, pnlen);
+  } else if (vtype(func) == T_FUNC) {
+    jsoff_t fnlen;
+    const char *fn = fnsrc(js, func, &fnlen);
+    js->nogc = (jsoff_t) vdata(func);
+    res = call_js(js, fn, fnlen, NULL, 0, pname, pnlen);
   } else {
-    res = call_c(js, (jsval_t(*)(struct js *, jsval_t *, int))vdata(func));
+    res = call_c(js, (jsval_t(*)(struct js *, jsval_t *, int))vdata(func), NULL, pname, pnlen);
   }
   js->code = code, js->clen = clen, js->pos = pos;  // Restore parser
   js->flags = flags, js->tok = tok, js->nogc = nogc;
@@ -771,21 +2215,55 @@ static jsval_t do_call_op(struct js *js, jsval_t func, jsval_t args) {
   return res;
 }
 
+// Operators on small integers: same results as on doubles, without doubles.
+// The left operand of unary ops is undefined. Results that are not small
+// integers become doubles: out of range, -0, fractions. Return false for
+// what is left to the double path: other ops, division by zero
+static bool do_smi_op(uint8_t op, int32_t a, int32_t b, jsval_t *res) {
+  int64_t x = a, y = b;
+  switch (op) {  // clang-format off
+    case TOK_PLUS:    *res = mksmi(x + y); return true;
+    case TOK_MINUS:   *res = mksmi(x - y); return true;
+    case TOK_MUL:     *res = x * y == 0 && (x < 0 || y < 0) ? tov(-0.0) : mksmi(x * y); return true;
+    case TOK_DIV:     if (y == 0) return false;
+                      *res = x % y != 0 || (x == 0 && y < 0) ? tov((double) x / (double) y) : mksmi(x / y); return true;
+    case TOK_REM:     if (y == 0) return false;
+                      *res = mksmi(x % y); return true;
+    case TOK_XOR:     *res = mksmi(a ^ b); return true;
+    case TOK_AND:     *res = mksmi(a & b); return true;
+    case TOK_OR:      *res = mksmi(a | b); return true;
+    case TOK_SHL:     *res = tonum((double)((long) a << (long) b)); return true;
+    case TOK_SHR:     *res = tonum((double)((long) a >> (long) b)); return true;
+    case TOK_UMINUS:  *res = b == 0 ? tov(-0.0) : mksmi(-y); return true;
+    case TOK_UPLUS:   *res = mksmi(b); return true;
+    case TOK_TILDA:   *res = mksmi(~b); return true;
+    case TOK_NOT:     *res = mkval(T_BOOL, b == 0); return true;
+    case TOK_EQ:      *res = mkval(T_BOOL, a == b); return true;
+    case TOK_NE:      *res = mkval(T_BOOL, a != b); return true;
+    case TOK_LT:      *res = mkval(T_BOOL, a < b); return true;
+    case TOK_LE:      *res = mkval(T_BOOL, a <= b); return true;
+    case TOK_GT:      *res = mkval(T_BOOL, a > b); return true;
+    case TOK_GE:      *res = mkval(T_BOOL, a >= b); return true;
+    default:          return false;
+  }  // clang-format on
+}
+
 // clang-format off
 static jsval_t do_op(struct js *js, uint8_t op, jsval_t lhs, jsval_t rhs) {
   if (js->flags & F_NOEXEC) return 0;
   jsval_t l = resolveprop(js, lhs), r = resolveprop(js, rhs);
   // printf("OP %d %d %d\n", op, vtype(lhs), vtype(r));
+  if (is_smi(r) && (is_smi(l) || is_unary(op)) && do_smi_op(op, smi(l), smi(r), &l)) return l;
   setlwm(js);
   if (is_err(l)) return l;
   if (is_err(r)) return r;
-  if (is_assign(op) && vtype(lhs) != T_PROP) return js_mkerr(js, "bad lhs");
+  if (is_assign(op) && vtype(lhs) != T_PROP && vtype(lhs) != T_ELEM) return js_mkerr(js, "bad lhs");
   switch (op) {
     case TOK_TYPEOF:  return js_mkstr(js, typestr(vtype(r)), strlen(typestr(vtype(r))));
     case TOK_CALL:    return do_call_op(js, l, r);
     case TOK_ASSIGN:  return assign(js, lhs, r);
-    case TOK_POSTINC: { do_assign_op(js, TOK_PLUS_ASSIGN, lhs, tov(1)); return l; }
-    case TOK_POSTDEC: { do_assign_op(js, TOK_MINUS_ASSIGN, lhs, tov(1)); return l; }
+    case TOK_POSTINC: { do_assign_op(js, TOK_PLUS_ASSIGN, lhs, mksmi(1)); return l; }
+    case TOK_POSTDEC: { do_assign_op(js, TOK_MINUS_ASSIGN, lhs, mksmi(1)); return l; }
     case TOK_NOT:     if (vtype(r) == T_BOOL) return mkval(T_BOOL, !vdata(r)); break;
   }
   if (is_assign(op))    return do_assign_op(js, op, lhs, r);
@@ -800,15 +2278,15 @@ static jsval_t do_op(struct js *js, uint8_t op, jsval_t lhs, jsval_t rhs) {
     case TOK_MUL:     return tov(a * b);
     case TOK_PLUS:    return tov(a + b);
     case TOK_MINUS:   return tov(a - b);
-    case TOK_XOR:     return tov((double)((long) a ^ (long) b));
-    case TOK_AND:     return tov((double)((long) a & (long) b));
-    case TOK_OR:      return tov((double)((long) a | (long) b));
+    case TOK_XOR:     return tonum((double)((long) a ^ (long) b));
+    case TOK_AND:     return tonum((double)((long) a & (long) b));
+    case TOK_OR:      return tonum((double)((long) a | (long) b));
     case TOK_UMINUS:  return tov(-b);
     case TOK_UPLUS:   return r;
-    case TOK_TILDA:   return tov((double)(~(long) b));
+    case TOK_TILDA:   return tonum((double)(~(long) b));
     case TOK_NOT:     return mkval(T_BOOL, b == 0);
-    case TOK_SHL:     return tov((double)((long) a << (long) b));
-    case TOK_SHR:     return tov((double)((long) a >> (long) b));
+    case TOK_SHL:     return tonum((double)((long) a << (long) b));
+    case TOK_SHR:     return tonum((double)((long) a >> (long) b));
     case TOK_DOT:     return do_dot_op(js, l, r);
     case TOK_EQ:      return mkval(T_BOOL, (long) a == (long) b);
     case TOK_NE:      return mkval(T_BOOL, (long) a != (long) b);
@@ -820,35 +2298,44 @@ static jsval_t do_op(struct js *js, uint8_t op, jsval_t lhs, jsval_t rhs) {
   }
 }  // clang-format on
 
-static jsval_t js_str_literal(struct js *js) {
-  uint8_t *in = (uint8_t *)&js->code[js->toff];
-  uint8_t *out = &js->mem[js->brk + sizeof(jsoff_t)];
+// Decode quoted string literal 'in' of length 'len' into 'out', which can be
+// NULL to validate only. Return decoded length, or ~0 on bad escape sequence
+static size_t unescape(const uint8_t *in, size_t len, uint8_t *out) {
   size_t n1 = 0, n2 = 0;
-  // printf("STR %u %lu %lu\n", js->brk, js->tlen, js->clen);
-  if (js->brk + sizeof(jsoff_t) + js->tlen > js->size)
-    return js_mkerr(js, "oom");
-  while (n2++ + 2 < js->tlen) {
-    if (in[n2] == '\\') {
+  while (n2++ + 2 < len) {
+    uint8_t ch = in[n2];
+    if (ch == '\\') {
       if (in[n2 + 1] == in[0]) {
-        out[n1++] = in[0];
+        ch = in[0];
       } else if (in[n2 + 1] == 'n') {
-        out[n1++] = '\n';
+        ch = '\n';
       } else if (in[n2 + 1] == 't') {
-        out[n1++] = '\t';
+        ch = '\t';
       } else if (in[n2 + 1] == 'r') {
-        out[n1++] = '\r';
+        ch = '\r';
       } else if (in[n2 + 1] == 'x' && is_xdigit(in[n2 + 2]) && is_xdigit(in[n2 + 3])) {
-        out[n1++] = (uint8_t)((unhex(in[n2 + 2]) << 4U) | unhex(in[n2 + 3]));
+        ch = (uint8_t)((unhex(in[n2 + 2]) << 4U) | unhex(in[n2 + 3]));
         n2 += 2;
       } else {
-        return js_mkerr(js, "bad str literal");
+        return ~(size_t)0;
       }
       n2++;
-    } else {
-      out[n1++] = ((uint8_t *)js->code)[js->toff + n2];
     }
+    if (out != NULL) out[n1] = ch;
+    n1++;
   }
-  return js_mkstr(js, NULL, n1);
+  return n1;
+}
+
+static jsval_t js_str_literal(struct js *js) {
+  uint8_t *in = (uint8_t *)&js->code[js->toff];
+  uint8_t *out = memp(js, toplim(js) + sizeof(jsoff_t));
+  // printf("STR %u %lu %lu\n", js->brk, js->tlen, js->clen);
+  if (!fits(js, toplim(js) + (jsoff_t)sizeof(jsoff_t) + js->tlen))
+    return js_mkerr(js, "oom");
+  size_t n = unescape(in, js->tlen, out);
+  if (n == ~(size_t)0) return js_mkerr(js, "bad str literal");
+  return js_mkstr(js, out, n);
 }
 
 static jsval_t js_obj_literal(struct js *js) {
@@ -860,9 +2347,9 @@ static jsval_t js_obj_literal(struct js *js) {
   while (next(js) != TOK_RBRACE) {
     jsval_t key = 0;
     if (js->tok == TOK_IDENTIFIER) {
-      if (exe) key = js_mkstr(js, js->code + js->toff, js->tlen);
+      if (exe) key = mkkey(js, js->code + js->toff, js->tlen);
     } else if (js->tok == TOK_STRING) {
-      if (exe) key = js_str_literal(js);
+      if (exe) key = mkkeyval(js, js_str_literal(js));
     } else {
       return js_mkerr(js, "parse error");
     }
@@ -883,6 +2370,25 @@ static jsval_t js_obj_literal(struct js *js) {
   return obj;
 }
 
+static jsval_t js_arr_literal(struct js *js) {
+  uint8_t exe = !(js->flags & F_NOEXEC);
+  jsval_t arr = exe ? mkarr(js, JS_ARRAY, 0) : js_mkundef();
+  if (is_err(arr)) return arr;
+  js->consumed = 1;
+  for (jsoff_t n = 0; next(js) != TOK_RBRACKET; n++) {
+    jsval_t val = js_expr(js);
+    if (exe) {
+      if (is_err(val)) return val;
+      jsval_t res = arrset(js, (jsoff_t)vdata(arr), n, resolveprop(js, val));
+      if (is_err(res)) return res;
+    }
+    if (next(js) == TOK_RBRACKET) break;
+    EXPECT(TOK_COMMA, );
+  }
+  EXPECT(TOK_RBRACKET, );
+  return arr;
+}
+
 static jsval_t js_func_literal(struct js *js) {
   uint8_t flags = js->flags;  // Save current flags
   js->consumed = 1;
@@ -904,10 +2410,9 @@ static jsval_t js_func_literal(struct js *js) {
     return res;
   }
   js->flags = flags;  // Restore flags
-  jsval_t str = js_mkstr(js, &js->code[pos], js->pos - pos);
   js->consumed = 1;
   // printf("FUNC: %u [%.*s]\n", pos, js->pos - pos, &js->code[pos]);
-  return mkval(T_FUNC, (unsigned long)vdata(str));
+  return mkfunc(js, &js->code[pos], js->pos - pos);
 }
 
 #define RTL_BINOP(_f1, _f2, _cond) \
@@ -934,15 +2439,15 @@ static jsval_t js_func_literal(struct js *js) {
 
 static jsval_t js_literal(struct js *js) {
   next(js);
-  setlwm(js);
-  // printf("css : %u\n", js->css);
-  if (js->maxcss > 0 && js->css > js->maxcss) return js_mkerr(js, "C stack");
+  jsoff_t css = setlwm(js);
+  if (js->maxcss > 0 && css > js->maxcss) return js_mkerr(js, "C stack");
   js->consumed = 1;
   switch (js->tok) {  // clang-format off
     case TOK_ERR:         return js_mkerr(js, "parse error");
     case TOK_NUMBER:      return js->tval;
     case TOK_STRING:      return js_str_literal(js);
     case TOK_LBRACE:      return js_obj_literal(js);
+    case TOK_LBRACKET:    return js_arr_literal(js);
     case TOK_FUNC:        return js_func_literal(js);
     case TOK_NULL:        return js_mknull();
     case TOK_UNDEF:       return js_mkundef();
@@ -967,19 +2472,33 @@ static jsval_t js_group(struct js *js) {
 }
 
 static jsval_t js_call_dot(struct js *js) {
-  jsval_t res = js_group(js);
+  jsval_t res = js_group(js), key;
+  const char *name = NULL;  // Name of the value, for profiling calls
+  jsoff_t nlen = 0;
   if (is_err(res)) return res;
   if (vtype(res) == T_CODEREF) {
-    res = lookup(js, &js->code[coderefoff(res)], codereflen(res));
+    name = &js->code[coderefoff(res)], nlen = codereflen(res);
+    res = lookup(js, name, nlen);
   }
-  while (next(js) == TOK_LPAREN || next(js) == TOK_DOT) {
+  while (next(js) == TOK_LPAREN || next(js) == TOK_DOT || next(js) == TOK_LBRACKET) {
     if (js->tok == TOK_DOT) {
       js->consumed = 1;
-      res = do_op(js, TOK_DOT, res, js_group(js));
+      key = js_group(js);
+      if (vtype(key) == T_CODEREF) name = &js->code[coderefoff(key)], nlen = codereflen(key);
+      res = do_op(js, TOK_DOT, res, key);
+    } else if (js->tok == TOK_LBRACKET) {
+      js->consumed = 1;
+      jsval_t idx = js_expr(js);
+      if (is_err(idx)) return idx;
+      EXPECT(TOK_RBRACKET, );
+      res = do_index(js, res, idx);
+      name = NULL, nlen = 0;
     } else {
       jsval_t params = js_call_params(js);
       if (is_err(params)) return params;
+      js->pname = name, js->pnlen = nlen;
       res = do_op(js, TOK_CALL, res, params);
+      name = NULL, nlen = 0;
     }
   }
   return res;
@@ -1124,10 +2643,11 @@ static jsval_t js_let(struct js *js) {
       if (is_err(v)) return v;  // Propagate error if any
     }
     if (exe) {
+      if (js->lazy) mkscope(js), js->lazy = 0;  // First let of the block
       if (lkp(js, js->scope, name, nlen) > 0)
         return js_mkerr(js, "'%.*s' already declared", (int)nlen, name);
       jsval_t x =
-        setprop(js, js->scope, js_mkstr(js, name, nlen), resolveprop(js, v));
+        setprop(js, js->scope, mkkey(js, name, nlen), resolveprop(js, v));
       if (is_err(x)) return x;
     }
     if (next(js) == TOK_SEMICOLON || next(js) == TOK_EOF) break;  // Stop
@@ -1186,7 +2706,8 @@ static jsval_t js_for(struct js *js) {
   uint8_t flags = js->flags, exe = !(flags & F_NOEXEC);
   jsval_t v, res = js_mkundef();
   jsoff_t pos1 = 0, pos2 = 0, pos3 = 0, pos4 = 0;
-  if (exe) mkscope(js);  // Enter new scope
+  uint8_t lazy = js->lazy;
+  if (exe) js->lazy = 1;  // Enter new scope, when needed
   if (!expect(js, TOK_FOR, &res)) goto done;
   if (!expect(js, TOK_LPAREN, &res)) goto done;
 
@@ -1217,6 +2738,8 @@ static jsval_t js_for(struct js *js) {
   if (is_err2(&v, &res)) goto done;
   pos4 = js->pos;  // end of body
   while (!(flags & F_NOEXEC)) {
+    v = budgetcheck(js);                 // Empty loop bodies have no
+    if (is_err2(&v, &res)) goto done;    // statements to check it
     js->flags = flags, js->pos = pos1, js->consumed = 1;
     if (next(js) != TOK_SEMICOLON) {     // Is condition specified?
       v = resolveprop(js, js_expr(js));  // Yes. check condition
@@ -1235,8 +2758,8 @@ static jsval_t js_for(struct js *js) {
   }
   js->pos = pos4, js->tok = TOK_SEMICOLON, js->consumed = 0;
 done:
-  if (exe) delscope(js);  // Exit scope
-  js->flags = flags;      // Restore flags
+  if (exe && !js->lazy) delscope(js);  // Exit scope, if created
+  js->flags = flags, js->lazy = lazy;  // Restore flags
   return res;
 }
 
@@ -1276,7 +2799,8 @@ static jsval_t js_return(struct js *js) {
 static jsval_t js_stmt(struct js *js) {
   jsval_t res;
   // jsoff_t pos = js->pos - js->tlen;
-  if (js->brk > js->gct) js_gc(js);
+  gccheck(js);
+  if (is_err(res = budgetcheck(js))) return res;
   switch (next(js)) {  // clang-format off
     case TOK_CASE: case TOK_CATCH: case TOK_CLASS: case TOK_CONST:
     case TOK_DEFAULT: case TOK_DELETE: case TOK_DO: case TOK_FINALLY:
@@ -1295,103 +2819,1506 @@ static jsval_t js_stmt(struct js *js) {
     default:            res = resolveprop(js, js_expr(js)); break;
   }
   //printf("STMT [%.*s] -> %s, tok %d, flags %d\n", (int) (js->pos - pos), &js->code[pos], js_str(js, res), next(js), js->flags);
+  if (is_err(res)) return res;  // Nested call errors leave the parser mid-statement
   if (next(js) != TOK_SEMICOLON && next(js) != TOK_EOF && next(js) != TOK_RBRACE) return js_mkerr(js, "; expected");
   js->consumed = 1;
   // clang-format on
   return res;
 }
 
-struct js *js_create(void *buf, size_t len) {
-  struct js *js = NULL;
-  if (len < sizeof(*js) + esize(T_OBJ)) return js;
-  memset(buf, 0, len);                      // Important!
-  js = (struct js *)buf;                    // struct js lives at the beginning
-  js->mem = (uint8_t *)(js + 1);            // Then goes memory for JS data
-  js->size = (jsoff_t)(len - sizeof(*js));  // JS memory size
-  js->scope = mkobj(js, 0);                 // Create global scope
-  js->size = js->size / 8U * 8U;            // Align js->size by 8 byte
-  js->lwm = js->size;                       // Initial LWM: 100% free
-  js->gct = js->size / 2;
-  return js;
-}
+// Bytecode VM, enabled by js_setvm(). The compiler below walks the same
+// tokens as the parser above and accepts the same grammar; anything it
+// cannot handle makes it bail out, and such code stays with the tree-walker.
+// Compiled code has identifiers and literals inlined, jump targets resolved
+// and function parameters pre-parsed. It runs on a jsval_t value stack that
+// GC treats as roots. Function bodies are compiled on the first call and
+// cached by the offset of the function string. VM memory layout:
+//
+//    | value stack | cached functions ... |    free    | top-level code |
+//    |-------------|----------------------|------------|----------------|
+//  js.vm      js.vmcache             js.vmbrk      js.vmtop    end of VM mem
+//
+// Cached function: 4 byte key (function string offset, ~0 if it was GC-ed),
+// 4 byte entry size, 1 byte number of params or 255 if the function cannot
+// be compiled, params as 1 byte length followed by the name, then the code.
+// Top-level code of nested js_eval() calls is stacked at the end.
 
 // clang-format off
-void js_setgct(struct js *js, size_t gct) { js->gct = (jsoff_t) gct; }
-void js_setmaxcss(struct js *js, size_t max) { js->maxcss = (jsoff_t) max; }
-jsval_t js_mktrue(void) { return mkval(T_BOOL, 1); }
-jsval_t js_mkfalse(void) { return mkval(T_BOOL, 0); }
-jsval_t js_mkundef(void) { return mkval(T_UNDEF, 0); }
-jsval_t js_mknull(void) { return mkval(T_NULL, 0); }
-jsval_t js_mknum(double value) { return tov(value); }
-jsval_t js_mkobj(struct js *js) { return mkobj(js, 0); }
-jsval_t js_mkfun(jsval_t (*fn)(struct js *, jsval_t *, int)) { return mkval(T_CFUNC, (size_t) (void *) fn); }
-double js_getnum(jsval_t value) { return tod(value); }
-int js_getbool(jsval_t value) { return vdata(value) & 1 ? 1 : 0; }
+enum {
+  OP_HALT, OP_STMT, OP_NUM, OP_STR, OP_FUNC, OP_UNDEF, OP_NULL, OP_TRUE,
+  OP_FALSE, OP_GET, OP_DOT, OP_OBJ, OP_SETKEY, OP_LET, OP_BINOP, OP_UNOP,
+  OP_POSTOP, OP_CALL, OP_POP, OP_RES, OP_CLR, OP_JMP, OP_JZ, OP_JZK,
+  OP_JNZK, OP_ENTER, OP_LEAVE, OP_RET, OP_ERR, OP_KEY, OP_ARR, OP_INDEX,
+  OP_PFUNC
+};
+// clang-format on
 
-jsval_t js_glob(struct js *js) { (void) js; return mkval(T_OBJ, 0); }
+#define NOPATCH ((jsoff_t)~0U)  // End of the jump patch chain
+#define VM_NOCODE 255U          // Cached function that cannot be compiled
 
-void js_set(struct js *js, jsval_t obj, const char *key, jsval_t val) {
-  if (vtype(obj) == T_OBJ) setprop(js, obj, js_mkstr(js, key, strlen(key)), val);
+struct jscomp {
+  uint8_t *buf;   // Output buffer
+  jsoff_t len;    // Output buffer size
+  jsoff_t n;      // Bytes emitted
+  jsoff_t lcont;  // Innermost loop: continue target
+  jsoff_t lbrk;   // Innermost loop: chain of jumps to the loop exit
+  int depth;      // Scope depth at the current position
+  int ldepth;     // Scope depth of the innermost loop body, -1 if not in loop
+  int skip;       // If > 0, parse only: function bodies compile when called
+  bool let;       // Has a let outside of blocks: needs a scope of its own
+  bool err;       // Cannot compile
+  bool oom;       // Output buffer is too small
+};
+
+static void emit(struct jscomp *c, const void *p, size_t n) {
+  if (c->skip > 0 || c->err) return;
+  if (c->n + n > c->len) {
+    c->err = c->oom = true;
+    return;
+  }
+  memcpy(&c->buf[c->n], p, n);
+  c->n += (jsoff_t)n;
 }
 
-char *js_getstr(struct js *js, jsval_t value, size_t *len) {
-  if (vtype(value) != T_STR) return NULL;
-  jsoff_t n, off = vstr(js, value, &n);
-  if (len != NULL) *len = n;
-  return (char *) &js->mem[off];
+static void emit1(struct jscomp *c, uint8_t v) { emit(c, &v, 1); }
+
+static void emitop(struct jscomp *c, uint8_t op, uint8_t v) {
+  emit1(c, op);
+  emit1(c, v);
 }
 
-int js_type(jsval_t val) {
-  switch (vtype(val)) {  
-    case T_UNDEF:   return JS_UNDEF;
-    case T_NULL:    return JS_NULL;
-    case T_BOOL:    return vdata(val) == 0 ? JS_FALSE: JS_TRUE;
-    case T_STR:     return JS_STR;
-    case T_NUM:     return JS_NUM;
-    case T_ERR:     return JS_ERR;
-    default:        return JS_PRIV;
+static void emitname(struct jscomp *c, uint8_t op, const char *p, jsoff_t n) {
+  if (n > 255) c->err = true;
+  emitop(c, op, (uint8_t)n);
+  emit(c, p, n);
+}
+
+static void emitstr(struct jscomp *c, uint8_t op, const char *p, jsoff_t n) {
+  emit1(c, op);
+  emit(c, &n, sizeof(n));
+  emit(c, p, n);
+}
+
+// Emit jump. Return operand offset, for patching or chaining
+static jsoff_t emitjmp(struct jscomp *c, uint8_t op, jsoff_t target) {
+  jsoff_t at = c->n + 1;
+  emit1(c, op);
+  emit(c, &target, sizeof(target));
+  return at;
+}
+
+// Resolve a chain of jumps, linked through their operands, to the target
+static void patch(struct jscomp *c, jsoff_t at, jsoff_t target) {
+  if (c->skip > 0 || c->err) return;
+  while (at != NOPATCH) {
+    jsoff_t next;
+    memcpy(&next, &c->buf[at], sizeof(next));
+    memcpy(&c->buf[at], &target, sizeof(target));
+    at = next;
   }
 }
-void js_stats(struct js *js, size_t *total, size_t *lwm, size_t *css) {
-  if (total) *total = js->size;
-  if (lwm) *lwm = js->lwm;
-  if (css) *css = js->css;
+
+#define C_EXPECT(_tok) do { if (next(js) != _tok) { c->err = true; return; } js->consumed = 1; } while (0)
+
+static void c_expr(struct js *js, struct jscomp *c);
+static void c_stmt(struct js *js, struct jscomp *c);
+static void c_block(struct js *js, struct jscomp *c, bool create_scope);
+
+static void c_str_literal(struct js *js, struct jscomp *c, uint8_t op) {
+  const uint8_t *in = (uint8_t *)&js->code[js->toff];
+  jsoff_t n = js->tlen;  // Decoded string is never longer than the literal
+  if (c->err || unescape(in, js->tlen, NULL) == ~(size_t)0) {
+    c->err = true;
+  } else if (c->skip == 0) {
+    if (c->n + 1 + sizeof(n) + n > c->len) {
+      c->err = c->oom = true;
+      return;
+    }
+    n = (jsoff_t)unescape(in, js->tlen, &c->buf[c->n + 1 + sizeof(n)]);
+    c->buf[c->n] = op;
+    memcpy(&c->buf[c->n + 1], &n, sizeof(n));
+    c->n += (jsoff_t)(1 + sizeof(n)) + n;
+  }
 }
-// clang-format on
 
-bool js_chkargs(jsval_t *args, int nargs, const char *spec) {
-  int i = 0, ok = 1;
-  for (; ok && i < nargs && spec[i]; i++) {
-    uint8_t t = vtype(args[i]), c = (uint8_t)spec[i];
-    ok = (c == 'b' && t == T_BOOL) || (c == 'd' && t == T_NUM) || (c == 's' && t == T_STR) || (c == 'j');
+static void c_obj_literal(struct js *js, struct jscomp *c) {
+  emit1(c, OP_OBJ);
+  js->consumed = 1;
+  while (next(js) != TOK_RBRACE) {
+    if (js->tok == TOK_IDENTIFIER) {
+      emitstr(c, OP_KEY, js->code + js->toff, js->tlen);
+    } else if (js->tok == TOK_STRING) {
+      c_str_literal(js, c, OP_KEY);
+    } else {
+      c->err = true;
+    }
+    if (c->err) return;
+    js->consumed = 1;
+    C_EXPECT(TOK_COLON);
+    c_expr(js, c);
+    emit1(c, OP_SETKEY);
+    if (c->err) return;
+    if (next(js) == TOK_RBRACE) break;
+    C_EXPECT(TOK_COMMA);
   }
-  if (spec[i] != '\0' || i != nargs) ok = 0;
-  return ok;
+  C_EXPECT(TOK_RBRACE);
 }
 
-jsval_t js_eval(struct js *js, const char *buf, size_t len) {
-  // printf("EVAL: [%.*s]\n", (int) len, buf);
-  jsval_t res = js_mkundef();
-  if (len == (size_t)~0U) len = strlen(buf);
+static void c_arr_literal(struct js *js, struct jscomp *c) {
+  int n = 0;
   js->consumed = 1;
-  js->tok = TOK_ERR;
-  js->code = buf;
+  while (next(js) != TOK_RBRACKET) {
+    c_expr(js, c);
+    if (c->err) return;
+    n++;
+    if (next(js) == TOK_RBRACKET) break;
+    C_EXPECT(TOK_COMMA);
+  }
+  C_EXPECT(TOK_RBRACKET);
+  if (n > 255) c->err = true;
+  emitop(c, OP_ARR, (uint8_t)n);  // Elements are on the stack
+}
+
+static void c_func_literal(struct js *js, struct jscomp *c) {
+  int depth = c->depth, ldepth = c->ldepth;
+  js->consumed = 1;
+  C_EXPECT(TOK_LPAREN);
+  jsoff_t pos = js->pos - 1;
+  for (bool comma = false; next(js) != TOK_EOF; comma = true) {
+    if (!comma && next(js) == TOK_RPAREN) break;
+    C_EXPECT(TOK_IDENTIFIER);
+    if (next(js) == TOK_RPAREN) break;
+    C_EXPECT(TOK_COMMA);
+  }
+  C_EXPECT(TOK_RPAREN);
+  C_EXPECT(TOK_LBRACE);
+  js->consumed = 0;
+  c->skip++, c->depth = 0, c->ldepth = -1;  // Check the body syntax only
+  c_block(js, c, false);
+  c->skip--, c->depth = depth, c->ldepth = ldepth;
+  if (c->err) return;
+  const char *fn = &js->code[pos];
+  jsoff_t ref[2] = {(jsoff_t) (fn - js->pin), js->pos - pos};
+  if (js->pin != NULL && fn >= js->pin && fn + ref[1] <= js->pin + js->pinlen) {
+    emit1(c, OP_PFUNC);  // Pinned source: emit a reference, not the text
+    emit(c, ref, sizeof(ref));
+  } else {
+    emitstr(c, OP_FUNC, fn, ref[1]);
+  }
+  js->consumed = 1;
+}
+
+static void c_literal(struct js *js, struct jscomp *c) {
+  next(js);
+  js->consumed = 1;
+  switch (js->tok) {  // clang-format off
+    case TOK_NUMBER:      emit1(c, OP_NUM); emit(c, &js->tval, sizeof(js->tval)); break;
+    case TOK_STRING:      c_str_literal(js, c, OP_STR); break;
+    case TOK_LBRACE:      c_obj_literal(js, c); break;
+    case TOK_LBRACKET:    c_arr_literal(js, c); break;
+    case TOK_FUNC:        c_func_literal(js, c); break;
+    case TOK_NULL:        emit1(c, OP_NULL); break;
+    case TOK_UNDEF:       emit1(c, OP_UNDEF); break;
+    case TOK_TRUE:        emit1(c, OP_TRUE); break;
+    case TOK_FALSE:       emit1(c, OP_FALSE); break;
+    case TOK_IDENTIFIER:  emitname(c, OP_GET, js->code + js->toff, js->tlen); break;
+    default:              c->err = true; break;
+  }  // clang-format on
+}
+
+static void c_group(struct js *js, struct jscomp *c) {
+  if (next(js) == TOK_LPAREN) {
+    js->consumed = 1;
+    c_expr(js, c);
+    if (c->err) return;
+    C_EXPECT(TOK_RPAREN);
+  } else {
+    c_literal(js, c);
+  }
+}
+
+// Compile call arguments and the call. 'name' is the offset of the OP_GET or
+// OP_DOT that named the callee, NOPATCH if none, so the profiler can name it
+static void c_call_params(struct js *js, struct jscomp *c, jsoff_t name) {
+  uint16_t dist = 0;  // Back from OP_CALL to the name op, 0 if unknown
+  int argc = 0;
+  js->consumed = 1;
+  for (bool comma = false; next(js) != TOK_EOF; comma = true) {
+    if (!comma && next(js) == TOK_RPAREN) break;
+    c_expr(js, c);
+    if (c->err) return;
+    argc++;
+    if (next(js) == TOK_RPAREN) break;
+    C_EXPECT(TOK_COMMA);
+  }
+  C_EXPECT(TOK_RPAREN);
+  if (argc > 255) c->err = true;
+  if (name != NOPATCH && c->n - name <= 0xffffU) dist = (uint16_t)(c->n - name);
+  emitop(c, OP_CALL, (uint8_t)argc);
+  emit(c, &dist, sizeof(dist));
+}
+
+static void c_call_dot(struct js *js, struct jscomp *c) {
+  jsoff_t name = c->n;  // Op that names the value, if it is OP_GET or OP_DOT
+  c_group(js, c);
+  if (c->err || c->n < name + 2 || c->buf[name] != OP_GET ||
+      name + 2U + c->buf[name + 1] != c->n) {
+    name = NOPATCH;
+  }
+  while (!c->err && (next(js) == TOK_LPAREN || next(js) == TOK_DOT || next(js) == TOK_LBRACKET)) {
+    if (js->tok == TOK_DOT) {
+      js->consumed = 1;
+      C_EXPECT(TOK_IDENTIFIER);
+      name = c->n;
+      emitname(c, OP_DOT, js->code + js->toff, js->tlen);
+    } else if (js->tok == TOK_LBRACKET) {
+      js->consumed = 1;
+      c_expr(js, c);
+      if (c->err) return;
+      C_EXPECT(TOK_RBRACKET);
+      emit1(c, OP_INDEX);
+      name = NOPATCH;
+    } else {
+      c_call_params(js, c, c->skip > 0 ? NOPATCH : name);
+      name = NOPATCH;
+    }
+  }
+}
+
+static void c_postfix(struct js *js, struct jscomp *c) {
+  c_call_dot(js, c);
+  if (c->err) return;
+  if (next(js) == TOK_POSTINC || js->tok == TOK_POSTDEC) {
+    js->consumed = 1;
+    emitop(c, OP_POSTOP, js->tok);
+  }
+}
+
+static void c_unary(struct js *js, struct jscomp *c) {
+  if (next(js) == TOK_NOT || js->tok == TOK_TILDA || js->tok == TOK_TYPEOF || js->tok == TOK_MINUS || js->tok == TOK_PLUS) {
+    uint8_t t = js->tok;
+    if (t == TOK_MINUS) t = TOK_UMINUS;
+    if (t == TOK_PLUS) t = TOK_UPLUS;
+    js->consumed = 1;
+    c_unary(js, c);
+    emitop(c, OP_UNOP, t);
+  } else {
+    c_postfix(js, c);
+  }
+}
+
+#define C_BINOP(_f, _cond) \
+  _f(js, c); \
+  while (!c->err && (_cond)) { \
+    uint8_t op = js->tok; \
+    js->consumed = 1; \
+    _f(js, c); \
+    emitop(c, OP_BINOP, op); \
+  }
+
+static void c_mul_div_rem(struct js *js, struct jscomp *c) {
+  C_BINOP(c_unary, (next(js) == TOK_MUL || js->tok == TOK_DIV || js->tok == TOK_REM));
+}
+
+static void c_plus_minus(struct js *js, struct jscomp *c) {
+  C_BINOP(c_mul_div_rem, (next(js) == TOK_PLUS || js->tok == TOK_MINUS));
+}
+
+static void c_shifts(struct js *js, struct jscomp *c) {
+  C_BINOP(c_plus_minus, (next(js) == TOK_SHR || next(js) == TOK_SHL || next(js) == TOK_ZSHR));
+}
+
+static void c_comparison(struct js *js, struct jscomp *c) {
+  C_BINOP(c_shifts, (next(js) == TOK_LT || next(js) == TOK_LE || next(js) == TOK_GT || next(js) == TOK_GE));
+}
+
+static void c_equality(struct js *js, struct jscomp *c) {
+  C_BINOP(c_comparison, (next(js) == TOK_EQ || next(js) == TOK_NE));
+}
+
+static void c_bitwise_and(struct js *js, struct jscomp *c) {
+  C_BINOP(c_equality, (next(js) == TOK_AND));
+}
+
+static void c_bitwise_xor(struct js *js, struct jscomp *c) {
+  C_BINOP(c_bitwise_and, (next(js) == TOK_XOR));
+}
+
+static void c_bitwise_or(struct js *js, struct jscomp *c) {
+  C_BINOP(c_bitwise_xor, (next(js) == TOK_OR));
+}
+
+static void c_logical_and(struct js *js, struct jscomp *c) {
+  c_bitwise_or(js, c);
+  while (!c->err && next(js) == TOK_LAND) {
+    js->consumed = 1;
+    jsoff_t j = emitjmp(c, OP_JZK, NOPATCH);  // false && ... shortcut
+    c_logical_and(js, c);
+    patch(c, j, c->n);
+  }
+}
+
+static void c_logical_or(struct js *js, struct jscomp *c) {
+  c_logical_and(js, c);
+  while (!c->err && next(js) == TOK_LOR) {
+    js->consumed = 1;
+    jsoff_t j = emitjmp(c, OP_JNZK, NOPATCH);  // true || ... shortcut
+    c_logical_or(js, c);
+    patch(c, j, c->n);
+  }
+}
+
+static void c_ternary(struct js *js, struct jscomp *c) {
+  c_logical_or(js, c);
+  if (!c->err && next(js) == TOK_Q) {
+    js->consumed = 1;
+    jsoff_t jz = emitjmp(c, OP_JZ, NOPATCH);
+    c_ternary(js, c);
+    if (c->err) return;
+    C_EXPECT(TOK_COLON);
+    jsoff_t jend = emitjmp(c, OP_JMP, NOPATCH);
+    patch(c, jz, c->n);
+    c_ternary(js, c);
+    patch(c, jend, c->n);
+  }
+}
+
+static void c_assignment(struct js *js, struct jscomp *c) {
+  c_ternary(js, c);
+  while (!c->err && is_assign(next(js))) {
+    uint8_t op = js->tok;
+    js->consumed = 1;
+    c_assignment(js, c);
+    emitop(c, OP_BINOP, op);
+  }
+}
+
+static void c_expr(struct js *js, struct jscomp *c) {
+  c_assignment(js, c);
+}
+
+static void c_let(struct js *js, struct jscomp *c) {
+  js->consumed = 1;
+  if (c->depth == 0 && c->skip == 0) c->let = true;
+  for (;;) {
+    C_EXPECT(TOK_IDENTIFIER);
+    jsoff_t noff = js->toff, nlen = js->tlen;
+    if (next(js) == TOK_ASSIGN) {
+      js->consumed = 1;
+      c_expr(js, c);
+      if (c->err) return;
+    } else {
+      emit1(c, OP_UNDEF);
+    }
+    emitname(c, OP_LET, &js->code[noff], nlen);
+    if (next(js) == TOK_SEMICOLON || next(js) == TOK_EOF) break;  // Stop
+    C_EXPECT(TOK_COMMA);
+  }
+  emit1(c, OP_CLR);
+}
+
+// Whether the block that starts at the current token declares anything with
+// let at its own level. Nested blocks and loop headers don't count: they get
+// their own scopes. Leaves the parser state as it is
+static bool c_haslet(struct js *js) {
+  uint8_t tok = js->tok, consumed = js->consumed;
+  jsoff_t pos = js->pos, tki = js->tki, toff = js->toff, tlen = js->tlen;
+  jsval_t tval = js->tval;
+  bool let = false;
+  for (int depth = 0; !let && depth >= 0; js->consumed = 1) {
+    uint8_t t = next(js);
+    if (t == TOK_EOF || t == TOK_ERR) break;
+    if (t == TOK_LBRACE || t == TOK_LPAREN) depth++;
+    if (t == TOK_RBRACE || t == TOK_RPAREN) depth--;
+    let = t == TOK_LET && depth == 0;
+  }
+  js->tok = tok, js->consumed = consumed, js->pos = pos, js->tki = tki;
+  js->toff = toff, js->tlen = tlen, js->tval = tval;
+  return let;
+}
+
+static void c_block(struct js *js, struct jscomp *c, bool create_scope) {
+  js->consumed = 1;
+  if (c->skip == 0) create_scope = create_scope && c_haslet(js);
+  if (create_scope) emit1(c, OP_ENTER), c->depth++;
+  emit1(c, OP_CLR);
+  while (!c->err && next(js) != TOK_EOF && next(js) != TOK_RBRACE) {
+    uint8_t t = js->tok;
+    c_stmt(js, c);
+    if (t != TOK_LBRACE && t != TOK_IF && t != TOK_WHILE && js->tok != TOK_SEMICOLON) c->err = true;
+  }
+  if (create_scope) emit1(c, OP_LEAVE), c->depth--;
+}
+
+static void c_block_or_stmt(struct js *js, struct jscomp *c) {
+  if (next(js) == TOK_LBRACE) {
+    c_block(js, c, true);
+  } else {
+    c_stmt(js, c);
+    js->consumed = 0;
+  }
+}
+
+static void c_if(struct js *js, struct jscomp *c) {
+  js->consumed = 1;
+  C_EXPECT(TOK_LPAREN);
+  c_expr(js, c);
+  if (c->err) return;
+  C_EXPECT(TOK_RPAREN);
+  jsoff_t jz = emitjmp(c, OP_JZ, NOPATCH);
+  c_block_or_stmt(js, c);
+  if (c->err) return;
+  jsoff_t jend = emitjmp(c, OP_JMP, NOPATCH);
+  patch(c, jz, c->n);
+  emit1(c, OP_CLR);
+  if (lookahead(js) == TOK_ELSE) {
+    js->consumed = 1;
+    next(js);
+    js->consumed = 1;
+    c_block_or_stmt(js, c);
+  }
+  patch(c, jend, c->n);
+}
+
+// Loop layout: init, cond: jz exit, jmp body, final: jmp cond, body: jmp final
+static void c_for(struct js *js, struct jscomp *c) {
+  jsoff_t lcont = c->lcont, lbrk = c->lbrk, cond, jbody;
+  int ldepth = c->ldepth;
+  bool scope;
+  C_EXPECT(TOK_FOR);
+  C_EXPECT(TOK_LPAREN);
+  scope = next(js) == TOK_LET;  // Only a let in the header needs a loop scope
+  if (scope) emit1(c, OP_ENTER), c->depth++;
+  if (next(js) == TOK_SEMICOLON) {  // initialisation
+  } else if (next(js) == TOK_LET) {
+    c_let(js, c);
+  } else {
+    c_expr(js, c);
+    emit1(c, OP_POP);
+  }
+  if (c->err) return;
+  C_EXPECT(TOK_SEMICOLON);
+  cond = c->n, c->lbrk = NOPATCH;
+  if (next(js) != TOK_SEMICOLON) {
+    c_expr(js, c);
+    c->lbrk = emitjmp(c, OP_JZ, NOPATCH);
+    if (c->err) return;
+  }
+  C_EXPECT(TOK_SEMICOLON);
+  jbody = emitjmp(c, OP_JMP, NOPATCH);
+  c->lcont = c->n;
+  emit1(c, OP_STMT);  // Once per iteration, even if the body is empty
+  if (next(js) != TOK_RPAREN) {
+    c_expr(js, c);
+    emit1(c, OP_POP);
+    if (c->err) return;
+  }
+  emitjmp(c, OP_JMP, cond);
+  C_EXPECT(TOK_RPAREN);
+  patch(c, jbody, c->n);
+  c->ldepth = c->depth;
+  c_block_or_stmt(js, c);
+  emitjmp(c, OP_JMP, c->lcont);
+  patch(c, c->lbrk, c->n);
+  c->lcont = lcont, c->lbrk = lbrk, c->ldepth = ldepth;
+  if (scope) emit1(c, OP_LEAVE), c->depth--;
+  emit1(c, OP_CLR);
+  js->tok = TOK_SEMICOLON, js->consumed = 0;
+}
+
+// Compile break or continue: leave scopes opened in the loop body and jump
+static void c_jump(struct js *js, struct jscomp *c, bool brk) {
+  js->consumed = 1;
+  emit1(c, OP_CLR);
+  if (c->ldepth < 0) {
+    emitname(c, OP_ERR, "not in loop", 11);
+    return;
+  }
+  for (int i = c->ldepth; i < c->depth; i++) emit1(c, OP_LEAVE);
+  if (brk) {
+    c->lbrk = emitjmp(c, OP_JMP, c->lbrk);
+  } else {
+    emitjmp(c, OP_JMP, c->lcont);
+  }
+}
+
+static void c_return(struct js *js, struct jscomp *c) {
+  js->consumed = 1;
+  if (next(js) == TOK_SEMICOLON) {
+    emit1(c, OP_UNDEF);
+  } else {
+    c_expr(js, c);
+  }
+  emit1(c, OP_RET);
+}
+
+static void c_stmt(struct js *js, struct jscomp *c) {
+  emit1(c, OP_STMT);
+  switch (next(js)) {  // clang-format off
+    case TOK_CASE: case TOK_CATCH: case TOK_CLASS: case TOK_CONST:
+    case TOK_DEFAULT: case TOK_DELETE: case TOK_DO: case TOK_FINALLY:
+    case TOK_IN: case TOK_INSTANCEOF: case TOK_NEW: case TOK_SWITCH:
+    case TOK_THIS: case TOK_THROW: case TOK_TRY: case TOK_VAR: case TOK_VOID:
+    case TOK_WITH: case TOK_WHILE: case TOK_YIELD:
+      c->err = true;
+      break;
+    case TOK_CONTINUE:  c_jump(js, c, false); break;
+    case TOK_BREAK:     c_jump(js, c, true); break;
+    case TOK_LET:       c_let(js, c); break;
+    case TOK_IF:        c_if(js, c); break;
+    case TOK_LBRACE:    c_block(js, c, true); break;
+    case TOK_FOR:       c_for(js, c); break;
+    case TOK_RETURN:    c_return(js, c); break;
+    default:            c_expr(js, c); emit1(c, OP_RES); break;
+  }
+  if (c->err) return;
+  if (next(js) != TOK_SEMICOLON && next(js) != TOK_EOF && next(js) != TOK_RBRACE) c->err = true;
+  js->consumed = 1;
+  // clang-format on
+}
+
+static void c_code(struct js *js, struct jscomp *c) {
+  while (!c->err && next(js) != TOK_EOF) c_stmt(js, c);
+  emit1(c, OP_HALT);
+}
+
+// Run compiled code from offset 'ip'. Jump targets are offsets in 'code'.
+// Return the value of the last statement, like the tree-walker does, or the
+// value of the executed return statement
+static jsval_t vm_exec(struct js *js, const uint8_t *code, jsoff_t ip) {
+  jsval_t *s = js->vstk, res = js_mkundef(), l, r;
+  jsoff_t base = js->vsp, n;
+  int depth = 0;  // Number of scopes entered by this frame
+  if (js->vsp >= js->vmax) return js_mkerr(js, "VM stack");
+  s[js->vsp++] = js_mkundef();  // Completion value slot
+  js->vmdepth++;
+#define VPOP() s[--js->vsp]
+#define VCHECK(_v) do { jsval_t v_ = (_v); if (is_err(v_)) { res = v_; goto done; } } while (0)
+#define VPUSH(_v) do { jsval_t w_ = (_v); VCHECK(w_); if (js->vsp >= js->vmax) { res = js_mkerr(js, "VM stack"); goto done; } s[js->vsp++] = w_; } while (0)
+#define VNAME(_p, _n) const char *_p = (const char *)&code[ip + 1]; uint8_t _n = code[ip]; ip += 1U + _n
+  for (;;) {
+    switch (code[ip++]) {
+      case OP_HALT:
+        res = s[base];
+        goto done;
+      case OP_STMT:
+        gccheck(js);
+        VCHECK(budgetcheck(js));
+        break;
+      case OP_NUM:
+        memcpy(&l, &code[ip], sizeof(l));
+        ip += (jsoff_t)sizeof(l);
+        VPUSH(l);
+        break;
+      case OP_STR:
+      case OP_FUNC:
+        memcpy(&n, &code[ip], sizeof(n));
+        l = code[ip - 1] == OP_FUNC ? mkfunc(js, (const char *) &code[ip + sizeof(n)], n)
+                                    : js_mkstr(js, &code[ip + sizeof(n)], n);
+        ip += (jsoff_t)sizeof(n) + n;
+        VPUSH(l);
+        break;
+      case OP_PFUNC: {
+        jsoff_t ref[2];  // Offset and length in the pinned buffer
+        memcpy(ref, &code[ip], sizeof(ref));
+        ip += (jsoff_t)sizeof(ref);
+        VPUSH(mkfunc(js, js->pin + ref[0], ref[1]));
+        break;
+      }
+      case OP_KEY:
+        memcpy(&n, &code[ip], sizeof(n));
+        l = mkkey(js, (const char *)&code[ip + sizeof(n)], n);
+        ip += (jsoff_t)sizeof(n) + n;
+        VPUSH(l);
+        break;
+      case OP_UNDEF: VPUSH(js_mkundef()); break;
+      case OP_NULL: VPUSH(js_mknull()); break;
+      case OP_TRUE: VPUSH(js_mktrue()); break;
+      case OP_FALSE: VPUSH(js_mkfalse()); break;
+      case OP_OBJ: VPUSH(mkobj(js, 0)); break;
+      case OP_ARR: {
+        jsoff_t argc = code[ip++];
+        l = mkarr(js, JS_ARRAY, argc);
+        for (jsoff_t i = 0; i < argc && !is_err(l); i++) {
+          r = arrset(js, (jsoff_t)vdata(l), i, resolveprop(js, s[js->vsp - argc + i]));
+          if (is_err(r)) l = r;
+        }
+        js->vsp -= argc;
+        VPUSH(l);
+        break;
+      }
+      case OP_INDEX:
+        r = VPOP(), l = VPOP();
+        VPUSH(do_index(js, l, r));
+        break;
+      case OP_GET: {
+        VNAME(p, len);
+        VPUSH(lookup(js, p, len));
+        break;
+      }
+      case OP_DOT: {
+        VNAME(p, len);
+        l = resolveprop(js, VPOP());
+        VPUSH(getprop(js, l, p, len));
+        break;
+      }
+      case OP_SETKEY:
+        r = VPOP(), l = VPOP();
+        VCHECK(setprop(js, s[js->vsp - 1], l, resolveprop(js, r)));
+        break;
+      case OP_LET: {
+        VNAME(p, len);
+        if (lkp(js, js->scope, p, len) > 0) {
+          res = js_mkerr(js, "'%.*s' already declared", (int)len, p);
+          goto done;
+        }
+        l = mkkey(js, p, len);
+        VCHECK(l);
+        VCHECK(setprop(js, js->scope, l, resolveprop(js, s[js->vsp - 1])));
+        js->vsp--;
+        break;
+      }
+      case OP_BINOP:
+        r = VPOP(), l = VPOP();
+        VPUSH(do_op(js, code[ip++], l, r));
+        break;
+      case OP_UNOP:
+        r = VPOP();
+        VPUSH(do_op(js, code[ip++], js_mkundef(), r));
+        break;
+      case OP_POSTOP:
+        l = VPOP();
+        VPUSH(do_op(js, code[ip++], l, 0));
+        break;
+      case OP_CALL: {
+        int argc = code[ip++];
+        uint16_t dist;  // Back to the OP_GET or OP_DOT that named the callee
+        memcpy(&dist, &code[ip], sizeof(dist));
+        const char *pname = dist ? (const char *)&code[ip - dist] : NULL;
+        uint8_t pnlen = dist ? code[ip - dist - 1U] : 0;
+        ip += (jsoff_t)sizeof(dist);
+        jsval_t *args = &s[js->vsp - (jsoff_t)argc];
+        for (int i = 0; i < argc; i++) args[i] = resolveprop(js, args[i]);
+        l = resolveprop(js, args[-1]);
+        if (vtype(l) == T_CFUNC) {
+          bool pf = profpush(js, pname, pnlen, NULL, 0);
+          r = ((jsval_t(*)(struct js *, jsval_t *, int))vdata(l))(js, args, argc);
+          profpop(js, pf);
+          setlwm(js);
+        } else if (vtype(l) == T_FUNC) {
+          const uint8_t *e = vm_entry(js, l);
+          if (e != NULL) {
+            bool pf = profpush(js, pname, pnlen, NULL, 0);
+            r = vm_invoke(js, e, args, argc);
+            profpop(js, pf);
+          } else {  // Cannot compile, let the tree-walker run it
+            const char *code_ = js->code;
+            jsoff_t clen = js->clen, pos = js->pos, nogc = js->nogc;
+            uint8_t tok = js->tok, flags = js->flags, consumed = js->consumed;
+            jsoff_t fnlen;
+            const char *fn = fnsrc(js, l, &fnlen);
+            js->nogc = (jsoff_t) vdata(l);
+            r = call_js(js, fn, fnlen, args, argc, pname, pnlen);
+            js->code = code_, js->clen = clen, js->pos = pos, js->tok = tok;
+            js->flags = flags, js->consumed = consumed, js->nogc = nogc;
+          }
+        } else {
+          r = js_mkerr(js, "calling non-function");
+        }
+        js->vsp -= (jsoff_t)argc + 1;
+        VPUSH(r);
+        break;
+      }
+      case OP_POP: js->vsp--; break;
+      case OP_RES: s[base] = resolveprop(js, VPOP()); break;
+      case OP_CLR: s[base] = js_mkundef(); break;
+      case OP_JMP: memcpy(&ip, &code[ip], sizeof(ip)); break;
+      case OP_JZ:
+        l = resolveprop(js, VPOP());
+        if (js_truthy(js, l)) ip += (jsoff_t)sizeof(ip); else memcpy(&ip, &code[ip], sizeof(ip));
+        break;
+      case OP_JZK:
+      case OP_JNZK:  // Jump keeping the value if it is falsy/truthy, else pop
+        l = s[js->vsp - 1] = resolveprop(js, s[js->vsp - 1]);
+        if (js_truthy(js, l) == (code[ip - 1] == OP_JNZK)) {
+          memcpy(&ip, &code[ip], sizeof(ip));
+        } else {
+          ip += (jsoff_t)sizeof(ip), js->vsp--;
+        }
+        break;
+      case OP_ENTER: mkscope(js), depth++; break;
+      case OP_LEAVE: delscope(js), depth--; break;
+      case OP_RET:
+        if (!(js->flags & F_CALL)) {
+          res = js_mkerr(js, "not in func");
+        } else {
+          res = resolveprop(js, VPOP());
+          js->flags |= F_RETURN;
+        }
+        goto done;
+      case OP_ERR: {
+        VNAME(p, len);
+        res = js_mkerr(js, "%.*s", (int)len, p);
+        goto done;
+      }
+      default:
+        res = js_mkerr(js, "bad opcode");  // LCOV_EXCL_LINE
+        goto done;                         // LCOV_EXCL_LINE
+    }
+  }
+#undef VPOP
+#undef VCHECK
+#undef VPUSH
+#undef VNAME
+done:
+  while (depth-- > 0) delscope(js);
+  js->vsp = base;
+  js->vmdepth--;
+  return res;
+}
+
+// Compile JS function into the function cache. Return cache entry, or NULL
+// if there is no room for it
+static const uint8_t *vm_compile(struct js *js, jsval_t func) {
+  jsoff_t key = (jsoff_t)vdata(func), size = 0, fnlen, body;
+  const char *fn = fnsrc(js, func, &fnlen);
+  struct jscomp c = {&js->vm[js->vmbrk], js->vmtop - js->vmbrk, 0, NOPATCH,
+                     NOPATCH, 0, -1, 0, false, false, false};
+  const char *code = js->code;  // Save parser state
+  jsoff_t clen = js->clen, pos = js->pos, toff = js->toff, tlen = js->tlen;
+  jsval_t tval = js->tval;
+  uint8_t tok = js->tok, consumed = js->consumed, np = 0;
+  struct jstok *tk = js->tk;
+  const char *tkcode = js->tkcode;
+  jsoff_t tklen = js->tklen, ntk = js->ntk, tki = js->tki;
+  uint8_t tkown = js->tkown;
+  jsoff_t tksize = tkbuild(js, fn, fnlen);
+  if (tksize == 0) js->tk = NULL;
+  js->tkown = tksize != 0;
+  js->code = fn, js->clen = fnlen, js->pos = 0, js->consumed = 1;
+  emit(&c, &key, sizeof(key));
+  emit(&c, &size, sizeof(size));
+  emit1(&c, np);
+  emit1(&c, 0);  // Whether the call needs a scope, set below
+  if (next(js) == TOK_LPAREN) {  // Pre-parse params
+    js->consumed = 1;
+    while (next(js) == TOK_IDENTIFIER && np < VM_NOCODE - 1) {
+      if (js->tlen > 255) c.err = true;
+      emit1(&c, (uint8_t)js->tlen);
+      emit(&c, js->code + js->toff, js->tlen);
+      np++, js->consumed = 1;
+      if (next(js) == TOK_COMMA) js->consumed = 1;
+    }
+  }
+  if (next(js) != TOK_RPAREN) c.err = true;
+  js->consumed = 1;
+  if (next(js) != TOK_LBRACE) c.err = true;
+  if (!c.err) {  // Function code with stripped braces, as call_js() runs it
+    body = js->pos;
+    js->code = fn + body, js->clen = fnlen - body - 1, js->pos = 0;
+    js->consumed = 1;
+    c_code(js, &c);
+  }
+  // Restore parser state, and drop the token cache unless tkdrop() did already
+  if (js->tk != NULL) js->size += tksize, js->tkbytes -= tksize;
+  js->tk = tk, js->tkcode = tkcode, js->tklen = tklen, js->ntk = ntk;
+  js->tkown = tkown, js->tki = tki, js->code = code, js->clen = clen, js->pos = pos;
+  js->toff = toff, js->tlen = tlen, js->tval = tval, js->tok = tok;
+  js->consumed = consumed;
+  if (c.oom) {
+    js->vmfull = 1;
+    return NULL;
+  }
+  if (c.err) {  // Remember that the function cannot be compiled
+    if (js->vmtop - js->vmbrk < 12) return NULL;
+    c.n = 10, c.err = false, np = VM_NOCODE;
+  }
+  size = align32(c.n);
+  memcpy(&c.buf[sizeof(key)], &size, sizeof(size));
+  c.buf[sizeof(key) + sizeof(size)] = np;
+  c.buf[sizeof(key) + sizeof(size) + 1] = np > 0 || c.let;
+  js->vmbrk += size;
+  return c.buf;
+}
+
+// Find compiled function in the cache, or compile it. Return NULL if the
+// function cannot be run by the VM
+static const uint8_t *vm_entry(struct js *js, jsval_t func) {
+  jsoff_t key = (jsoff_t)vdata(func), k, n;
+  for (jsoff_t off = js->vmcache; off < js->vmbrk; off += n) {
+    memcpy(&k, &js->vm[off], sizeof(k));
+    memcpy(&n, &js->vm[off + sizeof(k)], sizeof(n));
+    if (k != key) continue;
+    return js->vm[off + sizeof(k) + sizeof(n)] == VM_NOCODE ? NULL : &js->vm[off];
+  }
+  return vm_compile(js, func);
+}
+
+// Call compiled function: bind params in a new scope, like call_js() does.
+// Functions without params and top-level lets run in the caller's scope
+static jsval_t vm_invoke(struct js *js, const uint8_t *e, jsval_t *args, int nargs) {
+  jsoff_t off = (jsoff_t)(sizeof(jsoff_t) * 2), np = e[off++];
+  uint8_t flags = js->flags, lazy = js->lazy, scope = e[off++];
+  jsval_t res = js_mkundef();
+  jsoff_t css = setlwm(js);
+  if (js->maxcss > 0 && css > js->maxcss) return js_mkerr(js, "C stack");
+  if (scope) mkscope(js);  // Create function call scope
+  js->lazy = 0;
+  for (jsoff_t i = 0; i < np; i++, off += 1U + e[off]) {
+    jsval_t k = mkkey(js, (char *)&e[off + 1], e[off]);
+    if (!is_err(k)) {
+      k = setprop(js, js->scope, k, (int)i < nargs ? args[i] : js_mkundef());
+    }
+    if (is_err(k)) {
+      res = k;
+      goto done;
+    }
+  }
+  js->flags = F_CALL;  // Mark we're in the function call
+  res = vm_exec(js, e, off);
+  if (!is_err(res) && !(js->flags & F_RETURN)) res = js_mkundef();  // No return
+done:
+  if (scope) delscope(js);  // Delete call scope
+  js->flags = flags, js->lazy = lazy;
+  return res;
+}
+
+// Compile the code snippet set up by js_eval() and run it. Return false if
+// the snippet cannot be compiled, leaving it to the tree-walker
+static bool vm_eval(struct js *js, jsval_t *res) {
+  if (js->vmfull && js->vmdepth == 0) {  // No compiled code is running now,
+    js->vmbrk = js->vmcache;             // so it is safe to flush the cache
+    js->vmfull = 0;
+  }
+  struct jscomp c = {&js->vm[js->vmbrk], js->vmtop - js->vmbrk, 0, NOPATCH,
+                     NOPATCH, 0, -1, 0, false, false, false};
+  c_code(js, &c);
+  if (c.err) {
+    if (c.oom) js->vmfull = 1;
+    js->pos = 0, js->consumed = 1, js->tok = TOK_ERR, js->tki = 0;  // Rewind
+    return false;
+  }
+  jsoff_t n = align32(c.n);
+  uint8_t lazy = js->lazy;
+  if (lazy && c.let) mkscope(js), lazy = 0;  // For the pending block or call
+  js->vmtop -= n;  // Move code to the top, leave the room for the cache
+  memmove(&js->vm[js->vmtop], c.buf, c.n);
+  js->lazy = 0;
+  *res = vm_exec(js, &js->vm[js->vmtop], 0);
+  js->vmtop += n, js->lazy = lazy;
+  return true;
+}
+
+struct js *js_create(void *buf, size_t len) {
+  struct js *js = NULL;
+  if (len < sizeof(*js) + esize(T_OBJ) + 128) return js;
+  memset(buf, 0, len);                      // Important!
+  js = (struct js *)buf;                    // struct js lives at the beginning
+  js->mem = (uint8_t *)(js + 1);            // Then goes memory for JS data
+  js->split = ~(jsoff_t)0;                  // All of it in one tier
+  js->size = (jsoff_t)(len - sizeof(*js));  // JS memory size
+  js->size = js->size / 8U * 8U;            // Align js->size by 8 byte
+  // Atom table: 1 slot per 256 bytes of JS memory, index memory: 1/32
+  for (js->natoms = 16; js->natoms * 256 <= js->size;) js->natoms *= 2;
+  js->size -= js->natoms * (jsoff_t)sizeof(jsoff_t);
+  js->atoms = (jsoff_t *)memp(js, js->size);
+  js->idxsize = js->size / 32U / 8U * 8U;
+  js->size -= js->idxsize;
+  js->idx = memp(js, js->size);
+  js->scope = mkobj(js, 0);                 // Create global scope
+  js->lwm = js->size;                       // Initial LWM: 100% free
+  for (int i = 0; i < JS_ROOTS; i++) js->roots[i] = ROOT_FREE;
+  js->gct = js->size / 2;
+  return js;
+}
+
+// Extend JS memory with a slow tier: offsets from js->split on live there.
+// The atom table and the index memory are sized for both tiers, and stay at
+// the end of the fast one
+void js_setslowmem(struct js *js, void *buf, size_t len) {
+  jsoff_t lo = js->size + js->natoms * (jsoff_t)sizeof(jsoff_t) + js->idxsize, natoms, idxsize;
+  if (js->slow != NULL || buf == NULL || js->nkeys > 0 || js->gcmap != NULL ||
+      js->brk != esize(T_OBJ) || len / 8U * 8U > (jsoff_t)~0U / 2 - lo) {
+    return;  // Not right after js_create()
+  }
+  len = len / 8U * 8U;
+  for (natoms = 16; natoms * 256 <= lo + len;) natoms *= 2;
+  idxsize = (jsoff_t)(lo + len - natoms * sizeof(jsoff_t)) / 32U / 8U * 8U;
+  if (lo < natoms * (jsoff_t)sizeof(jsoff_t) + idxsize + js->brk + 128) return;
+  js->split = lo - natoms * (jsoff_t)sizeof(jsoff_t) - idxsize;
+  js->natoms = natoms, js->idxsize = idxsize;
+  js->atoms = (jsoff_t *)&js->mem[js->split];
+  js->idx = &js->mem[js->split + natoms * sizeof(jsoff_t)];
+  memset(js->atoms, 0, lo - js->split);
+  js->slow = (uint8_t *)buf;
+  js->size = js->split + (jsoff_t)len;
+  js->lwm = js->size - js->brk;
+  js->gct = js->size / 2;
+}
+
+// clang-format off
+void js_setgct(struct js *js, size_t gct) { js->gct = (jsoff_t) gct, js->gctmax = 0; }
+void js_pin(struct js *js, const void *buf, size_t len) { js->pin = (const char *) buf, js->pinlen = (jsoff_t) len; }
+void js_setgcadapt(struct js *js, size_t min, size_t max) {
+  js->gct = js->gctmin = (jsoff_t) min, js->gctmax = (jsoff_t) (max > min ? max : 0);
+}
+void js_setmaxcss(struct js *js, size_t max) { js->maxcss = (jsoff_t) max; }
+void js_setgcslice(struct js *js, size_t us) {
+  jsoff_t map = (js->size / 128 + 1) * 4, n = (map + JS_GC_STACK * 4 + 7) / 8 * 8;
+  if (us > 0 && js->gcmap == NULL) {  // Carve bitmap and mark stack from the
+    if (toplim(js) + n >= js->size) return;  // end of JS memory
+    js->size -= n;
+    js->gcmap = (uint32_t *) memp(js, js->size);
+    js->gcstk = (jsoff_t *) memp(js, js->size + map);
+    setlwm(js);
+  }
+  js->gcslice = (uint32_t) us, js->gcphase = 0;
+}
+void js_setresolver(struct js *js, jsval_t (*fn)(struct js *, const char *, size_t)) { js->resolve = fn; }
+void js_setbudget(struct js *js, size_t us, bool (*fn)(struct js *)) {
+  js->budget = us > 0xffffffffU ? 0xffffffffU : (uint32_t) us, js->overrun = fn;
+}
+void js_setvm(struct js *js, void *buf, size_t len) {
+  size_t stk = JS_VM_STACK * sizeof(jsval_t);
+  js->vm = NULL, js->vstk = NULL, js->vsp = js->vmax = js->vmdepth = 0;
+  js->vmcache = js->vmbrk = js->vmtop = 0, js->vmfull = 0;
+  if (buf == NULL || len < stk * 2 || len > (jsoff_t) ~0U) return;
+  js->vm = (uint8_t *) buf, js->vstk = (jsval_t *) buf, js->vmax = JS_VM_STACK;
+  js->vmcache = js->vmbrk = (jsoff_t) stk, js->vmtop = (jsoff_t) len & ~3U;
+}
+jsval_t js_mktrue(void) { return mkval(T_BOOL, 1); }
+jsval_t js_mkfalse(void) { return mkval(T_BOOL, 0); }
+jsval_t js_mkundef(void) { return mkval(T_UNDEF, 0); }
+jsval_t js_mknull(void) { return mkval(T_NULL, 0); }
+jsval_t js_mknum(double value) { return tonum(value); }
+jsval_t js_mkobj(struct js *js) { return mkobj(js, 0); }
+jsval_t js_mkfun(jsval_t (*fn)(struct js *, jsval_t *, int)) { return mkval(T_CFUNC, (size_t) (void *) fn); }
+double js_getnum(jsval_t value) { return tod(value); }
+int js_getint(jsval_t value) { return is_smi(value) ? smi(value) : (int) tod(value); }
+int js_getbool(jsval_t value) { return vdata(value) & 1 ? 1 : 0; }
+double js_parsenum(const char *buf, size_t len, size_t *n) { return parsenum(buf, len, n); }
+
+size_t js_fmtnum(double value, char *buf, size_t len) {
+  char tmp[26];
+  return cpy(buf, len, tmp, fmtnum(value, tmp));
+}
+
+jsval_t js_glob(struct js *js) { (void) js; return mkval(T_OBJ, 0); }
+
+void js_set(struct js *js, jsval_t obj, const char *key, jsval_t val) {
+  if (vtype(obj) == T_OBJ) setprop(js, obj, mkkey(js, key, strlen(key)), val);
+}
+
+jsval_t js_get(struct js *js, jsval_t obj, const char *key) {
+  jsoff_t off = vtype(obj) == T_OBJ ? lkp(js, obj, key, strlen(key)) : 0;
+  return off == 0 ? js_mkundef() : resolveprop(js, mkval(T_PROP, off));
+}
+
+int js_root(struct js *js, jsval_t val) {
+  for (int i = 0; i < JS_ROOTS; i++) {
+    if (js->roots[i] != ROOT_FREE) continue;
+    js->roots[i] = resolveprop(js, val);
+    return i;
+  }
+  return -1;
+}
+
+jsval_t js_rootval(struct js *js, int h) {
+  if (h < 0 || h >= JS_ROOTS || js->roots[h] == ROOT_FREE) return js_mkundef();
+  return js->roots[h];
+}
+
+void js_unroot(struct js *js, int h) {
+  if (h >= 0 && h < JS_ROOTS) js->roots[h] = ROOT_FREE;
+}
+
+jsval_t js_mkarr(struct js *js, int kind, size_t len) {
+  if (kind < JS_ARRAY || kind > JS_FLOAT32 || len > 0xffffffU) return js_mkerr(js, "bad array");
+  return mkarr(js, (uint8_t) kind, (jsoff_t) len);
+}
+
+jsval_t js_arrget(struct js *js, jsval_t arr, size_t idx) {
+  if (vtype(arr) != T_ARR || idx >= arrlen(js, (jsoff_t) vdata(arr))) return js_mkundef();
+  return arrload(js, (jsoff_t) vdata(arr), (jsoff_t) idx);
+}
+
+jsval_t js_arrset(struct js *js, jsval_t arr, size_t idx, jsval_t val) {
+  if (vtype(arr) != T_ARR) return js_mkerr(js, "not an array");
+  if (idx >= 0xffffffU) return js_mkerr(js, "bad index");
+  return arrset(js, (jsoff_t) vdata(arr), (jsoff_t) idx, val);
+}
+
+void *js_getarr(struct js *js, jsval_t arr, int *kind, size_t *len) {
+  if (vtype(arr) != T_ARR) return NULL;
+  if (kind != NULL) *kind = arrkind(js, (jsoff_t) vdata(arr));
+  if (len != NULL) *len = arrlen(js, (jsoff_t) vdata(arr));
+  return memp(js, arrdata(js, (jsoff_t) vdata(arr)));
+}
+
+char *js_getstr(struct js *js, jsval_t value, size_t *len) {
+  if (vtype(value) != T_STR) return NULL;
+  jsoff_t n, off = vstr(js, value, &n);
+  if (len != NULL) *len = n;
+  return off == ~(jsoff_t)0 ? NULL : (char *) memp(js, off);
+}
+
+int js_type(jsval_t val) {
+  switch (vtype(val)) {  
+    case T_UNDEF:   return JS_UNDEF;
+    case T_NULL:    return JS_NULL;
+    case T_BOOL:    return vdata(val) == 0 ? JS_FALSE: JS_TRUE;
+    case T_STR:     return JS_STR;
+    case T_NUM:     return JS_NUM;
+    case T_ERR:     return JS_ERR;
+    case T_ARR:     return JS_ARR;
+    default:        return JS_PRIV;
+  }
+}
+void js_stats(struct js *js, size_t *total, size_t *lwm, size_t *css, size_t *gcruns, size_t *gclast, size_t *gcmax, size_t *gctime, size_t *frag) {
+  if (total) *total = js->size;
+  if (lwm) *lwm = js->lwm;
+  if (css) *css = js->css;
+  if (gcruns) *gcruns = js->gcruns;
+  if (gclast) *gclast = js->gclast;
+  if (gcmax) *gcmax = js->gcmax;
+  if (gctime) *gctime = js->gctime > (size_t) ~0U ? (size_t) ~0U : (size_t) js->gctime;
+  if (frag) *frag = js->free + js->holes;
+}
+void js_heapstats(struct js *js, size_t *objs, size_t *props, size_t *strs, size_t *funcs, size_t *arrs, size_t *gct) {
+  if (objs) *objs = js->heap[0];
+  if (props) *props = js->heap[1];
+  if (strs) *strs = js->heap[2];
+  if (funcs) *funcs = js->heap[3];
+  if (arrs) *arrs = js->heap[4];
+  if (gct) *gct = js->gct;
+}
+// clang-format on
+
+bool js_chkargs(jsval_t *args, int nargs, const char *spec) {
+  int i = 0, ok = 1;
+  for (; ok && i < nargs && spec[i]; i++) {
+    uint8_t t = vtype(args[i]), c = (uint8_t)spec[i];
+    ok = (c == 'b' && t == T_BOOL) || (c == 'd' && t == T_NUM) || (c == 's' && t == T_STR) || (c == 'j');
+  }
+  if (spec[i] != '\0' || i != nargs) ok = 0;
+  return ok;
+}
+
+jsval_t js_eval(struct js *js, const char *buf, size_t len) {
+  // printf("EVAL: [%.*s]\n", (int) len, buf);
+  jsval_t res = js_mkundef();
+  struct jstok *tk = js->tk;  // Save outer token cache
+  const char *tkcode = js->tkcode;
+  jsoff_t tklen = js->tklen, ntk = js->ntk, tki = js->tki, tksize = 0;
+  uint8_t tkown = js->tkown;
+  if (len == (size_t)~0U) len = strlen(buf);
+  if (tk == NULL || buf < tkcode || buf + len > tkcode + tklen) {
+    tksize = tkbuild(js, buf, (jsoff_t) len);  // Not covered by outer cache
+    if (tksize == 0) js->tk = NULL;
+  }
+  js->tkown = tksize != 0;
+  js->consumed = 1;
+  js->tok = TOK_ERR;
+  js->code = buf;
   js->clen = (jsoff_t)len;
   js->pos = 0;
-  js->cstk = &res;
-  while (next(js) != TOK_EOF && !is_err(res)) {
-    res = js_stmt(js);
+  if (js->nrun == 0) js->cstk = &res;  // Stack use counts from the outermost
+  budgetenter(js);
+  bool pf = js->nrun == 1 && profpush(js, "(script)", 8, js->vm ? NULL : buf, (jsoff_t) len);
+  if (js->vm == NULL || !vm_eval(js, &res)) {
+    while (next(js) != TOK_EOF && !is_err(res)) {
+      res = js_stmt(js);
+    }
   }
+  profpop(js, pf);
+  js->nrun--;
+  // Drop our token cache, unless tkdrop() did already, restore the outer one
+  if (js->tk != NULL) js->size += tksize, js->tkbytes -= tksize;
+  js->tk = tk, js->tkcode = tkcode, js->tklen = tklen, js->ntk = ntk;
+  js->tkown = tkown, js->tki = tki;
   return res;
 }
 
+// Whether a space must separate two tokens, given the last char of the first
+// one and the first char of the second, so that they still lex as two tokens
+static bool jscsep(char a, char b) {
+  static const char *ops = "+-*/%&|=<>!^~?:.";
+  if ((is_ident_continue(a) || a == '.') && (is_ident_continue(b) || b == '.')) return true;
+  return a != '\0' && b != '\0' && strchr(ops, a) != NULL && strchr(ops, b) != NULL;
+}
+
+// Compiled script, see js_compile(): this header, then the minified code,
+// 0-terminated. It holds no tokens: lexing minified code is as fast as
+// loading them, and they made the file larger than the source
+struct jschdr {
+  uint32_t magic;  // JSC_MAGIC
+  uint32_t sum;    // FNV-1a of everything that follows the header
+  uint32_t src;    // js_srchash() of the source it was compiled from
+  uint32_t key;    // Embedder's key, see js_setjsckey()
+  jsoff_t clen;    // Minified code length
+};
+#define JSC_MAGIC 0x3443534aU  // "JSC4"
+
+// Minify code into out, if not NULL: drop whitespace and comments. Return
+// minified length, or ~0 on lex error
+static jsoff_t jscmin(struct js *js, const char *code, jsoff_t len, char *out) {
+  jsoff_t n = 0, end = 0;
+  js->code = code, js->clen = len, js->pos = 0, js->tk = NULL;
+  for (;; end = js->pos) {
+    uint8_t tok = lex(js);
+    if (tok == TOK_ERR) return ~(jsoff_t) 0;
+    if (tok == TOK_EOF) break;
+    if (n > 0 && js->toff > end && jscsep(code[end - 1], code[js->toff])) {
+      if (out != NULL) out[n] = ' ';
+      n++;
+    }
+    if (out != NULL) memcpy(out + n, code + js->toff, js->tlen);
+    n += js->tlen;
+  }
+  return n;
+}
+
+size_t js_compile(const char *code, size_t len, void *buf, size_t buflen) {
+  struct jschdr h = {JSC_MAGIC, 0, 0, 0, 0};
+  struct js a, b;  // Lexer state only, for the source and the minified code
+  uint8_t *p = (uint8_t *) buf;
+  if (len == (size_t)~0U) len = strlen(code);
+  if (len >= (size_t) (jsoff_t) ~0U / 4) return 0;
+  memset(&a, 0, sizeof(a));
+  memset(&b, 0, sizeof(b));
+  if ((h.clen = jscmin(&a, code, (jsoff_t) len, NULL)) == ~(jsoff_t) 0) return 0;
+  size_t size = sizeof(h) + (size_t) h.clen + 1;
+  if (p == NULL || buflen < size) return size;
+  jscmin(&a, code, (jsoff_t) len, (char *) p + sizeof(h));
+  p[sizeof(h) + h.clen] = '\0';
+  // Lex the source and the minified code in lockstep: tokens must match
+  a.pos = 0, b.code = (const char *) p + sizeof(h), b.clen = h.clen;
+  for (;;) {
+    uint8_t tok = lex(&a);
+    if (lex(&b) != tok || b.tlen != a.tlen ||
+        memcmp(b.code + b.toff, a.code + a.toff, a.tlen) != 0) {
+      return 0;
+    }
+    if (tok == TOK_EOF) break;
+  }
+  h.sum = strhash(p + sizeof(h), size - sizeof(h));
+  h.src = js_srchash(code, len, 0);
+  memcpy(p, &h, sizeof(h));
+  return size;
+}
+
+uint32_t js_srchash(const void *buf, size_t len, uint32_t h) {
+  if (h == 0) h = 2166136261U;  // FNV-1a, like strhash()
+  for (size_t i = 0; i < len; i++) h = (h ^ ((const uint8_t *) buf)[i]) * 16777619U;
+  return h;
+}
+
+// Whether a buffer is a whole compiled script, and an intact one if sum is
+// set. Without it, the code is still lexed as it runs
+static bool jscok(const void *buf, size_t len, bool sum) {
+  struct jschdr h;
+  const char *code = (const char *) buf + sizeof(h);
+  if (buf == NULL || len < sizeof(h)) return false;
+  memcpy(&h, buf, sizeof(h));
+  return h.magic == JSC_MAGIC && h.clen < len && sizeof(h) + (size_t) h.clen + 1 == len &&
+         code[h.clen] == '\0' && (!sum || strhash(code, len - sizeof(h)) == h.sum);
+}
+
+bool js_checkjsc(const void *buf, size_t len, uint32_t *src, uint32_t *key) {
+  struct jschdr h;
+  if (!jscok(buf, len, true)) return false;
+  memcpy(&h, buf, sizeof(h));
+  if (src != NULL) *src = h.src;
+  if (key != NULL) *key = h.key;
+  return true;
+}
+
+void js_setjsckey(void *buf, size_t len, uint32_t key) {
+  struct jschdr h;
+  if (!jscok(buf, len, false)) return;
+  memcpy(&h, buf, sizeof(h));
+  h.key = key;
+  memcpy(buf, &h, sizeof(h));
+}
+
+jsval_t js_evaljsc(struct js *js, const void *buf, size_t len) {
+  struct jschdr h;
+  if (!jscok(buf, len, false)) return js_mkerr(js, "bad jsc");
+  memcpy(&h, buf, sizeof(h));
+  return js_eval(js, (const char *) buf + sizeof(h), h.clen);
+}
+
+// Snapshot: JS memory up to brk, saved as is, followed by a relocation
+// table of native function values: (offset, ID) pairs. Function pointers
+// differ between builds, so the embedder maps them to stable IDs
+struct jssnap {
+  uint32_t magic;  // SNAP_MAGIC
+  uint32_t key;    // Embedder's key, e.g. a hash of the code that was run
+  jsoff_t size;    // JS memory size: snapshots load only into the same size
+  jsoff_t split;   // and the same tiers
+  jsoff_t brk;     // Bytes of JS memory that follow
+  jsoff_t nrel;    // Relocation table entries that follow
+};
+#define SNAP_MAGIC 0x32534c45U  // "ELS2"
+
+// Find the next native function value, in a property or Array element,
+// starting from element *i of entity *ent. Return its offset, or 0 if there
+// are no more
+static jsoff_t snapnext(struct js *js, jsoff_t *ent, jsoff_t *i) {
+  for (jsoff_t v; *ent < js->brk; *ent += esize(v), *i = 0) {
+    v = loadoff(js, *ent);
+    jsoff_t e = (jsoff_t)(*ent + sizeof(jsoff_t) * 2), n = 1;
+    if ((v & 3) == M_ARR && arrkind(js, *ent) == JS_ARRAY) {
+      e = arrdata(js, *ent), n = arrlen(js, *ent);
+    } else if ((v & 3) != T_PROP) {
+      continue;
+    }
+    for (; *i < n; (*i)++) {
+      jsoff_t off = e + *i * (jsoff_t)sizeof(jsval_t);
+      if (vtype(loadval(js, off)) == T_CFUNC) return (*i)++, off;
+    }
+  }
+  return 0;
+}
+
+bool js_snapshot(struct js *js, uint32_t key, uint32_t (*fnid)(void *),
+                 size_t (*io)(void *, void *, size_t), void *ctx) {
+  struct jssnap h = {SNAP_MAGIC, key, js->size, js->split, 0, 0};
+  jsoff_t ent = 0, i = 0, off, rel[2], lo;
+  js_gc(js);  // Smaller snapshot, and no incremental GC cycle in progress
+  lo = js->brk < js->split ? js->brk : js->split;  // Bytes in js->mem
+  while ((off = snapnext(js, &ent, &i)) != 0) {
+    if (fnid((void *)(size_t)vdata(loadval(js, off))) == ~(uint32_t)0) return false;
+    h.nrel++;
+  }
+  h.brk = js->brk;
+  if (io(ctx, &h, sizeof(h)) != sizeof(h) || io(ctx, js->mem, lo) != lo ||
+      (js->brk > lo && io(ctx, js->slow, js->brk - lo) != js->brk - lo)) {
+    return false;
+  }
+  for (ent = i = 0; (off = snapnext(js, &ent, &i)) != 0;) {
+    rel[0] = off, rel[1] = fnid((void *)(size_t)vdata(loadval(js, off)));
+    if (io(ctx, rel, sizeof(rel)) != sizeof(rel)) return false;
+  }
+  return true;
+}
+
+bool js_restore(struct js *js, uint32_t key, void *(*idfn)(uint32_t),
+                size_t (*io)(void *, void *, size_t), void *ctx) {
+  struct jssnap h;
+  jsoff_t rel[2];
+  if (io(ctx, &h, sizeof(h)) != sizeof(h) || h.magic != SNAP_MAGIC ||
+      h.key != key || h.size != js->size || h.split != js->split || h.brk > js->size ||
+      h.brk < esize(T_OBJ)) {
+    return false;  // Nothing in JS memory has changed yet
+  }
+  jsoff_t lo = h.brk < js->split ? h.brk : js->split;  // Bytes in js->mem
+  js->gcphase = 0, js->nidx = js->idxbrk = 0, js->vmbrk = js->vmcache;
+  memset(js->freel, 0, sizeof(js->freel)), js->free = js->holes = 0;
+  bool ok = io(ctx, js->mem, lo) == lo &&  // Straight into JS memory
+            (h.brk == lo || io(ctx, js->slow, h.brk - lo) == h.brk - lo);
+  js->brk = ok ? h.brk : 0;
+  for (jsoff_t n = 0; ok && n < h.nrel; n++) {
+    void *fn = NULL;
+    ok = io(ctx, rel, sizeof(rel)) == sizeof(rel) && rel[0] + sizeof(jsval_t) <= js->brk &&
+         vtype(loadval(js, rel[0])) == T_CFUNC && (fn = idfn(rel[1])) != NULL;
+    if (ok) saveval(js, rel[0], mkval(T_CFUNC, (size_t)fn));
+  }
+  if (!ok) js->brk = 0;  // Start over with empty memory
+  js->scope = ok ? mkval(T_OBJ, 0) : mkobj(js, 0);
+  for (int i = 0; i < JS_ROOTS; i++) js->roots[i] = ROOT_FREE;
+  atomsrebuild(js);
+  js->lwm = js->size - js->brk;
+  return ok;
+}
+
+// Call function value from C, like OP_CALL does. May run from a native
+// function in the middle of js_eval(), so save and restore the parser state
+jsval_t js_call(struct js *js, jsval_t func, jsval_t *args, int nargs) {
+  const char *code = js->code;
+  jsoff_t clen = js->clen, pos = js->pos, nogc = js->nogc;
+  uint8_t tok = js->tok, flags = js->flags, consumed = js->consumed;
+  void *cstk = js->cstk;
+  jsval_t res = js_mkundef(), none = js_mkundef();
+  func = resolveprop(js, func);
+  if (args == NULL || nargs < 0) args = &none, nargs = 0;  // call_js() parses
+  if (js->nrun == 0) js->cstk = &res;                       // args if NULL
+  budgetenter(js);
+  const char *name = NULL;
+  jsoff_t nlen = 0;
+  if (js->prof != NULL) name = profname(js, func, &nlen);
+  if (vtype(func) == T_CFUNC) {
+    bool pf = profpush(js, name, nlen, NULL, 0);
+    res = ((jsval_t(*)(struct js *, jsval_t *, int))vdata(func))(js, args, nargs);
+    profpop(js, pf);
+    setlwm(js);
+  } else if (vtype(func) == T_FUNC) {
+    const uint8_t *e = js->vm != NULL ? vm_entry(js, func) : NULL;
+    if (e != NULL) {
+      bool pf = profpush(js, name, nlen, NULL, 0);
+      res = vm_invoke(js, e, args, nargs);
+      profpop(js, pf);
+    } else {
+      jsoff_t fnlen;
+      const char *fn = fnsrc(js, func, &fnlen);
+      js->nogc = (jsoff_t) vdata(func);
+      res = call_js(js, fn, fnlen, args, nargs, name, nlen);
+    }
+  } else {
+    res = js_mkerr(js, "calling non-function");
+  }
+  js->nrun--;
+  js->code = code, js->clen = clen, js->pos = pos, js->tok = tok;
+  js->flags = flags, js->consumed = consumed, js->nogc = nogc, js->cstk = cstk;
+  return res;
+}
+
+bool js_profstart(struct js *js, void *buf, size_t len) {
+  struct jsprof *p = (struct jsprof *) buf;
+  if (buf == NULL || len < sizeof(*p) + sizeof(struct jssample)) return false;
+  if (p != js->prof) {  // Carry the calls in progress over to the new buffer
+    if (js->prof != NULL) memcpy(p, js->prof, sizeof(*p)); else memset(p, 0, sizeof(*p));
+    js->prof = p;
+  }
+  p->on = false;
+  p->nslots = (uint32_t) ((len - sizeof(*p)) / sizeof(struct jssample));
+  memset(p + 1, 0, p->nslots * sizeof(struct jssample));
+  p->nused = p->dropped = 0, p->taken = p->ticks, p->on = true;
+  return true;
+}
+
+void js_profstop(struct js *js) {
+  if (js->prof != NULL) js->prof->on = false;
+}
+
+// Build the collapsed stack of the calls in progress, like "a;b;c@42".
+// If it is too long, outer calls are replaced with "..."
+static size_t profstack(struct js *js, char *buf, size_t len) {
+  char tmp[JS_PROF_DEPTH * JS_PROF_NAME + 40];
+  struct jsprof *p = js->prof;
+  uint32_t depth = p->depth, n = depth < JS_PROF_DEPTH ? depth : JS_PROF_DEPTH;
+  size_t i, k = 0;
+  for (i = 0; i < n; i++) {
+    if (i > 0) tmp[k++] = ';';
+    size_t m = cpy(&tmp[k], JS_PROF_NAME, p->frames[i].name, JS_PROF_NAME - 1);
+    k += m > 0 ? m : cpy(&tmp[k], 12, "(anonymous)", 11);
+  }
+  const struct jsframe *f = &p->frames[n - 1];
+  const char *pc = js->code + js->toff;
+  if (depth > n) {
+    k += cpy(&tmp[k], 10, ";(deeper)", 9);
+  } else if (f->code != NULL && pc >= f->code && pc < f->code + f->len) {
+    tmp[k++] = '@';
+    k += js_fmtnum((double) (pc - f->code), &tmp[k], sizeof(tmp) - k);
+  }
+  if (k < len) return cpy(buf, len, tmp, k);
+  for (i = 0; i < k && (tmp[i] != ';' || k - i + 3 >= len);) i++;  // Keep
+  if (i >= k) return 0;                                             // inner calls
+  memcpy(buf, "...", 3);
+  return 3 + cpy(buf + 3, len - 3, &tmp[i], k - i);
+}
+
+// Length of a collapsed stack without the "@N" offset of the leaf, if any
+static size_t profstrip(const char *stack, size_t len) {
+  size_t i = len;
+  while (i > 0 && stack[i - 1] != '@' && stack[i - 1] != ';') i--;
+  return i > 0 && stack[i - 1] == '@' ? i - 1 : len;
+}
+
+// Count samples of a stack. Return false if it has no slot yet and 'add'
+// is false, or the table has no room for it
+static bool profcount(struct jsprof *p, const char *stack, size_t n, uint32_t count, bool add) {
+  struct jssample *t = (struct jssample *) (p + 1);
+  uint32_t h = strhash(stack, n), k = h % p->nslots;
+  for (uint32_t i = 0; i < 32 && i < p->nslots; i++, k = (k + 1) % p->nslots) {
+    if (t[k].count == 0) {
+      if (!add) return false;
+      memcpy(t[k].stack, stack, n);
+      t[k].stack[n] = '\0';
+      t[k].hash = h, t[k].count = count, p->nused++;
+      return true;
+    }
+    if (t[k].hash == h && strlen(t[k].stack) == n && memcmp(t[k].stack, stack, n) == 0) {
+      t[k].count += count;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Take the samples requested since the last time, of the calls in progress.
+// Once the table is 3/4 full, a stack at an offset not seen yet is counted
+// without the offset, so that offsets of one hot function do not take the
+// room other stacks need
+static void proftake(struct js *js) {
+  struct jsprof *p = js->prof;
+  uint32_t count = p->ticks - p->taken;
+  char stack[JS_PROF_STACK];
+  size_t n;
+  p->taken += count;
+  if (!p->on || p->depth == 0) return;
+  if ((n = profstack(js, stack, sizeof(stack))) == 0) return;
+  if (profcount(p, stack, n, count, p->nused < p->nslots / 2 + p->nslots / 4)) return;
+  if (profcount(p, stack, profstrip(stack, n), count, true)) return;
+  p->dropped += count;
+}
+
+// Only a counter is written: a timer on another core must not walk the
+// calls while the JS task pushes and pops them
+void js_profsample(struct js *js) {
+  struct jsprof *p = js->prof;
+  if (p != NULL && p->on) p->ticks++;
+}
+
+// Whether a sample is of a stack, ignoring its offset
+static bool profsame(const struct jssample *t, const char *stack, size_t len) {
+  return t->count > 0 && profstrip(t->stack, strlen(t->stack)) == len &&
+         memcmp(t->stack, stack, len) == 0;
+}
+
+// Output one collapsed stack line: "stack count\n"
+static void profline(void (*out)(void *, const char *, size_t), void *ctx, const char *stack,
+                     size_t len, uint32_t count) {
+  char num[26];
+  out(ctx, stack, len);
+  out(ctx, " ", 1);
+  out(ctx, num, js_fmtnum((double) count, num, sizeof(num)));
+  out(ctx, "\n", 1);
+}
+
+size_t js_profdump(struct js *js, bool offsets, void (*out)(void *, const char *, size_t),
+                   void *ctx) {
+  struct jsprof *p = js->prof;
+  size_t total = 0;
+  if (p == NULL) return 0;
+  struct jssample *t = (struct jssample *) (p + 1);
+  for (uint32_t i = 0, j; i < p->nslots; i++) {
+    if (t[i].count == 0) continue;
+    const char *s = t[i].stack;
+    size_t n = strlen(s);
+    uint32_t count = t[i].count;
+    if (!offsets) {  // One line per stack: add up its samples at all offsets
+      n = profstrip(s, n);
+      for (j = 0; j < i && !profsame(&t[j], s, n); j++) (void) 0;
+      if (j < i) continue;  // Output already
+      for (j = i + 1; j < p->nslots; j++) {
+        if (profsame(&t[j], s, n)) count += t[j].count;
+      }
+    }
+    profline(out, ctx, s, n, count);
+    total += count;
+  }
+  if (p->dropped > 0) profline(out, ctx, "(dropped)", 9, p->dropped);
+  return total + p->dropped;
+}
+
 #ifdef JS_DUMP
 void js_dump(struct js *js) {
   jsoff_t off = 0, v;
   printf("JS size %u, brk %u, lwm %u, css %u, nogc %u\n", js->size, js->brk,
          js->lwm, (unsigned)js->css, js->nogc);
   while (off < js->brk) {
-    memcpy(&v, &js->mem[off], sizeof(v));
+    memcpy(&v, memp(js, off), sizeof(v));
     printf(" %5u: ", off);
     if ((v & 3U) == T_OBJ) {
       printf("OBJ %u %u\n", v & ~3U,
@@ -1401,9 +4328,18 @@ void js_dump(struct js *js) {
       jsval_t val = loadval(js, (jsoff_t)(off + sizeof(v) + sizeof(v)));
       printf("PROP next %u, koff %u vtype %d vdata %lu\n", v & ~3U, koff,
              vtype(val), (unsigned long)vdata(val));
+    } else if ((v & 3) == T_STR && (v & S_EXT)) {
+      printf("PINNED %u, length %u\n", loadoff(js, (jsoff_t)(off + 4)),
+             loadoff(js, (jsoff_t)(off + 8)));
+    } else if ((v & 3) == T_STR && (v & S_ROPE)) {
+      printf("ROPE %u, left %u, right %u\n", loadoff(js, (jsoff_t)(off + 12)),
+             loadoff(js, (jsoff_t)(off + 4)), loadoff(js, (jsoff_t)(off + 8)));
     } else if ((v & 3) == T_STR) {
       jsoff_t len = offtolen(v);
-      printf("STR %u [%.*s]\n", len, (int)len, js->mem + off + sizeof(v));
+      printf("STR %u [%.*s]\n", len, (int)len, memp(js, off + sizeof(v)));
+    } else if ((v & 3) == M_ARR) {
+      printf("ARR data %u, kind %d, len %u\n", v & ~3U, arrkind(js, off),
+             arrlen(js, off));
     } else {
       printf("???\n");
       break;
@@ -32,6 +32,36 @@ extern "C" {
 
   jsval_t js_eval(struct js *, const char *, size_t);  // Execute JS code
 
+  // Compile code into a self-contained buffer for js_evaljsc(): minified
+  // code, a checksum and a hash of the source. Return the compiled size, 0 if
+  // the code has a bad token. If buf is NULL or smaller, nothing is written
+  size_t js_compile(const char *code, size_t len, void *buf, size_t buflen);
+
+  // Execute compiled code. The buffer must stay valid while the code runs.
+  // The checksum is not verified: check a buffer with js_checkjsc() first
+  jsval_t js_evaljsc(struct js *, const void *buf, size_t len);
+
+  // Hash of script source, as js_compile() records it. Hash a long text in
+  // chunks: start with h = 0, then pass the previous result
+  uint32_t js_srchash(const void *buf, size_t len, uint32_t h);
+
+  // Check that a buffer is a whole, intact js_compile() result, e.g. one
+  // read from a file. Get the js_srchash() of its source and its key, see
+  // js_setjsckey(), if not NULL. Run it with js_evaljsc() after that
+  bool js_checkjsc(const void *buf, size_t len, uint32_t *src, uint32_t *key);
+
+  // Set the key of a compiled script, 0 after js_compile(). The embedder
+  // keeps something there that is cheaper to check than the source hash,
+  // e.g. size and time of the source file. The checksum does not cover it
+  void js_setjsckey(void *buf, size_t len, uint32_t key);
+
+  // Pin a read-only source buffer, e.g. the app script in PSRAM or flash.
+  // Functions defined by code in it, run by js_eval() or js_evaljsc(), refer
+  // to their source there rather than copying it to JS memory. The buffer
+  // must stay valid and unchanged for the life of the instance. Pin the same
+  // buffer again after js_restore(): snapshots keep the references
+  void js_pin(struct js *, const void *buf, size_t len);
+
   jsval_t js_glob(struct js *);                  // Return global object
   const char *js_str(struct js *, jsval_t val);  // Stringify JS value
 
@@ -39,13 +69,83 @@ extern "C" {
 
   bool js_truthy(struct js *, jsval_t);  // Check if value is true
 
-  void js_setmaxcss(struct js *, size_t);  // Set max C stack size
+  // Set the max C stack that code may use, counted from the outermost
+  // js_eval() or js_call(). Deeper code fails with a "C stack" error
+  void js_setmaxcss(struct js *, size_t);
 
   void js_setgct(struct js *, size_t);  // Set GC trigger threshold
 
+  // Let the GC threshold adapt, between min and max bytes in use. After each
+  // GC, it leaves room for the live memory to grow by the fraction of it
+  // that survived, or for JS_GC_PERIOD_MS of growth at the measured rate,
+  // whichever is more. Then fewer GCs run when most memory survives
+  void js_setgcadapt(struct js *, size_t min, size_t max);
+
+  // Extend JS memory with a slower buffer, e.g. PSRAM, while the buffer given
+  // to js_create() is e.g. internal SRAM. Call right after js_create(). GC
+  // compaction slides entities that survive it down, to the fast buffer
+  // first, so long-lived objects like the global scope end up there, and new
+  // ones are made in the slow buffer once the fast one is full of survivors
+  void js_setslowmem(struct js *, void *buf, size_t len);
+
+  // Enable bytecode VM: code is compiled and run in the given memory buffer,
+  // falling back to the tree-walking interpreter. NULL disables the VM
+  void js_setvm(struct js *, void *buf, size_t len);
+
+  // Set a fallback for names not found in any scope, e.g. native functions
+  // kept in a constant table rather than in global properties. It returns
+  // the value, or undefined if the name is unknown. Such values are read-only
+  void js_setresolver(struct js *,
+                      jsval_t (*fn)(struct js *, const char *name, size_t len));
+
+  // Set execution budget: when code started by the outermost js_eval() or
+  // js_call() runs longer than us microseconds, fn is called on the next
+  // statement or loop iteration. If it returns true, e.g. after yielding to
+  // other tasks, the code goes on with a new budget. Otherwise, or if fn is
+  // NULL, it is aborted with the "execution budget exceeded" error. 0: off
+  void js_setbudget(struct js *, size_t us, bool (*fn)(struct js *));
+
+  // Sampling profiler. js_profstart() takes a buffer for the profiler state
+  // and the sample table, aligned like malloc(), and clears the table. Keep
+  // using the same buffer. Then call js_profsample() periodically, e.g. from
+  // a timer interrupt or another task. It only requests a sample: the task
+  // running JS code takes it on its next statement or call return. It counts
+  // the calls in progress, named by the variable or property the function
+  // was called by, with the source offset of the innermost function run by
+  // the tree-walking interpreter. js_profdump()
+  // outputs "outer;inner count" lines, the collapsed stack format of flame
+  // graph tools, and returns the number of samples
+  bool js_profstart(struct js *, void *buf, size_t len);
+  void js_profstop(struct js *);
+  void js_profsample(struct js *);
+  size_t js_profdump(struct js *, bool offsets,
+                     void (*out)(void *ctx, const char *buf, size_t len), void *ctx);
+
+  // Enable incremental GC, given the time budget of a GC slice in microseconds.
+  // Takes memory for the mark bitmap (1/32) from the JS memory. Call before
+  // js_eval(). Then GC slices run in js_gcstep() calls, rather than stopping
+  // the world on statement boundaries. 0 disables incremental GC
+  void js_setgcslice(struct js *, size_t us);
+
+  // Run an incremental GC slice, if GC is due. Call it outside of js_eval(),
+  // e.g. from the main loop. Return true if the GC cycle is not finished yet
+  bool js_gcstep(struct js *);
+
   void js_gc(struct js *);  // Force garbage collection
 
-  void js_stats(struct js *, size_t *total, size_t *min, size_t *cstacksize);
+  // Memory and GC stats: total memory, min free memory observed, max C stack
+  // size, number of GC runs, last and longest GC pause and total GC time in
+  // microseconds, and fragmentation: free memory in the middle of used memory,
+  // in slots left by dead entities. The min free memory does not include it
+  void js_stats(struct js *, size_t *total, size_t *min, size_t *cstacksize,
+                size_t *gcruns, size_t *gclast, size_t *gcmax, size_t *gctime,
+                size_t *frag);
+
+  // Live memory after the last GC, in bytes, by kind: objects, properties,
+  // strings, function bodies, arrays with their elements. And the current
+  // GC threshold. Before the first GC, all live memory counts are 0
+  void js_heapstats(struct js *, size_t *objs, size_t *props, size_t *strs,
+                    size_t *funcs, size_t *arrs, size_t *gct);
 
   void js_dump(struct js *);  // Print debug info. Requires -DJS_DUMP
 
@@ -71,6 +171,52 @@ extern "C" {
 
   void js_set(struct js *, jsval_t, const char *, jsval_t);  // Set obj attr
 
+  jsval_t js_get(struct js *, jsval_t, const char *);  // Get obj attr or undef
+
+  // Call JS or C function value with the given arguments, return the result
+  // or error. No code gets parsed to make the call. Can be called from
+  // native functions and from outside js_eval(), e.g. from event callbacks
+  jsval_t js_call(struct js *, jsval_t func, jsval_t *args, int nargs);
+
+  // GC moves and deletes values that no JS variable refers to, so C code
+  // must not keep jsval_t across js_eval() or js_call(). Root a value to keep
+  // it: js_root() returns a handle, or -1 if all JS_ROOTS slots are taken.
+  // js_rootval() returns the value, up to date after GC
+  int js_root(struct js *, jsval_t val);
+  jsval_t js_rootval(struct js *, int handle);
+  void js_unroot(struct js *, int handle);  // Free root slot
+
+  // Snapshot: save JS memory after the top-level code has run, and restore it
+  // on later runs instead of running the code again. Native function values
+  // are saved as IDs: fnid() maps a function to its ID, or ~0 if it has none,
+  // idfn() maps an ID back, or returns NULL. A snapshot restores only with the
+  // same key, into a JS instance with the same memory size and settings.
+  // io() writes or reads len bytes and returns the number of bytes done.
+  // Roots are not saved. Call these when no code is running
+  bool js_snapshot(struct js *, uint32_t key, uint32_t (*fnid)(void *fn),
+                   size_t (*io)(void *ctx, void *buf, size_t len), void *ctx);
+  bool js_restore(struct js *, uint32_t key, void *(*idfn)(uint32_t id),
+                  size_t (*io)(void *ctx, void *buf, size_t len), void *ctx);
+
+  // Arrays: Array holds any JS values and grows on stores past its end.
+  // Typed arrays hold numbers, converted to the element type, and have fixed
+  // length. Elements are contiguous in JS memory
+  enum { JS_ARRAY, JS_UINT8, JS_INT16, JS_FLOAT32 };
+
+  jsval_t js_mkarr(struct js *, int kind, size_t len);  // Create array
+
+  // Get array element, or undefined if out of range
+  jsval_t js_arrget(struct js *, jsval_t arr, size_t idx);
+
+  // Store array element, return error or val. Does not convert for Array
+  jsval_t js_arrset(struct js *, jsval_t arr, size_t idx, jsval_t val);
+
+  // Get array elements: jsval_t, uint8_t, int16_t or float, depending on the
+  // kind. Pointer is valid until the next JS memory allocation or GC. It is
+  // 4-byte aligned, so memcpy() Array elements. Do not store JS values into an
+  // Array through it, use js_arrset() instead
+  void *js_getarr(struct js *, jsval_t arr, int *kind, size_t *len);
+
   // Extract C values from JS values
   enum { JS_UNDEF,
          JS_NULL,
@@ -79,14 +225,29 @@ extern "C" {
          JS_STR,
          JS_NUM,
          JS_ERR,
-         JS_PRIV };
+         JS_PRIV,
+         JS_ARR };
 
   int js_type(jsval_t val);  // Return JS value type
 
   double js_getnum(jsval_t val);  // Get number
+  int js_getint(jsval_t val);     // Get number as int, truncated like (int)
+
+  int js_getbool(jsval_t val);  // Get boolean, 0 or 1
+
+  // Get string. A string made by a long concatenation is copied into one
+  // piece on first access, so this may allocate. Return NULL, and length 0,
+  // if val is not a string, or if memory is out for that copy
+  char *js_getstr(struct js *js, jsval_t val, size_t *len);
+
+  // Parse a number from at most len bytes, the way JS source is parsed, plus
+  // an optional sign and "Infinity". Set *n to the number of bytes taken, 0
+  // if there is no number
+  double js_parsenum(const char *buf, size_t len, size_t *n);
 
-  int js_getbool(jsval_t val);                               // Get boolean, 0 or 1
-  char *js_getstr(struct js *js, jsval_t val, size_t *len);  // Get string
+  // Format a number the way JS does: shortest digits that round-trip. Needs
+  // up to 26 bytes. Return string length
+  size_t js_fmtnum(double val, char *buf, size_t len);
 
 #ifdef __cplusplus
 }
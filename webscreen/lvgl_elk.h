@@ -12,7 +12,10 @@
 #include <ArduinoJson.h>
 #include <PubSubClient.h>  // For MQTT
 
+#include <mutex>
 #include <vector>
+#include <tuple>
+#include <type_traits>
 #include <utility>  // for std::pair
 
 #include "globals.h"
@@ -24,9 +27,19 @@
 static WiFiClient g_wifiClient;
 static PubSubClient g_mqttClient(g_wifiClient);
 
-// HTTP client certificate.
-static char *g_httpCAcert = nullptr;  // Will hold entire PEM cert from SD
-static std::vector<std::pair<String, String>> g_http_headers;
+// HTTP headers and CA certificate, set by the UI script and used by
+// requests in workers too: take a copy with elk_http_config()
+struct ElkHttpConfig {
+  String ca_cert;  // Entire PEM cert from SD, or empty for insecure HTTPS
+  std::vector<std::pair<String, String>> headers;
+};
+static ElkHttpConfig g_http_config;
+static std::mutex g_http_mtx;
+
+static ElkHttpConfig elk_http_config() {
+  std::lock_guard<std::mutex> lock(g_http_mtx);
+  return g_http_config;
+}
 
 // NimBLE globals
 static NimBLEServer *g_bleServer = nullptr;
@@ -39,8 +52,20 @@ extern "C" {
 #include "elk.h"
 }
 
+// A JavaScript callback held by C code, see elk_callback_set(). Scripts pass
+// either the function or its global name
+struct ElkCallback {
+  int id;             // Index of the function in the callbacks Array, or -1
+  char name[32];      // Global name to look up on each call, or empty
+  uint32_t overruns;  // Times a call ran out of execution budget
+  uint32_t aborts;    // Calls aborted for running too long
+  ElkCallback *next;  // All callbacks, see elk_print_budget_stats()
+  uint8_t calls;      // Calls in progress
+  bool deleted;       // Deleted during a call, free it after that
+};
+
 // For storing a JavaScript callback to handle incoming messages
-static char g_mqttCallbackName[32];  // Big enough for a function name
+static ElkCallback g_mqttCallback = { -1, "" };
 static unsigned long lastMqttReconnectAttempt = 0;
 static unsigned long lastWiFiReconnectAttempt = 0;
 
@@ -48,8 +73,15 @@ static unsigned long lastWiFiReconnectAttempt = 0;
  * A) Elk Memory + Global Instances
  ******************************************************************************/
 #define ELK_HEAP_BYTES (256 * 1024)  // 256KB in PSRAM for complex scripts
+#define ELK_VM_BYTES (64 * 1024)     // Bytecode VM code cache; 0 = tree-walker only
+#define ELK_GC_SLICE_US 2000         // Incremental GC slice budget; 0 = stop-the-world GC
+#define ELK_FAST_BYTES (48 * 1024)   // Internal SRAM in front of the PSRAM heap; 0 = PSRAM only
 static uint8_t *elk_memory = NULL;
 static size_t elk_memory_size = 0;
+static uint8_t *elk_fast_memory = NULL;
+static size_t elk_fast_memory_size = 0;
+static uint8_t *elk_vm_memory = NULL;
+static size_t elk_vm_memory_size = 0;
 struct js *js = NULL;  // Global Elk instance
 
 // Initialize Elk memory from PSRAM (must be called before js_create)
@@ -63,6 +95,20 @@ static bool init_elk_memory() {
   if (elk_memory != NULL) {
     elk_memory_size = ELK_HEAP_BYTES;
     LOGF("Elk heap allocated in PSRAM: %u KB\n", ELK_HEAP_BYTES / 1024);
+    if (ELK_VM_BYTES > 0) {
+      elk_vm_memory = (uint8_t*)ps_malloc(ELK_VM_BYTES);
+      if (elk_vm_memory != NULL) {
+        elk_vm_memory_size = ELK_VM_BYTES;
+        LOGF("Elk bytecode VM allocated in PSRAM: %u KB\n", ELK_VM_BYTES / 1024);
+      }
+    }
+    if (ELK_FAST_BYTES > 0) {
+      elk_fast_memory = (uint8_t*)heap_caps_malloc(ELK_FAST_BYTES, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+      if (elk_fast_memory != NULL) {
+        elk_fast_memory_size = ELK_FAST_BYTES;
+        LOGF("Elk fast heap allocated in internal RAM: %u KB\n", ELK_FAST_BYTES / 1024);
+      }
+    }
     return true;
   }
 
@@ -78,6 +124,16 @@ static bool init_elk_memory() {
   LOG("ERROR: Failed to allocate Elk heap!");
   return false;
 }
+
+// Create the Elk instance on the memory from init_elk_memory(). With a fast
+// buffer, the PSRAM heap goes behind it, and the GC moves long-lived data
+// like the global scope and the script's state to internal RAM
+static struct js *elk_create_js() {
+  if (elk_fast_memory == NULL) return js_create(elk_memory, elk_memory_size);
+  struct js *instance = js_create(elk_fast_memory, elk_fast_memory_size);
+  if (instance != NULL) js_setslowmem(instance, elk_memory, elk_memory_size);
+  return instance;
+}
 // Adjust as needed
 #define MAX_RAM_IMAGES 16
 
@@ -328,11 +384,42 @@ void lvgl_loop() {  // Call LVGL's timer handler
 /******************************************************************************
  * E) Elk-Facing Functions (print, Wi-Fi, SD ops, etc.)
  ******************************************************************************/
+// Typed access to binding arguments. A string comes as a view straight into
+// the JS heap, 0-terminated, with no copy: it stays valid until the binding
+// calls back into JS, so copy it if it must live longer
+struct ElkStr {
+  const char *ptr;  // NULL if the argument is missing or not a string
+  size_t len;
+  bool ok() const { return ptr != NULL; }
+  const char *c_str() const { return ptr; }
+};
+
+// Argument i as a string, e.g. a path or a URL. Not ok() if memory is out
+// to join the pieces of a long concatenation
+static ElkStr elk_arg_str(struct js *js, jsval_t *args, int nargs, int i) {
+  ElkStr s = {NULL, 0};
+  if (i < nargs && js_type(args[i]) == JS_STR) s.ptr = js_getstr(js, args[i], &s.len);
+  return s;
+}
+
+// Argument i as text to show or send: strings as they are, other values
+// stringified, e.g. label_set_text(label, 42) shows 42. A missing argument
+// is empty text. Not ok() only for a string, like elk_arg_str()
+static ElkStr elk_arg_text(struct js *js, jsval_t *args, int nargs, int i) {
+  ElkStr s = elk_arg_str(js, args, nargs, i);
+  if (s.ptr == NULL && (i >= nargs || js_type(args[i]) != JS_STR)) s.ptr = i < nargs ? js_str(js, args[i]) : "", s.len = strlen(s.ptr);
+  return s;
+}
+
+// Argument i as an int, or def if it is missing or not a number
+static int elk_arg_int(jsval_t *args, int nargs, int i, int def) {
+  return i < nargs && js_type(args[i]) == JS_NUM ? js_getint(args[i]) : def;
+}
+
 static jsval_t js_print(struct js *js, jsval_t *args, int nargs) {
   for (int i = 0; i < nargs; i++) {
-    const char *str = js_str(js, args[i]);
-    if (str) LOG(str);
-    else LOG("print: argument is not a string");
+    ElkStr s = elk_arg_text(js, args, nargs, i);
+    LOG(s.ok() ? s.c_str() : "(out of memory)");
   }
   return js_mknull();
 }
@@ -351,6 +438,13 @@ static jsval_t js_mem_stats(struct js *js, jsval_t *args, int nargs) {
   LOGF("ESP32 Heap: %u / %u bytes (min free: %u)\n", freeHeap, heapSize, minFreeHeap);
   LOGF("LVGL Memory: %u / %u bytes (%u%% used, %u%% frag)\n",
        mon.total_size - mon.free_size, mon.total_size, mon.used_pct, mon.frag_pct);
+
+  // Get Elk heap and GC info
+  size_t jsTotal, jsMinFree, gcRuns, gcLast, gcMax, gcTime, jsFrag;
+  js_stats(js, &jsTotal, &jsMinFree, NULL, &gcRuns, &gcLast, &gcMax, &gcTime, &jsFrag);
+  LOGF("Elk Heap: %u bytes (min free: %u, fragmented: %u)\n", jsTotal, jsMinFree, jsFrag);
+  LOGF("Elk GC: %u runs, last pause %u us, max pause %u us, total %u us\n", gcRuns, gcLast,
+       gcMax, gcTime);
   LOGF("====================\n");
 
   // Return free heap as a number for JS to use
@@ -359,20 +453,8 @@ static jsval_t js_mem_stats(struct js *js, jsval_t *args, int nargs) {
 
 // Wi-Fi connect
 static jsval_t js_wifi_connect(struct js *js, jsval_t *args, int nargs) {
-  if (nargs != 2) return js_mkfalse();
-  const char *ssidQ = js_str(js, args[0]);
-  const char *passQ = js_str(js, args[1]);
-  if (!ssidQ || !passQ) return js_mkfalse();
-
-  // Strip quotes if any
-  String ssid(ssidQ);
-  String pass(passQ);
-  if (ssid.startsWith("\"") && ssid.endsWith("\"")) {
-    ssid = ssid.substring(1, ssid.length() - 1);
-  }
-  if (pass.startsWith("\"") && pass.endsWith("\"")) {
-    pass = pass.substring(1, pass.length() - 1);
-  }
+  ElkStr ssid = elk_arg_str(js, args, nargs, 0), pass = elk_arg_str(js, args, nargs, 1);
+  if (nargs != 2 || !ssid.ok() || !pass.ok()) return js_mkfalse();
 
   LOGF("Connecting to Wi-Fi SSID: %s\n", ssid.c_str());
   WiFi.begin(ssid.c_str(), pass.c_str());
@@ -405,26 +487,214 @@ static jsval_t js_wifi_get_ip(struct js *js, jsval_t *args, int nargs) {
   return js_mkstr(js, ipStr.c_str(), ipStr.length());
 }
 
-// Delay in JS: "delay(ms)"
+static bool elk_worker_wait(struct js *js, uint32_t ms);
+
+// Delay in JS: "delay(ms)". Workers get their messages meanwhile
 static jsval_t js_delay(struct js *js, jsval_t *args, int nargs) {
   if (nargs != 1) return js_mknull();
   double ms = js_getnum(args[0]);
-  vTaskDelay(pdMS_TO_TICKS((unsigned long)ms));
-  return js_mknull();
+  if (!elk_worker_wait(js, (uint32_t)ms)) vTaskDelay(pdMS_TO_TICKS((unsigned long)ms));
+  return js_mknull();
+}
+
+// Execution budget. A callback that runs longer than
+// WEBSCREEN_JS_MAX_EXECUTION_TIME_MS yields the CPU to other tasks, e.g. the
+// Wi-Fi stack and the idle task that feeds the watchdog, then goes on. After
+// WEBSCREEN_JS_MAX_YIELDS such overruns it is aborted with the "execution
+// budget exceeded" error, so that LVGL and MQTT, which run in the JS task
+// between callbacks, get their turn. The script top level only yields
+static ElkCallback *g_elk_callbacks = NULL;  // All callbacks ever set
+static std::mutex g_elk_callbacks_mtx;       // Links, /stats walks them
+static ElkCallback *g_elk_running = NULL;    // Callback being called, or NULL
+static uint32_t g_elk_yields = 0;            // Overruns in the current call
+static uint32_t g_elk_script_overruns = 0;   // Overruns of the top level
+
+static bool elk_overrun(struct js *js) {
+  if (g_elk_running == NULL) {
+    g_elk_script_overruns++;
+  } else if (g_elk_running->overruns++, ++g_elk_yields > WEBSCREEN_JS_MAX_YIELDS) {
+    g_elk_running->aborts++;
+    return false;
+  }
+  vTaskDelay(1);
+  return true;
+}
+
+static int *elk_callbacks_root(struct js *js);
+
+// The callback functions of a JS instance, in one Array that takes a single
+// root, created on first use. A callback's id is its index there
+static jsval_t elk_callbacks(struct js *js) {
+  int *root = elk_callbacks_root(js);
+  if (root == NULL) return js_mkundef();
+  if (*root < 0) {
+    jsval_t arr = js_mkarr(js, JS_ARRAY, 0);
+    if (js_type(arr) != JS_ARR || (*root = js_root(js, arr)) < 0) return js_mkundef();
+  }
+  return js_rootval(js, *root);
+}
+
+// Clear a callback, and free its slot for the next one
+static void elk_callback_free(struct js *js, ElkCallback *cb) {
+  if (cb->id >= 0) js_arrset(js, elk_callbacks(js), (size_t)cb->id, js_mkundef());
+  cb->id = -1;
+  cb->name[0] = '\0';
+}
+
+// Set a callback from a JS argument: a function, or the name of a global
+// function. A name is looked up on each call, so that the function can be
+// defined after the callback is set, or replaced
+static bool elk_callback_set(struct js *js, ElkCallback *cb, jsval_t fn) {
+  size_t len = 0, i = 0;
+  char *str = js_type(fn) == JS_STR ? js_getstr(js, fn, &len) : NULL;
+  elk_callback_free(js, cb);
+  if (str != NULL) {
+    if (len == 0 || len >= sizeof(cb->name)) return false;
+    memcpy(cb->name, str, len);  // not zero-terminated by default
+    cb->name[len] = '\0';
+    return true;
+  }
+  if (js_type(fn) != JS_PRIV) return false;  // Not a function
+  jsval_t arr = elk_callbacks(js);
+  if (js_type(arr) != JS_ARR) {
+    LOG("No JS memory for a callback");
+    return false;
+  }
+  while (js_type(js_arrget(js, arr, i)) != JS_UNDEF) i++;  // First free slot
+  if (js_type(js_arrset(js, arr, i, fn)) == JS_ERR) return false;
+  cb->id = (int)i;
+  return true;
+}
+
+// The function to call for a callback, or an error
+static jsval_t elk_callback_fn(struct js *js, const ElkCallback *cb) {
+  jsval_t fn = js_mkundef();
+  if (cb->name[0] != '\0') {
+    fn = js_get(js, js_glob(js), cb->name);
+    if (js_type(fn) == JS_UNDEF) return js_mkerr(js, "'%s' not found", cb->name);
+  } else if (cb->id >= 0) {
+    fn = js_arrget(js, elk_callbacks(js), (size_t)cb->id);
+  }
+  return js_type(fn) == JS_UNDEF ? js_mkerr(js, "no callback") : fn;
+}
+
+// Call a callback with the given arguments. Nothing gets parsed, and the
+// arguments can be any JS values, e.g. strings made with js_mkstr() just
+// before the call
+static jsval_t elk_callback_call(ElkCallback *cb, jsval_t *args, int nargs) {
+  jsval_t fn = elk_callback_fn(js, cb);
+  if (js_type(fn) == JS_ERR) return fn;
+  {
+    std::lock_guard<std::mutex> lock(g_elk_callbacks_mtx);
+    ElkCallback *p = g_elk_callbacks;
+    while (p != NULL && p != cb) p = p->next;
+    if (p == NULL) cb->next = g_elk_callbacks, g_elk_callbacks = cb;  // First call
+  }
+  ElkCallback *running = g_elk_running;
+  uint32_t yields = g_elk_yields;
+  g_elk_running = cb, g_elk_yields = 0, cb->calls++;
+  jsval_t res = js_call(js, fn, args, nargs);
+  g_elk_running = running, g_elk_yields = yields, cb->calls--;
+  return res;
+}
+
+// Forget a callback that is about to be freed. Once it is unlinked, /stats
+// cannot reach it any more
+static void elk_callback_drop(struct js *js, ElkCallback *cb) {
+  {
+    std::lock_guard<std::mutex> lock(g_elk_callbacks_mtx);
+    ElkCallback **p = &g_elk_callbacks;
+    while (*p != NULL && *p != cb) p = &(*p)->next;
+    if (*p != NULL) *p = cb->next;
+  }
+  elk_callback_free(js, cb);
+}
+
+static const char *elk_callback_name(const ElkCallback *cb) {
+  return cb->name[0] != '\0' ? cb->name : "(function)";
+}
+
+// Print JS memory in use and live memory by kind, as of the last GC
+static void elk_print_memory_stats(Print &out) {
+  size_t total, minFree, gcRuns, objs, props, strs, funcs, arrs, gct;
+  js_stats(js, &total, &minFree, NULL, &gcRuns, NULL, NULL, NULL, NULL);
+  js_heapstats(js, &objs, &props, &strs, &funcs, &arrs, &gct);
+  out.printf("JS Heap: %lu KB, min free %lu KB, GC threshold %lu KB, %lu GC runs\n",
+             (unsigned long)total / 1024, (unsigned long)minFree / 1024,
+             (unsigned long)gct / 1024, (unsigned long)gcRuns);
+  out.printf("  Live: objects %lu, props %lu, strings %lu, functions %lu, arrays %lu bytes\n",
+             (unsigned long)objs, (unsigned long)props, (unsigned long)strs,
+             (unsigned long)funcs, (unsigned long)arrs);
+}
+
+// Print execution budget overruns, per callback that had any. Runs in the
+// serial task: the lock keeps the JS task from freeing a callback meanwhile
+static void elk_print_budget_stats(Print &out) {
+  out.printf("JS Budget: %d ms, script overruns: %lu\n", WEBSCREEN_JS_MAX_EXECUTION_TIME_MS,
+             (unsigned long)g_elk_script_overruns);
+  std::lock_guard<std::mutex> lock(g_elk_callbacks_mtx);
+  for (ElkCallback *cb = g_elk_callbacks; cb != NULL; cb = cb->next) {
+    if (cb->overruns == 0) continue;
+    out.printf("  %s: %lu overruns, %lu aborted\n", elk_callback_name(cb),
+               (unsigned long)cb->overruns, (unsigned long)cb->aborts);
+  }
+}
+
+// Sampling profiler. An esp_timer requests a sample of the JS call stack
+// every WEBSCREEN_JS_PROFILE_PERIOD_US. The JS task takes it, into a table
+// in PSRAM, allocated on the first start and kept, so that a profile can be
+// dumped after it is stopped. The dump is in the collapsed stack format of
+// flamegraph.pl
+static uint8_t *g_elk_prof_mem = NULL;
+static esp_timer_handle_t g_elk_prof_timer = NULL;
+
+static void elk_profile_sample(void *arg) {
+  js_profsample(js);
+}
+
+static bool elk_profile_start() {
+  const size_t size = WEBSCREEN_JS_PROFILE_KB * 1024;
+  if (js == NULL) return false;
+  if (g_elk_prof_mem == NULL) g_elk_prof_mem = (uint8_t *)ps_malloc(size);
+  if (g_elk_prof_mem == NULL) return false;
+  if (g_elk_prof_timer == NULL) {
+    esp_timer_create_args_t args = {};
+    args.callback = elk_profile_sample;
+    args.name = "elk_prof";
+    if (esp_timer_create(&args, &g_elk_prof_timer) != ESP_OK) return false;
+  }
+  esp_timer_stop(g_elk_prof_timer);  // Restart clears the samples
+  if (!js_profstart(js, g_elk_prof_mem, size)) return false;
+  return esp_timer_start_periodic(g_elk_prof_timer, WEBSCREEN_JS_PROFILE_PERIOD_US) == ESP_OK;
+}
+
+static void elk_profile_stop() {
+  if (g_elk_prof_timer != NULL) esp_timer_stop(g_elk_prof_timer);
+  if (js != NULL) js_profstop(js);
+}
+
+static void elk_profile_out(void *ctx, const char *buf, size_t len) {
+  ((Print *)ctx)->write((const uint8_t *)buf, len);
+}
+
+// Print "outer;inner count" lines, return the number of samples. With
+// offsets, tree-walker functions are split by the source offset running
+static size_t elk_profile_dump(Print &out, bool offsets) {
+  return js != NULL ? js_profdump(js, offsets, elk_profile_out, &out) : 0;
 }
 
 // LVGL Timer Bridging Functions
 
 // Execution counter for periodic maintenance
 static uint32_t g_timer_exec_count = 0;
-static const uint32_t GC_INTERVAL = 60;  // Run GC every 60 timer callbacks
+static std::vector<lv_timer_t *> g_elk_timers;  // By handle, NULL once deleted
 static const uint32_t REBOOT_THRESHOLD = 36000;  // Reboot after ~10 hours (36000 seconds)
 
 // This C++ function will be the callback for LVGL. It will execute a JS function.
 static void elk_timer_cb(lv_timer_t *timer) {
-  char *func_name = (char *)timer->user_data;
+  ElkCallback *cb = (ElkCallback *)timer->user_data;
 
-  if (func_name != NULL && js != NULL) {
+  if (cb != NULL && js != NULL) {
     g_timer_exec_count++;
 
     // Check memory before executing JS - skip if critically low to prevent crash
@@ -449,11 +719,6 @@ static void elk_timer_cb(lv_timer_t *timer) {
       return;
     }
 
-    // Periodic garbage collection to prevent fragmentation
-    if (g_timer_exec_count % GC_INTERVAL == 0) {
-      js_gc(js);
-    }
-
     // Safety reboot after very long runtime to prevent memory issues
     if (g_timer_exec_count >= REBOOT_THRESHOLD) {
       LOG("[TIMER CB] Scheduled maintenance reboot after long runtime");
@@ -461,14 +726,10 @@ static void elk_timer_cb(lv_timer_t *timer) {
       ESP.restart();
     }
 
-    // Construct a snippet of JavaScript to call the function, e.g., "my_func();"
-    char snippet[64];
-    snprintf(snippet, sizeof(snippet), "%s();", func_name);
-
-    // Use js_eval to execute the function call.
-    jsval_t res = js_eval(js, snippet, strlen(snippet));
+    // Call the JS function directly, without parsing any code
+    jsval_t res = elk_callback_call(cb, NULL, 0);
     if (js_type(res) == JS_ERR) {
-      LOGF("[TIMER CB] Error executing JS function '%s': %s\n", func_name, js_str(js, res));
+      LOGF("[TIMER CB] Error executing JS function '%s': %s\n", elk_callback_name(cb), js_str(js, res));
       // If we get a parse error, memory might be corrupted - reboot
       const char* errStr = js_str(js, res);
       if (errStr && strstr(errStr, "expected")) {
@@ -477,6 +738,7 @@ static void elk_timer_cb(lv_timer_t *timer) {
         ESP.restart();
       }
     }
+    if (cb->deleted && cb->calls == 0) free(cb);
   }
 }
 
@@ -484,47 +746,66 @@ static void elk_timer_cb(lv_timer_t *timer) {
 // It creates an LVGL timer that will call our C++ callback.
 static jsval_t js_create_timer(struct js *js, jsval_t *args, int nargs) {
   if (nargs < 2) {
-    LOG("create_timer expects: function_name, period_ms");
+    LOG("create_timer expects: function or function_name, period_ms");
     return js_mknull();
   }
 
-  size_t func_name_len;
-  char *func_name_str = js_getstr(js, args[0], &func_name_len);
   double period = js_getnum(args[1]);
 
-  if (!func_name_str || func_name_len == 0) {
+  ElkCallback *cb = (ElkCallback *)malloc(sizeof(ElkCallback));
+  if (!cb) {
+    LOG("Failed to allocate memory for timer callback");
+    return js_mknull();
+  }
+  memset(cb, 0, sizeof(*cb));
+  cb->id = -1;
+  if (!elk_callback_set(js, cb, args[0])) {
+    free(cb);
     return js_mknull();
   }
 
-  char *name_for_timer = (char *)malloc(func_name_len + 1);
-  if (!name_for_timer) {
-    LOG("Failed to allocate memory for timer callback name");
+  // Create the LVGL timer, and a handle for delete_timer()
+  lv_timer_t *timer = lv_timer_create(elk_timer_cb, (uint32_t)period, cb);
+  if (timer == NULL) {
+    LOG("Failed to create LVGL timer");
+    elk_callback_free(js, cb);
+    free(cb);
     return js_mknull();
   }
-  memcpy(name_for_timer, func_name_str, func_name_len);
-  name_for_timer[func_name_len] = '\0';
+  size_t handle = 0;
+  while (handle < g_elk_timers.size() && g_elk_timers[handle] != NULL) handle++;
+  if (handle == g_elk_timers.size()) g_elk_timers.push_back(timer);
+  g_elk_timers[handle] = timer;
 
-  // Create the LVGL timer
-  lv_timer_create(elk_timer_cb, (uint32_t)period, name_for_timer);
+  LOGF("Created LVGL timer to call JS function '%s' every %dms\n", elk_callback_name(cb), (int)period);
+  return js_mknum((double)handle);
+}
 
-  LOGF("Created LVGL timer to call JS function '%s' every %dms\n", name_for_timer, (int)period);
-  return js_mknull();
+// delete_timer(handle): stop a timer, and free its callback
+static jsval_t js_delete_timer(struct js *js, jsval_t *args, int nargs) {
+  int handle = elk_arg_int(args, nargs, 0, -1);
+  if (handle < 0 || handle >= (int)g_elk_timers.size() || g_elk_timers[handle] == NULL) {
+    return js_mkfalse();
+  }
+  lv_timer_t *timer = g_elk_timers[handle];
+  ElkCallback *cb = (ElkCallback *)timer->user_data;
+  g_elk_timers[handle] = NULL;
+  lv_timer_del(timer);
+  elk_callback_drop(js, cb);
+  if (cb->calls > 0) {
+    cb->deleted = true;  // Still running: elk_timer_cb() frees it
+  } else {
+    free(cb);
+  }
+  return js_mktrue();
 }
 
 // sd_read_file(path)
 static jsval_t js_sd_read_file(struct js *js, jsval_t *args, int nargs) {
-  if (nargs != 1) return js_mknull();
-  const char *rawPath = js_str(js, args[0]);
-  if (!rawPath) return js_mknull();
-
-  // Strip quotes if present
-  String path(rawPath);
-  if (path.startsWith("\"") && path.endsWith("\"")) {
-    path.remove(0, 1);
-    path.remove(path.length() - 1, 1);
-  }
+  ElkStr path = elk_arg_str(js, args, nargs, 0);
+  if (nargs != 1 || !path.ok()) return js_mknull();
 
-  File file = SD_MMC.open(path);
+  File file = SD_MMC.open(path.c_str());
   if (!file) {
     LOGF("Failed to open file: %s\n", path.c_str());
     return js_mknull();
@@ -536,34 +817,25 @@ static jsval_t js_sd_read_file(struct js *js, jsval_t *args, int nargs) {
 
 // sd_write_file(path, data)
 static jsval_t js_sd_write_file(struct js *js, jsval_t *args, int nargs) {
-  if (nargs != 2) return js_mkfalse();
-  const char *path = js_str(js, args[0]);
-  const char *data = js_str(js, args[1]);
-  if (!path || !data) return js_mkfalse();
+  ElkStr path = elk_arg_str(js, args, nargs, 0), data = elk_arg_text(js, args, nargs, 1);
+  if (nargs != 2 || !path.ok() || !data.ok()) return js_mkfalse();
 
-  File f = SD_MMC.open(path, FILE_WRITE);
+  File f = SD_MMC.open(path.c_str(), FILE_WRITE);
   if (!f) {
-    LOGF("Failed to open for writing: %s\n", path);
+    LOGF("Failed to open for writing: %s\n", path.c_str());
     return js_mkfalse();
   }
-  f.write((const uint8_t *)data, strlen(data));
+  f.write((const uint8_t *)data.ptr, data.len);
   f.close();
   return js_mktrue();
 }
 
 // sd_list_dir(path)
 static jsval_t js_sd_list_dir(struct js *js, jsval_t *args, int nargs) {
-  if (nargs != 1) return js_mknull();
-  const char *pathQ = js_str(js, args[0]);
-  if (!pathQ) return js_mknull();
-
-  // Strip quotes
-  String path(pathQ);
-  if (path.startsWith("\"") && path.endsWith("\"")) {
-    path = path.substring(1, path.length() - 1);
-  }
+  ElkStr path = elk_arg_str(js, args, nargs, 0);
+  if (nargs != 1 || !path.ok()) return js_mknull();
 
-  File root = SD_MMC.open(path);
+  File root = SD_MMC.open(path.c_str());
   if (!root) {
     LOGF("Failed to open directory: %s\n", path.c_str());
     return js_mknull();
@@ -604,14 +876,15 @@ static jsval_t js_to_number(struct js *js, jsval_t *args, int nargs) {
   }
 
   // Get the string value from the JS argument
-  size_t len;
+  size_t len, n;
   const char *str = js_getstr(js, args[0], &len);
   if (!str) {
     return js_mknum(0);  // Return 0 if not a valid string
   }
 
-  // Convert the C-string to a double and return as a JS number
-  return js_mknum(atof(str));
+  // Like atof(): skip leading whitespace, take the longest number prefix
+  while (len > 0 && (*str == ' ' || *str == '\t' || *str == '\n' || *str == '\r')) str++, len--;
+  return js_mknum(js_parsenum(str, len, &n));
 }
 
 // Helper function to convert a JS number to a JS string
@@ -624,10 +897,9 @@ static jsval_t js_number_to_string(struct js *js, jsval_t *args, int nargs) {
 
   if (type == JS_NUM) {
     char buf[32];
-    double num = js_getnum(args[0]);
-    // Using "%.17g" is how the Elk engine itself formats numbers
-    snprintf(buf, sizeof(buf), "%.17g", num);
-    return js_mkstr(js, buf, strlen(buf));
+    // Same shortest round-trip form the Elk engine itself prints
+    size_t n = js_fmtnum(js_getnum(args[0]), buf, sizeof(buf));
+    return js_mkstr(js, buf, n);
   } else if (type == JS_STR) {  // If it's already a string (like from parse_json_value), just return it
     return args[0];
   }
@@ -635,6 +907,37 @@ static jsval_t js_number_to_string(struct js *js, jsval_t *args, int nargs) {
   return js_mkstr(js, "", 0);
 }
 
+// Array constructors: (length) or (array to copy). Typed array elements are
+// converted like stores do, e.g. Uint8Array([300]) holds 44
+static jsval_t js_new_array(struct js *js, jsval_t *args, int nargs, int kind) {
+  if (nargs < 1) return js_mkarr(js, kind, 0);
+  if (js_type(args[0]) == JS_NUM) return js_mkarr(js, kind, (size_t)js_getnum(args[0]));
+  size_t len;
+  if (js_getarr(js, args[0], NULL, &len) == NULL) return js_mkerr(js, "bad args");
+  jsval_t arr = js_mkarr(js, kind, len);
+  for (size_t i = 0; i < len && js_type(arr) != JS_ERR; i++) {
+    jsval_t res = js_arrset(js, arr, i, js_arrget(js, args[0], i));
+    if (js_type(res) == JS_ERR) return res;
+  }
+  return arr;
+}
+
+static jsval_t js_array(struct js *js, jsval_t *args, int nargs) {
+  return js_new_array(js, args, nargs, JS_ARRAY);
+}
+
+static jsval_t js_uint8_array(struct js *js, jsval_t *args, int nargs) {
+  return js_new_array(js, args, nargs, JS_UINT8);
+}
+
+static jsval_t js_int16_array(struct js *js, jsval_t *args, int nargs) {
+  return js_new_array(js, args, nargs, JS_INT16);
+}
+
+static jsval_t js_float32_array(struct js *js, jsval_t *args, int nargs) {
+  return js_new_array(js, args, nargs, JS_FLOAT32);
+}
+
 /******************************************************************************
  * F) Load GIF from SD => g_gifBuffer => "M:mygif"
  ******************************************************************************/
@@ -674,19 +977,11 @@ static jsval_t js_show_gif_from_sd(struct js *js, jsval_t *args, int nargs) {  /
     return js_mknull();
   }
 
-  // Argument 0: Get the path string
-  const char *rawPath = js_str(js, args[0]);
-  if (!rawPath) return js_mknull();
-
-  // Strip quotes from the path
-  String path(rawPath);
-  if (path.startsWith("\"") && path.endsWith("\"")) {
-    path = path.substring(1, path.length() - 1);
-  }
-
-  // Argument 1 & 2: Get the x and y coordinates
-  int x = (int)js_getnum(args[1]);
-  int y = (int)js_getnum(args[2]);
+  // Argument 0: the path, 1 & 2: the x and y coordinates
+  ElkStr path = elk_arg_str(js, args, nargs, 0);
+  int x = elk_arg_int(args, nargs, 1, 0);
+  int y = elk_arg_int(args, nargs, 2, 0);
+  if (!path.ok()) return js_mknull();
 
   // Load the specified GIF file into RAM
   if (!load_gif_into_ram(path.c_str())) {
@@ -759,6 +1054,8 @@ bool load_image_file_into_ram(const char *path, RamImage *outImg) {
   LOG("Image loaded into PSRAM successfully");
   return true;
 }
+jsval_t elk_run_script(const char *code, size_t len, bool jsc = false);
+
 bool load_and_execute_js_script(const char *path) {
   LOGF("Loading JavaScript script from: %s\n", path);
 
@@ -767,10 +1064,11 @@ bool load_and_execute_js_script(const char *path) {
     LOG("Failed to open JavaScript script file");
     return false;
   }
-  String jsScript = file.readString();
+  static String jsScript;  // Pinned by elk_run_script(), keep it for good
+  jsScript = file.readString();
   file.close();
 
-  jsval_t res = js_eval(js, jsScript.c_str(), jsScript.length());
+  jsval_t res = elk_run_script(jsScript.c_str(), jsScript.length());
   if (js_type(res) == JS_ERR) {
     const char *error = js_str(js, res);
     LOGF("Error executing script: %s\n", error);
@@ -802,23 +1100,17 @@ static jsval_t js_lvgl_draw_label(struct js *js, jsval_t *args, int nargs) {  //
     return js_mknull();
   }
 
-  const char *rawText = js_str(js, args[0]);
-  if (!rawText) return js_mknull();
-  String txt(rawText);
-  if (txt.startsWith("\"") && txt.endsWith("\"")) {
-    txt.remove(0, 1);
-    txt.remove(txt.length() - 1, 1);
-  }
-
-  int x = (int)js_getnum(args[1]);
-  int y = (int)js_getnum(args[2]);
+  ElkStr txt = elk_arg_text(js, args, nargs, 0);
+  if (!txt.ok()) return js_mknull();
+  int x = elk_arg_int(args, nargs, 1, 0);
+  int y = elk_arg_int(args, nargs, 2, 0);
 
   lv_obj_t *label = lv_label_create(lv_scr_act());
   lv_label_set_text(label, txt.c_str());
   lv_obj_set_pos(label, x, y);
 
   if (nargs >= 4) {
-    int fontSize = (int)js_getnum(args[3]);
+    int fontSize = js_getint(args[3]);
     const lv_font_t *font = get_font_for_size(fontSize);
     lv_obj_set_style_text_font(label, font, 0);
   }
@@ -831,10 +1123,10 @@ static jsval_t js_lvgl_draw_rect(struct js *js, jsval_t *args, int nargs) {
     LOG("draw_rect: expects x, y, w, h [, color]");
     return js_mknum(-1);
   }
-  int x = (int)js_getnum(args[0]);
-  int y = (int)js_getnum(args[1]);
-  int w = (int)js_getnum(args[2]);
-  int h = (int)js_getnum(args[3]);
+  int x = js_getint(args[0]);
+  int y = js_getint(args[1]);
+  int w = js_getint(args[2]);
+  int h = js_getint(args[3]);
 
   // Optional color parameter (default: green 0x00ff00)
   uint32_t color = 0x00ff00;
@@ -863,26 +1155,22 @@ static jsval_t js_lvgl_show_image(struct js *js, jsval_t *args, int nargs) {
     LOG("show_image: expects path,x,y");
     return js_mknull();
   }
-  const char *rawPath = js_str(js, args[0]);
-  int x = (int)js_getnum(args[1]);
-  int y = (int)js_getnum(args[2]);
+  ElkStr path = elk_arg_str(js, args, nargs, 0);
+  int x = elk_arg_int(args, nargs, 1, 0);
+  int y = elk_arg_int(args, nargs, 2, 0);
+  char lvglPath[256];  // "S:/filename", LVGL copies it
 
-  if (!rawPath) {
+  if (!path.ok() || path.len + 3 > sizeof(lvglPath)) {
     LOG("show_image: invalid path");
     return js_mknull();
   }
-  // Build "S:/filename"
-  String path(rawPath);
-  if (path.startsWith("\"") && path.endsWith("\"")) {
-    path = path.substring(1, path.length() - 1);
-  }
-  String lvglPath = "S:" + path;
+  snprintf(lvglPath, sizeof(lvglPath), "S:%s", path.c_str());
 
   lv_obj_t *img = lv_img_create(lv_scr_act());
-  lv_img_set_src(img, lvglPath.c_str());
+  lv_img_set_src(img, lvglPath);
   lv_obj_set_pos(img, x, y);
 
-  LOGF("show_image: '%s' at (%d,%d)\n", lvglPath.c_str(), x, y);
+  LOGF("show_image: '%s' at (%d,%d)\n", lvglPath, x, y);
   return js_mknull();
 }
 
@@ -934,23 +1222,19 @@ static jsval_t js_create_image(struct js *js, jsval_t *args, int nargs) {
     LOG("create_image: expects path,x,y");
     return js_mknum(-1);
   }
-  const char *rawPath = js_str(js, args[0]);
-  int x = (int)js_getnum(args[1]);
-  int y = (int)js_getnum(args[2]);
-  if (!rawPath) return js_mknum(-1);
-
-  String path(rawPath);
-  if (path.startsWith("\"") && path.endsWith("\"")) {
-    path = path.substring(1, path.length() - 1);
-  }
-  String fullPath = "S:" + path;
+  ElkStr path = elk_arg_str(js, args, nargs, 0);
+  int x = elk_arg_int(args, nargs, 1, 0);
+  int y = elk_arg_int(args, nargs, 2, 0);
+  char fullPath[256];  // "S:/filename", LVGL copies it
+  if (!path.ok() || path.len + 3 > sizeof(fullPath)) return js_mknum(-1);
+  snprintf(fullPath, sizeof(fullPath), "S:%s", path.c_str());
 
   lv_obj_t *img = lv_img_create(lv_scr_act());
-  lv_img_set_src(img, fullPath.c_str());
+  lv_img_set_src(img, fullPath);
   lv_obj_set_pos(img, x, y);
 
   int handle = store_lv_obj(img);
-  LOGF("create_image: '%s' => handle %d\n", fullPath.c_str(), handle);
+  LOGF("create_image: '%s' => handle %d\n", fullPath, handle);
   return js_mknum(handle);
 }
 
@@ -961,10 +1245,10 @@ static jsval_t js_create_image_from_ram(struct js *js, jsval_t *args, int nargs)
     return js_mknum(-1);
   }
 
-  const char *rawPath = js_str(js, args[0]);
-  int x = (int)js_getnum(args[1]);
-  int y = (int)js_getnum(args[2]);
-  if (!rawPath) return js_mknum(-1);
+  ElkStr path = elk_arg_str(js, args, nargs, 0);
+  int x = elk_arg_int(args, nargs, 1, 0);
+  int y = elk_arg_int(args, nargs, 2, 0);
+  if (!path.ok()) return js_mknum(-1);
 
   int slot = -1;
   for (int i = 0; i < MAX_RAM_IMAGES; i++) {
@@ -979,11 +1263,6 @@ static jsval_t js_create_image_from_ram(struct js *js, jsval_t *args, int nargs)
   }
   RamImage *ri = &g_ram_images[slot];
 
-  String path = String(rawPath);
-  if (path.startsWith("\"") && path.endsWith("\"")) {
-    path = path.substring(1, path.length() - 1);
-  }
-
   if (!load_image_file_into_ram(path.c_str(), ri)) {
     LOG("Could not load image into RAM");
     return js_mknum(-1);
@@ -1006,8 +1285,8 @@ static jsval_t js_rotate_obj(struct js *js, jsval_t *args, int nargs) {
     LOG("rotate_obj: expects handle, angle");
     return js_mknull();
   }
-  int handle = (int)js_getnum(args[0]);
-  int angle = (int)js_getnum(args[1]);  // 0..3600 => 0..360 deg
+  int handle = js_getint(args[0]);
+  int angle = js_getint(args[1]);  // 0..3600 => 0..360 deg
 
   lv_obj_t *obj = get_lv_obj(handle);
   if (!obj) {
@@ -1026,9 +1305,9 @@ static jsval_t js_move_obj(struct js *js, jsval_t *args, int nargs) {
     LOG("move_obj: expects handle,x,y");
     return js_mknull();
   }
-  int handle = (int)js_getnum(args[0]);
-  int x = (int)js_getnum(args[1]);
-  int y = (int)js_getnum(args[2]);
+  int handle = js_getint(args[0]);
+  int x = js_getint(args[1]);
+  int y = js_getint(args[2]);
 
   lv_obj_t *obj = get_lv_obj(handle);
   if (!obj) {
@@ -1056,12 +1335,12 @@ static jsval_t js_animate_obj(struct js *js, jsval_t *args, int nargs) {
     LOG("animate_obj: expects handle,x0,y0,x1,y1,[duration]");
     return js_mknull();
   }
-  int handle = (int)js_getnum(args[0]);
-  int x0 = (int)js_getnum(args[1]);
-  int y0 = (int)js_getnum(args[2]);
-  int x1 = (int)js_getnum(args[3]);
-  int y1 = (int)js_getnum(args[4]);
-  int duration = (nargs >= 6) ? (int)js_getnum(args[5]) : 1000;
+  int handle = js_getint(args[0]);
+  int x0 = js_getint(args[1]);
+  int y0 = js_getint(args[2]);
+  int x1 = js_getint(args[3]);
+  int y1 = js_getint(args[4]);
+  int duration = (nargs >= 6) ? js_getint(args[5]) : 1000;
 
   lv_obj_t *obj = get_lv_obj(handle);
   if (!obj) {
@@ -1104,10 +1383,73 @@ static lv_style_t *get_lv_style(int handle) {
   if (handle < 0 || handle >= MAX_STYLES) return nullptr;
   return g_style_map[handle];
 }
+
+// Bindings generated from the native signature. ELK_BIND(lv_style_set_radius)
+// is the native function for style_set_radius(styleHandle, radius): it takes
+// one JS argument per C parameter and converts each by its C type. A missing
+// or mistyped argument, or a stale handle, skips the call and returns null
+static bool elk_conv(struct js *, jsval_t v, lv_obj_t **out) {
+  return js_type(v) == JS_NUM && (*out = get_lv_obj(js_getint(v))) != nullptr;
+}
+
+static bool elk_conv(struct js *, jsval_t v, lv_style_t **out) {
+  return js_type(v) == JS_NUM && (*out = get_lv_style(js_getint(v))) != nullptr;
+}
+
+static bool elk_conv(struct js *js, jsval_t v, lv_color_t *out) {  // 0xRRGGBB or "#RRGGBB"
+  size_t len;
+  const char *s = js_type(v) == JS_STR ? js_getstr(js, v, &len) : NULL;
+  if (s != NULL && len == 7 && s[0] == '#') {
+    *out = lv_color_hex((uint32_t)strtoul(s + 1, NULL, 16));
+    return true;
+  }
+  if (js_type(v) != JS_NUM) return false;
+  *out = lv_color_hex((uint32_t)js_getnum(v));
+  return true;
+}
+
+static bool elk_conv(struct js *js, jsval_t v, bool *out) {  // true, 1, ...
+  *out = js_truthy(js, v);
+  return true;
+}
+
+// Coordinates, opacities, flags, parts and LVGL enums
+template <typename T>
+static bool elk_conv(struct js *, jsval_t v, T *out) {
+  static_assert(std::is_integral<T>::value || std::is_enum<T>::value,
+                "no elk_conv for this parameter type");
+  if (js_type(v) != JS_NUM) return false;
+  *out = (T)js_getint(v);
+  return true;
+}
+
+template <int... I> struct ElkSeq {};
+template <int N, int... I> struct ElkMakeSeq : ElkMakeSeq<N - 1, N - 1, I...> {};
+template <int... I> struct ElkMakeSeq<0, I...> { typedef ElkSeq<I...> type; };
+
+template <typename F, F fn> struct ElkBind;
+template <typename... A, void (*fn)(A...)>
+struct ElkBind<void (*)(A...), fn> {
+  static jsval_t call(struct js *js, jsval_t *args, int nargs) {
+    if (nargs < (int)sizeof...(A)) return js_mknull();
+    return call(js, args, typename ElkMakeSeq<sizeof...(A)>::type());
+  }
+  template <int... I>
+  static jsval_t call(struct js *js, jsval_t *args, ElkSeq<I...>) {
+    std::tuple<typename std::decay<A>::type...> v;
+    bool ok[] = {true, elk_conv(js, args[I], &std::get<I>(v))...};
+    for (bool b : ok)
+      if (!b) return js_mknull();
+    fn(std::get<I>(v)...);
+    return js_mknull();
+  }
+};
+
+#define ELK_BIND(fn) (ElkBind<decltype(&fn), &fn>::call)
 static jsval_t js_create_label(struct js *js, jsval_t *args, int nargs) {
   if (nargs < 2) return js_mknum(-1);  // need x,y
-  int x = (int)js_getnum(args[0]);
-  int y = (int)js_getnum(args[1]);
+  int x = js_getint(args[0]);
+  int y = js_getint(args[1]);
 
   lv_obj_t *label = lv_label_create(lv_scr_act());
   lv_obj_set_pos(label, x, y);
@@ -1118,12 +1460,9 @@ static jsval_t js_create_label(struct js *js, jsval_t *args, int nargs) {
 
 static jsval_t js_label_set_text(struct js *js, jsval_t *args, int nargs) {
   if (nargs < 2) return js_mknull();
-  int lblHandle = (int)js_getnum(args[0]);
-  const char *rawText = js_str(js, args[1]);
-  if (!rawText) {
-    LOG("label_set_text: invalid text argument");
-    return js_mknull();
-  }
+  int lblHandle = js_getint(args[0]);
+  ElkStr text = elk_arg_text(js, args, nargs, 1);
+  if (!text.ok()) return js_mknull();
 
   // Check memory before doing anything - fail early if critically low
   size_t freeHeap = ESP.getFreeHeap();
@@ -1139,37 +1478,23 @@ static jsval_t js_label_set_text(struct js *js, jsval_t *args, int nargs) {
     return js_mknull();
   }
 
-  // Use static buffer to avoid heap allocation - max 256 chars
+  // LVGL copies the text, so set it straight from the JS heap. Only longer
+  // text than 255 chars goes through a static buffer, to cut it there
   static char textBuffer[256];
-  size_t rawLen = strlen(rawText);
-
-  // Strip surrounding quotes if present, using C-style operations
-  const char *start = rawText;
-  size_t len = rawLen;
-
-  if (rawLen >= 2 && rawText[0] == '"' && rawText[rawLen - 1] == '"') {
-    start = rawText + 1;
-    len = rawLen - 2;
-  }
-
-  // Clamp to buffer size
-  if (len >= sizeof(textBuffer)) {
-    len = sizeof(textBuffer) - 1;
+  if (text.len >= sizeof(textBuffer)) {
+    memcpy(textBuffer, text.ptr, sizeof(textBuffer) - 1);
+    textBuffer[sizeof(textBuffer) - 1] = '\0';
+    text.ptr = textBuffer;
   }
-
-  memcpy(textBuffer, start, len);
-  textBuffer[len] = '\0';
-
-  // Set the text
-  lv_label_set_text(label, textBuffer);
+  lv_label_set_text(label, text.c_str());
   return js_mknull();
 }
 
 // style_set_text_font(styleHandle, fontSize)
 static jsval_t js_style_set_text_font(struct js *js, jsval_t *args, int nargs) {
   if (nargs < 2) return js_mknull();
-  int styleH = (int)js_getnum(args[0]);
-  int fontSize = (int)js_getnum(args[1]);
+  int styleH = js_getint(args[0]);
+  int fontSize = js_getint(args[1]);
 
   // Convert the style handle to an lv_style_t*
   lv_style_t *st = get_lv_style(styleH);
@@ -1178,560 +1503,42 @@ static jsval_t js_style_set_text_font(struct js *js, jsval_t *args, int nargs) {
   // Pick a built-in font
   const lv_font_t *font = get_font_for_size(fontSize);
 
-  // Apply it
-  lv_style_set_text_font(st, font);
-
-  return js_mknull();
-}
-
-// style_set_text_align(styleHandle, align)
-static jsval_t js_style_set_text_align(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 2) return js_mknull();
-  int styleH = (int)js_getnum(args[0]);
-  int alignVal = (int)js_getnum(args[1]);  // e.g. 0 for LEFT, 1 for CENTER, etc.
-
-  lv_style_t *st = get_lv_style(styleH);
-  if (!st) return js_mknull();
-
-  // In LVGL 8.x: LV_TEXT_ALIGN_LEFT=0, _CENTER=1, _RIGHT=2, _AUTO=3
-  lv_style_set_text_align(st, (lv_text_align_t)alignVal);
-
-  return js_mknull();
-}
-
-// create_style()
-static jsval_t js_create_style(struct js *js, jsval_t *args, int nargs) {
-  for (int i = 0; i < MAX_STYLES; i++) {
-    if (!g_style_map[i]) {
-      lv_style_t *st = new lv_style_t;
-      lv_style_init(st);
-      g_style_map[i] = st;
-      // Style created with handle i
-      return js_mknum(i);
-    }
-  }
-  LOG("create_style => no free style slots");
-  return js_mknum(-1);
-}
-
-// obj_add_style(objHandle, styleHandle, partOrState)
-static jsval_t js_obj_add_style(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 2) return js_mknull();
-  int objHandle = (int)js_getnum(args[0]);
-  int styleHandle = (int)js_getnum(args[1]);
-  int partState = 0;
-  if (nargs >= 3) partState = (int)js_getnum(args[2]);
-
-  lv_obj_t *obj = get_lv_obj(objHandle);
-  lv_style_t *st = get_lv_style(styleHandle);
-  if (!obj || !st) {
-    LOG("obj_add_style => invalid handle");
-    return js_mknull();
-  }
-  lv_obj_add_style(obj, st, partState);
-  return js_mknull();
-}
-
-// ***Full style property setters***
-static jsval_t js_style_set_radius(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 2) return js_mknull();
-  int styleH = (int)js_getnum(args[0]);
-  int radius = (int)js_getnum(args[1]);
-  lv_style_t *st = get_lv_style(styleH);
-  if (!st) return js_mknull();
-  lv_style_set_radius(st, (lv_coord_t)radius);
-  return js_mknull();
-}
-
-static jsval_t js_style_set_bg_opa(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 2) return js_mknull();
-  int styleH = (int)js_getnum(args[0]);
-  int opaVal = (int)js_getnum(args[1]);
-  lv_style_t *st = get_lv_style(styleH);
-  if (!st) return js_mknull();
-  lv_style_set_bg_opa(st, (lv_opa_t)opaVal);
-  return js_mknull();
-}
-
-static jsval_t js_style_set_bg_color(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 2) return js_mknull();
-  int styleH = (int)js_getnum(args[0]);
-  double color = js_getnum(args[1]);  // numeric hex
-  lv_style_t *st = get_lv_style(styleH);
-  if (!st) return js_mknull();
-  lv_style_set_bg_color(st, lv_color_hex((uint32_t)color));
-  return js_mknull();
-}
-
-static jsval_t js_style_set_border_color(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 2) return js_mknull();
-  int styleH = (int)js_getnum(args[0]);
-  double color = js_getnum(args[1]);
-  lv_style_t *st = get_lv_style(styleH);
-  if (!st) return js_mknull();
-  lv_style_set_border_color(st, lv_color_hex((uint32_t)color));
-  return js_mknull();
-}
-
-static jsval_t js_style_set_border_width(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 2) return js_mknull();
-  int styleH = (int)js_getnum(args[0]);
-  int bw = (int)js_getnum(args[1]);
-  lv_style_t *st = get_lv_style(styleH);
-  if (!st) return js_mknull();
-  lv_style_set_border_width(st, bw);
-  return js_mknull();
-}
-
-static jsval_t js_style_set_border_opa(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 2) return js_mknull();
-  int styleH = (int)js_getnum(args[0]);
-  int opa = (int)js_getnum(args[1]);
-  lv_style_t *st = get_lv_style(styleH);
-  if (!st) return js_mknull();
-  lv_style_set_border_opa(st, (lv_opa_t)opa);
-  return js_mknull();
-}
-
-static jsval_t js_style_set_border_side(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 2) return js_mknull();
-  int styleH = (int)js_getnum(args[0]);
-  int side = (int)js_getnum(args[1]);  // e.g. LV_BORDER_SIDE_BOTTOM|LV_BORDER_SIDE_RIGHT
-  lv_style_t *st = get_lv_style(styleH);
-  if (!st) return js_mknull();
-  lv_style_set_border_side(st, side);
-  return js_mknull();
-}
-
-// Outline
-static jsval_t js_style_set_outline_width(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 2) return js_mknull();
-  int styleH = (int)js_getnum(args[0]);
-  int w = (int)js_getnum(args[1]);
-  lv_style_t *st = get_lv_style(styleH);
-  if (!st) return js_mknull();
-  lv_style_set_outline_width(st, w);
-  return js_mknull();
-}
-
-static jsval_t js_style_set_outline_color(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 2) return js_mknull();
-  int styleH = (int)js_getnum(args[0]);
-  double col = js_getnum(args[1]);
-  lv_style_t *st = get_lv_style(styleH);
-  if (!st) return js_mknull();
-  lv_style_set_outline_color(st, lv_color_hex((uint32_t)col));
-  return js_mknull();
-}
-
-static jsval_t js_style_set_outline_pad(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 2) return js_mknull();
-  int styleH = (int)js_getnum(args[0]);
-  int pad = (int)js_getnum(args[1]);
-  lv_style_t *st = get_lv_style(styleH);
-  if (!st) return js_mknull();
-  lv_style_set_outline_pad(st, pad);
-  return js_mknull();
-}
-
-// Shadow
-static jsval_t js_style_set_shadow_width(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 2) return js_mknull();
-  int styleH = (int)js_getnum(args[0]);
-  int w = (int)js_getnum(args[1]);
-  lv_style_t *st = get_lv_style(styleH);
-  if (!st) return js_mknull();
-  lv_style_set_shadow_width(st, w);
-  return js_mknull();
-}
-
-static jsval_t js_style_set_shadow_color(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 2) return js_mknull();
-  int styleH = (int)js_getnum(args[0]);
-  double color = js_getnum(args[1]);
-  lv_style_t *st = get_lv_style(styleH);
-  if (!st) return js_mknull();
-  lv_style_set_shadow_color(st, lv_color_hex((uint32_t)color));
-  return js_mknull();
-}
-
-static jsval_t js_style_set_shadow_ofs_x(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 2) return js_mknull();
-  int styleH = (int)js_getnum(args[0]);
-  int ofs = (int)js_getnum(args[1]);
-  lv_style_t *st = get_lv_style(styleH);
-  if (!st) return js_mknull();
-  lv_style_set_shadow_ofs_x(st, ofs);
-  return js_mknull();
-}
-
-static jsval_t js_style_set_shadow_ofs_y(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 2) return js_mknull();
-  int styleH = (int)js_getnum(args[0]);
-  int ofs = (int)js_getnum(args[1]);
-  lv_style_t *st = get_lv_style(styleH);
-  if (!st) return js_mknull();
-  lv_style_set_shadow_ofs_y(st, ofs);
-  return js_mknull();
-}
-
-// Image recolor, transform
-static jsval_t js_style_set_img_recolor(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 2) return js_mknull();
-  int styleH = (int)js_getnum(args[0]);
-  double color = js_getnum(args[1]);
-  lv_style_t *st = get_lv_style(styleH);
-  if (!st) return js_mknull();
-  lv_style_set_img_recolor(st, lv_color_hex((uint32_t)color));
-  return js_mknull();
-}
-
-static jsval_t js_style_set_img_recolor_opa(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 2) return js_mknull();
-  int styleH = (int)js_getnum(args[0]);
-  int opa = (int)js_getnum(args[1]);
-  lv_style_t *st = get_lv_style(styleH);
-  if (!st) return js_mknull();
-  lv_style_set_img_recolor_opa(st, (lv_opa_t)opa);
-  return js_mknull();
-}
-
-static jsval_t js_style_set_transform_angle(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 2) return js_mknull();
-  int styleH = (int)js_getnum(args[0]);
-  int angle = (int)js_getnum(args[1]);
-  lv_style_t *st = get_lv_style(styleH);
-  if (!st) return js_mknull();
-  lv_style_set_transform_angle(st, (lv_coord_t)angle);
-  return js_mknull();
-}
-
-// Text
-static jsval_t js_style_set_text_color(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 2) return js_mknull();
-  int styleH = (int)js_getnum(args[0]);
-  double color = js_getnum(args[1]);
-  lv_style_t *st = get_lv_style(styleH);
-  if (!st) return js_mknull();
-  lv_style_set_text_color(st, lv_color_hex((uint32_t)color));
-  return js_mknull();
-}
-
-static jsval_t js_style_set_text_letter_space(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 2) return js_mknull();
-  int styleH = (int)js_getnum(args[0]);
-  int space = (int)js_getnum(args[1]);
-  lv_style_t *st = get_lv_style(styleH);
-  if (!st) return js_mknull();
-  lv_style_set_text_letter_space(st, space);
-  return js_mknull();
-}
-
-static jsval_t js_style_set_text_line_space(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 2) return js_mknull();
-  int styleH = (int)js_getnum(args[0]);
-  int space = (int)js_getnum(args[1]);
-  lv_style_t *st = get_lv_style(styleH);
-  if (!st) return js_mknull();
-  lv_style_set_text_line_space(st, space);
-  return js_mknull();
-}
-
-static jsval_t js_style_set_text_decor(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 2) return js_mknull();
-  int styleH = (int)js_getnum(args[0]);
-  int decor = (int)js_getnum(args[1]);  // e.g. LV_TEXT_DECOR_UNDERLINE
-  lv_style_t *st = get_lv_style(styleH);
-  if (!st) return js_mknull();
-  lv_style_set_text_decor(st, decor);
-  return js_mknull();
-}
-
-// Line
-static jsval_t js_style_set_line_color(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 2) return js_mknull();
-  int styleH = (int)js_getnum(args[0]);
-  double color = js_getnum(args[1]);
-  lv_style_t *st = get_lv_style(styleH);
-  if (!st) return js_mknull();
-  lv_style_set_line_color(st, lv_color_hex((uint32_t)color));
-  return js_mknull();
-}
-
-static jsval_t js_style_set_line_width(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 2) return js_mknull();
-  int styleH = (int)js_getnum(args[0]);
-  int w = (int)js_getnum(args[1]);
-  lv_style_t *st = get_lv_style(styleH);
-  if (!st) return js_mknull();
-  lv_style_set_line_width(st, w);
-  return js_mknull();
-}
-
-static jsval_t js_style_set_line_rounded(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 2) return js_mknull();
-  int styleH = (int)js_getnum(args[0]);
-  bool round = (bool)js_getnum(args[1]);
-  lv_style_t *st = get_lv_style(styleH);
-  if (!st) return js_mknull();
-  lv_style_set_line_rounded(st, round);
-  return js_mknull();
-}
-
-// Padding
-static jsval_t js_style_set_pad_all(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 2) return js_mknull();
-  int styleH = (int)js_getnum(args[0]);
-  int pad = (int)js_getnum(args[1]);
-  lv_style_t *st = get_lv_style(styleH);
-  if (!st) return js_mknull();
-  lv_style_set_pad_all(st, pad);
-  return js_mknull();
-}
-
-static jsval_t js_style_set_pad_left(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 2) return js_mknull();
-  int styleH = (int)js_getnum(args[0]);
-  int pad = (int)js_getnum(args[1]);
-  lv_style_t *st = get_lv_style(styleH);
-  if (!st) return js_mknull();
-  lv_style_set_pad_left(st, pad);
-  return js_mknull();
-}
-
-static jsval_t js_style_set_pad_right(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 2) return js_mknull();
-  int styleH = (int)js_getnum(args[0]);
-  int pad = (int)js_getnum(args[1]);
-  lv_style_t *st = get_lv_style(styleH);
-  if (!st) return js_mknull();
-  lv_style_set_pad_right(st, pad);
-  return js_mknull();
-}
-
-static jsval_t js_style_set_pad_top(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 2) return js_mknull();
-  int styleH = (int)js_getnum(args[0]);
-  int pad = (int)js_getnum(args[1]);
-  lv_style_t *st = get_lv_style(styleH);
-  if (!st) return js_mknull();
-  lv_style_set_pad_top(st, pad);
-  return js_mknull();
-}
-
-static jsval_t js_style_set_pad_bottom(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 2) return js_mknull();
-  int styleH = (int)js_getnum(args[0]);
-  int pad = (int)js_getnum(args[1]);
-  lv_style_t *st = get_lv_style(styleH);
-  if (!st) return js_mknull();
-  lv_style_set_pad_bottom(st, pad);
-  return js_mknull();
-}
-
-static jsval_t js_style_set_pad_ver(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 2) return js_mknull();
-  int styleH = (int)js_getnum(args[0]);
-  int pad = (int)js_getnum(args[1]);
-  lv_style_t *st = get_lv_style(styleH);
-  if (!st) return js_mknull();
-  lv_style_set_pad_ver(st, pad);
-  return js_mknull();
-}
-
-static jsval_t js_style_set_pad_hor(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 2) return js_mknull();
-  int styleH = (int)js_getnum(args[0]);
-  int pad = (int)js_getnum(args[1]);
-  lv_style_t *st = get_lv_style(styleH);
-  if (!st) return js_mknull();
-  lv_style_set_pad_hor(st, pad);
-  return js_mknull();
-}
-
-// Some dimension-related style props
-static jsval_t js_style_set_width(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 2) return js_mknull();
-  int styleH = (int)js_getnum(args[0]);
-  int w = (int)js_getnum(args[1]);
-  lv_style_t *st = get_lv_style(styleH);
-  if (!st) return js_mknull();
-  lv_style_set_width(st, (lv_coord_t)w);
-  return js_mknull();
-}
-
-static jsval_t js_style_set_height(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 2) return js_mknull();
-  int styleH = (int)js_getnum(args[0]);
-  int h = (int)js_getnum(args[1]);
-  lv_style_t *st = get_lv_style(styleH);
-  if (!st) return js_mknull();
-  lv_style_set_height(st, (lv_coord_t)h);
-  return js_mknull();
-}
-
-static jsval_t js_style_set_x(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 2) return js_mknull();
-  int styleH = (int)js_getnum(args[0]);
-  double val = js_getnum(args[1]);
-  lv_style_t *st = get_lv_style(styleH);
-  if (!st) return js_mknull();
-  lv_style_set_x(st, (lv_coord_t)val);
-  return js_mknull();
-}
-
-static jsval_t js_style_set_y(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 2) return js_mknull();
-  int styleH = (int)js_getnum(args[0]);
-  double val = js_getnum(args[1]);
-  lv_style_t *st = get_lv_style(styleH);
-  if (!st) return js_mknull();
-  lv_style_set_y(st, (lv_coord_t)val);
-  return js_mknull();
-}
-
-/******************************************************************************
- * H2) Additional object property functions
- ******************************************************************************/
-static jsval_t js_obj_set_size(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 3) return js_mknull();
-  int handle = (int)js_getnum(args[0]);
-  int w = (int)js_getnum(args[1]);
-  int h = (int)js_getnum(args[2]);
-
-  lv_obj_t *obj = get_lv_obj(handle);
-  if (!obj) {
-    LOGF("obj_set_size => invalid handle %d\n", handle);
-    return js_mknull();
-  }
-  lv_obj_set_size(obj, w, h);
-  return js_mknull();
-}
-
-// obj_align(objHandle, alignConst, xOfs, yOfs)
-static jsval_t js_obj_align(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 4) return js_mknull();
-  int handle = (int)js_getnum(args[0]);
-  int alignVal = (int)js_getnum(args[1]);
-  int xOfs = (int)js_getnum(args[2]);
-  int yOfs = (int)js_getnum(args[3]);
-
-  lv_obj_t *obj = get_lv_obj(handle);
-  if (!obj) {
-    LOGF("obj_align => invalid handle %d\n", handle);
-    return js_mknull();
-  }
-  lv_obj_align(obj, (lv_align_t)alignVal, xOfs, yOfs);
-  return js_mknull();
-}
-
-/******************************************************************************
- * ***ADDED FOR NEW EXAMPLES***
- * For scrolling, flex, flags, etc.
- ******************************************************************************/
-static jsval_t js_obj_set_scroll_snap_x(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 2) return js_mknull();
-  int handle = (int)js_getnum(args[0]);
-  int snap_mode = (int)js_getnum(args[1]);  // numeric for LV_SCROLL_SNAP_x
-  lv_obj_t *obj = get_lv_obj(handle);
-  if (!obj) return js_mknull();
-  lv_obj_set_scroll_snap_x(obj, (lv_scroll_snap_t)snap_mode);
-  return js_mknull();
-}
-
-static jsval_t js_obj_set_scroll_snap_y(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 2) return js_mknull();
-  int handle = (int)js_getnum(args[0]);
-  int snap_mode = (int)js_getnum(args[1]);
-  lv_obj_t *obj = get_lv_obj(handle);
-  if (!obj) return js_mknull();
-  lv_obj_set_scroll_snap_y(obj, (lv_scroll_snap_t)snap_mode);
-  return js_mknull();
-}
-
-static jsval_t js_obj_add_flag(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 2) return js_mknull();
-  int handle = (int)js_getnum(args[0]);
-  int flag = (int)js_getnum(args[1]);
-  lv_obj_t *obj = get_lv_obj(handle);
-  if (!obj) return js_mknull();
-  lv_obj_add_flag(obj, (lv_obj_flag_t)flag);
-  return js_mknull();
-}
-
-static jsval_t js_obj_clear_flag(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 2) return js_mknull();
-  int handle = (int)js_getnum(args[0]);
-  int flag = (int)js_getnum(args[1]);
-  lv_obj_t *obj = get_lv_obj(handle);
-  if (!obj) return js_mknull();
-  lv_obj_clear_flag(obj, (lv_obj_flag_t)flag);
-  return js_mknull();
-}
-
-static jsval_t js_obj_set_scroll_dir(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 2) return js_mknull();
-  int handle = (int)js_getnum(args[0]);
-  int dir = (int)js_getnum(args[1]);  // e.g. LV_DIR_VER or ...
-  lv_obj_t *obj = get_lv_obj(handle);
-  if (!obj) return js_mknull();
-  lv_obj_set_scroll_dir(obj, (lv_dir_t)dir);
-  return js_mknull();
-}
-
-static jsval_t js_obj_set_scrollbar_mode(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 2) return js_mknull();
-  int handle = (int)js_getnum(args[0]);
-  int mode = (int)js_getnum(args[1]);  // e.g. LV_SCROLLBAR_MODE_OFF
-  lv_obj_t *obj = get_lv_obj(handle);
-  if (!obj) return js_mknull();
-  lv_obj_set_scrollbar_mode(obj, (lv_scrollbar_mode_t)mode);
-  return js_mknull();
-}
-
-static jsval_t js_obj_set_flex_flow(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 2) return js_mknull();
-  int handle = (int)js_getnum(args[0]);
-  int flowEnum = (int)js_getnum(args[1]);  // e.g. LV_FLEX_FLOW_ROW_WRAP
-  lv_obj_t *obj = get_lv_obj(handle);
-  if (!obj) return js_mknull();
-  lv_obj_set_flex_flow(obj, (lv_flex_flow_t)flowEnum);
-  return js_mknull();
-}
-
-static jsval_t js_obj_set_flex_align(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 4) return js_mknull();
-  int handle = (int)js_getnum(args[0]);
-  int main_place = (int)js_getnum(args[1]);
-  int cross_place = (int)js_getnum(args[2]);
-  int track_place = (int)js_getnum(args[3]);
-  lv_obj_t *obj = get_lv_obj(handle);
-  if (!obj) return js_mknull();
-  lv_obj_set_flex_align(obj, (lv_flex_align_t)main_place,
-                        (lv_flex_align_t)cross_place,
-                        (lv_flex_align_t)track_place);
+  // Apply it
+  lv_style_set_text_font(st, font);
+
   return js_mknull();
 }
 
-static jsval_t js_obj_set_style_clip_corner(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 3) return js_mknull();
-  int handle = (int)js_getnum(args[0]);
-  bool en = (bool)js_getnum(args[1]);
-  int part = (int)js_getnum(args[2]);
-  lv_obj_t *obj = get_lv_obj(handle);
-  if (!obj) return js_mknull();
-  lv_obj_set_style_clip_corner(obj, en, part);
-  return js_mknull();
+// create_style()
+static jsval_t js_create_style(struct js *js, jsval_t *args, int nargs) {
+  for (int i = 0; i < MAX_STYLES; i++) {
+    if (!g_style_map[i]) {
+      lv_style_t *st = new lv_style_t;
+      lv_style_init(st);
+      g_style_map[i] = st;
+      // Style created with handle i
+      return js_mknum(i);
+    }
+  }
+  LOG("create_style => no free style slots");
+  return js_mknum(-1);
 }
 
-static jsval_t js_obj_set_style_base_dir(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 3) return js_mknull();
-  int handle = (int)js_getnum(args[0]);
-  int base_dir = (int)js_getnum(args[1]);  // e.g. LV_BASE_DIR_RTL
-  int part = (int)js_getnum(args[2]);
-  lv_obj_t *obj = get_lv_obj(handle);
-  if (!obj) return js_mknull();
-  lv_obj_set_style_base_dir(obj, (lv_base_dir_t)base_dir, part);
+// obj_add_style(objHandle, styleHandle, partOrState)
+static jsval_t js_obj_add_style(struct js *js, jsval_t *args, int nargs) {
+  if (nargs < 2) return js_mknull();
+  int objHandle = js_getint(args[0]);
+  int styleHandle = js_getint(args[1]);
+  int partState = 0;
+  if (nargs >= 3) partState = js_getint(args[2]);
+
+  lv_obj_t *obj = get_lv_obj(objHandle);
+  lv_style_t *st = get_lv_style(styleHandle);
+  if (!obj || !st) {
+    LOG("obj_add_style => invalid handle");
+    return js_mknull();
+  }
+  lv_obj_add_style(obj, st, partState);
   return js_mknull();
 }
 
@@ -1753,87 +1560,11 @@ static jsval_t js_lv_chart_create(struct js *js, jsval_t *args, int nargs) {  //
   return js_mknum(handle);
 }
 
-static jsval_t js_lv_chart_set_type(struct js *js, jsval_t *args, int nargs) {  // (handle, lv_chart_type int)
-  if (nargs < 2) return js_mknull();
-  int h = (int)js_getnum(args[0]);
-  int t = (int)js_getnum(args[1]);  // e.g. LV_CHART_TYPE_LINE, LV_CHART_TYPE_BAR, etc.
-
-  lv_obj_t *obj = get_lv_obj(h);
-  if (!obj) return js_mknull();
-
-  lv_chart_set_type(obj, (lv_chart_type_t)t);
-  return js_mknull();
-}
-
-static jsval_t js_lv_chart_set_div_line_count(struct js *js, jsval_t *args, int nargs) {  // (handle, y_div, x_div)
-  if (nargs < 3) return js_mknull();
-  int h = (int)js_getnum(args[0]);
-  int y_div = (int)js_getnum(args[1]);
-  int x_div = (int)js_getnum(args[2]);
-
-  lv_obj_t *obj = get_lv_obj(h);
-  if (!obj) return js_mknull();
-
-  lv_chart_set_div_line_count(obj, y_div, x_div);
-  return js_mknull();
-}
-
-static jsval_t js_lv_chart_set_update_mode(struct js *js, jsval_t *args, int nargs) {  // (handle, mode)
-  // e.g. mode = LV_CHART_UPDATE_MODE_SHIFT, LV_CHART_UPDATE_MODE_CIRCULAR
-  if (nargs < 2) return js_mknull();
-  int h = (int)js_getnum(args[0]);
-  int mode = (int)js_getnum(args[1]);
-
-  lv_obj_t *obj = get_lv_obj(h);
-  if (!obj) return js_mknull();
-
-  lv_chart_set_update_mode(obj, (lv_chart_update_mode_t)mode);
-  return js_mknull();
-}
-
-static jsval_t js_lv_chart_set_range(struct js *js, jsval_t *args, int nargs) {  // (handle, axis, min, max)
-  // e.g. axis=LV_CHART_AXIS_PRIMARY_Y, min=0, max=100
-  if (nargs < 4) return js_mknull();
-  int h = (int)js_getnum(args[0]);
-  int axis = (int)js_getnum(args[1]);
-  int mn = (int)js_getnum(args[2]);
-  int mx = (int)js_getnum(args[3]);
-
-  lv_obj_t *obj = get_lv_obj(h);
-  if (!obj) return js_mknull();
-
-  lv_chart_set_range(obj, (lv_chart_axis_t)axis, mn, mx);
-  return js_mknull();
-}
-
-static jsval_t js_lv_chart_set_point_count(struct js *js, jsval_t *args, int nargs) {  // (handle, count)
-  if (nargs < 2) return js_mknull();
-  int h = (int)js_getnum(args[0]);
-  int c = (int)js_getnum(args[1]);
-
-  lv_obj_t *obj = get_lv_obj(h);
-  if (!obj) return js_mknull();
-
-  lv_chart_set_point_count(obj, c);
-  return js_mknull();
-}
-
-static jsval_t js_lv_chart_refresh(struct js *js, jsval_t *args, int nargs) {  // (handle)
-  if (nargs < 1) return js_mknull();
-  int h = (int)js_getnum(args[0]);
-
-  lv_obj_t *obj = get_lv_obj(h);
-  if (!obj) return js_mknull();
-
-  lv_chart_refresh(obj);
-  return js_mknull();
-}
-
 static jsval_t js_lv_chart_add_series(struct js *js, jsval_t *args, int nargs) {  // (handle, color, axis)
   if (nargs < 3) return js_mknull();
-  int h = (int)js_getnum(args[0]);
+  int h = js_getint(args[0]);
   double col = js_getnum(args[1]);
-  int axis = (int)js_getnum(args[2]);
+  int axis = js_getint(args[2]);
 
   lv_obj_t *obj = get_lv_obj(h);
   if (!obj) return js_mknull();
@@ -1847,9 +1578,9 @@ static jsval_t js_lv_chart_add_series(struct js *js, jsval_t *args, int nargs) {
 
 static jsval_t js_lv_chart_set_next_value(struct js *js, jsval_t *args, int nargs) {  // (chartHandle, seriesPtr, value)
   if (nargs < 3) return js_mknull();
-  int h = (int)js_getnum(args[0]);
+  int h = js_getint(args[0]);
   intptr_t sp = (intptr_t)js_getnum(args[1]);
-  int val = (int)js_getnum(args[2]);
+  int val = js_getint(args[2]);
 
   lv_obj_t *chart = get_lv_obj(h);
   if (!chart) return js_mknull();
@@ -1861,10 +1592,10 @@ static jsval_t js_lv_chart_set_next_value(struct js *js, jsval_t *args, int narg
 
 static jsval_t js_lv_chart_set_next_value2(struct js *js, jsval_t *args, int nargs) {  // (chartHandle, seriesPtr, xVal, yVal)
   if (nargs < 4) return js_mknull();
-  int h = (int)js_getnum(args[0]);
+  int h = js_getint(args[0]);
   intptr_t sp = (intptr_t)js_getnum(args[1]);
-  int xval = (int)js_getnum(args[2]);
-  int yval = (int)js_getnum(args[3]);
+  int xval = js_getint(args[2]);
+  int yval = js_getint(args[3]);
 
   lv_obj_t *chart = get_lv_obj(h);
   if (!chart) return js_mknull();
@@ -1874,50 +1605,9 @@ static jsval_t js_lv_chart_set_next_value2(struct js *js, jsval_t *args, int nar
   return js_mknull();
 }
 
-static jsval_t js_lv_chart_set_axis_tick(struct js *js, jsval_t *args, int nargs) {  // (chartH, axis, majorLen, minorLen, majorCnt, minorCnt, label_en, draw_size)
-  if (nargs < 8) return js_mknull();
-  int h = (int)js_getnum(args[0]);
-  int axis = (int)js_getnum(args[1]);
-  int majorLen = (int)js_getnum(args[2]);
-  int minorLen = (int)js_getnum(args[3]);
-  int majorCnt = (int)js_getnum(args[4]);
-  int minorCnt = (int)js_getnum(args[5]);
-  bool label = (bool)js_getnum(args[6]);
-  int drawSiz = (int)js_getnum(args[7]);
-
-  lv_obj_t *chart = get_lv_obj(h);
-  if (!chart) return js_mknull();
-
-  lv_chart_set_axis_tick(chart, (lv_chart_axis_t)axis, majorLen, minorLen,
-                         majorCnt, minorCnt, label, drawSiz);
-  return js_mknull();
-}
-
-static jsval_t js_lv_chart_set_zoom_x(struct js *js, jsval_t *args, int nargs) {  // (chartH, zoom)
-  if (nargs < 2) return js_mknull();
-  int h = (int)js_getnum(args[0]);
-  int zm = (int)js_getnum(args[1]);
-  lv_obj_t *chart = get_lv_obj(h);
-  if (!chart) return js_mknull();
-
-  lv_chart_set_zoom_x(chart, zm);
-  return js_mknull();
-}
-
-static jsval_t js_lv_chart_set_zoom_y(struct js *js, jsval_t *args, int nargs) {  // (chartH, zoom)
-  if (nargs < 2) return js_mknull();
-  int h = (int)js_getnum(args[0]);
-  int zm = (int)js_getnum(args[1]);
-  lv_obj_t *chart = get_lv_obj(h);
-  if (!chart) return js_mknull();
-
-  lv_chart_set_zoom_y(chart, zm);
-  return js_mknull();
-}
-
 static jsval_t js_lv_chart_get_y_array(struct js *js, jsval_t *args, int nargs) {  // (chartH, seriesPtr) -> returns a pointer number to the array
   if (nargs < 2) return js_mknull();
-  int h = (int)js_getnum(args[0]);
+  int h = js_getint(args[0]);
   intptr_t sp = (intptr_t)js_getnum(args[1]);
 
   lv_obj_t *chart = get_lv_obj(h);
@@ -1930,6 +1620,38 @@ static jsval_t js_lv_chart_get_y_array(struct js *js, jsval_t *args, int nargs)
   return js_mknum((double)ret);
 }
 
+static jsval_t js_lv_chart_set_values(struct js *js, jsval_t *args, int nargs) {  // (chartH, seriesPtr, array)
+  if (nargs < 3) return js_mknull();
+  int h = js_getint(args[0]);
+  intptr_t sp = (intptr_t)js_getnum(args[1]);
+  int kind;
+  size_t len;
+  const void *p = js_getarr(js, args[2], &kind, &len);
+
+  lv_obj_t *chart = get_lv_obj(h);
+  if (!chart || !p) return js_mknull();
+
+  // Copy the whole series in one go, rather than a set_next_value per point
+  lv_chart_series_t *ser = (lv_chart_series_t *)sp;
+  lv_coord_t *ys = lv_chart_get_y_array(chart, ser);
+  uint16_t count = lv_chart_get_point_count(chart);
+  for (size_t i = 0; i < len && i < count; i++) {
+    if (kind == JS_UINT8) {
+      ys[i] = ((const uint8_t *)p)[i];
+    } else if (kind == JS_INT16) {
+      ys[i] = ((const int16_t *)p)[i];
+    } else if (kind == JS_FLOAT32) {
+      ys[i] = (lv_coord_t)((const float *)p)[i];
+    } else {
+      jsval_t v;
+      memcpy(&v, (const jsval_t *)p + i, sizeof(v));
+      ys[i] = js_type(v) == JS_NUM ? (lv_coord_t)js_getnum(v) : LV_CHART_POINT_NONE;
+    }
+  }
+  lv_chart_refresh(chart);
+  return js_mknull();
+}
+
 // Similarly you can add bridging for lv_chart_set_ext_y_array, lv_chart_set_ext_x_array,
 // lv_chart_get_x_array, lv_chart_get_pressed_point, lv_chart_set_cursor_point, etc.
 // if your examples require them.
@@ -1951,7 +1673,7 @@ static jsval_t js_lv_meter_create(struct js *js, jsval_t *args, int nargs) {  //
 
 static jsval_t js_lv_meter_add_scale(struct js *js, jsval_t *args, int nargs) {  // (meterHandle) -> scale pointer as number
   if (nargs < 1) return js_mknull();
-  int mh = (int)js_getnum(args[0]);
+  int mh = js_getint(args[0]);
   lv_obj_t *mt = get_lv_obj(mh);
   if (!mt) return js_mknull();
 
@@ -1963,11 +1685,11 @@ static jsval_t js_lv_meter_add_scale(struct js *js, jsval_t *args, int nargs) {
 
 static jsval_t js_lv_meter_set_scale_ticks(struct js *js, jsval_t *args, int nargs) {  // (meterH, scalePtr, cnt, width, length, color)
   if (nargs < 6) return js_mknull();
-  int mH = (int)js_getnum(args[0]);
+  int mH = js_getint(args[0]);
   intptr_t scP = (intptr_t)js_getnum(args[1]);
-  int cnt = (int)js_getnum(args[2]);
-  int width = (int)js_getnum(args[3]);
-  int length = (int)js_getnum(args[4]);
+  int cnt = js_getint(args[2]);
+  int width = js_getint(args[3]);
+  int length = js_getint(args[4]);
   double col = js_getnum(args[5]);
 
   lv_obj_t *mt = get_lv_obj(mH);
@@ -1979,13 +1701,13 @@ static jsval_t js_lv_meter_set_scale_ticks(struct js *js, jsval_t *args, int nar
 
 static jsval_t js_lv_meter_set_scale_major_ticks(struct js *js, jsval_t *args, int nargs) {  // (meterH, scalePtr, freq, width, length, color, label_gap)
   if (nargs < 7) return js_mknull();
-  int mH = (int)js_getnum(args[0]);
+  int mH = js_getint(args[0]);
   intptr_t scP = (intptr_t)js_getnum(args[1]);
-  int freq = (int)js_getnum(args[2]);
-  int width = (int)js_getnum(args[3]);
-  int length = (int)js_getnum(args[4]);
+  int freq = js_getint(args[2]);
+  int width = js_getint(args[3]);
+  int length = js_getint(args[4]);
   double col = js_getnum(args[5]);
-  int label_gap = (int)js_getnum(args[6]);
+  int label_gap = js_getint(args[6]);
 
   lv_obj_t *mt = get_lv_obj(mH);
   if (!mt) return js_mknull();
@@ -1997,12 +1719,12 @@ static jsval_t js_lv_meter_set_scale_major_ticks(struct js *js, jsval_t *args, i
 
 static jsval_t js_lv_meter_set_scale_range(struct js *js, jsval_t *args, int nargs) {  // (meterH, scalePtr, min, max, angle_range, rotation)
   if (nargs < 6) return js_mknull();
-  int mH = (int)js_getnum(args[0]);
+  int mH = js_getint(args[0]);
   intptr_t scP = (intptr_t)js_getnum(args[1]);
-  int minV = (int)js_getnum(args[2]);
-  int maxV = (int)js_getnum(args[3]);
-  int angleRange = (int)js_getnum(args[4]);
-  int rotation = (int)js_getnum(args[5]);
+  int minV = js_getint(args[2]);
+  int maxV = js_getint(args[3]);
+  int angleRange = js_getint(args[4]);
+  int rotation = js_getint(args[5]);
 
   lv_obj_t *mt = get_lv_obj(mH);
   if (!mt) return js_mknull();
@@ -2015,11 +1737,11 @@ static jsval_t js_lv_meter_set_scale_range(struct js *js, jsval_t *args, int nar
 static jsval_t js_lv_meter_add_arc(struct js *js, jsval_t *args, int nargs) {  // (meterH, scalePtr, width, color, rMod)
   // returns indicator pointer
   if (nargs < 5) return js_mknull();
-  int mH = (int)js_getnum(args[0]);
+  int mH = js_getint(args[0]);
   intptr_t scP = (intptr_t)js_getnum(args[1]);
-  int width = (int)js_getnum(args[2]);
+  int width = js_getint(args[2]);
   double col = js_getnum(args[3]);
-  int rMod = (int)js_getnum(args[4]);
+  int rMod = js_getint(args[4]);
 
   lv_obj_t *mt = get_lv_obj(mH);
   if (!mt) return js_mknull();
@@ -2033,12 +1755,12 @@ static jsval_t js_lv_meter_add_arc(struct js *js, jsval_t *args, int nargs) {  /
 static jsval_t js_lv_meter_add_scale_lines(struct js *js, jsval_t *args, int nargs) {  // (meterH, scalePtr, color_main, color_grad, local, width_mod)
   // returns indicator pointer
   if (nargs < 6) return js_mknull();
-  int mH = (int)js_getnum(args[0]);
+  int mH = js_getint(args[0]);
   intptr_t scP = (intptr_t)js_getnum(args[1]);
   double colorM = js_getnum(args[2]);
   double colorG = js_getnum(args[3]);
   bool local = (bool)js_getnum(args[4]);
-  int widthMod = (int)js_getnum(args[5]);
+  int widthMod = js_getint(args[5]);
 
   lv_obj_t *mt = get_lv_obj(mH);
   if (!mt) return js_mknull();
@@ -2054,11 +1776,11 @@ static jsval_t js_lv_meter_add_scale_lines(struct js *js, jsval_t *args, int nar
 
 static jsval_t js_lv_meter_add_needle_line(struct js *js, jsval_t *args, int nargs) {  // (meterH, scalePtr, width, color, rMod)
   if (nargs < 5) return js_mknull();
-  int mH = (int)js_getnum(args[0]);
+  int mH = js_getint(args[0]);
   intptr_t scP = (intptr_t)js_getnum(args[1]);
-  int width = (int)js_getnum(args[2]);
+  int width = js_getint(args[2]);
   double col = js_getnum(args[3]);
-  int rMod = (int)js_getnum(args[4]);
+  int rMod = js_getint(args[4]);
 
   lv_obj_t *mt = get_lv_obj(mH);
   if (!mt) return js_mknull();
@@ -2072,12 +1794,12 @@ static jsval_t js_lv_meter_add_needle_line(struct js *js, jsval_t *args, int nar
 static jsval_t js_lv_meter_add_needle_img(struct js *js, jsval_t *args, int nargs) {  // (meterH, scalePtr, srcAddr, pivot_x, pivot_y)
   // returns indicator pointer
   if (nargs < 5) return js_mknull();
-  int mH = (int)js_getnum(args[0]);
+  int mH = js_getint(args[0]);
   intptr_t scP = (intptr_t)js_getnum(args[1]);
   // "srcAddr" is an image source pointer or something
   intptr_t srcPtr = (intptr_t)js_getnum(args[2]);
-  int pivotX = (int)js_getnum(args[3]);
-  int pivotY = (int)js_getnum(args[4]);
+  int pivotX = js_getint(args[3]);
+  int pivotY = js_getint(args[4]);
 
   // If we have a global or static "LV_IMG_DECLARE(img_hand);" we normally pass &img_hand
   // from JS. That means we store "img_hand" pointer in a variable.
@@ -2097,9 +1819,9 @@ static jsval_t js_lv_meter_add_needle_img(struct js *js, jsval_t *args, int narg
 // meter set indicator
 static jsval_t js_lv_meter_set_indicator_start_value(struct js *js, jsval_t *args, int nargs) {  // (meterH, indicatorPtr, startVal)
   if (nargs < 3) return js_mknull();
-  int mH = (int)js_getnum(args[0]);
+  int mH = js_getint(args[0]);
   intptr_t indP = (intptr_t)js_getnum(args[1]);
-  int stVal = (int)js_getnum(args[2]);
+  int stVal = js_getint(args[2]);
 
   lv_obj_t *mt = get_lv_obj(mH);
   if (!mt) return js_mknull();
@@ -2111,9 +1833,9 @@ static jsval_t js_lv_meter_set_indicator_start_value(struct js *js, jsval_t *arg
 
 static jsval_t js_lv_meter_set_indicator_end_value(struct js *js, jsval_t *args, int nargs) {  // (meterH, indicatorPtr, endVal)
   if (nargs < 3) return js_mknull();
-  int mH = (int)js_getnum(args[0]);
+  int mH = js_getint(args[0]);
   intptr_t indP = (intptr_t)js_getnum(args[1]);
-  int endVal = (int)js_getnum(args[2]);
+  int endVal = js_getint(args[2]);
 
   lv_obj_t *mt = get_lv_obj(mH);
   if (!mt) return js_mknull();
@@ -2125,9 +1847,9 @@ static jsval_t js_lv_meter_set_indicator_end_value(struct js *js, jsval_t *args,
 
 static jsval_t js_lv_meter_set_indicator_value(struct js *js, jsval_t *args, int nargs) {  // (meterH, indicatorPtr, val)
   if (nargs < 3) return js_mknull();
-  int mH = (int)js_getnum(args[0]);
+  int mH = js_getint(args[0]);
   intptr_t indP = (intptr_t)js_getnum(args[1]);
-  int val = (int)js_getnum(args[2]);
+  int val = js_getint(args[2]);
 
   lv_obj_t *mt = get_lv_obj(mH);
   if (!mt) return js_mknull();
@@ -2148,8 +1870,8 @@ static jsval_t js_lv_spangroup_create(struct js *js, jsval_t *args, int nargs) {
 
 static jsval_t js_lv_spangroup_set_align(struct js *js, jsval_t *args, int nargs) {  // (spangroupH, alignEnum=LV_TEXT_ALIGN_LEFT/CENTER/RIGHT/AUTO)
   if (nargs < 2) return js_mknull();
-  int h = (int)js_getnum(args[0]);
-  int alg = (int)js_getnum(args[1]);
+  int h = js_getint(args[0]);
+  int alg = js_getint(args[1]);
   lv_obj_t *spg = get_lv_obj(h);
   if (!spg) return js_mknull();
 
@@ -2159,8 +1881,8 @@ static jsval_t js_lv_spangroup_set_align(struct js *js, jsval_t *args, int nargs
 
 static jsval_t js_lv_spangroup_set_overflow(struct js *js, jsval_t *args, int nargs) {  // (spangroupH, overflowEnum=LV_SPAN_OVERFLOW_CLIP/ELLIPSIS)
   if (nargs < 2) return js_mknull();
-  int h = (int)js_getnum(args[0]);
-  int ovf = (int)js_getnum(args[1]);
+  int h = js_getint(args[0]);
+  int ovf = js_getint(args[1]);
   lv_obj_t *spg = get_lv_obj(h);
   if (!spg) return js_mknull();
 
@@ -2170,8 +1892,8 @@ static jsval_t js_lv_spangroup_set_overflow(struct js *js, jsval_t *args, int na
 
 static jsval_t js_lv_spangroup_set_indent(struct js *js, jsval_t *args, int nargs) {  // (spangroupH, indentPX)
   if (nargs < 2) return js_mknull();
-  int h = (int)js_getnum(args[0]);
-  int indent = (int)js_getnum(args[1]);
+  int h = js_getint(args[0]);
+  int indent = js_getint(args[1]);
   lv_obj_t *spg = get_lv_obj(h);
   if (!spg) return js_mknull();
 
@@ -2181,8 +1903,8 @@ static jsval_t js_lv_spangroup_set_indent(struct js *js, jsval_t *args, int narg
 
 static jsval_t js_lv_spangroup_set_mode(struct js *js, jsval_t *args, int nargs) {  // (spangroupH, mode=LV_SPAN_MODE_FIXED/NOWRAP/BREAK)
   if (nargs < 2) return js_mknull();
-  int h = (int)js_getnum(args[0]);
-  int md = (int)js_getnum(args[1]);
+  int h = js_getint(args[0]);
+  int md = js_getint(args[1]);
   lv_obj_t *spg = get_lv_obj(h);
   if (!spg) return js_mknull();
 
@@ -2192,7 +1914,7 @@ static jsval_t js_lv_spangroup_set_mode(struct js *js, jsval_t *args, int nargs)
 
 static jsval_t js_lv_spangroup_new_span(struct js *js, jsval_t *args, int nargs) {  // (spangroupH) -> pointer
   if (nargs < 1) return js_mknull();
-  int h = (int)js_getnum(args[0]);
+  int h = js_getint(args[0]);
   lv_obj_t *spg = get_lv_obj(h);
   if (!spg) return js_mknull();
 
@@ -2204,28 +1926,30 @@ static jsval_t js_lv_spangroup_new_span(struct js *js, jsval_t *args, int nargs)
 static jsval_t js_lv_span_set_text(struct js *js, jsval_t *args, int nargs) {  // (spanPtr, text)
   if (nargs < 2) return js_mknull();
   intptr_t spP = (intptr_t)js_getnum(args[0]);
-  const char *txt = js_str(js, args[1]);
-  if (!txt) return js_mknull();
+  ElkStr txt = elk_arg_text(js, args, nargs, 1);
+  if (!txt.ok()) return js_mknull();
 
   lv_span_t *sp = (lv_span_t *)spP;
-  lv_span_set_text(sp, txt);
+  lv_span_set_text(sp, txt.c_str());
   return js_mknull();
 }
 
 static jsval_t js_lv_span_set_text_static(struct js *js, jsval_t *args, int nargs) {  // (spanPtr, text) => static
   if (nargs < 2) return js_mknull();
   intptr_t spP = (intptr_t)js_getnum(args[0]);
-  const char *txt = js_str(js, args[1]);
-  if (!txt) return js_mknull();
+  ElkStr txt = elk_arg_text(js, args, nargs, 1);
+  if (!txt.ok()) return js_mknull();
 
   lv_span_t *sp = (lv_span_t *)spP;
-  lv_span_set_text_static(sp, txt);
+  // LVGL keeps a static text and redraws from it, but a JS string moves or
+  // goes away on GC, and a number's text is in a scratch buffer: copy it
+  lv_span_set_text(sp, txt.c_str());
   return js_mknull();
 }
 
 static jsval_t js_lv_spangroup_refr_mode(struct js *js, jsval_t *args, int nargs) {  // (spangroupH)
   if (nargs < 1) return js_mknull();
-  int h = (int)js_getnum(args[0]);
+  int h = js_getint(args[0]);
   lv_obj_t *spg = get_lv_obj(h);
   if (!spg) return js_mknull();
 
@@ -2248,7 +1972,7 @@ static jsval_t js_lv_line_create(struct js *js, jsval_t *args, int nargs) {
 // For simplicity, here's a bridging that receives e.g. (lineH, x0, y0, x1, y1, x2, y2, ...)
 static jsval_t js_lv_line_set_points(struct js *js, jsval_t *args, int nargs) {  // Must have at least (lineH, x0, y0)
   if (nargs < 3) return js_mknull();
-  int h = (int)js_getnum(args[0]);
+  int h = js_getint(args[0]);
 
   // The rest are coordinate pairs
   int pairCount = (nargs - 1) / 2;  // minus 1 for the handle, then each 2 = one point
@@ -2262,8 +1986,8 @@ static jsval_t js_lv_line_set_points(struct js *js, jsval_t *args, int nargs) {
 
   int idx = 1;  // start reading from arg[1]
   for (int i = 0; i < pairCount; i++) {
-    int x = (int)js_getnum(args[idx++]);
-    int y = (int)js_getnum(args[idx++]);
+    int x = js_getint(args[idx++]);
+    int y = js_getint(args[idx++]);
     points[i].x = x;
     points[i].y = y;
   }
@@ -2530,8 +2254,8 @@ static jsval_t js_str_substring(struct js *js, jsval_t *args, int nargs) {
   }
 
   // Extract numerical values
-  int start = (int)js_getnum(args[1]);
-  int length = (int)js_getnum(args[2]);
+  int start = js_getint(args[1]);
+  int length = js_getint(args[2]);
 
   // Strip surrounding quotes if present
   if (strStr.startsWith("\"") && strStr.endsWith("\"") && strStr.length() >= 2) {
@@ -2551,66 +2275,96 @@ static jsval_t js_str_substring(struct js *js, jsval_t *args, int nargs) {
 
   return js_mkstr(js, strStr.c_str(), strStr.length());
 }
-static jsval_t js_http_get(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 1) return js_mkstr(js, "", 0);
-  const char *rawUrl = js_str(js, args[0]);
-  if (!rawUrl) return js_mkstr(js, "", 0);
-
-  // Convert to Arduino String
-  String url(rawUrl);
-
-  // Strip quotes if needed
-  if (url.startsWith("\"") && url.endsWith("\"")) {
-    url.remove(0, 1);
-    url.remove(url.length() - 1, 1);
-  }
-
-  // Determine if HTTPS or HTTP
-  bool useSSL = true;
-  const String HTTPS_PREFIX = "https://";
-  const String HTTP_PREFIX = "http://";
-
-  String urlWithoutPrefix = url;
-  if (url.startsWith(HTTPS_PREFIX)) {
-    urlWithoutPrefix = url.substring(HTTPS_PREFIX.length());
-    useSSL = true;
-  } else if (url.startsWith(HTTP_PREFIX)) {
-    urlWithoutPrefix = url.substring(HTTP_PREFIX.length());
-    useSSL = false;
-  } else {
-    useSSL = true;
-  }
 
-  int slashPos = urlWithoutPrefix.indexOf('/');
-  String hostWithPort, path;
-  if (slashPos < 0) {
-    hostWithPort = urlWithoutPrefix;
-    path = "/";
-  } else {
-    hostWithPort = urlWithoutPrefix.substring(0, slashPos);
-    path = urlWithoutPrefix.substring(slashPos);
-  }
-
-  // Parse port from host (e.g., "192.168.1.20:2000" or "example.com:8080")
-  String host;
-  int port = useSSL ? 443 : 80;  // Default ports
-  int colonPos = hostWithPort.indexOf(':');
-  if (colonPos > 0) {
-    host = hostWithPort.substring(0, colonPos);
-    port = hostWithPort.substring(colonPos + 1).toInt();
-    if (port <= 0 || port > 65535) {
-      port = useSSL ? 443 : 80;  // Invalid port, use default
+// Text of an array element for str_join(): strings as they are, numbers
+// formatted, anything else stringified. NULL if memory is out for a string
+static const char *str_join_part(struct js *js, jsval_t v, char *buf, size_t buflen, size_t *len) {
+  const char *s = js_getstr(js, v, len);
+  if (s != NULL || js_type(v) == JS_STR) return s;
+  if (js_type(v) == JS_NUM) {
+    *len = js_fmtnum(js_getnum(v), buf, buflen);
+    return buf;
+  }
+  s = js_str(js, v);
+  *len = strlen(s);
+  return s;
+}
+
+// str_join(array, sep): concatenate array elements with sep in between. The
+// result is sized up front and written in one go, so building a long string
+// from parts takes one allocation instead of one per '+'
+static jsval_t js_str_join(struct js *js, jsval_t *args, int nargs) {
+  size_t n, len, seplen = 0, total = 0;
+  char buf[32];
+  const char *sep = nargs > 1 ? js_getstr(js, args[1], &seplen) : NULL;
+  if (nargs < 1 || js_getarr(js, args[0], NULL, &n) == NULL) {
+    LOG("str_join: Argument 1 is not an array");
+    return js_mkstr(js, "", 0);
+  }
+  if (nargs > 1 && sep == NULL && js_type(args[1]) == JS_STR) return js_mkerr(js, "oom");
+  for (size_t i = 0; i < n; i++) {
+    if (str_join_part(js, js_arrget(js, args[0], i), buf, sizeof(buf), &len) == NULL) {
+      return js_mkerr(js, "oom");
     }
+    total += len + (i > 0 ? seplen : 0);
+  }
+  jsval_t res = js_mkstr(js, NULL, total);
+  char *out = js_getstr(js, res, NULL);
+  if (out == NULL) return res;  // Out of memory
+  char *end = out + total;
+  for (size_t i = 0; i < n; i++) {
+    const char *s = str_join_part(js, js_arrget(js, args[0], i), buf, sizeof(buf), &len);
+    if (i > 0 && seplen > 0) memcpy(out, sep, seplen), out += seplen;
+    // A piece comes out different from the first pass if allocating the
+    // result left too little memory to stringify it: fail, do not pad
+    if (s == NULL || len > (size_t)(end - out)) return js_mkerr(js, "oom");
+    memcpy(out, s, len), out += len;
+  }
+  return out == end ? res : js_mkerr(js, "oom");
+}
+
+// Parts of a URL for the http_* bindings: http:// or https://, which is also
+// the default. The host is copied out, the path points into the URL
+struct ElkUrl {
+  bool ssl;
+  int port;
+  char host[128];
+  const char *path;
+};
+
+static bool elk_parse_url(ElkStr url, ElkUrl *u) {
+  const char *p = url.ptr, *end = url.ptr + url.len, *slash, *colon;
+  u->ssl = true;
+  if (url.len >= 8 && strncmp(p, "https://", 8) == 0) {
+    p += 8;
+  } else if (url.len >= 7 && strncmp(p, "http://", 7) == 0) {
+    p += 7, u->ssl = false;
+  }
+  if ((slash = (const char *)memchr(p, '/', end - p)) == NULL) slash = end;
+  u->path = slash < end ? slash : "/";
+  u->port = u->ssl ? 443 : 80;  // Unless e.g. "192.168.1.20:2000" says else
+  if ((colon = (const char *)memchr(p, ':', slash - p)) != NULL && colon > p) {
+    int port = atoi(colon + 1);
+    if (port > 0 && port <= 65535) u->port = port;
   } else {
-    host = hostWithPort;
+    colon = slash;
   }
+  if ((size_t)(colon - p) >= sizeof(u->host)) return false;
+  memcpy(u->host, p, colon - p);
+  u->host[colon - p] = '\0';
+  return true;
+}
+
+static jsval_t js_http_get(struct js *js, jsval_t *args, int nargs) {
+  ElkStr url = elk_arg_str(js, args, nargs, 0);
+  ElkUrl u;
+  if (!url.ok() || !elk_parse_url(url, &u)) return js_mkstr(js, "", 0);
 
-  LOG("\njs_http_get => " + String(useSSL ? "HTTPS" : "HTTP"));
-  LOG("Host: " + host);
-  LOGF("Port: %d\n", port);
-  LOG("Path: " + path);
+  LOGF("\njs_http_get => %s\nHost: %s\nPort: %d\nPath: %s\n", u.ssl ? "HTTPS" : "HTTP", u.host,
+       u.port, u.path);
 
   String response;
+  ElkHttpConfig cfg = elk_http_config();
   const int MAX_RETRIES = 3;  // Up to 4 attempts total
 
   for (int attempt = 0; attempt <= MAX_RETRIES; attempt++) {
@@ -2621,27 +2375,26 @@ static jsval_t js_http_get(struct js *js, jsval_t *args, int nargs) {
       vTaskDelay(pdMS_TO_TICKS(delayMs));
     }
 
-    if (useSSL) {
+    if (u.ssl) {
       WiFiClientSecure client;
       client.setTimeout(15000);  // 15 second timeout for read/write operations
-      if (g_httpCAcert) {
-        client.setCACert(g_httpCAcert);
+      if (cfg.ca_cert.length() > 0) {
+        client.setCACert(cfg.ca_cert.c_str());
         LOG("Using CA cert for HTTPS");
       } else {
         client.setInsecure();
         LOG("Using insecure mode for HTTPS");
       }
 
-      LOGF("Connecting to %s:%d (HTTPS)...\n", host.c_str(), port);
-      if (!client.connect(host.c_str(), port, 10000)) {  // 10 second connection timeout
+      LOGF("Connecting to %s:%d (HTTPS)...\n", u.host, u.port);
+      if (!client.connect(u.host, u.port, 10000)) {  // 10 second connection timeout
         LOG("Connection failed!");
         continue;  // Retry
       }
       LOG("Connected!");
 
-      client.print(String("GET ") + path + " HTTP/1.1\r\n");
-      client.print(String("Host: ") + host + "\r\n");
-      for (auto &hdr : g_http_headers) {
+      client.printf("GET %s HTTP/1.1\r\nHost: %s\r\n", u.path, u.host);
+      for (auto &hdr : cfg.headers) {
         client.print(hdr.first);
         client.print(": ");
         client.print(hdr.second);
@@ -2655,16 +2408,15 @@ static jsval_t js_http_get(struct js *js, jsval_t *args, int nargs) {
       WiFiClient client;
       client.setTimeout(15000);  // 15 second timeout for read/write operations
 
-      LOGF("Connecting to %s:%d (HTTP)...\n", host.c_str(), port);
-      if (!client.connect(host.c_str(), port, 10000)) {  // 10 second connection timeout
+      LOGF("Connecting to %s:%d (HTTP)...\n", u.host, u.port);
+      if (!client.connect(u.host, u.port, 10000)) {  // 10 second connection timeout
         LOG("Connection failed!");
         continue;  // Retry
       }
       LOG("Connected!");
 
-      client.print(String("GET ") + path + " HTTP/1.1\r\n");
-      client.print(String("Host: ") + host + "\r\n");
-      for (auto &hdr : g_http_headers) {
+      client.printf("GET %s HTTP/1.1\r\nHost: %s\r\n", u.path, u.host);
+      for (auto &hdr : cfg.headers) {
         client.print(hdr.first);
         client.print(": ");
         client.print(hdr.second);
@@ -2692,111 +2444,55 @@ static jsval_t js_http_get(struct js *js, jsval_t *args, int nargs) {
 }
 
 static jsval_t js_http_post(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 2) return js_mkstr(js, "", 0);
-  const char *rawUrl = js_str(js, args[0]);
-  const char *body = js_str(js, args[1]);
-  if (!rawUrl || !body) return js_mkstr(js, "", 0);
-
-  // Convert to Arduino Strings for easy manipulation
-  String url(rawUrl);
-  String jsonBody(body);
-
-  // Strip quotes if any
-  if (url.startsWith("\"") && url.endsWith("\"")) {
-    url.remove(0, 1);
-    url.remove(url.length() - 1, 1);
-  }
-  if (jsonBody.startsWith("\"") && jsonBody.endsWith("\"")) {
-    jsonBody.remove(0, 1);
-    jsonBody.remove(jsonBody.length() - 1, 1);
-  }
-
-  // Determine if HTTPS or HTTP
-  bool useSSL = true;
-  const String HTTPS_PREFIX = "https://";
-  const String HTTP_PREFIX = "http://";
-  if (url.startsWith(HTTPS_PREFIX)) {
-    url.remove(0, HTTPS_PREFIX.length());
-    useSSL = true;
-  } else if (url.startsWith(HTTP_PREFIX)) {
-    url.remove(0, HTTP_PREFIX.length());
-    useSSL = false;
-  }
-
-  // Find first slash => host + path
-  int slashPos = url.indexOf('/');
-  String hostWithPort, path;
-  if (slashPos < 0) {
-    hostWithPort = url;
-    path = "/";
-  } else {
-    hostWithPort = url.substring(0, slashPos);
-    path = url.substring(slashPos);
-  }
-
-  // Parse port from host
-  String host;
-  int port = useSSL ? 443 : 80;
-  int colonPos = hostWithPort.indexOf(':');
-  if (colonPos > 0) {
-    host = hostWithPort.substring(0, colonPos);
-    port = hostWithPort.substring(colonPos + 1).toInt();
-    if (port <= 0 || port > 65535) {
-      port = useSSL ? 443 : 80;
-    }
-  } else {
-    host = hostWithPort;
-  }
+  ElkStr url = elk_arg_str(js, args, nargs, 0), body = elk_arg_text(js, args, nargs, 1);
+  ElkUrl u;
+  if (nargs < 2 || !url.ok() || !body.ok() || !elk_parse_url(url, &u)) return js_mkstr(js, "", 0);
 
-  LOG("\njs_http_post => manual approach");
-  LOG("Host: " + host);
-  LOGF("Port: %d\n", port);
-  LOG("Path: " + path);
-  LOGF("Body length=%d\n", jsonBody.length());
+  LOGF("\njs_http_post => manual approach\nHost: %s\nPort: %d\nPath: %s\nBody length=%u\n",
+       u.host, u.port, u.path, (unsigned) body.len);
 
   String response;
+  ElkHttpConfig cfg = elk_http_config();
 
-  if (useSSL) {
+  if (u.ssl) {
     WiFiClientSecure client;
-    if (g_httpCAcert) {
-      client.setCACert(g_httpCAcert);
+    if (cfg.ca_cert.length() > 0) {
+      client.setCACert(cfg.ca_cert.c_str());
     } else {
       client.setInsecure();
     }
 
-    if (!client.connect(host.c_str(), port)) {
+    if (!client.connect(u.host, u.port)) {
       LOG("Connection failed (POST)!");
       return js_mkstr(js, "", 0);
     }
 
-    client.print(String("POST ") + path + " HTTP/1.1\r\n");
-    client.print(String("Host: ") + host + "\r\n");
-    for (auto &hdr : g_http_headers) {
-      client.print(hdr.first + ": " + hdr.second + "\r\n");
+    client.printf("POST %s HTTP/1.1\r\nHost: %s\r\n", u.path, u.host);
+    for (auto &hdr : cfg.headers) {
+      client.printf("%s: %s\r\n", hdr.first.c_str(), hdr.second.c_str());
     }
     client.print("Content-Type: application/json\r\n");
-    client.printf("Content-Length: %d\r\n", jsonBody.length());
+    client.printf("Content-Length: %u\r\n", (unsigned) body.len);
     client.print("Connection: close\r\n\r\n");
-    client.print(jsonBody);
+    client.write((const uint8_t *) body.ptr, body.len);
 
     response = readHttpResponseBody(client);
     client.stop();
   } else {
     WiFiClient client;
-    if (!client.connect(host.c_str(), port)) {
+    if (!client.connect(u.host, u.port)) {
       LOG("Connection failed (POST)!");
       return js_mkstr(js, "", 0);
     }
 
-    client.print(String("POST ") + path + " HTTP/1.1\r\n");
-    client.print(String("Host: ") + host + "\r\n");
-    for (auto &hdr : g_http_headers) {
-      client.print(hdr.first + ": " + hdr.second + "\r\n");
+    client.printf("POST %s HTTP/1.1\r\nHost: %s\r\n", u.path, u.host);
+    for (auto &hdr : cfg.headers) {
+      client.printf("%s: %s\r\n", hdr.first.c_str(), hdr.second.c_str());
     }
     client.print("Content-Type: application/json\r\n");
-    client.printf("Content-Length: %d\r\n", jsonBody.length());
+    client.printf("Content-Length: %u\r\n", (unsigned) body.len);
     client.print("Connection: close\r\n\r\n");
-    client.print(jsonBody);
+    client.write((const uint8_t *) body.ptr, body.len);
 
     response = readHttpResponseBody(client);
     client.stop();
@@ -2807,79 +2503,32 @@ static jsval_t js_http_post(struct js *js, jsval_t *args, int nargs) {
 }
 
 static jsval_t js_http_delete(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 1) return js_mkstr(js, "", 0);
-  const char *rawUrl = js_str(js, args[0]);
-  if (!rawUrl) return js_mkstr(js, "", 0);
-
-  String url(rawUrl);
-
-  // Remove quotes if any
-  if (url.startsWith("\"") && url.endsWith("\"")) {
-    url.remove(0, 1);
-    url.remove(url.length() - 1, 1);
-  }
-
-  // Determine if HTTPS or HTTP
-  bool useSSL = true;
-  const String HTTPS_PREFIX = "https://";
-  const String HTTP_PREFIX = "http://";
-  if (url.startsWith(HTTPS_PREFIX)) {
-    url.remove(0, HTTPS_PREFIX.length());
-    useSSL = true;
-  } else if (url.startsWith(HTTP_PREFIX)) {
-    url.remove(0, HTTP_PREFIX.length());
-    useSSL = false;
-  }
-
-  // Split host/path
-  int slashPos = url.indexOf('/');
-  String hostWithPort, path;
-  if (slashPos < 0) {
-    hostWithPort = url;
-    path = "/";
-  } else {
-    hostWithPort = url.substring(0, slashPos);
-    path = url.substring(slashPos);
-  }
-
-  // Parse port from host
-  String host;
-  int port = useSSL ? 443 : 80;
-  int colonPos = hostWithPort.indexOf(':');
-  if (colonPos > 0) {
-    host = hostWithPort.substring(0, colonPos);
-    port = hostWithPort.substring(colonPos + 1).toInt();
-    if (port <= 0 || port > 65535) {
-      port = useSSL ? 443 : 80;
-    }
-  } else {
-    host = hostWithPort;
-  }
+  ElkStr url = elk_arg_str(js, args, nargs, 0);
+  ElkUrl u;
+  if (!url.ok() || !elk_parse_url(url, &u)) return js_mkstr(js, "", 0);
 
-  LOG("\njs_http_delete => manual approach");
-  LOG("Host: " + host);
-  LOGF("Port: %d\n", port);
-  LOG("Path: " + path);
+  LOGF("\njs_http_delete => manual approach\nHost: %s\nPort: %d\nPath: %s\n", u.host, u.port,
+       u.path);
 
   String response;
+  ElkHttpConfig cfg = elk_http_config();
 
-  if (useSSL) {
+  if (u.ssl) {
     WiFiClientSecure client;
-    if (g_httpCAcert) {
-      client.setCACert(g_httpCAcert);
+    if (cfg.ca_cert.length() > 0) {
+      client.setCACert(cfg.ca_cert.c_str());
     } else {
       client.setInsecure();
     }
 
-    if (!client.connect(host.c_str(), port)) {
+    if (!client.connect(u.host, u.port)) {
       LOG("Connection failed (DELETE)!");
       return js_mkstr(js, "", 0);
     }
 
-    client.print(String("DELETE ") + path + " HTTP/1.1\r\n");
-    client.print(String("Host: ") + host + "\r\n");
-    for (auto &hdr : g_http_headers) {
-      client.print(hdr.first + ": " + hdr.second + "\r\n");
+    client.printf("DELETE %s HTTP/1.1\r\nHost: %s\r\n", u.path, u.host);
+    for (auto &hdr : cfg.headers) {
+      client.printf("%s: %s\r\n", hdr.first.c_str(), hdr.second.c_str());
     }
     client.print("Connection: close\r\n\r\n");
 
@@ -2887,15 +2536,14 @@ static jsval_t js_http_delete(struct js *js, jsval_t *args, int nargs) {
     client.stop();
   } else {
     WiFiClient client;
-    if (!client.connect(host.c_str(), port)) {
+    if (!client.connect(u.host, u.port)) {
       LOG("Connection failed (DELETE)!");
       return js_mkstr(js, "", 0);
     }
 
-    client.print(String("DELETE ") + path + " HTTP/1.1\r\n");
-    client.print(String("Host: ") + host + "\r\n");
-    for (auto &hdr : g_http_headers) {
-      client.print(hdr.first + ": " + hdr.second + "\r\n");
+    client.printf("DELETE %s HTTP/1.1\r\nHost: %s\r\n", u.path, u.host);
+    for (auto &hdr : cfg.headers) {
+      client.printf("%s: %s\r\n", hdr.first.c_str(), hdr.second.c_str());
     }
     client.print("Connection: close\r\n\r\n");
 
@@ -2908,49 +2556,30 @@ static jsval_t js_http_delete(struct js *js, jsval_t *args, int nargs) {
 }
 
 static jsval_t js_http_set_header(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 2) return js_mkfalse();
+  ElkStr key = elk_arg_str(js, args, nargs, 0), value = elk_arg_text(js, args, nargs, 1);
+  if (nargs < 2 || !key.ok() || !value.ok()) return js_mkfalse();
 
-  const char *key = js_str(js, args[0]);
-  const char *value = js_str(js, args[1]);
-  if (!key || !value) return js_mkfalse();
-
-  // Convert to Arduino Strings for easy storage
-  String k(key), v(value);
-
-  // Optionally strip leading/trailing quotes if needed
-  if (k.startsWith("\"") && k.endsWith("\"")) {
-    k.remove(0, 1);
-    k.remove(k.length() - 1, 1);
-  }
-  if (v.startsWith("\"") && v.endsWith("\"")) {
-    v.remove(0, 1);
-    v.remove(v.length() - 1, 1);
-  }
+  // Copy to Arduino Strings: headers are kept for the following requests
+  String k(key.c_str()), v(value.c_str());
 
-  // Append to our global vector
-  g_http_headers.push_back(std::make_pair(k, v));
+  std::lock_guard<std::mutex> lock(g_http_mtx);
+  g_http_config.headers.push_back(std::make_pair(k, v));
   LOGF("Added header: %s: %s\n", k.c_str(), v.c_str());
   return js_mktrue();
 }
 
 static jsval_t js_http_clear_headers(struct js *js, jsval_t *args, int nargs) {
-  g_http_headers.clear();
+  std::lock_guard<std::mutex> lock(g_http_mtx);
+  g_http_config.headers.clear();
   return js_mktrue();
 }
 
 static jsval_t js_http_set_ca_cert_from_sd(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 1) return js_mkfalse();
-  const char *rawPath = js_str(js, args[0]);
-  if (!rawPath) return js_mkfalse();
-
-  // Strip quotes if present
-  String path(rawPath);
-  if (path.startsWith("\"") && path.endsWith("\"")) {
-    path = path.substring(1, path.length() - 1);
-  }
+  ElkStr path = elk_arg_str(js, args, nargs, 0);
+  if (!path.ok()) return js_mkfalse();
 
   // Open file from SD
-  File f = SD_MMC.open(path, FILE_READ);
+  File f = SD_MMC.open(path.c_str(), FILE_READ);
   if (!f) {
     LOGF("Failed to open CA cert file: %s\n", path.c_str());
     return js_mkfalse();
@@ -2963,25 +2592,27 @@ static jsval_t js_http_set_ca_cert_from_sd(struct js *js, jsval_t *args, int nar
     return js_mkfalse();
   }
 
-  // Reallocate or free old buffer
-  if (g_httpCAcert) {
-    free(g_httpCAcert);
-    g_httpCAcert = nullptr;
-  }
-
   // Allocate enough bytes (include space for trailing '\0')
-  g_httpCAcert = (char *)malloc(size + 1);
-  if (!g_httpCAcert) {
+  char *buf = (char *)malloc(size + 1);
+  if (!buf) {
     LOG("Not enough RAM to store CA cert!");
     f.close();
     return js_mkfalse();
   }
 
-  // Read the file
-  size_t bytesRead = f.readBytes(g_httpCAcert, size);
+  // Read the file, then swap it in: requests in flight keep their copy
+  size_t bytesRead = f.readBytes(buf, size);
   f.close();
-  g_httpCAcert[bytesRead] = '\0';  // Null-terminate
+  buf[bytesRead] = '\0';  // Null-terminate
+  String cert(buf);
+  free(buf);
+  if (cert.length() != bytesRead) {
+    LOG("Not enough RAM to store CA cert!");
+    return js_mkfalse();
+  }
 
+  std::lock_guard<std::mutex> lock(g_http_mtx);
+  g_http_config.ca_cert = cert;
   LOGF("Loaded CA cert (%u bytes) from SD file: %s\n", (unsigned)bytesRead, path.c_str());
   return js_mktrue();
 }
@@ -2989,13 +2620,11 @@ static jsval_t js_http_set_ca_cert_from_sd(struct js *js, jsval_t *args, int nar
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~ 4) Extended SD ops ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 // We already have sd_list_dir, sd_read_file, sd_write_file. Add file delete:
 static jsval_t js_sd_delete_file(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 1) return js_mkfalse();
-  const char *path = js_str(js, args[0]);
-  if (!path) return js_mkfalse();
+  ElkStr path = elk_arg_str(js, args, nargs, 0);
+  if (!path.ok()) return js_mkfalse();
 
-  String fullPath = String(path);
-  if (SD_MMC.exists(fullPath)) {
-    bool ok = SD_MMC.remove(fullPath);
+  if (SD_MMC.exists(path.c_str())) {
+    bool ok = SD_MMC.remove(path.c_str());
     return ok ? js_mktrue() : js_mkfalse();
   }
   return js_mkfalse();
@@ -3032,25 +2661,24 @@ public:
 
 // ble_init(devName, serviceUUID, charUUID)
 static jsval_t js_ble_init(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 3) return js_mkfalse();
-  const char *devName = js_str(js, args[0]);
-  const char *svcUUID = js_str(js, args[1]);
-  const char *charUUID = js_str(js, args[2]);
-  if (!devName || !svcUUID || !charUUID) return js_mkfalse();
+  ElkStr devName = elk_arg_str(js, args, nargs, 0);
+  ElkStr svcUUID = elk_arg_str(js, args, nargs, 1);
+  ElkStr charUUID = elk_arg_str(js, args, nargs, 2);
+  if (!devName.ok() || !svcUUID.ok() || !charUUID.ok()) return js_mkfalse();
 
   // Initialize NimBLE
-  NimBLEDevice::init(devName);
+  NimBLEDevice::init(devName.c_str());
 
   // Create server
   g_bleServer = NimBLEDevice::createServer();
   g_bleServer->setCallbacks(new MyServerCallbacks());
 
   // Create a BLE service
-  NimBLEService *pService = g_bleServer->createService(svcUUID);
+  NimBLEService *pService = g_bleServer->createService(svcUUID.c_str());
 
   // Create a BLE Characteristic
   g_bleChar = pService->createCharacteristic(
-    charUUID,
+    charUUID.c_str(),
     NIMBLE_PROPERTY::WRITE | NIMBLE_PROPERTY::WRITE_NR);
   g_bleChar->setCallbacks(new MyCharCallbacks());
 
@@ -3072,10 +2700,10 @@ static jsval_t js_ble_is_connected(struct js *js, jsval_t *args, int nargs) {
 static jsval_t js_ble_write(struct js *js, jsval_t *args, int nargs) {
   if (!g_bleChar) return js_mkfalse();
   if (nargs < 1) return js_mkfalse();
-  const char *data = js_str(js, args[0]);
-  if (!data) return js_mkfalse();
+  ElkStr data = elk_arg_text(js, args, nargs, 0);
+  if (!data.ok()) return js_mkfalse();
 
-  g_bleChar->setValue(data);
+  g_bleChar->setValue((const uint8_t *)data.ptr, data.len);
   g_bleChar->notify();
   return js_mktrue();
 }
@@ -3085,29 +2713,13 @@ static jsval_t js_ble_write(struct js *js, jsval_t *args, int nargs) {
 void onMqttMessage(char *topic, byte *payload, unsigned int length) {
   LOGF("[MQTT] Message arrived on topic '%s'\n", topic);
 
-  // If we have a non-empty callback name, build a snippet and eval
-  if (g_mqttCallbackName[0] != '\0') {  // Convert char* topic and payload to a C++ string
-    String topicStr(topic);
-    String msgStr;
-    msgStr.reserve(length);
-    for (unsigned int i = 0; i < length; i++) {
-      msgStr += (char)payload[i];
-    }
-
-    // Build snippet: myCallback('topicString','payloadString')
-    char snippet[512];
-    // Use %s for the function name, plus single quotes around the data
-    snprintf(snippet, sizeof(snippet),
-             "%s('%s','%s');",
-             g_mqttCallbackName,
-             topicStr.c_str(),
-             msgStr.c_str());
-
-    LOGF("[MQTT] Evaluating snippet: %s\n", snippet);
-
-    // Evaluate snippet
-    jsval_t res = js_eval(js, snippet, strlen(snippet));
-    // Optionally check if res is error
+  // If we have a callback, pass topic and payload to it as JS strings:
+  // no quoting, and no length limit other than free JS memory
+  if (js != NULL && (g_mqttCallback.id >= 0 || g_mqttCallback.name[0] != '\0')) {
+    jsval_t args[2] = { js_mkstr(js, topic, strlen(topic)), js_mkstr(js, payload, length) };
+    jsval_t res = args[1];
+    if (js_type(args[0]) == JS_ERR) res = args[0];
+    if (js_type(res) != JS_ERR) res = elk_callback_call(&g_mqttCallback, args, 2);
     if (js_type(res) == JS_ERR) {
       Serial.print("[MQTT] Callback error: ");
       LOG(js_str(js, res));
@@ -3117,12 +2729,13 @@ void onMqttMessage(char *topic, byte *payload, unsigned int length) {
 // JavaScript-exposed bridging functions
 // mqtt_init(broker, port)
 static jsval_t js_mqtt_init(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 2) return js_mkfalse();
-  const char *broker = js_str(js, args[0]);
-  int port = (int)js_getnum(args[1]);
+  static char broker[128];  // PubSubClient keeps the pointer
+  ElkStr host = elk_arg_str(js, args, nargs, 0);
+  int port = elk_arg_int(args, nargs, 1, 0);
 
-  if (!broker || port <= 0) return js_mkfalse();
+  if (!host.ok() || host.len >= sizeof(broker) || port <= 0) return js_mkfalse();
 
+  memcpy(broker, host.ptr, host.len + 1);
   g_mqttClient.setServer(broker, port);
   g_mqttClient.setCallback(onMqttMessage);
   LOGF("[MQTT] init => broker=%s port=%d\n", broker, port);
@@ -3132,16 +2745,15 @@ static jsval_t js_mqtt_init(struct js *js, jsval_t *args, int nargs) {
 
 // mqtt_connect(clientID, user, pass)
 static jsval_t js_mqtt_connect(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 1) return js_mkfalse();
-  const char *clientID = js_str(js, args[0]);
-  const char *user = (nargs >= 2) ? js_str(js, args[1]) : nullptr;
-  const char *pass = (nargs >= 3) ? js_str(js, args[2]) : nullptr;
+  ElkStr clientID = elk_arg_str(js, args, nargs, 0);
+  ElkStr user = elk_arg_str(js, args, nargs, 1), pass = elk_arg_str(js, args, nargs, 2);
+  if (!clientID.ok()) return js_mkfalse();
 
   bool ok = false;
-  if (user && pass && strlen(user) && strlen(pass)) {
-    ok = g_mqttClient.connect(clientID, user, pass);
+  if (user.len > 0 && pass.len > 0) {
+    ok = g_mqttClient.connect(clientID.c_str(), user.c_str(), pass.c_str());
   } else {
-    ok = g_mqttClient.connect(clientID);
+    ok = g_mqttClient.connect(clientID.c_str());
   }
 
   if (ok) {
@@ -3155,23 +2767,20 @@ static jsval_t js_mqtt_connect(struct js *js, jsval_t *args, int nargs) {
 
 // mqtt_publish(topic, message)
 static jsval_t js_mqtt_publish(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 2) return js_mkfalse();
-  const char *topic = js_str(js, args[0]);
-  const char *message = js_str(js, args[1]);
-  if (!topic || !message) return js_mkfalse();
+  ElkStr topic = elk_arg_str(js, args, nargs, 0), message = elk_arg_text(js, args, nargs, 1);
+  if (nargs < 2 || !topic.ok() || !message.ok()) return js_mkfalse();
 
-  bool ok = g_mqttClient.publish(topic, message);
+  bool ok = g_mqttClient.publish(topic.c_str(), (const uint8_t *)message.ptr, message.len);
   return ok ? js_mktrue() : js_mkfalse();
 }
 
 // mqtt_subscribe(topic)
 static jsval_t js_mqtt_subscribe(struct js *js, jsval_t *args, int nargs) {
-  if (nargs < 1) return js_mkfalse();
-  const char *topic = js_str(js, args[0]);
-  if (!topic) return js_mkfalse();
+  ElkStr topic = elk_arg_str(js, args, nargs, 0);
+  if (!topic.ok()) return js_mkfalse();
 
-  bool ok = g_mqttClient.subscribe(topic);
-  LOGF("[MQTT] Subscribed to '%s'? => %s\n", topic, ok ? "OK" : "FAIL");
+  bool ok = g_mqttClient.subscribe(topic.c_str());
+  LOGF("[MQTT] Subscribed to '%s'? => %s\n", topic.c_str(), ok ? "OK" : "FAIL");
   return ok ? js_mktrue() : js_mkfalse();
 }
 
@@ -3181,24 +2790,21 @@ static jsval_t js_mqtt_loop(struct js *js, jsval_t *args, int nargs) {
   return js_mknull();
 }
 
-// mqtt_on_message("myCallback")
+// mqtt_on_message(myCallback) or mqtt_on_message("myCallback"), or
+// mqtt_on_message(null) to remove the callback
 static jsval_t js_mqtt_on_message(struct js *js, jsval_t *args, int nargs) {
   if (nargs < 1) return js_mkfalse();
 
-  // Check if user passed a string naming the function
-  size_t len = 0;
-  char *str = js_getstr(js, args[0], &len);
-  if (!str || len == 0 || len >= sizeof(g_mqttCallbackName)) {
+  if (js_type(args[0]) == JS_NULL) {
+    elk_callback_free(js, &g_mqttCallback);
+    return js_mktrue();
+  }
+  if (!elk_callback_set(js, &g_mqttCallback, args[0])) {
     return js_mkfalse();
   }
 
-  // Copy that name to our global
-  memset(g_mqttCallbackName, 0, sizeof(g_mqttCallbackName));
-  memcpy(g_mqttCallbackName, str, len);  // not zero-terminated by default
-  g_mqttCallbackName[len] = '\0';
-
-  Serial.print("[MQTT] JS callback name set to: ");
-  LOG(g_mqttCallbackName);
+  Serial.print("[MQTT] JS callback set to: ");
+  LOG(elk_callback_name(&g_mqttCallback));
   return js_mktrue();
 }
 
@@ -3284,7 +2890,7 @@ void wifiMqttMaintainLoop() {
 
 static jsval_t js_set_brightness(struct js *js, jsval_t *args, int nargs) {
   if (nargs < 1) return js_mknum(-1);
-  int val = (int)js_getnum(args[0]);
+  int val = js_getint(args[0]);
   if (val < 0) val = 0;
   if (val > 255) val = 255;
   lcd_brightness((uint8_t)val);
@@ -3295,159 +2901,529 @@ static jsval_t js_get_brightness(struct js *js, jsval_t *args, int nargs) {
   return js_mknum((double)webscreen_display_get_brightness());
 }
 
+/******************************************************************************
+ * H3) Worker Contexts and Message Channels
+ ******************************************************************************/
+
+// A script can start workers: more Elk instances, each with its own memory,
+// task and set of native functions, e.g. to poll a server on core 1 while
+// the UI script keeps drawing on core 0. Only the UI context, 0, may use
+// LVGL. Contexts exchange strings through bounded queues: post_message(to,
+// text) copies the text, on_message(fn) sets the handler, called with
+// (text, from) by the task of the receiving context. HTTP headers and the CA
+// certificate are shared, set them from the UI context
+struct ElkMessage {
+  int from;     // Sender context
+  size_t len;   // Text length
+  char text[1];  // Text, 0-terminated
+};
+
+struct ElkContext {
+  struct js *js;        // NULL for a free worker slot
+  uint8_t *mem;         // Elk heap and VM memory of a worker
+  QueueHandle_t inbox;  // ElkMessage *, allocated by the sender
+  int callbacks;        // Root of the callbacks Array, or -1, see elk_callbacks()
+  ElkCallback handler;  // on_message() function
+  TaskHandle_t task;    // Worker task
+  volatile bool stop;   // Set by elk_workers_stop(): the worker task must end
+  volatile bool done;   // Set by the worker task as it ends
+  char script[64];      // Worker script path
+};
+static ElkContext g_elk_contexts[1 + WEBSCREEN_JS_MAX_WORKERS];
+
+// Forget the callbacks of a context whose JS instance is new or gone
+static void elk_context_reset(ElkContext *ctx) {
+  ctx->callbacks = -1;
+  ctx->handler.id = -1;
+  ctx->handler.name[0] = '\0';
+}
+
+// Create the message queues, once, before any worker starts
+static void elk_contexts_init() {
+  for (int i = 0; i <= WEBSCREEN_JS_MAX_WORKERS; i++) {
+    ElkContext *ctx = &g_elk_contexts[i];
+    if (ctx->inbox == NULL) {
+      ctx->inbox = xQueueCreate(WEBSCREEN_JS_CHANNEL_DEPTH, sizeof(ElkMessage *));
+      elk_context_reset(ctx);
+    }
+  }
+  g_elk_contexts[0].js = js;
+  elk_context_reset(&g_elk_contexts[0]);
+  g_mqttCallback.id = -1, g_mqttCallback.name[0] = '\0';
+}
+
+static ElkContext *elk_context(struct js *js) {
+  for (int i = 0; i <= WEBSCREEN_JS_MAX_WORKERS; i++) {
+    if (g_elk_contexts[i].js == js) return &g_elk_contexts[i];
+  }
+  return NULL;
+}
+
+static int *elk_callbacks_root(struct js *js) {
+  ElkContext *ctx = elk_context(js);
+  return ctx != NULL ? &ctx->callbacks : NULL;
+}
+
+// Call the on_message() handler for each queued message. Wait up to ms for
+// the first one
+static void elk_deliver_messages(struct js *js, uint32_t ms) {
+  ElkContext *ctx = elk_context(js);
+  ElkMessage *m;
+  if (ctx == NULL || ctx->inbox == NULL) return;
+  while (!ctx->stop && xQueueReceive(ctx->inbox, &m, pdMS_TO_TICKS(ms)) == pdTRUE) {
+    if (ctx->handler.id >= 0) {
+      jsval_t args[2] = {js_mkstr(js, m->text, m->len), js_mknum(m->from)};
+      jsval_t res = js_call(js, elk_callback_fn(js, &ctx->handler), args, 2);
+      if (js_type(res) == JS_ERR) LOGF("on_message error: %s\n", js_str(js, res));
+    }
+    free(m);
+    ms = 0;
+  }
+}
+
+// delay() in a worker: deliver messages until the time is up, or the worker
+// is stopped. Return false in the UI context, which must not run handlers in
+// the middle of a callback
+static bool elk_worker_wait(struct js *js, uint32_t ms) {
+  ElkContext *ctx = elk_context(js);
+  if (ctx == NULL || ctx == &g_elk_contexts[0]) return false;
+  for (uint32_t start = millis(), now = start; now - start < ms && !ctx->stop; now = millis()) {
+    uint32_t left = ms - (now - start);
+    elk_deliver_messages(js, left < 50 ? left : 50);  // Check stop now and then
+  }
+  return true;
+}
+
+// post_message(to, text): queue a copy of text for context 'to'. Return
+// false if there is no such context or its queue is full
+static jsval_t js_post_message(struct js *js, jsval_t *args, int nargs) {
+  size_t len = 0;
+  int to = nargs > 0 && js_type(args[0]) == JS_NUM ? js_getint(args[0]) : -1;
+  char *text = nargs > 1 && js_type(args[1]) == JS_STR ? js_getstr(js, args[1], &len) : NULL;
+  ElkContext *ctx = to >= 0 && to <= WEBSCREEN_JS_MAX_WORKERS ? &g_elk_contexts[to] : NULL;
+  ElkContext *self = elk_context(js);
+  if (ctx == NULL || ctx->js == NULL || ctx->inbox == NULL || self == NULL || text == NULL) {
+    return js_mkfalse();
+  }
+  if (len > WEBSCREEN_JS_MESSAGE_MAX) return js_mkerr(js, "message too long");
+  ElkMessage *m = (ElkMessage *)ps_malloc(sizeof(ElkMessage) + len);
+  if (m == NULL) return js_mkfalse();
+  m->from = (int)(self - g_elk_contexts), m->len = len;
+  memcpy(m->text, text, len);
+  m->text[len] = '\0';
+  if (xQueueSend(ctx->inbox, &m, 0) != pdTRUE) {
+    free(m);
+    return js_mkfalse();
+  }
+  return js_mktrue();
+}
+
+// on_message(fn): set the message handler of this context, fn(text, from).
+// on_message(null) removes it
+static jsval_t js_on_message(struct js *js, jsval_t *args, int nargs) {
+  ElkContext *ctx = elk_context(js);
+  if (ctx == NULL || nargs < 1) return js_mkfalse();
+  if (js_type(args[0]) == JS_NULL) {
+    elk_callback_free(js, &ctx->handler);
+    return js_mktrue();
+  }
+  if (js_type(args[0]) != JS_PRIV) return js_mkfalse();
+  return elk_callback_set(js, &ctx->handler, args[0]) ? js_mktrue() : js_mkfalse();
+}
+
+static jsval_t elk_worker_builtin(struct js *js, const char *name, size_t len);
+
+// A runaway worker only yields, nothing else waits for it. A stopped one is
+// aborted, so that its task can end
+static bool elk_worker_overrun(struct js *js) {
+  ElkContext *ctx = elk_context(js);
+  if (ctx != NULL && ctx->stop) return false;
+  vTaskDelay(1);
+  return true;
+}
+
+static void elk_worker_task(void *arg) {
+  ElkContext *ctx = (ElkContext *)arg;
+  File f = SD_MMC.open(ctx->script);
+  size_t len = f ? f.size() : 0;
+  char *code = len > 0 ? (char *)ps_malloc(len) : NULL;
+  if (code != NULL && f.read((uint8_t *)code, len) == len) {
+    jsval_t res = js_eval(ctx->js, code, len);
+    if (js_type(res) == JS_ERR) LOGF("Worker %s: %s\n", ctx->script, js_str(ctx->js, res));
+  } else {
+    LOGF("Worker %s: cannot read script\n", ctx->script);
+  }
+  if (f) f.close();
+  free(code);
+  while (!ctx->stop) {
+    elk_deliver_messages(ctx->js, 50);
+    js_gcstep(ctx->js);
+  }
+  ctx->done = true;  // Nothing of the context is used after this
+  vTaskDelete(NULL);
+}
+
+// worker_start(path): run a script in a new context on core
+// WEBSCREEN_JS_WORKER_CORE. Return the context number for post_message(),
+// or -1. UI context only
+static jsval_t js_worker_start(struct js *js, jsval_t *args, int nargs) {
+  const size_t heap = WEBSCREEN_JS_WORKER_HEAP_KB * 1024, vm = WEBSCREEN_JS_WORKER_VM_KB * 1024;
+  size_t len = 0;
+  char *path = nargs > 0 && js_type(args[0]) == JS_STR ? js_getstr(js, args[0], &len) : NULL;
+  if (elk_context(js) != &g_elk_contexts[0] || path == NULL || len == 0) return js_mknum(-1);
+  for (int i = 1; i <= WEBSCREEN_JS_MAX_WORKERS; i++) {
+    ElkContext *ctx = &g_elk_contexts[i];
+    if (ctx->js != NULL || ctx->inbox == NULL || len >= sizeof(ctx->script)) continue;
+    if ((ctx->mem = (uint8_t *)ps_malloc(heap + vm)) == NULL) return js_mknum(-1);
+    memcpy(ctx->script, path, len);
+    ctx->script[len] = '\0';
+    elk_context_reset(ctx);
+    ctx->stop = false, ctx->done = false;
+    ctx->js = js_create(ctx->mem, heap);
+    js_setvm(ctx->js, ctx->mem + heap, vm);
+    js_setgcadapt(ctx->js, heap / 4, heap / 2);
+    js_setgcslice(ctx->js, ELK_GC_SLICE_US);
+    js_setbudget(ctx->js, WEBSCREEN_JS_MAX_EXECUTION_TIME_MS * 1000U, elk_worker_overrun);
+    js_setmaxcss(ctx->js, (WEBSCREEN_JS_WORKER_STACK_KB - WEBSCREEN_JS_NATIVE_STACK_KB) * 1024);
+    js_setresolver(ctx->js, elk_worker_builtin);
+    if (xTaskCreatePinnedToCore(elk_worker_task, "WebScreenJSW", WEBSCREEN_JS_WORKER_STACK_KB * 1024,
+                                ctx, 1, &ctx->task, WEBSCREEN_JS_WORKER_CORE) != pdPASS) {
+      free(ctx->mem);
+      ctx->js = NULL, ctx->mem = NULL;
+      return js_mknum(-1);
+    }
+    LOGF("Worker %d started: %s\n", i, ctx->script);
+    return js_mknum(i);
+  }
+  return js_mknum(-1);
+}
+
+// Stop all workers and drop queued messages, e.g. before the UI context goes.
+// Workers are not deleted where they are, they may hold a lock such as
+// g_http_mtx or an open file: each one is told to stop, and its script is
+// aborted on the next budget check, see elk_worker_overrun(). Wait for the
+// tasks to end, within about WEBSCREEN_JS_MAX_EXECUTION_TIME_MS or a request
+static void elk_workers_stop() {
+  ElkMessage *m;
+  for (int i = 1; i <= WEBSCREEN_JS_MAX_WORKERS; i++) {
+    if (g_elk_contexts[i].js != NULL) g_elk_contexts[i].stop = true;
+  }
+  for (int i = 0; i <= WEBSCREEN_JS_MAX_WORKERS; i++) {
+    ElkContext *ctx = &g_elk_contexts[i];
+    if (i > 0 && ctx->js != NULL) {
+      while (!ctx->done) vTaskDelay(pdMS_TO_TICKS(10));
+      free(ctx->mem);
+      ctx->js = NULL, ctx->mem = NULL, ctx->task = NULL;
+    }
+    while (ctx->inbox != NULL && xQueueReceive(ctx->inbox, &m, 0) == pdTRUE) free(m);
+    elk_context_reset(ctx);
+  }
+  g_elk_contexts[0].js = NULL;
+}
+
 /******************************************************************************
  * I) Register All JS Functions
  ******************************************************************************/
 
+// Native functions, as X(JS name, C function). They take no JS heap: the
+// table lives in flash, and Elk falls back to it for names that are not found
+// in any scope. Scripts can still shadow a builtin with `let`.
+#define ELK_BUILTINS(X)                                                        \
+  /* Basic */                                                                  \
+  X(print, js_print)                                                           \
+  X(mem_stats, js_mem_stats)                                                   \
+  X(wifi_connect, js_wifi_connect)                                             \
+  X(wifi_status, js_wifi_status)                                               \
+  X(wifi_get_ip, js_wifi_get_ip)                                               \
+  X(delay, js_delay)                                                           \
+  X(set_brightness, js_set_brightness)                                         \
+  X(get_brightness, js_get_brightness)                                         \
+  X(create_timer, js_create_timer)                                             \
+  X(delete_timer, js_delete_timer)                                             \
+  X(toNumber, js_to_number)                                                    \
+  X(numberToString, js_number_to_string)                                       \
+  X(Array, js_array)                                                           \
+  X(Uint8Array, js_uint8_array)                                                \
+  X(Int16Array, js_int16_array)                                                \
+  X(Float32Array, js_float32_array)                                            \
+  /* bridging for indexOf / substring */                                       \
+  X(str_index_of, js_str_index_of)                                             \
+  X(str_substring, js_str_substring)                                           \
+  X(str_join, js_str_join)                                                     \
+  X(http_get, js_http_get)                                                     \
+  X(http_post, js_http_post)                                                   \
+  X(http_delete, js_http_delete)                                               \
+  X(http_set_ca_cert_from_sd, js_http_set_ca_cert_from_sd)                     \
+  X(parse_json_value, js_parse_json_value)                                     \
+  X(http_set_header, js_http_set_header)                                       \
+  X(http_clear_headers, js_http_clear_headers)                                 \
+  /* SD functions */                                                           \
+  X(sd_read_file, js_sd_read_file)                                             \
+  X(sd_write_file, js_sd_write_file)                                           \
+  X(sd_list_dir, js_sd_list_dir)                                               \
+  X(sd_delete_file, js_sd_delete_file)                                         \
+  X(ble_init, js_ble_init)                                                     \
+  X(ble_is_connected, js_ble_is_connected)                                     \
+  X(ble_write, js_ble_write)                                                   \
+  /* GIF from memory */                                                        \
+  X(show_gif_from_sd, js_show_gif_from_sd)                                     \
+  /* Basic shapes and labels. */                                               \
+  X(draw_label, js_lvgl_draw_label)                                            \
+  X(draw_rect, js_lvgl_draw_rect)                                              \
+  X(show_image, js_lvgl_show_image)                                            \
+  X(create_label, js_create_label)                                             \
+  X(label_set_text, js_label_set_text)                                         \
+  /* Handle-based image creation + transforms */                               \
+  X(create_image, js_create_image)                                             \
+  X(create_image_from_ram, js_create_image_from_ram)                           \
+  X(rotate_obj, js_rotate_obj)                                                 \
+  X(move_obj, js_move_obj)                                                     \
+  X(animate_obj, js_animate_obj)                                               \
+  /* Style creation + property setters */                                      \
+  X(create_style, js_create_style)                                             \
+  X(obj_add_style, js_obj_add_style)                                           \
+  X(style_set_radius, ELK_BIND(lv_style_set_radius))                           \
+  X(style_set_bg_opa, ELK_BIND(lv_style_set_bg_opa))                           \
+  X(style_set_bg_color, ELK_BIND(lv_style_set_bg_color))                       \
+  X(style_set_border_color, ELK_BIND(lv_style_set_border_color))               \
+  X(style_set_border_width, ELK_BIND(lv_style_set_border_width))               \
+  X(style_set_border_opa, ELK_BIND(lv_style_set_border_opa))                   \
+  X(style_set_border_side, ELK_BIND(lv_style_set_border_side))                 \
+  X(style_set_outline_width, ELK_BIND(lv_style_set_outline_width))             \
+  X(style_set_outline_color, ELK_BIND(lv_style_set_outline_color))             \
+  X(style_set_outline_pad, ELK_BIND(lv_style_set_outline_pad))                 \
+  X(style_set_shadow_width, ELK_BIND(lv_style_set_shadow_width))               \
+  X(style_set_shadow_color, ELK_BIND(lv_style_set_shadow_color))               \
+  X(style_set_shadow_ofs_x, ELK_BIND(lv_style_set_shadow_ofs_x))               \
+  X(style_set_shadow_ofs_y, ELK_BIND(lv_style_set_shadow_ofs_y))               \
+  X(style_set_img_recolor, ELK_BIND(lv_style_set_img_recolor))                 \
+  X(style_set_img_recolor_opa, ELK_BIND(lv_style_set_img_recolor_opa))         \
+  X(style_set_transform_angle, ELK_BIND(lv_style_set_transform_angle))         \
+  X(style_set_text_color, ELK_BIND(lv_style_set_text_color))                   \
+  X(style_set_text_letter_space, ELK_BIND(lv_style_set_text_letter_space))     \
+  X(style_set_text_line_space, ELK_BIND(lv_style_set_text_line_space))         \
+  X(style_set_text_font, js_style_set_text_font)                               \
+  X(style_set_text_align, ELK_BIND(lv_style_set_text_align))                   \
+  X(style_set_text_decor, ELK_BIND(lv_style_set_text_decor))                   \
+  X(style_set_line_color, ELK_BIND(lv_style_set_line_color))                   \
+  X(style_set_line_width, ELK_BIND(lv_style_set_line_width))                   \
+  X(style_set_line_rounded, ELK_BIND(lv_style_set_line_rounded))               \
+  X(style_set_pad_all, ELK_BIND(lv_style_set_pad_all))                         \
+  X(style_set_pad_left, ELK_BIND(lv_style_set_pad_left))                       \
+  X(style_set_pad_right, ELK_BIND(lv_style_set_pad_right))                     \
+  X(style_set_pad_top, ELK_BIND(lv_style_set_pad_top))                         \
+  X(style_set_pad_bottom, ELK_BIND(lv_style_set_pad_bottom))                   \
+  X(style_set_pad_ver, ELK_BIND(lv_style_set_pad_ver))                         \
+  X(style_set_pad_hor, ELK_BIND(lv_style_set_pad_hor))                         \
+  X(style_set_width, ELK_BIND(lv_style_set_width))                             \
+  X(style_set_height, ELK_BIND(lv_style_set_height))                           \
+  X(style_set_x, ELK_BIND(lv_style_set_x))                                     \
+  X(style_set_y, ELK_BIND(lv_style_set_y))                                     \
+  /* Object property setters */                                                \
+  X(obj_set_size, ELK_BIND(lv_obj_set_size))                                   \
+  X(obj_align, ELK_BIND(lv_obj_align))                                         \
+  /* Scroll, flex, flags */                                                    \
+  X(obj_set_scroll_snap_x, ELK_BIND(lv_obj_set_scroll_snap_x))                 \
+  X(obj_set_scroll_snap_y, ELK_BIND(lv_obj_set_scroll_snap_y))                 \
+  X(obj_add_flag, ELK_BIND(lv_obj_add_flag))                                   \
+  X(obj_clear_flag, ELK_BIND(lv_obj_clear_flag))                               \
+  X(obj_set_scroll_dir, ELK_BIND(lv_obj_set_scroll_dir))                       \
+  X(obj_set_scrollbar_mode, ELK_BIND(lv_obj_set_scrollbar_mode))               \
+  X(obj_set_flex_flow, ELK_BIND(lv_obj_set_flex_flow))                         \
+  X(obj_set_flex_align, ELK_BIND(lv_obj_set_flex_align))                       \
+  X(obj_set_style_clip_corner, ELK_BIND(lv_obj_set_style_clip_corner))         \
+  X(obj_set_style_base_dir, ELK_BIND(lv_obj_set_style_base_dir))               \
+  /* CHART */                                                                  \
+  X(lv_chart_create, js_lv_chart_create)                                       \
+  X(lv_chart_set_type, ELK_BIND(lv_chart_set_type))                            \
+  X(lv_chart_set_div_line_count, ELK_BIND(lv_chart_set_div_line_count))        \
+  X(lv_chart_set_update_mode, ELK_BIND(lv_chart_set_update_mode))              \
+  X(lv_chart_set_range, ELK_BIND(lv_chart_set_range))                          \
+  X(lv_chart_set_point_count, ELK_BIND(lv_chart_set_point_count))              \
+  X(lv_chart_refresh, ELK_BIND(lv_chart_refresh))                              \
+  X(lv_chart_add_series, js_lv_chart_add_series)                               \
+  X(lv_chart_set_next_value, js_lv_chart_set_next_value)                       \
+  X(lv_chart_set_next_value2, js_lv_chart_set_next_value2)                     \
+  X(lv_chart_set_values, js_lv_chart_set_values)                               \
+  X(lv_chart_set_axis_tick, ELK_BIND(lv_chart_set_axis_tick))                  \
+  X(lv_chart_set_zoom_x, ELK_BIND(lv_chart_set_zoom_x))                        \
+  X(lv_chart_set_zoom_y, ELK_BIND(lv_chart_set_zoom_y))                        \
+  /* METER */                                                                  \
+  X(lv_meter_create, js_lv_meter_create)                                       \
+  X(lv_meter_add_scale, js_lv_meter_add_scale)                                 \
+  X(lv_meter_set_scale_ticks, js_lv_meter_set_scale_ticks)                     \
+  X(lv_meter_set_scale_major_ticks, js_lv_meter_set_scale_major_ticks)         \
+  X(lv_meter_set_scale_range, js_lv_meter_set_scale_range)                     \
+  X(lv_meter_add_arc, js_lv_meter_add_arc)                                     \
+  X(lv_meter_add_scale_lines, js_lv_meter_add_scale_lines)                     \
+  X(lv_meter_add_needle_line, js_lv_meter_add_needle_line)                     \
+  X(lv_meter_add_needle_img, js_lv_meter_add_needle_img)                       \
+  X(lv_meter_set_indicator_start_value, js_lv_meter_set_indicator_start_value) \
+  X(lv_meter_set_indicator_end_value, js_lv_meter_set_indicator_end_value)     \
+  X(lv_meter_set_indicator_value, js_lv_meter_set_indicator_value)             \
+  /* SPAN */                                                                   \
+  X(lv_spangroup_create, js_lv_spangroup_create)                               \
+  X(lv_spangroup_set_align, js_lv_spangroup_set_align)                         \
+  X(lv_spangroup_set_overflow, js_lv_spangroup_set_overflow)                   \
+  X(lv_spangroup_set_indent, js_lv_spangroup_set_indent)                       \
+  X(lv_spangroup_set_mode, js_lv_spangroup_set_mode)                           \
+  X(lv_spangroup_new_span, js_lv_spangroup_new_span)                           \
+  X(lv_span_set_text, js_lv_span_set_text)                                     \
+  X(lv_span_set_text_static, js_lv_span_set_text_static)                       \
+  X(lv_spangroup_refr_mode, js_lv_spangroup_refr_mode)                         \
+  /* LINE bridging */                                                          \
+  X(lv_line_create, js_lv_line_create)                                         \
+  X(lv_line_set_points, js_lv_line_set_points)                                 \
+  /* MQTT bridging */                                                          \
+  X(mqtt_init, js_mqtt_init)                                                   \
+  X(mqtt_connect, js_mqtt_connect)                                             \
+  X(mqtt_publish, js_mqtt_publish)                                             \
+  X(mqtt_subscribe, js_mqtt_subscribe)                                         \
+  X(mqtt_loop, js_mqtt_loop)                                                   \
+  X(mqtt_on_message, js_mqtt_on_message)                                       \
+  /* Worker contexts */                                                        \
+  X(worker_start, js_worker_start)                                             \
+  X(post_message, js_post_message)                                             \
+  X(on_message, js_on_message)
+
+struct ElkBuiltin {
+  const char *name;
+  jsval_t (*fn)(struct js *, jsval_t *, int);
+};
+
+#define ELK_BUILTIN_ENUM(name, fn) ELK_BUILTIN_##name,
+#define ELK_BUILTIN_ENTRY(name, fn) {#name, fn},
+#define ELK_BUILTIN_CASE(name, fn) \
+  case elk_hash(#name, sizeof(#name) - 1): i = ELK_BUILTIN_##name; break;
+
+enum { ELK_BUILTINS(ELK_BUILTIN_ENUM) ELK_NUM_BUILTINS };
+static constexpr ElkBuiltin elk_builtins[ELK_NUM_BUILTINS] = {ELK_BUILTINS(ELK_BUILTIN_ENTRY)};
+
+// FNV-1a hash, usable in constant expressions
+static constexpr uint32_t elk_hash(const char *s, size_t len, uint32_t h = 2166136261U) {
+  return len == 0 ? h : elk_hash(s + 1, len - 1, (h ^ (uint8_t)*s) * 16777619U);
+}
+
+// Lookup fallback for Elk: find a builtin by name. Name hashes are computed at
+// compile time and used as case labels, so a hash collision in the table fails
+// the build, i.e. the hash is perfect, and the compiler turns the switch into a
+// jump table or a binary search. The name compare rejects other names that
+// happen to hash the same
+static uint32_t g_elk_builtin_hits = 0;  // Builtins resolved, see elk_run_script()
+
+static int elk_builtin_find(const char *name, size_t len) {
+  int i = -1;
+  switch (elk_hash(name, len)) {
+    ELK_BUILTINS(ELK_BUILTIN_CASE)
+  }
+  if (i < 0 || strncmp(elk_builtins[i].name, name, len) != 0 || elk_builtins[i].name[len] != '\0') {
+    return -1;
+  }
+  return i;
+}
+
+static jsval_t elk_builtin(struct js *js, const char *name, size_t len) {
+  int i = elk_builtin_find(name, len);
+  if (i < 0) return js_mkundef();
+  g_elk_builtin_hits++;
+  return js_mkfun(elk_builtins[i].fn);
+}
+
+// Native functions a worker gets: none that touch LVGL or the callbacks of
+// the UI context
+#define ELK_WORKER_BUILTINS(X)                                                 \
+  X(print) X(delay) X(wifi_status) X(wifi_get_ip) X(toNumber)                  \
+  X(numberToString) X(Array) X(Uint8Array) X(Int16Array) X(Float32Array)      \
+  X(str_index_of) X(str_substring) X(str_join) X(parse_json_value)             \
+  X(http_get) X(http_post) X(http_delete) X(sd_read_file) X(sd_write_file)     \
+  X(sd_list_dir) X(post_message) X(on_message)
+
+#define ELK_WORKER_CASE(name) case ELK_BUILTIN_##name:
+
+static jsval_t elk_worker_builtin(struct js *js, const char *name, size_t len) {
+  int i = elk_builtin_find(name, len);
+  switch (i) {
+    ELK_WORKER_BUILTINS(ELK_WORKER_CASE)
+    return js_mkfun(elk_builtins[i].fn);
+    default:
+      return js_mkundef();
+  }
+}
+
 void register_js_functions() {
-  jsval_t global = js_glob(js);
-
-  // Basic
-  js_set(js, global, "print", js_mkfun(js_print));
-  js_set(js, global, "mem_stats", js_mkfun(js_mem_stats));
-  js_set(js, global, "wifi_connect", js_mkfun(js_wifi_connect));
-  js_set(js, global, "wifi_status", js_mkfun(js_wifi_status));
-  js_set(js, global, "wifi_get_ip", js_mkfun(js_wifi_get_ip));
-  js_set(js, global, "delay", js_mkfun(js_delay));
-  js_set(js, global, "set_brightness", js_mkfun(js_set_brightness));
-  js_set(js, global, "get_brightness", js_mkfun(js_get_brightness));
-  js_set(js, global, "create_timer", js_mkfun(js_create_timer));
-  js_set(js, global, "toNumber", js_mkfun(js_to_number));
-  js_set(js, global, "numberToString", js_mkfun(js_number_to_string));
-
-  // bridging for indexOf / substring
-  js_set(js, global, "str_index_of", js_mkfun(js_str_index_of));
-  js_set(js, global, "str_substring", js_mkfun(js_str_substring));
-
-  js_set(js, global, "http_get", js_mkfun(js_http_get));
-  js_set(js, global, "http_post", js_mkfun(js_http_post));
-  js_set(js, global, "http_delete", js_mkfun(js_http_delete));
-  js_set(js, global, "http_set_ca_cert_from_sd", js_mkfun(js_http_set_ca_cert_from_sd));
-  js_set(js, global, "parse_json_value", js_mkfun(js_parse_json_value));
-  js_set(js, global, "http_set_header", js_mkfun(js_http_set_header));
-  js_set(js, global, "http_clear_headers", js_mkfun(js_http_clear_headers));
-
-  // SD functions
-  js_set(js, global, "sd_read_file", js_mkfun(js_sd_read_file));
-  js_set(js, global, "sd_write_file", js_mkfun(js_sd_write_file));
-  js_set(js, global, "sd_list_dir", js_mkfun(js_sd_list_dir));
-  js_set(js, global, "sd_delete_file", js_mkfun(js_sd_delete_file));
-
-  js_set(js, global, "ble_init", js_mkfun(js_ble_init));
-  js_set(js, global, "ble_is_connected", js_mkfun(js_ble_is_connected));
-  js_set(js, global, "ble_write", js_mkfun(js_ble_write));
-
-  // GIF from memory
-  js_set(js, global, "show_gif_from_sd", js_mkfun(js_show_gif_from_sd));
-
-  // Basic shapes and labels.
-  js_set(js, global, "draw_label", js_mkfun(js_lvgl_draw_label));
-  js_set(js, global, "draw_rect", js_mkfun(js_lvgl_draw_rect));
-  js_set(js, global, "show_image", js_mkfun(js_lvgl_show_image));
-  js_set(js, global, "create_label", js_mkfun(js_create_label));
-  js_set(js, global, "label_set_text", js_mkfun(js_label_set_text));
-
-  // Handle-based image creation + transforms
-  js_set(js, global, "create_image", js_mkfun(js_create_image));
-  js_set(js, global, "create_image_from_ram", js_mkfun(js_create_image_from_ram));
-  js_set(js, global, "rotate_obj", js_mkfun(js_rotate_obj));
-  js_set(js, global, "move_obj", js_mkfun(js_move_obj));
-  js_set(js, global, "animate_obj", js_mkfun(js_animate_obj));
-
-  // Style creation + property setters
-  js_set(js, global, "create_style", js_mkfun(js_create_style));
-  js_set(js, global, "obj_add_style", js_mkfun(js_obj_add_style));
-
-  js_set(js, global, "style_set_radius", js_mkfun(js_style_set_radius));
-  js_set(js, global, "style_set_bg_opa", js_mkfun(js_style_set_bg_opa));
-  js_set(js, global, "style_set_bg_color", js_mkfun(js_style_set_bg_color));
-  js_set(js, global, "style_set_border_color", js_mkfun(js_style_set_border_color));
-  js_set(js, global, "style_set_border_width", js_mkfun(js_style_set_border_width));
-  js_set(js, global, "style_set_border_opa", js_mkfun(js_style_set_border_opa));
-  js_set(js, global, "style_set_border_side", js_mkfun(js_style_set_border_side));
-  js_set(js, global, "style_set_outline_width", js_mkfun(js_style_set_outline_width));
-  js_set(js, global, "style_set_outline_color", js_mkfun(js_style_set_outline_color));
-  js_set(js, global, "style_set_outline_pad", js_mkfun(js_style_set_outline_pad));
-  js_set(js, global, "style_set_shadow_width", js_mkfun(js_style_set_shadow_width));
-  js_set(js, global, "style_set_shadow_color", js_mkfun(js_style_set_shadow_color));
-  js_set(js, global, "style_set_shadow_ofs_x", js_mkfun(js_style_set_shadow_ofs_x));
-  js_set(js, global, "style_set_shadow_ofs_y", js_mkfun(js_style_set_shadow_ofs_y));
-  js_set(js, global, "style_set_img_recolor", js_mkfun(js_style_set_img_recolor));
-  js_set(js, global, "style_set_img_recolor_opa", js_mkfun(js_style_set_img_recolor_opa));
-  js_set(js, global, "style_set_transform_angle", js_mkfun(js_style_set_transform_angle));
-  js_set(js, global, "style_set_text_color", js_mkfun(js_style_set_text_color));
-  js_set(js, global, "style_set_text_letter_space", js_mkfun(js_style_set_text_letter_space));
-  js_set(js, global, "style_set_text_line_space", js_mkfun(js_style_set_text_line_space));
-  js_set(js, global, "style_set_text_font", js_mkfun(js_style_set_text_font));
-  js_set(js, global, "style_set_text_align", js_mkfun(js_style_set_text_align));
-  js_set(js, global, "style_set_text_decor", js_mkfun(js_style_set_text_decor));
-  js_set(js, global, "style_set_line_color", js_mkfun(js_style_set_line_color));
-  js_set(js, global, "style_set_line_width", js_mkfun(js_style_set_line_width));
-  js_set(js, global, "style_set_line_rounded", js_mkfun(js_style_set_line_rounded));
-  js_set(js, global, "style_set_pad_all", js_mkfun(js_style_set_pad_all));
-  js_set(js, global, "style_set_pad_left", js_mkfun(js_style_set_pad_left));
-  js_set(js, global, "style_set_pad_right", js_mkfun(js_style_set_pad_right));
-  js_set(js, global, "style_set_pad_top", js_mkfun(js_style_set_pad_top));
-  js_set(js, global, "style_set_pad_bottom", js_mkfun(js_style_set_pad_bottom));
-  js_set(js, global, "style_set_pad_ver", js_mkfun(js_style_set_pad_ver));
-  js_set(js, global, "style_set_pad_hor", js_mkfun(js_style_set_pad_hor));
-  js_set(js, global, "style_set_width", js_mkfun(js_style_set_width));
-  js_set(js, global, "style_set_height", js_mkfun(js_style_set_height));
-  js_set(js, global, "style_set_x", js_mkfun(js_style_set_x));
-  js_set(js, global, "style_set_y", js_mkfun(js_style_set_y));
-
-  // Object property setters
-  js_set(js, global, "obj_set_size", js_mkfun(js_obj_set_size));
-  js_set(js, global, "obj_align", js_mkfun(js_obj_align));
-
-  // Scroll, flex, flags
-  js_set(js, global, "obj_set_scroll_snap_x", js_mkfun(js_obj_set_scroll_snap_x));
-  js_set(js, global, "obj_set_scroll_snap_y", js_mkfun(js_obj_set_scroll_snap_y));
-  js_set(js, global, "obj_add_flag", js_mkfun(js_obj_add_flag));
-  js_set(js, global, "obj_clear_flag", js_mkfun(js_obj_clear_flag));
-  js_set(js, global, "obj_set_scroll_dir", js_mkfun(js_obj_set_scroll_dir));
-  js_set(js, global, "obj_set_scrollbar_mode", js_mkfun(js_obj_set_scrollbar_mode));
-  js_set(js, global, "obj_set_flex_flow", js_mkfun(js_obj_set_flex_flow));
-  js_set(js, global, "obj_set_flex_align", js_mkfun(js_obj_set_flex_align));
-  js_set(js, global, "obj_set_style_clip_corner", js_mkfun(js_obj_set_style_clip_corner));
-  js_set(js, global, "obj_set_style_base_dir", js_mkfun(js_obj_set_style_base_dir));
-
-  //==================== METER ============================
-  js_set(js, global, "lv_meter_create", js_mkfun(js_lv_meter_create));
-  js_set(js, global, "lv_meter_add_scale", js_mkfun(js_lv_meter_add_scale));
-  js_set(js, global, "lv_meter_set_scale_ticks", js_mkfun(js_lv_meter_set_scale_ticks));
-  js_set(js, global, "lv_meter_set_scale_major_ticks", js_mkfun(js_lv_meter_set_scale_major_ticks));
-  js_set(js, global, "lv_meter_set_scale_range", js_mkfun(js_lv_meter_set_scale_range));
-  js_set(js, global, "lv_meter_add_arc", js_mkfun(js_lv_meter_add_arc));
-  js_set(js, global, "lv_meter_add_scale_lines", js_mkfun(js_lv_meter_add_scale_lines));
-  js_set(js, global, "lv_meter_add_needle_line", js_mkfun(js_lv_meter_add_needle_line));
-  js_set(js, global, "lv_meter_add_needle_img", js_mkfun(js_lv_meter_add_needle_img));
-  js_set(js, global, "lv_meter_set_indicator_start_value", js_mkfun(js_lv_meter_set_indicator_start_value));
-  js_set(js, global, "lv_meter_set_indicator_end_value", js_mkfun(js_lv_meter_set_indicator_end_value));
-  js_set(js, global, "lv_meter_set_indicator_value", js_mkfun(js_lv_meter_set_indicator_value));
-
-  //==================== SPAN ============================
-  js_set(js, global, "lv_spangroup_create", js_mkfun(js_lv_spangroup_create));
-  js_set(js, global, "lv_spangroup_set_align", js_mkfun(js_lv_spangroup_set_align));
-  js_set(js, global, "lv_spangroup_set_overflow", js_mkfun(js_lv_spangroup_set_overflow));
-  js_set(js, global, "lv_spangroup_set_indent", js_mkfun(js_lv_spangroup_set_indent));
-  js_set(js, global, "lv_spangroup_set_mode", js_mkfun(js_lv_spangroup_set_mode));
-  js_set(js, global, "lv_spangroup_new_span", js_mkfun(js_lv_spangroup_new_span));
-  js_set(js, global, "lv_span_set_text", js_mkfun(js_lv_span_set_text));
-  js_set(js, global, "lv_span_set_text_static", js_mkfun(js_lv_span_set_text_static));
-  js_set(js, global, "lv_spangroup_refr_mode", js_mkfun(js_lv_spangroup_refr_mode));
-
-  // ---------- LINE bridging
-  js_set(js, global, "lv_line_create", js_mkfun(js_lv_line_create));
-  js_set(js, global, "lv_line_set_points", js_mkfun(js_lv_line_set_points));
-
-  // MQTT bridging
-  js_set(js, global, "mqtt_init", js_mkfun(js_mqtt_init));
-  js_set(js, global, "mqtt_connect", js_mkfun(js_mqtt_connect));
-  js_set(js, global, "mqtt_publish", js_mkfun(js_mqtt_publish));
-  js_set(js, global, "mqtt_subscribe", js_mkfun(js_mqtt_subscribe));
-  js_set(js, global, "mqtt_loop", js_mkfun(js_mqtt_loop));
-  js_set(js, global, "mqtt_on_message", js_mkfun(js_mqtt_on_message));
+  js_setresolver(js, elk_builtin);
+  elk_contexts_init();
+}
+
+// App snapshots. Evaluating app.js on every boot re-creates all of its
+// functions and data before the first frame. When the top level only
+// defines things, and leaves UI, timers and network to a setup() function,
+// Elk memory is saved to SD after the top level has run. Later boots
+// restore it with one read instead, then call setup(). LVGL objects and
+// other native state are not in Elk memory, so a script whose top level
+// uses native functions always runs normally. Snapshots are keyed by the
+// script and the firmware build; native functions are saved as their index
+// in elk_builtins[]
+#define ELK_SNAPSHOT_FILE "/webscreen.snap"
+
+static uint32_t elk_snapshot_fnid(void *fn) {
+  for (uint32_t i = 0; i < ELK_NUM_BUILTINS; i++) {
+    if ((void *)elk_builtins[i].fn == fn) return i;
+  }
+  return ~(uint32_t)0;
+}
+
+static void *elk_snapshot_idfn(uint32_t id) {
+  return id < ELK_NUM_BUILTINS ? (void *)elk_builtins[id].fn : NULL;
+}
+
+static size_t elk_snapshot_write(void *ctx, void *buf, size_t len) {
+  return ((File *)ctx)->write((const uint8_t *)buf, len);
+}
+
+static size_t elk_snapshot_read(void *ctx, void *buf, size_t len) {
+  return ((File *)ctx)->read((uint8_t *)buf, len);
+}
+
+static uint32_t elk_snapshot_key(const char *code, size_t len) {
+  uint32_t h = 2166136261U;  // FNV-1a
+  for (size_t i = 0; i < len; i++) h = (h ^ (uint8_t)code[i]) * 16777619U;
+  for (const char *p = __DATE__ " " __TIME__; *p != '\0'; p++) h = (h ^ (uint8_t)*p) * 16777619U;
+  return h;
+}
+
+// Run the app script: restore its snapshot, or evaluate it and take one.
+// The script is source text, or compiled by js_compile() if jsc is true.
+// It gets pinned: functions refer to their source in it, so the buffer must
+// stay unchanged while the JS instance lives. Return the result of setup()
+// for snapshot-friendly scripts, or of the evaluation otherwise
+jsval_t elk_run_script(const char *code, size_t len, bool jsc) {
+  uint32_t key = elk_snapshot_key(code, len), start = millis();
+  js_pin(js, code, len);  // Before js_restore(): snapshots refer to it too
+  File f = SD_MMC.exists(ELK_SNAPSHOT_FILE) ? SD_MMC.open(ELK_SNAPSHOT_FILE) : File();
+  bool restored = f && js_restore(js, key, elk_snapshot_idfn, elk_snapshot_read, &f);
+  if (f) f.close();
+
+  if (restored) {
+    LOGF("[SNAPSHOT] Restored in %lu ms\n", (unsigned long)(millis() - start));
+  } else {
+    g_elk_builtin_hits = 0;
+    jsval_t res = jsc ? js_evaljsc(js, code, len) : js_eval(js, code, len);
+    LOGF("[SNAPSHOT] Top level evaluated in %lu ms\n", (unsigned long)(millis() - start));
+    if (js_type(res) == JS_ERR || js_type(js_get(js, js_glob(js), "setup")) != JS_PRIV) {
+      return res;  // Not snapshot-friendly: no setup()
+    }
+    if (g_elk_builtin_hits > 0) {
+      LOG("[SNAPSHOT] Top level uses native functions, not taking a snapshot");
+      return res;  // setup() may have been called already
+    }
+    File w = SD_MMC.open(ELK_SNAPSHOT_FILE, FILE_WRITE);
+    bool ok = w && js_snapshot(js, key, elk_snapshot_fnid, elk_snapshot_write, &w);
+    if (w) w.close();
+    if (!ok) SD_MMC.remove(ELK_SNAPSHOT_FILE);
+    LOG(ok ? "[SNAPSHOT] Saved" : "[SNAPSHOT] Failed to save");
+  }
+  return js_call(js, js_get(js, js_glob(js), "setup"), NULL, 0);
 }
 // K) The elk_task -- runs Elk + bridging in a separate FreeRTOS task
 
@@ -3459,13 +3435,16 @@ static void elk_task(void *pvParam) {
     return;
   }
 
-  js = js_create(elk_memory, elk_memory_size);
+  js = elk_create_js();
   if (!js) {
     LOG("Failed to initialize Elk in elk_task");
     // Delete this task if you want
     vTaskDelete(NULL);
     return;
   }
+  js_setvm(js, elk_vm_memory, elk_vm_memory_size);
+  js_setgcslice(js, ELK_GC_SLICE_US);
+  js_setbudget(js, WEBSCREEN_JS_MAX_EXECUTION_TIME_MS * 1000U, elk_overrun);
 
   register_js_functions();
 
@@ -3481,6 +3460,8 @@ static void elk_task(void *pvParam) {
     if (g_mqtt_enabled) {
       wifiMqttMaintainLoop();
     }
+    elk_deliver_messages(js, 0);
+    js_gcstep(js);  // GC slice between UI frames
     lv_timer_handler();
     vTaskDelay(pdMS_TO_TICKS(5));
   }
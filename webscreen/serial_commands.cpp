@@ -2,6 +2,7 @@
 #include "globals.h"
 #include "webscreen_config.h"
 #include "webscreen_hardware.h"
+#include "webscreen_runtime.h"
 #include <WiFi.h>
 #include <esp_system.h>
 #include <freertos/FreeRTOS.h>
@@ -89,6 +90,9 @@ void SerialCommands::processCommand(const String& command) {
   else if (baseCmd == "brightness") {
     setBrightness(args);
   }
+  else if (baseCmd == "profile" || baseCmd == "prof") {
+    profile(args);
+  }
   else {
     printError("Unknown command: " + baseCmd + ". Type /help for available commands.");
   }
@@ -114,6 +118,7 @@ void SerialCommands::showHelp() {
   Serial.println("/backup [save|restore]   - Backup/restore configuration");
   Serial.println("/monitor [cpu|mem|net]   - Live system monitoring");
   Serial.println("/brightness <0-255>     - Set display brightness");
+  Serial.println("/profile <cmd> [file]    - JS profiler: start, stop, dump [offsets] [file]");
   Serial.println("/reboot                  - Restart the device");
   Serial.println("\nExamples:");
   Serial.println("/write hello.js");
@@ -154,6 +159,10 @@ void SerialCommands::showStats() {
     Serial.println("WiFi: Disconnected");
   }
   
+  // JavaScript
+  webscreen_runtime_print_javascript_memory_stats();
+  webscreen_runtime_print_javascript_budget_stats();
+
   // Uptime
   Serial.printf("Uptime: %lu seconds\n", millis() / 1000);
   Serial.printf("CPU Frequency: %d MHz\n", ESP.getCpuFreqMHz());
@@ -220,6 +229,9 @@ void SerialCommands::writeScript(const String& args) {
   
   file.close();
   printSuccess("Script saved: " + filename + " (" + formatBytes(SD_MMC.open(filename).size()) + ")");
+  if (webscreen_runtime_compile_script(filename.c_str())) {
+    Serial.println("Compiled: " + filename + "c");
+  }
 }
 
 // Base64 decoding table
@@ -335,6 +347,9 @@ void SerialCommands::uploadFile(const String& args) {
   file.close();
   Serial.println();
   printSuccess("File saved: " + filename + " (" + formatBytes(totalBytes) + ")");
+  if (filename.endsWith(".js") && webscreen_runtime_compile_script(filename.c_str())) {
+    Serial.println("Compiled: " + filename + "c");
+  }
 }
 
 void SerialCommands::configSet(const String& args) {
@@ -1055,4 +1070,46 @@ void SerialCommands::setBrightness(const String& args) {
 
   webscreen_display_set_brightness((uint8_t)brightness);
   printSuccess("Brightness set to " + String(brightness));
-}
\ No newline at end of file
+}
+void SerialCommands::profile(const String& args) {
+  String operation = args;
+  String rest = "";
+  int spaceIndex = args.indexOf(' ');
+  if (spaceIndex > 0) {
+    operation = args.substring(0, spaceIndex);
+    rest = args.substring(spaceIndex + 1);
+  }
+  operation.toLowerCase();
+  rest.trim();
+
+  if (operation == "start") {
+    if (!webscreen_runtime_profile_start()) {
+      printError("Cannot start profiler: no JavaScript engine, no memory or JS task busy");
+      return;
+    }
+    printSuccess("Profiler started, sampling every " + String(WEBSCREEN_JS_PROFILE_PERIOD_US) + " us");
+  } else if (operation == "stop") {
+    webscreen_runtime_profile_stop();
+    printSuccess("Profiler stopped");
+  } else if (operation == "dump") {
+    bool offsets = rest.startsWith("offsets");
+    if (offsets) {
+      rest = rest.substring(7);
+      rest.trim();
+    }
+    if (rest.length() == 0) {
+      size_t samples = webscreen_runtime_profile_dump(NULL, offsets);
+      Serial.printf("Samples: %u\n", (unsigned)samples);
+      return;
+    }
+    String path = rest.startsWith("/") ? rest : ("/" + rest);
+    size_t samples = webscreen_runtime_profile_dump(path.c_str(), offsets);
+    if (samples == 0) {
+      printError("No samples written to " + path);
+      return;
+    }
+    printSuccess(String(samples) + " samples written to " + path);
+  } else {
+    printError("Usage: /profile start|stop|dump [offsets] [file]");
+  }
+}
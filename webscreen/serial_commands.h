@@ -29,6 +29,7 @@ private:
   static void backup(const String& args);
   static void monitor(const String& args);
   static void setBrightness(const String& args);
+  static void profile(const String& args);
 
   static void printPrompt();
   static String formatBytes(size_t bytes);
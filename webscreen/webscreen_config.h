@@ -64,6 +64,18 @@
 // JavaScript Engine
 #define WEBSCREEN_JS_HEAP_SIZE_KB 512           // JavaScript heap size (KB)
 #define WEBSCREEN_JS_MAX_EXECUTION_TIME_MS 100  // Max script execution time
+#define WEBSCREEN_JS_MAX_YIELDS 10              // Overruns before a callback is aborted
+#define WEBSCREEN_JS_TASK_STACK_KB 24           // JS task stack (KB)
+#define WEBSCREEN_JS_NATIVE_STACK_KB 8          // Of that, kept for native calls, e.g. TLS (KB)
+#define WEBSCREEN_JS_PROFILE_KB 64              // Profiler sample table in PSRAM (KB)
+#define WEBSCREEN_JS_PROFILE_PERIOD_US 1000     // Profiler sampling period
+#define WEBSCREEN_JS_MAX_WORKERS 2              // Worker contexts a script can start
+#define WEBSCREEN_JS_WORKER_HEAP_KB 64          // Elk heap per worker, in PSRAM (KB)
+#define WEBSCREEN_JS_WORKER_VM_KB 16            // Bytecode VM memory per worker (KB)
+#define WEBSCREEN_JS_WORKER_CORE 1              // Core for worker tasks; UI runs on 0
+#define WEBSCREEN_JS_WORKER_STACK_KB 16         // Worker task stack (KB)
+#define WEBSCREEN_JS_CHANNEL_DEPTH 8            // Messages queued per context
+#define WEBSCREEN_JS_MESSAGE_MAX 4096           // Max message length (bytes)
 
 // ============================================================================
 // NETWORK CONFIGURATION
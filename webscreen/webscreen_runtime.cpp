@@ -12,6 +12,7 @@ extern "C" {
 }
 #include <WiFi.h>
 #include <PubSubClient.h>
+#include <atomic>
 static bool g_javascript_active = false;
 static bool g_fallback_active = false;
 static String g_current_script_file = "";
@@ -23,10 +24,26 @@ static bool g_lvgl_initialized = false;
 extern struct js* js;
 extern uint8_t *elk_memory;
 extern size_t elk_memory_size;
+extern uint8_t *elk_vm_memory;
+extern size_t elk_vm_memory_size;
 extern bool init_elk_memory();
+extern struct js *elk_create_js();
 static TaskHandle_t g_js_task_handle = NULL;
 static bool g_js_engine_initialized = false;
-static String g_js_script_content = "";
+static String g_js_script_content = "";  // Both are pinned by elk_run_script(): keep until shutdown
+static uint8_t* g_js_script_jsc = NULL;  // Compiled script, used instead of the text
+static size_t g_js_script_jsc_len = 0;
+static volatile bool g_js_gc_requested = false;  // Run by the JS task
+
+// Profiler operations requested by the serial task, run by the JS task
+// between frames: the profile table is written there, see
+// webscreen_runtime_profile_request()
+enum { PROFILE_NONE, PROFILE_START, PROFILE_STOP, PROFILE_DUMP };
+static std::atomic<int> g_js_profile_request(PROFILE_NONE);
+static SemaphoreHandle_t g_js_profile_done = NULL;  // Given when it has run
+static Print* g_js_profile_out = NULL;               // PROFILE_DUMP arguments
+static bool g_js_profile_offsets = false;
+static size_t g_js_profile_result = 0;
 
 static unsigned long g_last_mqtt_reconnect_attempt = 0;
 static unsigned long g_last_wifi_reconnect_attempt = 0;
@@ -82,12 +99,12 @@ bool webscreen_runtime_start_javascript(const char* script_file) {
     return false;
   }
 
+  g_current_script_file = script_file;  // Before the task, which may reload it
   if (!webscreen_runtime_start_javascript_task()) {
     g_last_error = "Failed to start JavaScript execution task";
     return false;
   }
 
-  g_current_script_file = script_file;
   g_javascript_active = true;
   g_fallback_active = false;
   g_runtime_start_time = WEBSCREEN_MILLIS();
@@ -154,7 +171,8 @@ void webscreen_runtime_shutdown(void) {
       g_js_task_handle = NULL;
     }
     if (js) {
-
+      elk_profile_stop();  // The sampler must not see a stale JS instance
+      elk_workers_stop();
       js = NULL;
     }
 
@@ -163,6 +181,9 @@ void webscreen_runtime_shutdown(void) {
     g_js_engine_initialized = false;
     g_current_script_file = "";
     g_js_script_content = "";
+    free(g_js_script_jsc);
+    g_js_script_jsc = NULL;
+    g_js_script_jsc_len = 0;
     g_last_error = "";
   }
 }
@@ -205,6 +226,74 @@ bool webscreen_runtime_execute_javascript(const char* code) {
 
   return true;  // Simulate successful execution
 }
+void webscreen_runtime_print_javascript_budget_stats(void) {
+  elk_print_budget_stats(Serial);
+}
+void webscreen_runtime_print_javascript_memory_stats(void) {
+  if (js) elk_print_memory_stats(Serial);
+}
+void webscreen_runtime_get_javascript_heap(uint32_t* objects, uint32_t* props,
+                                           uint32_t* strings, uint32_t* functions,
+                                           uint32_t* arrays) {
+  size_t o = 0, p = 0, s = 0, f = 0, a = 0;
+  if (js) js_heapstats(js, &o, &p, &s, &f, &a, NULL);
+  if (objects) *objects = o;
+  if (props) *props = p;
+  if (strings) *strings = s;
+  if (functions) *functions = f;
+  if (arrays) *arrays = a;
+}
+static size_t webscreen_runtime_profile_run(int op) {
+  switch (op) {
+    case PROFILE_START: return elk_profile_start() ? 1 : 0;
+    case PROFILE_STOP: elk_profile_stop(); return 0;
+    case PROFILE_DUMP: return elk_profile_dump(*g_js_profile_out, g_js_profile_offsets);
+    default: return 0;
+  }
+}
+
+// Have the JS task run a profiler operation, and wait for the result. If the
+// JS task does not take it within a second, e.g. while the script top level
+// runs, withdraw it and return 0. Without a JS task, run it here
+static size_t webscreen_runtime_profile_request(int op) {
+  if (g_js_task_handle == NULL || xTaskGetCurrentTaskHandle() == g_js_task_handle) {
+    return webscreen_runtime_profile_run(op);
+  }
+  if (g_js_profile_done == NULL && (g_js_profile_done = xSemaphoreCreateBinary()) == NULL) {
+    return 0;
+  }
+  g_js_profile_request = op;
+  if (xSemaphoreTake(g_js_profile_done, pdMS_TO_TICKS(1000)) != pdTRUE) {
+    int expected = op;
+    if (g_js_profile_request.compare_exchange_strong(expected, PROFILE_NONE)) {
+      return 0;  // Not taken
+    }
+    xSemaphoreTake(g_js_profile_done, portMAX_DELAY);  // Taken, running
+  }
+  return g_js_profile_result;
+}
+
+bool webscreen_runtime_profile_start(void) {
+  return webscreen_runtime_profile_request(PROFILE_START) != 0;
+}
+void webscreen_runtime_profile_stop(void) {
+  webscreen_runtime_profile_request(PROFILE_STOP);
+}
+size_t webscreen_runtime_profile_dump(const char* path, bool offsets) {
+  g_js_profile_offsets = offsets;
+  if (path == NULL) {
+    g_js_profile_out = &Serial;
+    return webscreen_runtime_profile_request(PROFILE_DUMP);
+  }
+  File out = SD_MMC.open(path, FILE_WRITE);
+  if (!out) {
+    return 0;
+  }
+  g_js_profile_out = &out;
+  size_t samples = webscreen_runtime_profile_request(PROFILE_DUMP);
+  out.close();
+  return samples;
+}
 void webscreen_runtime_get_javascript_stats(uint32_t* exec_count,
                                             uint32_t* avg_time_us,
                                             uint32_t* error_count) {
@@ -269,13 +358,24 @@ void webscreen_runtime_get_memory_usage(uint32_t* js_heap_used,
                                         uint32_t* lvgl_memory_used,
                                         uint32_t* total_runtime_memory) {
 
-  if (js_heap_used) *js_heap_used = g_javascript_active ? 50000 : 0;
-  if (lvgl_memory_used) *lvgl_memory_used = 100000;
-  if (total_runtime_memory) *total_runtime_memory = 150000;
+  uint32_t objects, props, strings, functions, arrays, js_used = 0, lvgl_used = 0;
+  if (g_javascript_active) {
+    webscreen_runtime_get_javascript_heap(&objects, &props, &strings, &functions, &arrays);
+    js_used = objects + props + strings + functions + arrays;
+  }
+  if (g_lvgl_initialized) {
+    lv_mem_monitor_t mon;
+    lv_mem_monitor(&mon);
+    lvgl_used = mon.total_size - mon.free_size;
+  }
+  if (js_heap_used) *js_heap_used = js_used;
+  if (lvgl_memory_used) *lvgl_memory_used = lvgl_used;
+  if (total_runtime_memory) *total_runtime_memory = js_used + lvgl_used;
 }
 bool webscreen_runtime_garbage_collect(void) {
-  if (g_javascript_active) {
-    WEBSCREEN_DEBUG_PRINTLN("JavaScript garbage collection triggered");
+  if (g_javascript_active && js) {
+    WEBSCREEN_DEBUG_PRINTLN("JavaScript garbage collection requested");
+    g_js_gc_requested = true;  // The heap belongs to the JS task
     return true;
   }
   return false;
@@ -345,15 +445,27 @@ bool webscreen_runtime_init_javascript_engine(void) {
     return false;
   }
 
-  js = js_create(elk_memory, elk_memory_size);
+  js = elk_create_js();  // Internal RAM first, then PSRAM
   if (!js) {
     WEBSCREEN_DEBUG_PRINTLN("Failed to initialize Elk JavaScript engine");
     return false;
   }
 
-  // Set aggressive GC threshold to trigger garbage collection more often
-  // This helps prevent memory fragmentation during long-running scripts
-  js_setgct(js, elk_memory_size / 4);  // Trigger GC when 25% of heap is used
+  // Trigger GC when 25% of heap is used, or more when most of it survives
+  // GC, up to 50%: then collecting often would gain little
+  js_setgcadapt(js, elk_memory_size / 4, elk_memory_size / 2);
+
+  // Run scripts on the bytecode VM when its memory is available. Code the
+  // VM cannot compile still runs on the tree-walking interpreter
+  js_setvm(js, elk_vm_memory, elk_vm_memory_size);
+
+  // Collect garbage in time-bounded slices from the JS task loop, so that
+  // GC does not stall LVGL rendering
+  js_setgcslice(js, ELK_GC_SLICE_US);
+
+  // Keep runaway callbacks from starving LVGL and the network, see
+  // elk_overrun()
+  js_setbudget(js, WEBSCREEN_JS_MAX_EXECUTION_TIME_MS * 1000U, elk_overrun);
 
   webscreen_runtime_register_js_functions();
 
@@ -361,6 +473,104 @@ bool webscreen_runtime_init_javascript_engine(void) {
   WEBSCREEN_DEBUG_PRINTLN("JavaScript engine initialized successfully");
   return true;
 }
+// Compiled scripts: "app.jsc" next to "app.js" holds the script minified,
+// with a checksum, see js_compile(). It is written when a script is uploaded,
+// or on the first boot that finds it missing, stale or damaged: the .js is
+// always the source of truth
+static String webscreen_runtime_jsc_path(const char* script_file) {
+  return String(script_file) + "c";
+}
+
+// Key of a script file as its .jsc records it, see js_setjsckey(): its size
+// and time, so that a .jsc is matched to its .js without reading the .js.
+// Scripts written on the device are compiled right away, and an edit on a
+// computer changes the time. Never 0, the key of a .jsc made by tools/jsc.c
+static uint32_t webscreen_runtime_script_key(File& file) {
+  uint32_t size = (uint32_t)file.size();
+  int64_t time = (int64_t)file.getLastWrite();
+  uint32_t key = js_srchash(&time, sizeof(time), js_srchash(&size, sizeof(size), 0));
+  return key != 0 ? key : 1;
+}
+
+// Hash of a script as js_compile() records it, to accept a .jsc compiled on a
+// computer once, by content
+static bool webscreen_runtime_hash_script(const char* script_file, uint32_t* hash) {
+  uint8_t chunk[512];
+  File file = SD_MMC.open(script_file);
+  if (!file) {
+    return false;
+  }
+  *hash = 0;
+  for (int n; (n = file.read(chunk, sizeof(chunk))) > 0;) {
+    *hash = js_srchash(chunk, (size_t)n, *hash);
+  }
+  file.close();
+  return true;
+}
+
+static bool webscreen_runtime_write_jsc(const String& path, const uint8_t* buf, size_t len) {
+  File out = SD_MMC.open(path, FILE_WRITE);
+  bool ok = out && out.write(buf, len) == len;
+  if (out) out.close();
+  return ok;
+}
+
+// Read the compiled script if it was made from the .js and is intact, else NULL
+static uint8_t* webscreen_runtime_read_jsc(const char* script_file, size_t* len) {
+  String path = webscreen_runtime_jsc_path(script_file);
+  File src_file = SD_MMC.open(script_file);
+  uint32_t key = src_file ? webscreen_runtime_script_key(src_file) : 0;
+  if (src_file) src_file.close();
+  File jsc_file = key != 0 && SD_MMC.exists(path) ? SD_MMC.open(path) : File();
+  *len = jsc_file ? jsc_file.size() : 0;
+  uint8_t* buf = *len > 0 ? (uint8_t*)ps_malloc(*len) : NULL;
+  uint32_t jsc_src = 0, jsc_key = 0, hash = 0;
+  bool ok = buf && jsc_file.read(buf, *len) == *len && js_checkjsc(buf, *len, &jsc_src, &jsc_key);
+  if (jsc_file) jsc_file.close();
+  if (ok && jsc_key != key) {
+    ok = jsc_key == 0 && webscreen_runtime_hash_script(script_file, &hash) && hash == jsc_src;
+    if (ok) {
+      js_setjsckey(buf, *len, key);  // Next boots check the key only
+      webscreen_runtime_write_jsc(path, buf, *len);
+    }
+  }
+  if (buf && !ok) {
+    WEBSCREEN_DEBUG_PRINTF("Compiled script %s is stale or damaged, using the source\n",
+                           path.c_str());
+    free(buf);
+    buf = NULL;
+  }
+  return buf;
+}
+
+bool webscreen_runtime_compile_script(const char* script_file) {
+  String path = webscreen_runtime_jsc_path(script_file);
+  File file = SD_MMC.open(script_file);
+  if (!file) {
+    return false;
+  }
+  String code = file.readString();
+  uint32_t key = webscreen_runtime_script_key(file);
+  file.close();
+
+  size_t len = js_compile(code.c_str(), code.length(), NULL, 0);
+  uint8_t* buf = len > 0 ? (uint8_t*)ps_malloc(len) : NULL;
+  bool ok = buf && js_compile(code.c_str(), code.length(), buf, len) == len;
+  if (ok) {
+    js_setjsckey(buf, len, key);
+    ok = webscreen_runtime_write_jsc(path, buf, len);
+  }
+  free(buf);
+  if (!ok && SD_MMC.exists(path)) {
+    SD_MMC.remove(path);  // Do not leave a stale compiled script behind
+  }
+  WEBSCREEN_DEBUG_PRINTF("Compiled %s: %s (%u -> %u bytes)\n", script_file,
+                         ok ? "ok" : "failed", (unsigned)code.length(), (unsigned)len);
+  return ok;
+}
+
+static bool webscreen_runtime_load_source(const char* script_file);
+
 bool webscreen_runtime_load_script(const char* script_file) {
   if (!script_file) {
     return false;
@@ -368,6 +578,17 @@ bool webscreen_runtime_load_script(const char* script_file) {
 
   WEBSCREEN_DEBUG_PRINTF("Loading JavaScript script from: %s\n", script_file);
 
+  free(g_js_script_jsc);
+  g_js_script_jsc = webscreen_runtime_read_jsc(script_file, &g_js_script_jsc_len);
+  if (g_js_script_jsc) {
+    WEBSCREEN_DEBUG_PRINTF("Compiled script loaded (%u bytes)\n", (unsigned)g_js_script_jsc_len);
+    return true;
+  }
+  return webscreen_runtime_load_source(script_file);
+}
+
+// Load the .js text, and compile it for the next start
+static bool webscreen_runtime_load_source(const char* script_file) {
   File file = SD_MMC.open(script_file);
   if (!file) {
     WEBSCREEN_DEBUG_PRINTF("Failed to open script file: %s\n", script_file);
@@ -383,6 +604,7 @@ bool webscreen_runtime_load_script(const char* script_file) {
   }
 
   WEBSCREEN_DEBUG_PRINTF("Script loaded successfully (%d bytes)\n", g_js_script_content.length());
+  webscreen_runtime_compile_script(script_file);  // Faster start next time
   return true;
 }
 bool webscreen_runtime_start_javascript_task(void) {
@@ -393,10 +615,18 @@ bool webscreen_runtime_start_javascript_task(void) {
 
   WEBSCREEN_DEBUG_PRINTLN("Starting JavaScript execution task...");
 
+  // The parser, the tree-walker and the VM recurse on the C stack. Elk fails
+  // with a "C stack" error rather than overflow it, leaving room for native
+  // functions called at the deepest point. On a host, this limit (16 KB)
+  // allows 11 nested JS calls on the tree-walker and 55 on the VM
+  if (js) {
+    js_setmaxcss(js, (WEBSCREEN_JS_TASK_STACK_KB - WEBSCREEN_JS_NATIVE_STACK_KB) * 1024);
+  }
+
   BaseType_t result = xTaskCreatePinnedToCore(
     webscreen_runtime_javascript_task,
     "WebScreenJS",
-    24576,  // Stack size - increased from 16KB to 24KB for complex JS operations
+    WEBSCREEN_JS_TASK_STACK_KB * 1024,  // Stack size
     NULL,   // Parameters
     1,      // Priority
     &g_js_task_handle,
@@ -414,10 +644,21 @@ bool webscreen_runtime_start_javascript_task(void) {
 void webscreen_runtime_javascript_task(void* pvParameters) {
   WEBSCREEN_DEBUG_PRINTLN("JavaScript task started");
   vTaskDelay(pdMS_TO_TICKS(100));
-  if (js && g_js_script_content.length() > 0) {
-    jsval_t result = js_eval(js, g_js_script_content.c_str(), g_js_script_content.length());
+  if (js && (g_js_script_jsc || g_js_script_content.length() > 0)) {
+    jsval_t result = g_js_script_jsc
+                       ? elk_run_script((const char*)g_js_script_jsc, g_js_script_jsc_len, true)
+                       : elk_run_script(g_js_script_content.c_str(), g_js_script_content.length());
+    const char *error = js_type(result) == JS_ERR ? js_str(js, result) : NULL;
+    if (g_js_script_jsc && error && strstr(error, "bad jsc") != NULL &&
+        webscreen_runtime_load_source(g_current_script_file.c_str())) {
+      WEBSCREEN_DEBUG_PRINTLN("Compiled script rejected, running the source");
+      free(g_js_script_jsc);  // Nothing of it ran, nothing refers to it
+      g_js_script_jsc = NULL;
+      g_js_script_jsc_len = 0;
+      result = elk_run_script(g_js_script_content.c_str(), g_js_script_content.length());
+    }
     if (js_type(result) == JS_ERR) {
-      const char *error = js_str(js, result);
+      error = js_str(js, result);
       WEBSCREEN_DEBUG_PRINT("JavaScript execution error: ");
       WEBSCREEN_DEBUG_PRINTLN(error ? error : "unknown error");
     } else {
@@ -425,10 +666,23 @@ void webscreen_runtime_javascript_task(void* pvParameters) {
     }
   }
   for (;;) {
-
+    g_loop_count++;
     if (g_mqtt_enabled) {
       webscreen_runtime_wifi_mqtt_maintain_loop();
     }
+    if (js) {
+      elk_deliver_messages(js, 0);  // From worker contexts
+      if (g_js_gc_requested) {      // See webscreen_runtime_garbage_collect()
+        g_js_gc_requested = false;
+        js_gc(js);
+      }
+      int op = g_js_profile_request.exchange(PROFILE_NONE);
+      if (op != PROFILE_NONE) {     // See webscreen_runtime_profile_request()
+        g_js_profile_result = webscreen_runtime_profile_run(op);
+        xSemaphoreGive(g_js_profile_done);
+      }
+      js_gcstep(js);                // GC slice between UI frames
+    }
     lv_timer_handler();
     vTaskDelay(pdMS_TO_TICKS(5));
   }
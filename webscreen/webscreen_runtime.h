@@ -102,6 +102,61 @@ extern "C" {
                                               uint32_t* avg_time_us,
                                               uint32_t* error_count);
 
+  /**
+ * @brief Print JavaScript execution budget overruns to Serial
+ *
+ * Shows how often the script and each callback ran longer than
+ * WEBSCREEN_JS_MAX_EXECUTION_TIME_MS, and how many callback calls were aborted.
+ */
+
+  void webscreen_runtime_print_javascript_budget_stats(void);
+
+  /**
+ * @brief Print JavaScript heap usage and GC threshold to Serial
+ *
+ * Live memory is broken down by kind, as of the last garbage collection.
+ */
+
+  void webscreen_runtime_print_javascript_memory_stats(void);
+
+  /**
+ * @brief Get live JavaScript heap memory by kind, as of the last garbage collection
+ * @param objects Pointer to store bytes in objects
+ * @param props Pointer to store bytes in object properties
+ * @param strings Pointer to store bytes in strings
+ * @param functions Pointer to store bytes in function bodies
+ * @param arrays Pointer to store bytes in arrays and their elements
+ */
+
+  void webscreen_runtime_get_javascript_heap(uint32_t* objects, uint32_t* props,
+                                             uint32_t* strings, uint32_t* functions,
+                                             uint32_t* arrays);
+
+  /**
+ * @brief Start the JavaScript sampling profiler, clearing earlier samples
+ * @return true if started, false if there is no JS engine or no memory
+ *
+ * Samples the JS call stack every WEBSCREEN_JS_PROFILE_PERIOD_US. Start,
+ * stop and dump run in the JS task between frames, the caller waits.
+ */
+
+  bool webscreen_runtime_profile_start(void);
+
+  /**
+ * @brief Stop the JavaScript sampling profiler, keeping the samples
+ */
+
+  void webscreen_runtime_profile_stop(void);
+
+  /**
+ * @brief Dump profiler samples as collapsed stacks, e.g. for flamegraph.pl
+ * @param path SD card file to write, or NULL for Serial
+ * @param offsets Split interpreted functions by the source offset running
+ * @return Number of samples, 0 if none or the file cannot be written
+ */
+
+  size_t webscreen_runtime_profile_dump(const char* path, bool offsets);
+
   // ============================================================================
   // FALLBACK APPLICATION
   // ============================================================================
@@ -172,9 +227,9 @@ extern "C" {
 
   /**
  * @brief Get runtime memory usage
- * @param js_heap_used Pointer to store JavaScript heap usage
- * @param lvgl_memory_used Pointer to store LVGL memory usage
- * @param total_runtime_memory Pointer to store total runtime memory
+ * @param js_heap_used Pointer to store live JavaScript heap bytes, as of the last GC
+ * @param lvgl_memory_used Pointer to store LVGL memory bytes in use
+ * @param total_runtime_memory Pointer to store the sum of both
  */
 
   void webscreen_runtime_get_memory_usage(uint32_t* js_heap_used,
@@ -183,7 +238,10 @@ extern "C" {
 
   /**
  * @brief Force garbage collection (if supported)
- * @return true if garbage collection was performed
+ *
+ * The JavaScript task runs a full, compacting collection before its next frame.
+ *
+ * @return true if garbage collection was requested
  */
 
   bool webscreen_runtime_garbage_collect(void);
@@ -252,12 +310,28 @@ extern "C" {
 
   /**
  * @brief Load JavaScript script from SD card
+ *
+ * Prefers the compiled script (script_file + "c") when it was compiled
+ * from the script as it is now, otherwise loads the source and compiles it.
+ *
  * @param script_file Path to script file
  * @return true if script loaded successfully, false otherwise
  */
 
   bool webscreen_runtime_load_script(const char* script_file);
 
+  /**
+ * @brief Compile a script into its .jsc file next to it
+ *
+ * The .jsc holds the script minified, and the size and time of the .js it
+ * was made from. A failed compile removes the old .jsc.
+ *
+ * @param script_file Path to the .js file
+ * @return true if the .jsc was written, false otherwise
+ */
+
+  bool webscreen_runtime_compile_script(const char* script_file);
+
   /**
  * @brief Start JavaScript execution task
  * @return true if task started successfully, false otherwise